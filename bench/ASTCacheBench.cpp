@@ -0,0 +1,69 @@
+#include "Bench.h"
+#include "AST.h"
+#include "ASTCache.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Sema.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace bench;
+
+/*
+	whole compiles without the cache, with an empty one that the compile
+	fills and with one that has the program, and what a compile with
+	-cache-dir pays to find out whether the cache has it
+*/
+void bench::benchASTCache(const Options& Opts)
+{
+	std::string Source = generateProgram(Opts.scaled(20000, 10), 1000);
+	std::string Input = writeInput(Opts, "cached.mas", Source);
+	llvm::SmallString<128> Dir(Opts.TempDir);
+	llvm::sys::path::append(Dir, "ast-cache");
+	std::string CacheDir = "-cache-dir=" + Dir.str().str();
+
+	double PlainTime = measure(Opts.Runs, [&] { runCompiler(Opts, { "-f", Input }); });
+	double ColdTime = measure(Opts.Runs, [&] {
+		llvm::sys::fs::remove_directories(Dir);
+		runCompiler(Opts, { CacheDir, "-f", Input });
+	});
+	double WarmTime = measure(Opts.Runs, [&] { runCompiler(Opts, { CacheDir, "-f", Input }); });
+
+	// the compiler keys the cache on its own binary, which is Opts.Compiler,
+	// and folds by default
+	ASTCache Cache(Dir, Opts.Compiler, /*Folded=*/true);
+	size_t Nodes = 0;
+	double HitTime = measure(Opts.Runs, [&] {
+		std::unique_ptr<FlatAST> Tree = Cache.lookup(Source);
+		Nodes = Tree ? Tree->size() : 0;
+	});
+	if (!Nodes)
+		fail("ast-cache: the compile with -cache-dir left no entry for the program");
+
+	// the same size, so only the hash tells it apart
+	std::string Edited = Source;
+	Edited[Edited.size() / 2] = Edited[Edited.size() / 2] == ' ' ? '\t' : ' ';
+	bool Missed = true;
+	double MissTime = measure(Opts.Runs, [&] { Missed &= !Cache.lookup(Edited); });
+	if (!Missed)
+		fail("ast-cache: an edited program was found in the cache");
+
+	double HashTime = measure(Opts.Runs, [&] { ASTCache::getSourceKey(Source); });
+	double FrontTime = measure(Opts.Runs, [&] {
+		TokenBuffer Tokens;
+		Lexer(Source).lex(Tokens);
+		ASTContext Ctx;
+		Sema().semantic(Parser(Tokens, Ctx).parse());
+	});
+
+	section("whole compiles, " + formatSize(Source.size()) + ", " + std::to_string(Nodes) + " flat nodes");
+	report("without a cache", PlainTime);
+	report("cold: compile and store the AST", ColdTime);
+	report("warm: map the AST, then CodeGen", WarmTime);
+	section("finding the program in the cache");
+	report("source hash", HashTime, Source.size(), "B");
+	report("lookup, hit: hash, map, check the header", HitTime);
+	report("lookup, miss: hash, no file", MissTime);
+	report("what a hit skips: lex, parse, Sema", FrontTime, Source.size(), "B");
+}
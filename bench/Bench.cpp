@@ -0,0 +1,251 @@
+#include "Bench.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace bench;
+
+size_t Options::scaled(size_t N, size_t Min) const
+{
+	return std::max<size_t>(Min, (size_t)(N * Scale));
+}
+
+namespace {
+	// xorshift64, so a program does not depend on the standard library
+	class Random {
+		uint64_t State;
+
+	public:
+		explicit Random(uint64_t Seed) : State(Seed * 0x9E3779B97F4A7C15ull | 1) {}
+
+		// a number in [0, N)
+		unsigned below(unsigned N)
+		{
+			State ^= State << 13;
+			State ^= State >> 7;
+			State ^= State << 17;
+			return (unsigned)(State % N);
+		}
+	};
+
+	class ProgramWriter {
+		std::string& Out;
+		Random R;
+		unsigned Vars;
+		bool LongNames;
+
+		void indent(unsigned Depth)
+		{
+			Out.append(Depth * 4, ' ');
+		}
+
+		void variable(unsigned V)
+		{
+			Out += LongNames ? "generatedstatevariable" : "v";
+			Out += std::to_string(V);
+		}
+
+		void operand()
+		{
+			if (R.below(3))
+				variable(R.below(Vars));
+			else
+				Out += std::to_string(R.below(1000));
+		}
+
+		// divisors are nonzero numbers, so the folder never finds a division by zero
+		void expression()
+		{
+			static const char* const Operators[] = { " + ", " - ", " * ", " / ", " % " };
+			operand();
+			for (unsigned I = R.below(4); I > 0; --I)
+			{
+				unsigned Op = R.below(5);
+				Out += Operators[Op];
+				if (Op >= 3)
+					Out += std::to_string(R.below(9) + 1);
+				else if (R.below(4) == 0)
+				{
+					Out += '(';
+					operand();
+					Out += Operators[R.below(3)];
+					operand();
+					Out += ')';
+				}
+				else
+					operand();
+			}
+		}
+
+		void condition()
+		{
+			static const char* const Relations[] = { " < ", " > ", " <= ", " >= ", " == ", " != " };
+			for (unsigned I = R.below(3);; --I)
+			{
+				variable(R.below(Vars));
+				Out += Relations[R.below(6)];
+				expression();
+				if (I == 0)
+					break;
+				Out += R.below(2) ? " and " : " or ";
+			}
+		}
+
+		void assignment(unsigned Depth)
+		{
+			static const char* const Operators[] = { " = ", " += ", " -= ", " *= " };
+			indent(Depth);
+			variable(R.below(Vars));
+			Out += Operators[R.below(4)];
+			expression();
+			Out += ";\n";
+		}
+
+		// "begin", the statements of a block and "end"
+		void body(unsigned Depth)
+		{
+			Out += "begin\n";
+			for (unsigned I = R.below(3) + 1; I > 0; --I)
+				statement(Depth + 1);
+			indent(Depth);
+			Out += "end\n";
+		}
+
+	public:
+		ProgramWriter(std::string& Out, unsigned Vars, bool LongNames) : Out(Out), R(Vars + 1), Vars(Vars), LongNames(LongNames) {}
+
+		void declarations()
+		{
+			for (unsigned V = 0; V < Vars; V += 4)
+			{
+				unsigned Count = std::min(4u, Vars - V);
+				Out += "int ";
+				for (unsigned I = 0; I < Count; ++I)
+				{
+					if (I)
+						Out += ", ";
+					variable(V + I);
+				}
+				Out += " = ";
+				for (unsigned I = 0; I < Count; ++I)
+				{
+					if (I)
+						Out += ", ";
+					Out += std::to_string(R.below(100));
+				}
+				Out += ";\n";
+			}
+		}
+
+		void statement(unsigned Depth)
+		{
+			unsigned Kind = Depth < 3 ? R.below(10) : 0;
+			if (Kind < 6)
+			{
+				assignment(Depth);
+				return;
+			}
+
+			indent(Depth);
+			Out += Kind < 9 ? "if " : "loopc ";
+			condition();
+			Out += ": ";
+			body(Depth);
+			if (Kind == 9)
+				return;
+
+			for (unsigned I = R.below(3); I > 0; --I)
+			{
+				indent(Depth);
+				Out += "elif ";
+				condition();
+				Out += ": ";
+				body(Depth);
+			}
+			if (R.below(2))
+			{
+				indent(Depth);
+				Out += "else: ";
+				body(Depth);
+			}
+		}
+	};
+}
+
+std::string bench::generateProgram(size_t Statements, unsigned Vars, bool LongNames)
+{
+	std::string Out;
+	Out.reserve(Statements * (LongNames ? 160 : 80));
+	ProgramWriter W(Out, std::max(Vars, 1u), LongNames);
+	W.declarations();
+	for (size_t I = 0; I < Statements; ++I)
+		W.statement(0);
+	return Out;
+}
+
+std::string bench::writeInput(const Options& Opts, llvm::StringRef Name, llvm::StringRef Source)
+{
+	llvm::SmallString<128> Path(Opts.TempDir);
+	llvm::sys::path::append(Path, Name);
+	std::error_code EC;
+	llvm::raw_fd_ostream Out(Path, EC);
+	if (EC)
+		fail("cannot write " + Path + ": " + EC.message());
+	else
+		Out << Source;
+	return Path.str().str();
+}
+
+bool bench::runCompiler(const Options& Opts, llvm::ArrayRef<std::string> Args)
+{
+	std::vector<llvm::StringRef> Argv = { Opts.Compiler };
+	Argv.insert(Argv.end(), Args.begin(), Args.end());
+	llvm::Optional<llvm::StringRef> Redirects[] = { llvm::None, llvm::StringRef(""), llvm::StringRef("") };
+	std::string Message;
+	int Result = llvm::sys::ExecuteAndWait(Opts.Compiler, Argv, llvm::None, Redirects, 0, 0, &Message);
+	if (Result != 0)
+	{
+		std::string Command = Opts.Compiler;
+		for (const std::string& Arg : Args)
+			Command += " " + Arg;
+		fail(Command + " failed with " + std::to_string(Result) + (Message.empty() ? "" : ": " + Message));
+		return false;
+	}
+	return true;
+}
+
+void bench::report(llvm::StringRef Label, double Seconds, double Items, llvm::StringRef Unit)
+{
+	llvm::outs() << "  " << llvm::left_justify(Label, 44) << llvm::format("%10.3f ms", Seconds * 1e3);
+	if (Items > 0 && Seconds > 0)
+		llvm::outs() << llvm::format("%10.2f M", Items / Seconds / 1e6) << Unit << "/s";
+	llvm::outs() << "\n";
+}
+
+void bench::section(const llvm::Twine& Title)
+{
+	llvm::outs() << Title << "\n";
+}
+
+std::string bench::formatSize(size_t Bytes)
+{
+	std::string Res;
+	llvm::raw_string_ostream(Res) << llvm::format("%.1f MB", Bytes / 1048576.0);
+	return Res;
+}
+
+static bool Failed = false;
+
+void bench::fail(const llvm::Twine& Message)
+{
+	llvm::errs() << "error: " << Message << "\n";
+	Failed = true;
+}
+
+bool bench::hasFailed()
+{
+	return Failed;
+}
@@ -0,0 +1,84 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*
+	shared pieces of mas-bench: the settings of a run, generators for
+	MAS programs of a given shape and size, and timing. every suite
+	prints one line per measurement, so runs can be compared with diff.
+*/
+namespace bench {
+
+	struct Options {
+		double Scale;           // multiplies the input sizes of every suite
+		unsigned Runs;          // a measurement is the fastest of this many runs
+		std::string Compiler;   // the MAS-Lang binary, for suites that time whole compiles
+		std::string TempDir;    // inputs and caches of those compiles
+
+		// N scaled, and at least Min
+		size_t scaled(size_t N, size_t Min = 1) const;
+	};
+
+	// a suite measures one part of the compiler, see main.cpp for the list
+	typedef void (*Suite)(const Options& Opts);
+
+	void benchLexer(const Options& Opts);
+	void benchIncremental(const Options& Opts);
+	void benchFlatAST(const Options& Opts);
+	void benchDeclarations(const Options& Opts);
+	void benchASTCache(const Options& Opts);
+	void benchWalker(const Options& Opts);
+	void benchStatementCache(const Options& Opts);
+	void benchSSA(const Options& Opts);
+
+	// Statements top level constructs over Vars variables: declarations
+	// first, then assignments, if/elif/else and loopc blocks nested up to
+	// three deep. LongNames spells variables like generated code does,
+	// with long names. the same arguments give the same program
+	std::string generateProgram(size_t Statements, unsigned Vars, bool LongNames = false);
+
+	// writes Source to Name in the temporary directory, returns its path
+	std::string writeInput(const Options& Opts, llvm::StringRef Name, llvm::StringRef Source);
+
+	// compiles with Opts.Compiler and Args, the output thrown away. a
+	// compile that fails is reported with fail()
+	bool runCompiler(const Options& Opts, llvm::ArrayRef<std::string> Args);
+
+	// seconds the fastest of Runs calls of F takes
+	template <typename Fn>
+	double measure(unsigned Runs, Fn&& F)
+	{
+		double Best = 0;
+		for (unsigned I = 0; I < Runs; ++I)
+		{
+			auto Start = std::chrono::steady_clock::now();
+			F();
+			double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+			if (I == 0 || Seconds < Best)
+				Best = Seconds;
+		}
+		return Best;
+	}
+
+	// prints "Label  time  rate", the rate is Items per second in millions of Unit
+	void report(llvm::StringRef Label, double Seconds, double Items = 0, llvm::StringRef Unit = "");
+
+	// prints a heading for the measurements that follow
+	void section(const llvm::Twine& Title);
+
+	// "12.3 MB", for headings
+	std::string formatSize(size_t Bytes);
+
+	// reports a result that is wrong rather than slow, mas-bench then
+	// exits with an error once every suite has run
+	void fail(const llvm::Twine& Message);
+	bool hasFailed();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "Bench.h"
+#include "AST.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Sema.h"
+
+using namespace bench;
+
+namespace {
+	// one "int" declaring Names variables with a value each, as the
+	// preambles of generated programs do, and a statement that uses them
+	std::string generateDeclarations(size_t Names)
+	{
+		std::string Source = "int ";
+		for (size_t I = 0; I < Names; ++I)
+			Source += (I ? ", v" : "v") + std::to_string(I);
+		Source += " = ";
+		for (size_t I = 0; I < Names; ++I)
+			Source += (I ? ", " : "") + std::to_string(I % 1000);
+		Source += ";\nv0 = v0 + v" + std::to_string(Names - 1) + ";\n";
+		return Source;
+	}
+
+	/*
+		the time per name has to stay the same from ten thousand names to
+		a million. erasing the front of the name list for every name made
+		a million take minutes
+	*/
+	void measureDeclarations(const Options& Opts, size_t Names)
+	{
+		std::string Source = generateDeclarations(Names);
+
+		double LexTime = measure(Opts.Runs, [&] {
+			TokenBuffer Tokens;
+			Lexer(Source).lex(Tokens);
+		});
+
+		TokenBuffer Tokens;
+		Lexer(Source).lex(Tokens);
+		size_t Statements = 0;
+		double ParseTime = measure(Opts.Runs, [&] {
+			ASTContext Ctx;
+			Statements = Parser(Tokens, Ctx).parse()->getStatements().size();
+		});
+		if (Statements != Names + 1)
+			fail("declarations: " + std::to_string(Names) + " names gave " + std::to_string(Statements) + " statements");
+
+		ASTContext Ctx;
+		Base* Tree = Parser(Tokens, Ctx).parse();
+		double SemaTime = measure(Opts.Runs, [&] { Sema().semantic(Tree); });
+
+		std::string Input = writeInput(Opts, "declarations.mas", Source);
+		double CompileTime = measure(Opts.Runs, [&] { runCompiler(Opts, { "-f", Input }); });
+
+		section("int with " + std::to_string(Names) + " names, " + formatSize(Source.size()));
+		report("lex", LexTime, Names, "name");
+		report("parse", ParseTime, Names, "name");
+		report("semantic analysis", SemaTime, Names, "name");
+		report("whole compile", CompileTime, Names, "name");
+	}
+}
+
+void bench::benchDeclarations(const Options& Opts)
+{
+	for (size_t Names : { 10000, 100000, 1000000 })
+		measureDeclarations(Opts, Opts.scaled(Names, 10));
+}
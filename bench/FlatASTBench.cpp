@@ -0,0 +1,107 @@
+#include "Bench.h"
+#include "AST.h"
+#include "ASTWalker.h"
+#include "FlatAST.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Sema.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace bench;
+
+namespace {
+	// identifiers in the pointer tree, targets of declarations and
+	// assignments included, as the flat AST has a node for each
+	class CountIdentifiers : public ASTWalker<CountIdentifiers> {
+		friend class ASTWalker<CountIdentifiers>;
+
+		bool visitIdentifier(Expression* E, unsigned Step)
+		{
+			++Count;
+			return false;
+		}
+
+		bool visitDeclaration(DecStatement* S, unsigned Step)
+		{
+			++Count;
+			push(S->getRValue());
+			return false;
+		}
+
+		bool visitAssignment(AssignStatement* S, unsigned Step)
+		{
+			++Count;
+			push(S->getRValue());
+			return false;
+		}
+
+	public:
+		size_t Count = 0;
+	};
+
+	// the same program in both encodings: their size, the time to build
+	// one from the other, and the time a pass over each takes
+	void measureProgram(const Options& Opts, llvm::StringRef Name, const std::string& Source)
+	{
+		TokenBuffer Tokens;
+		Lexer(Source).lex(Tokens);
+		ASTContext Ctx;
+		Base* Tree = Parser(Tokens, Ctx).parse();
+		size_t Nodes = Ctx.getNodeCount();
+
+		double FlattenTime = measure(Opts.Runs, [&] { FlatAST Flat(Tree); });
+		FlatAST Flat(Tree);
+		double RebuildTime = measure(Opts.Runs, [&] {
+			ASTContext Rebuilt;
+			Flat.toTree(Rebuilt);
+		});
+
+		bool TreeError = false, FlatError = false;
+		double TreeSemaTime = measure(Opts.Runs, [&] { TreeError = Sema().semantic(Tree); });
+		double FlatSemaTime = measure(Opts.Runs, [&] { FlatError = Sema().semantic(Flat); });
+		if (TreeError != FlatError)
+			fail("flat-ast: " + Name + ": semantic analysis disagrees between the two encodings");
+
+		size_t TreeCount = 0, FlatCount = 0;
+		double TreeWalkTime = measure(Opts.Runs, [&] {
+			CountIdentifiers Walker;
+			Walker.walk(Tree);
+			TreeCount = Walker.Count;
+		});
+		double FlatScanTime = measure(Opts.Runs, [&] {
+			FlatCount = 0;
+			for (const FlatAST::Node& N : Flat.nodes())
+				FlatCount += N.Kind == FlatAST::Identifier;
+		});
+		if (TreeCount != FlatCount)
+			fail("flat-ast: " + Name + ": the encodings hold different numbers of identifiers");
+
+		section(Name + ", " + formatSize(Source.size()) + ", " + std::to_string(Nodes) + " nodes");
+		llvm::outs() << "  pointer tree: " << formatSize(Ctx.getBytesAllocated())
+			<< llvm::format(" (%.1f B/node)", (double)Ctx.getBytesAllocated() / Nodes)
+			<< ", flat AST: " << formatSize(Flat.getBytes())
+			<< llvm::format(" (%.1f B/node)", (double)Flat.getBytes() / Flat.size()) << "\n";
+		report("flatten the pointer tree", FlattenTime, Nodes, "node");
+		report("build the pointer tree back", RebuildTime, Nodes, "node");
+		report("semantic pass, pointer tree", TreeSemaTime, Nodes, "node");
+		report("semantic pass, flat AST", FlatSemaTime, Flat.size(), "node");
+		report("count identifiers, ASTWalker", TreeWalkTime, Nodes, "node");
+		report("count identifiers, flat nodes in order", FlatScanTime, Flat.size(), "node");
+	}
+}
+
+void bench::benchFlatAST(const Options& Opts)
+{
+	measureProgram(Opts, "generated program", generateProgram(Opts.scaled(20000, 100), 1000));
+
+	// blocks nested as deep as the parser allows, neither pass may recurse
+	size_t Depth = Opts.scaled(100000, 100);
+	std::string Deep = "int a;\n";
+	for (size_t I = 0; I < Depth; ++I)
+		Deep += "if a < 1: begin\n";
+	Deep += "a = 1;\n";
+	for (size_t I = 0; I < Depth; ++I)
+		Deep += "end\n";
+	measureProgram(Opts, std::to_string(Depth) + " nested blocks", Deep);
+}
@@ -0,0 +1,124 @@
+#include "Bench.h"
+#include "AST.h"
+#include "Incremental.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+using namespace bench;
+
+namespace {
+	// start of the first top level line after the middle of Source,
+	// where a construct begins
+	uint32_t middleConstruct(const std::string& Source)
+	{
+		size_t Offset = Source.find("\nv", Source.size() / 2);
+		return Offset == std::string::npos ? 0 : Offset + 1;
+	}
+
+	// statements of a fresh parse of Text
+	size_t countStatements(llvm::StringRef Text)
+	{
+		TokenBuffer Tokens;
+		Lexer(Text).lex(Tokens);
+		ASTContext Ctx;
+		return Parser(Tokens, Ctx).parse()->getStatements().size();
+	}
+
+	// the incremental tree has as many statements as a fresh parse
+	void verify(IncrementalParser& Incremental, llvm::StringRef What)
+	{
+		size_t Statements = Incremental.getTree()->getStatements().size();
+		if (Statements != countStatements(Incremental.getText()))
+			fail("incremental: " + What + " leaves a tree that differs from a fresh parse");
+	}
+
+	/*
+		time from an edit to the statements at the edit, against parsing
+		the whole buffer again, which is what an editor did per keystroke.
+		every edit is undone by the next one, so the text stays the same
+	*/
+	void measureFileSize(const Options& Opts, size_t Statements)
+	{
+		std::string Source = generateProgram(Statements, 1000);
+
+		size_t Nodes = 0;
+		double FullTime = measure(Opts.Runs, [&] {
+			TokenBuffer Tokens;
+			Lexer(Source).lex(Tokens);
+			ASTContext Ctx;
+			Parser(Tokens, Ctx).parse();
+			Nodes = Ctx.getNodeCount();
+		});
+
+		IncrementalParser Incremental(Source);
+		uint32_t Offset = middleConstruct(Source) + 1;    // inside the variable name
+		const unsigned Edits = 1000;
+		double EditTime = measure(Opts.Runs, [&] {
+			for (unsigned I = 0; I < Edits; ++I)
+			{
+				Incremental.edit(Offset, 0, "7");
+				(void)Incremental.getStatementsAt(Offset);
+				Incremental.edit(Offset, 1, "");
+				(void)Incremental.getStatementsAt(Offset);
+			}
+		});
+
+		// the first and the last construct in turn, the gap moves over
+		// the whole text every time
+		uint32_t Last = Source.rfind("\nv") + 1;
+		const unsigned Jumps = 20;
+		double JumpTime = measure(Opts.Runs, [&] {
+			for (unsigned I = 0; I < Jumps; ++I)
+			{
+				Incremental.edit(0, 0, " ");
+				Incremental.edit(Last + 1, 0, " ");
+				Incremental.edit(Last + 1, 1, "");
+				Incremental.edit(0, 1, "");
+			}
+		});
+		verify(Incremental, "a one character edit");
+
+		section("one character typed and removed, " + formatSize(Source.size()) + ", " + std::to_string(Nodes) + " nodes");
+		report("parse the whole buffer", FullTime, Nodes, "node");
+		report("incremental edit and its statements", EditTime / (2 * Edits));
+		report("incremental edit at the other end", JumpTime / (4 * Jumps));
+	}
+
+	// inserting and removing Count statements at once: the time follows
+	// the size of the edit
+	void measureEditSize(const Options& Opts, size_t Statements)
+	{
+		std::string Source = generateProgram(Statements, 1000);
+		IncrementalParser Incremental(Source);
+		uint32_t Offset = middleConstruct(Source);
+
+		section("statements inserted and removed in the middle of " + formatSize(Source.size()));
+		for (size_t Count = 1; Count <= 10000; Count *= 10)
+		{
+			std::string Inserted;
+			for (size_t I = 0; I < Count; ++I)
+				Inserted += "v1 = v2 + " + std::to_string(I) + ";\n";
+
+			unsigned Edits = std::max<unsigned>(1, 1000 / Count);
+			double Time = measure(Opts.Runs, [&] {
+				for (unsigned I = 0; I < Edits; ++I)
+				{
+					Incremental.edit(Offset, 0, Inserted);
+					(void)Incremental.getStatementsAt(Offset);
+					Incremental.edit(Offset, Inserted.size(), "");
+					(void)Incremental.getStatementsAt(Offset);
+				}
+			});
+			report(std::to_string(Count) + " statements, " + std::to_string(Inserted.size()) + " characters",
+				Time / (2 * Edits), Count, "stmt");
+		}
+		verify(Incremental, "inserting statements");
+	}
+}
+
+void bench::benchIncremental(const Options& Opts)
+{
+	for (size_t Statements : { 1000, 10000, 100000 })
+		measureFileSize(Opts, Opts.scaled(Statements, 10));
+	measureEditSize(Opts, Opts.scaled(20000, 10));
+}
@@ -0,0 +1,267 @@
+#include "Bench.h"
+#include "AST.h"
+#include "Lexer.h"
+#include "LineTable.h"
+#include "Parser.h"
+
+using namespace bench;
+
+namespace {
+	/*
+		Lexer::next as it was before the keyword table and the vector
+		scans: one comparison per keyword and one character at a time.
+		kept as the baseline the current lexer is measured against
+	*/
+	class ReferenceLexer {
+		const char* BufferPtr;
+
+		static bool isWhitespace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\f' || c == '\v' || c == '\r' || c == '\n';
+		}
+
+		static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+		static bool isLetter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+		Token::TokenKind form(const char* End, Token::TokenKind Kind, llvm::StringRef& Text)
+		{
+			Text = llvm::StringRef(BufferPtr, End - BufferPtr);
+			BufferPtr = End;
+			return Kind;
+		}
+
+	public:
+		explicit ReferenceLexer(llvm::StringRef Buffer) : BufferPtr(Buffer.begin()) {}
+
+		// not inlined into the benchmark loop, as Lexer::next is not
+		LLVM_ATTRIBUTE_NOINLINE Token::TokenKind next(llvm::StringRef& Text)
+		{
+			while (*BufferPtr && isWhitespace(*BufferPtr))
+				++BufferPtr;
+			if (!*BufferPtr)
+				return Token::eof;
+
+			if (isLetter(*BufferPtr))
+			{
+				const char* End = BufferPtr + 1;
+				while (isLetter(*End) || isDigit(*End))
+					++End;
+				llvm::StringRef Context(BufferPtr, End - BufferPtr);
+				Token::TokenKind Kind = Token::ident;
+				if (Context == "int") Kind = Token::KW_int;
+				else if (Context == "if") Kind = Token::KW_if;
+				else if (Context == "elif") Kind = Token::KW_elif;
+				else if (Context == "else") Kind = Token::KW_else;
+				else if (Context == "loopc") Kind = Token::KW_loopc;
+				else if (Context == "and") Kind = Token::KW_and;
+				else if (Context == "or") Kind = Token::KW_or;
+				else if (Context == "true") Kind = Token::KW_true;
+				else if (Context == "false") Kind = Token::KW_false;
+				else if (Context == "begin") Kind = Token::KW_begin;
+				else if (Context == "end") Kind = Token::KW_end;
+				return form(End, Kind, Text);
+			}
+
+			if (isDigit(*BufferPtr))
+			{
+				const char* End = BufferPtr + 1;
+				while (isDigit(*End))
+					++End;
+				return form(End, Token::number, Text);
+			}
+
+			if (BufferPtr[1] == '=')
+			{
+				switch (*BufferPtr)
+				{
+				case '=': return form(BufferPtr + 2, Token::equal_equal, Text);
+				case '+': return form(BufferPtr + 2, Token::plus_equal, Text);
+				case '-': return form(BufferPtr + 2, Token::minus_equal, Text);
+				case '*': return form(BufferPtr + 2, Token::star_equal, Text);
+				case '/': return form(BufferPtr + 2, Token::slash_equal, Text);
+				case '%': return form(BufferPtr + 2, Token::mod_equal, Text);
+				case '!': return form(BufferPtr + 2, Token::not_equal, Text);
+				case '<': return form(BufferPtr + 2, Token::less_equal, Text);
+				case '>': return form(BufferPtr + 2, Token::greater_equal, Text);
+				}
+			}
+
+			switch (*BufferPtr)
+			{
+			case '=': return form(BufferPtr + 1, Token::equal, Text);
+			case '+': return form(BufferPtr + 1, Token::plus, Text);
+			case '-': return form(BufferPtr + 1, Token::minus, Text);
+			case '*': return form(BufferPtr + 1, Token::star, Text);
+			case '/': return form(BufferPtr + 1, Token::slash, Text);
+			case '(': return form(BufferPtr + 1, Token::l_paren, Text);
+			case ')': return form(BufferPtr + 1, Token::r_paren, Text);
+			case ':': return form(BufferPtr + 1, Token::colon, Text);
+			case ',': return form(BufferPtr + 1, Token::comma, Text);
+			case '^': return form(BufferPtr + 1, Token::power, Text);
+			case '>': return form(BufferPtr + 1, Token::greater, Text);
+			case '<': return form(BufferPtr + 1, Token::less, Text);
+			case ';': return form(BufferPtr + 1, Token::semi_colon, Text);
+			case '%': return form(BufferPtr + 1, Token::mod, Text);
+			}
+			return form(BufferPtr + 1, Token::unknown, Text);
+		}
+	};
+
+	// the kinds and lengths of every token are summed, so no lexer can skip work
+	struct Checksum {
+		size_t Tokens = 0;
+		size_t Sum = 0;
+
+		void add(Token::TokenKind Kind, size_t Length)
+		{
+			++Tokens;
+			Sum += Kind * 31 + Length;
+		}
+	};
+
+	Checksum lexReference(llvm::StringRef Source)
+	{
+		Checksum C;
+		ReferenceLexer Lex(Source);
+		llvm::StringRef Text;
+		for (Token::TokenKind Kind; (Kind = Lex.next(Text)) != Token::eof;)
+			C.add(Kind, Text.size());
+		return C;
+	}
+
+	Checksum lexCurrent(llvm::StringRef Source)
+	{
+		Checksum C;
+		Lexer Lex(Source);
+		Token Tok;
+		for (Lex.next(Tok); !Tok.is(Token::eof); Lex.next(Tok))
+			C.add(Tok.getKind(), Tok.getText().size());
+		return C;
+	}
+
+	// what the parser got per token before the token buffer: a Token
+	// pulled from Lexer::next, with numbers decoded by getAsInteger
+	Checksum pullTokens(llvm::StringRef Source)
+	{
+		Checksum C;
+		Lexer Lex(Source);
+		Token Tok;
+		for (Lex.next(Tok); !Tok.is(Token::eof); Lex.next(Tok))
+		{
+			int Value = Tok.getText().size();
+			if (Tok.is(Token::number))
+				Tok.getText().getAsInteger(10, Value);
+			C.add(Tok.getKind(), Value);
+		}
+		return C;
+	}
+
+	// the parser's view of a pre-lexed stream: a cursor over the arrays
+	Checksum readTokens(const TokenBuffer& Tokens)
+	{
+		Checksum C;
+		for (TokenCursor Tok(Tokens); !Tok.is(Token::eof); Tok.advance())
+			C.add(Tok.getKind(), Tok.getNumber() + Tok.peek(1));
+		return C;
+	}
+
+	// the pull-based token stream against pre-lexing into a TokenBuffer,
+	// which the parser reads back with arbitrary lookahead
+	void compareStreams(const Options& Opts, const std::string& Source)
+	{
+		Checksum Pulled, Read;
+		size_t Count = 0, Nodes = 0;
+		double PullTime = measure(Opts.Runs, [&] { Pulled = pullTokens(Source); });
+		double LexTime = measure(Opts.Runs, [&] {
+			TokenBuffer Tokens;
+			Lexer(Source).lex(Tokens);
+			Count = Tokens.size();
+		});
+
+		TokenBuffer Tokens;
+		Lexer(Source).lex(Tokens);
+		double ReadTime = measure(Opts.Runs, [&] { Read = readTokens(Tokens); });
+		double ParseTime = measure(Opts.Runs, [&] {
+			ASTContext Ctx;
+			Parser(Tokens, Ctx).parse();
+			Nodes = Ctx.getNodeCount();
+		});
+
+		section("token stream, " + formatSize(Source.size()) + ", " + std::to_string(Count) + " tokens, " +
+			formatSize(Count * (sizeof(uint8_t) + 2 * sizeof(uint32_t))) + " of token buffer");
+		report("pull: Lexer::next, getAsInteger per number", PullTime, Pulled.Tokens, "tok");
+		report("pre-lex: Lexer::lex into a TokenBuffer", LexTime, Count, "tok");
+		report("read back through a TokenCursor, peek(1)", ReadTime, Read.Tokens, "tok");
+		report("parse from the TokenBuffer", ParseTime, Nodes, "node");
+	}
+
+	// what source locations cost: the offsets the happy path stores, and
+	// the line table a diagnostic builds on first use
+	void measureLocations(const Options& Opts, const std::string& Source)
+	{
+		TokenBuffer Tokens;
+		Lexer(Source).lex(Tokens);
+
+		std::vector<uint32_t> ScalarStarts;
+		double ScalarTime = measure(Opts.Runs, [&] {
+			ScalarStarts.assign(1, 0);
+			for (size_t I = 0; I < Source.size(); ++I)
+				if (Source[I] == '\n')
+					ScalarStarts.push_back(I + 1);
+		});
+
+		// a fresh table per run, so every run builds it
+		unsigned Line = 0;
+		double BuildTime = measure(Opts.Runs, [&] {
+			LineTable Lines(Source);
+			Line = Lines.getLineAndColumn(Tokens.getOffset(Tokens.size() - 1)).first;
+		});
+		if (Line != ScalarStarts.size())
+			fail("lexer: the line table counts " + llvm::Twine(Line) + " lines, not " + llvm::Twine(ScalarStarts.size()));
+
+		// diagnostics after the first one, spread over the whole file
+		LineTable Lines(Source);
+		Lines.getLineAndColumn(0);
+		size_t Lookups = std::min<size_t>(Tokens.size(), 1000000);
+		size_t Columns = 0;
+		double LookupTime = measure(Opts.Runs, [&] {
+			for (size_t I = 0; I < Lookups; ++I)
+				Columns += Lines.getLineAndColumn(Tokens.getOffset(I * 7919 % Tokens.size())).second;
+		});
+
+		if (!Columns)
+			fail("lexer: the line table found no columns");
+
+		section("source locations, " + formatSize(Source.size()) + ", " + std::to_string(ScalarStarts.size()) + " lines");
+		llvm::outs() << "  token offsets: " << formatSize(Tokens.size() * sizeof(uint32_t)) << ", AST node sizes with the offset: "
+			<< "Expression " << sizeof(Expression) << ", BinaryOp " << sizeof(BinaryOp) << ", AssignStatement "
+			<< sizeof(AssignStatement) << ", IfStatement " << sizeof(IfStatement) << " bytes\n";
+		report("line starts, one character at a time", ScalarTime, Source.size(), "B");
+		report("first diagnostic: LineTable built", BuildTime, Source.size(), "B");
+		report("further diagnostics: line and column", LookupTime, Lookups, "lookup");
+	}
+
+	void compare(const Options& Opts, llvm::StringRef Name, const std::string& Source)
+	{
+		Checksum Reference, Current;
+		double ReferenceTime = measure(Opts.Runs, [&] { Reference = lexReference(Source); });
+		double CurrentTime = measure(Opts.Runs, [&] { Current = lexCurrent(Source); });
+		if (Reference.Tokens != Current.Tokens || Reference.Sum != Current.Sum)
+			fail("lexer: the lexers disagree on " + Name);
+
+		section(Name + ", " + formatSize(Source.size()) + ", " + std::to_string(Current.Tokens) + " tokens");
+		report("Lexer::next, keyword chain, scalar scans", ReferenceTime, Reference.Tokens, "tok");
+		report("Lexer::next, keyword table, vector scans", CurrentTime, Current.Tokens, "tok");
+	}
+}
+
+void bench::benchLexer(const Options& Opts)
+{
+	size_t Statements = Opts.scaled(50000, 100);
+	std::string Source = generateProgram(Statements, 1000);
+	compare(Opts, "short names", Source);
+	compare(Opts, "long names", generateProgram(Statements, 1000, true));
+	compareStreams(Opts, Source);
+	measureLocations(Opts, Source);
+}
@@ -0,0 +1,45 @@
+#include "Bench.h"
+
+using namespace bench;
+
+namespace {
+	// above this many variables the allocas are not optimized, SROA takes
+	// 40 s on 10^4 of them and grows faster than their square
+	const size_t MaxOptimizedAllocas = 10000;
+
+	/*
+		whole compiles of a program with Vars variables, each loaded from
+		and stored to its alloca as by default or kept in SSA values with
+		-ssa. with -O1 the allocas are what SROA spends its time on
+	*/
+	void measureVariables(const Options& Opts, size_t Vars)
+	{
+		unsigned Scaled = Opts.scaled(Vars, 10);
+		size_t Statements = Opts.scaled(Vars / 5, 10);
+		std::string Source = generateProgram(Statements, Scaled);
+		std::string Input = writeInput(Opts, "variables.mas", Source);
+
+		section(std::to_string(Scaled) + " variables, " + std::to_string(Statements) + " statements, " + formatSize(Source.size()));
+		for (const char* Level : { "", "-O1" })
+		{
+			std::vector<std::string> Args = { "-f", Input };
+			std::string Suffix;
+			if (*Level)
+			{
+				Args.push_back(Level);
+				Suffix = std::string(", ") + Level;
+			}
+
+			if (!*Level || Vars <= MaxOptimizedAllocas)
+				report("allocas, loads and stores" + Suffix, measure(Opts.Runs, [&] { runCompiler(Opts, Args); }));
+			Args.push_back("-ssa");
+			report("-ssa" + Suffix, measure(Opts.Runs, [&] { runCompiler(Opts, Args); }));
+		}
+	}
+}
+
+void bench::benchSSA(const Options& Opts)
+{
+	for (size_t Vars : { 2500, 5000, 10000, 100000 })
+		measureVariables(Opts, Vars);
+}
@@ -0,0 +1,67 @@
+#include "Bench.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+using namespace bench;
+
+namespace {
+	// Source with Statement added before the first top level line after
+	// the middle
+	std::string insertInMiddle(const std::string& Source, llvm::StringRef Statement)
+	{
+		size_t Offset = Source.find("\nv", Source.size() / 2);
+		Offset = Offset == std::string::npos ? Source.size() : Offset + 1;
+		return Source.substr(0, Offset) + Statement.str() + Source.substr(Offset);
+	}
+
+	bool hasCacheFile(llvm::StringRef Dir)
+	{
+		std::error_code EC;
+		for (llvm::sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC; I.increment(EC))
+			if (llvm::sys::path::extension(I->path()) == ".mass")
+				return true;
+		return false;
+	}
+}
+
+/*
+	whole compiles of a program with a hundred thousand statements with
+	-stmt-cache-dir: the first one, which fills the cache, the same
+	program again and the program with one statement different from the
+	last compile, which is what the cache is for
+*/
+void bench::benchStatementCache(const Options& Opts)
+{
+	size_t Statements = Opts.scaled(100000, 10);
+	std::string Source = generateProgram(Statements, 1000);
+	std::string Input = writeInput(Opts, "statements.mas", Source);
+	// two versions that differ from each other in one statement, each
+	// compile of one replaces the entry of the other
+	std::string Edited[] = {
+		writeInput(Opts, "statements-a.mas", insertInMiddle(Source, "v1 = v2 + 12345;\n")),
+		writeInput(Opts, "statements-b.mas", insertInMiddle(Source, "v1 = v2 + 54321;\n")),
+	};
+	llvm::SmallString<128> Dir(Opts.TempDir);
+	llvm::sys::path::append(Dir, "stmt-cache");
+	std::string CacheDir = "-stmt-cache-dir=" + Dir.str().str();
+
+	double PlainTime = measure(Opts.Runs, [&] { runCompiler(Opts, { "-f", Input }); });
+	double ColdTime = measure(Opts.Runs, [&] {
+		llvm::sys::fs::remove_directories(Dir);
+		runCompiler(Opts, { CacheDir, "-f", Input });
+	});
+	if (!hasCacheFile(Dir))
+		fail("stmt-cache: the compile with -stmt-cache-dir left no cache in " + Dir);
+	double UnchangedTime = measure(Opts.Runs, [&] { runCompiler(Opts, { CacheDir, "-f", Input }); });
+
+	unsigned Next = 0;
+	runCompiler(Opts, { CacheDir, "-f", Edited[Next++ % 2] });
+	double EditTime = measure(Opts.Runs, [&] { runCompiler(Opts, { CacheDir, "-f", Edited[Next++ % 2] }); });
+
+	section(std::to_string(Statements) + " statements, " + formatSize(Source.size()));
+	report("without a cache", PlainTime);
+	report("first compile, fills the cache", ColdTime);
+	report("unchanged", UnchangedTime);
+	report("one statement edited", EditTime);
+}
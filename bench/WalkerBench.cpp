@@ -0,0 +1,313 @@
+#include "Bench.h"
+#include "AST.h"
+#include "ASTWalker.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "llvm/ADT/SmallVector.h"
+
+using namespace bench;
+
+namespace {
+	/*
+		the double dispatch Sema and CodeGen used before ASTWalker: accept()
+		calls visit(Statement&), which switches on the kind, casts and calls
+		accept() again for the visit of the node's own type. it recurses,
+		which the generated program is shallow enough for
+	*/
+	class VirtualCountNodes : public ASTVisitor {
+		void visitAll(llvm::ArrayRef<Statement*> Statements)
+		{
+			for (Statement* S : Statements)
+				S->accept(*this);
+		}
+
+	public:
+		size_t Count = 0;
+
+		virtual void visit(Base& Node) override { visitAll(Node.getStatements()); }
+
+		virtual void visit(Statement& Node) override
+		{
+			switch (Node.getKind())
+			{
+			case Statement::StateMentType::Declaration:
+				((DecStatement*)&Node)->accept(*this);
+				break;
+			case Statement::StateMentType::Assignment:
+				((AssignStatement*)&Node)->accept(*this);
+				break;
+			case Statement::StateMentType::If:
+				((IfStatement*)&Node)->accept(*this);
+				break;
+			case Statement::StateMentType::Elif:
+				((ElifStatement*)&Node)->accept(*this);
+				break;
+			case Statement::StateMentType::Else:
+				((ElseStatement*)&Node)->accept(*this);
+				break;
+			case Statement::StateMentType::Loop:
+				((LoopStatement*)&Node)->accept(*this);
+				break;
+			}
+		}
+
+		virtual void visit(Expression& Node) override
+		{
+			switch (Node.getKind())
+			{
+			case Expression::ExpressionType::BinaryOpType:
+				((BinaryOp*)&Node)->accept(*this);
+				break;
+			case Expression::ExpressionType::BooleanOpType:
+				(Node.getBooleanOp() ? Node.getBooleanOp() : (BooleanOp*)&Node)->accept(*this);
+				break;
+			default:
+				++Count;
+			}
+		}
+
+		virtual void visit(BinaryOp& Node) override
+		{
+			++Count;
+			Node.getLeft()->accept(*this);
+			Node.getRight()->accept(*this);
+		}
+
+		virtual void visit(BooleanOp& Node) override
+		{
+			++Count;
+			Node.getLeft()->accept(*this);
+			Node.getRight()->accept(*this);
+		}
+
+		virtual void visit(DecStatement& Node) override
+		{
+			++Count;
+			Node.getRValue()->accept(*this);
+		}
+
+		virtual void visit(AssignStatement& Node) override
+		{
+			++Count;
+			Node.getRValue()->accept(*this);
+		}
+
+		virtual void visit(IfStatement& Node) override
+		{
+			++Count;
+			Node.getCondition()->accept(*this);
+			visitAll(Node.getStatements());
+			for (ElifStatement* Elif : Node.getElifsStatements())
+				Elif->accept(*this);
+			if (Node.hasElse())
+				Node.getElseStatement()->accept(*this);
+		}
+
+		virtual void visit(ElifStatement& Node) override
+		{
+			++Count;
+			Node.getCondition()->accept(*this);
+			visitAll(Node.getStatements());
+		}
+
+		virtual void visit(ElseStatement& Node) override
+		{
+			++Count;
+			visitAll(Node.getStatements());
+		}
+
+		virtual void visit(LoopStatement& Node) override
+		{
+			++Count;
+			Node.getCondition()->accept(*this);
+			visitAll(Node.getStatements());
+		}
+	};
+
+	/*
+		ASTWalker as it was before its hooks were picked statically: the
+		same worklist, but one virtual visit() per node, which switches on
+		the kind and casts
+	*/
+	class VirtualWalker {
+		struct Item {
+			union {
+				Statement* S;
+				Expression* E;
+			};
+			unsigned Step;
+			bool IsExpression;
+		};
+
+		llvm::SmallVector<Item, 64> Worklist;
+		llvm::SmallVector<Item, 16> Pushed;
+
+		void schedule()
+		{
+			Worklist.append(Pushed.rbegin(), Pushed.rend());
+			Pushed.clear();
+		}
+
+	protected:
+		void push(Statement* S)
+		{
+			Item I;
+			I.S = S;
+			I.Step = 0;
+			I.IsExpression = false;
+			Pushed.push_back(I);
+		}
+
+		void push(Expression* E)
+		{
+			Item I;
+			I.E = E;
+			I.Step = 0;
+			I.IsExpression = true;
+			Pushed.push_back(I);
+		}
+
+		template <typename T>
+		void push(llvm::ArrayRef<T*> Nodes)
+		{
+			for (T* N : Nodes)
+				push(N);
+		}
+
+		virtual bool visit(Statement* S, unsigned Step) = 0;
+		virtual bool visit(Expression* E, unsigned Step) = 0;
+
+	public:
+		virtual ~VirtualWalker() {}
+
+		void walk(Base* Tree)
+		{
+			push(Tree->getStatements());
+			schedule();
+			while (!Worklist.empty())
+			{
+				Item Current = Worklist.pop_back_val();
+				bool More = Current.IsExpression ? visit(Current.E, Current.Step) : visit(Current.S, Current.Step);
+				if (More)
+				{
+					++Current.Step;
+					Worklist.push_back(Current);
+				}
+				schedule();
+			}
+		}
+	};
+
+	class VirtualWalkerCountNodes : public VirtualWalker {
+		bool visit(Statement* S, unsigned Step) override
+		{
+			++Count;
+			switch (S->getKind())
+			{
+			case Statement::StateMentType::Declaration:
+				push(((DecStatement*)S)->getRValue());
+				break;
+			case Statement::StateMentType::Assignment:
+				push(((AssignStatement*)S)->getRValue());
+				break;
+			case Statement::StateMentType::If: {
+				IfStatement* If = (IfStatement*)S;
+				push(If->getCondition());
+				push(If->getStatements());
+				push(If->getElifsStatements());
+				if (If->hasElse())
+					push(If->getElseStatement());
+				break;
+			}
+			case Statement::StateMentType::Elif:
+				push(((ElifStatement*)S)->getCondition());
+				push(((ElifStatement*)S)->getStatements());
+				break;
+			case Statement::StateMentType::Else:
+				push(((ElseStatement*)S)->getStatements());
+				break;
+			case Statement::StateMentType::Loop:
+				push(((LoopStatement*)S)->getCondition());
+				push(((LoopStatement*)S)->getStatements());
+				break;
+			}
+			return false;
+		}
+
+		bool visit(Expression* E, unsigned Step) override
+		{
+			++Count;
+			if (E->getKind() == Expression::ExpressionType::BinaryOpType)
+			{
+				push(((BinaryOp*)E)->getLeft());
+				push(((BinaryOp*)E)->getRight());
+			}
+			else if (E->getKind() == Expression::ExpressionType::BooleanOpType)
+			{
+				BooleanOp* B = E->getBooleanOp() ? E->getBooleanOp() : (BooleanOp*)E;
+				push(B->getLeft());
+				push(B->getRight());
+			}
+			return false;
+		}
+
+	public:
+		size_t Count = 0;
+	};
+
+	// the same count through the hooks of ASTWalker, each of which
+	// leaves the children to the default one
+	class CountNodes : public ASTWalker<CountNodes> {
+		friend class ASTWalker<CountNodes>;
+		using Walker = ASTWalker<CountNodes>;
+
+		bool visitDeclaration(DecStatement* S, unsigned Step) { ++Count; return Walker::visitDeclaration(S, Step); }
+		bool visitAssignment(AssignStatement* S, unsigned Step) { ++Count; return Walker::visitAssignment(S, Step); }
+		bool visitIf(IfStatement* S, unsigned Step) { ++Count; return Walker::visitIf(S, Step); }
+		bool visitElif(ElifStatement* S, unsigned Step) { ++Count; return Walker::visitElif(S, Step); }
+		bool visitElse(ElseStatement* S, unsigned Step) { ++Count; return Walker::visitElse(S, Step); }
+		bool visitLoop(LoopStatement* S, unsigned Step) { ++Count; return Walker::visitLoop(S, Step); }
+		bool visitIdentifier(Expression* E, unsigned Step) { ++Count; return false; }
+		bool visitNumber(Expression* E, unsigned Step) { ++Count; return false; }
+		bool visitBoolean(Expression* E, unsigned Step) { ++Count; return false; }
+		bool visitBinaryOp(BinaryOp* E, unsigned Step) { ++Count; return Walker::visitBinaryOp(E, Step); }
+		bool visitBooleanOp(BooleanOp* E, unsigned Step) { ++Count; return Walker::visitBooleanOp(E, Step); }
+
+	public:
+		size_t Count = 0;
+	};
+}
+
+void bench::benchWalker(const Options& Opts)
+{
+	std::string Source = generateProgram(Opts.scaled(40000, 100), 1000);
+	TokenBuffer Tokens;
+	Lexer(Source).lex(Tokens);
+	ASTContext Ctx;
+	Base* Tree = Parser(Tokens, Ctx).parse();
+
+	size_t VirtualCount = 0, VirtualWalkerCount = 0, WalkerCount = 0;
+	double VirtualTime = measure(Opts.Runs, [&] {
+		VirtualCountNodes Visitor;
+		Tree->accept(Visitor);
+		VirtualCount = Visitor.Count;
+	});
+	double VirtualWalkerTime = measure(Opts.Runs, [&] {
+		VirtualWalkerCountNodes Walker;
+		Walker.walk(Tree);
+		VirtualWalkerCount = Walker.Count;
+	});
+	double WalkerTime = measure(Opts.Runs, [&] {
+		CountNodes Walker;
+		Walker.walk(Tree);
+		WalkerCount = Walker.Count;
+	});
+	if (VirtualCount != WalkerCount || VirtualWalkerCount != WalkerCount)
+		fail("walker: the visitor counts " + std::to_string(VirtualCount) + " nodes, the virtual walker "
+			+ std::to_string(VirtualWalkerCount) + ", ASTWalker " + std::to_string(WalkerCount));
+
+	section("count the nodes, " + formatSize(Source.size()) + ", " + std::to_string(WalkerCount) + " nodes");
+	report("accept() and virtual visit(), recursive", VirtualTime, VirtualCount, "node");
+	report("worklist, virtual visit() per node", VirtualWalkerTime, VirtualWalkerCount, "node");
+	report("ASTWalker, hooks picked by the kind tag", WalkerTime, WalkerCount, "node");
+}
@@ -0,0 +1,102 @@
+#include "Bench.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace bench;
+
+namespace {
+	struct SuiteInfo {
+		const char* Name;
+		Suite Run;
+		const char* Description;
+	};
+
+	const SuiteInfo Suites[] = {
+		{ "lexer", benchLexer, "Lexer::next against the scalar lexer it replaced, pulled tokens against the TokenBuffer, cost of source locations" },
+		{ "incremental", benchIncremental, "edit to AST latency of IncrementalParser against the file and the edit size, against a full parse" },
+		{ "flat-ast", benchFlatAST, "bytes per node and traversal throughput of the flat AST against the pointer tree" },
+		{ "declarations", benchDeclarations, "parse, Sema and compile time per name of one int declaring ten thousand to a million variables" },
+		{ "ast-cache", benchASTCache, "whole compiles with -cache-dir cold and warm against none, and the cost of a cache lookup" },
+		{ "walker", benchWalker, "a pass over millions of nodes: recursive double dispatch, the virtual worklist walker and ASTWalker" },
+		{ "stmt-cache", benchStatementCache, "whole compiles with -stmt-cache-dir cold, unchanged and with one statement of 100k edited" },
+		{ "ssa", benchSSA, "whole compiles of up to 100k variables with allocas against -ssa, unoptimized and with -O1" },
+	};
+}
+
+static llvm::cl::list<std::string> Selected(llvm::cl::Positional,
+	llvm::cl::desc("<suites, all of them if none is given>"));
+
+static llvm::cl::opt<double> Scale("scale",
+	llvm::cl::desc("Multiply the input sizes of every suite by this"),
+	llvm::cl::init(1.0));
+
+static llvm::cl::opt<unsigned> Runs("runs",
+	llvm::cl::desc("Report the fastest of this many runs of each measurement"),
+	llvm::cl::init(3));
+
+static llvm::cl::opt<bool> Quick("quick",
+	llvm::cl::desc("Run every suite once on tiny inputs, to check that they still work"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<std::string> Compiler("compiler",
+	llvm::cl::desc("The MAS-Lang binary that whole compiles are timed with"),
+	llvm::cl::value_desc("path"),
+	llvm::cl::init(MAS_LANG_BINARY));
+
+static llvm::cl::opt<bool> List("list",
+	llvm::cl::desc("List the suites"),
+	llvm::cl::init(false));
+
+int main(int argc, const char** argv)
+{
+	llvm::InitLLVM X(argc, argv);
+	llvm::cl::ParseCommandLineOptions(argc, argv, "MAS-Lang benchmarks\n");
+
+	if (List)
+	{
+		for (const SuiteInfo& S : Suites)
+			llvm::outs() << "  " << llvm::left_justify(S.Name, 12) << S.Description << "\n";
+		return 0;
+	}
+
+#ifndef __OPTIMIZE__
+	llvm::errs() << "warning: mas-bench was built without optimization, configure with -DCMAKE_BUILD_TYPE=Release\n";
+#endif
+
+	Options Opts;
+	Opts.Scale = Quick ? 0.001 : Scale;
+	Opts.Runs = Quick ? 1 : std::max(1u, (unsigned)Runs);
+	Opts.Compiler = Compiler;
+
+	llvm::SmallString<128> TempDir;
+	if (std::error_code EC = llvm::sys::fs::createUniqueDirectory("mas-bench", TempDir))
+	{
+		llvm::errs() << "Cannot create a temporary directory: " << EC.message() << "\n";
+		return 1;
+	}
+	Opts.TempDir = TempDir.str().str();
+
+	int Result = 0;
+	for (const SuiteInfo& S : Suites)
+	{
+		if (!Selected.empty() && std::find(Selected.begin(), Selected.end(), S.Name) == Selected.end())
+			continue;
+		llvm::outs() << "== " << S.Name << ": " << S.Description << "\n";
+		S.Run(Opts);
+		llvm::outs().flush();
+	}
+	for (const std::string& Name : Selected)
+	{
+		if (std::none_of(std::begin(Suites), std::end(Suites), [&](const SuiteInfo& S) { return Name == S.Name; }))
+		{
+			llvm::errs() << "Unknown suite '" << Name << "'...\n";
+			Result = 1;
+		}
+	}
+
+	llvm::sys::fs::remove_directories(Opts.TempDir);
+	return hasFailed() ? 1 : Result;
+}
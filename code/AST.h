@@ -1,9 +1,12 @@
 #ifndef AST_H
 #define AST_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/raw_ostream.h"
+#include <memory>
 
 class AST; // Abstract Syntax Tree
 class Expression; // top level expression that is evaluated to boolean, int or variable name at last
@@ -50,15 +53,15 @@ public:
 // base Node that contains all the syntax nodes
 class Base : public AST {
 private:
-	llvm::SmallVector<Statement*> statements;                          // Stores the list of expressions
+	llvm::ArrayRef<Statement*> statements;                          // Stores the list of expressions
 
 public:
-	Base(llvm::SmallVector<Statement*> Statements) : statements(Statements) {}
-	llvm::SmallVector<Statement*> getStatements() { return statements; }
+	Base(llvm::ArrayRef<Statement*> Statements) : statements(Statements) {}
+	llvm::ArrayRef<Statement*> getStatements() { return statements; }
 
-	llvm::SmallVector<Statement*>::const_iterator begin() { return statements.begin(); }
+	llvm::ArrayRef<Statement*>::iterator begin() { return statements.begin(); }
 
-	llvm::SmallVector<Statement*>::const_iterator end() { return statements.end(); }
+	llvm::ArrayRef<Statement*>::iterator end() { return statements.end(); }
 	virtual void accept(ASTVisitor& V) override
 	{
 		V.visit(*this);
@@ -68,8 +71,15 @@ public:
 
 
 class TopLevelEntity : AST {
+private:
+	uint32_t Loc; // source offset of the token the node starts at, or of its operator
+
 public:
-	TopLevelEntity() {}
+	TopLevelEntity() : Loc(0) {}
+
+	// line and column are only computed from this when a diagnostic is printed
+	uint32_t getLocation() { return Loc; }
+	void setLocation(uint32_t Offset) { Loc = Offset; }
 };
 
 
@@ -90,19 +100,20 @@ private:
 	ExpressionType Type; // can be number of variable name
 
 	// if it holds a number NumberVal is used else Value is
-	// used to store variable name
+	// used to store variable name and Symbol its interned id
 	llvm::StringRef Value;
+	uint32_t Symbol;
 	int NumberVal;
 	bool BoolVal;
 	BooleanOp* BOVal;
 
 public:
 	Expression() {}
-	Expression(llvm::StringRef value) : Type(ExpressionType::Identifier), Value(value) {} // store string
+	Expression(llvm::StringRef value, uint32_t symbol) : Type(ExpressionType::Identifier), Value(value), Symbol(symbol) {} // store variable
 	Expression(int value) : Type(ExpressionType::Number), NumberVal(value) {} // store number
 	Expression(bool value) : Type(ExpressionType::Boolean), BoolVal(value) {} // store boolean
 	Expression(BooleanOp* value) : Type(ExpressionType::BooleanOpType), BOVal(value) {} // store boolean
-	Expression(ExpressionType type) : Type(type) {}
+	Expression(ExpressionType type) : Type(type), BOVal(nullptr) {}
 
 	bool isNumber() {
 		if (Type == ExpressionType::Number)
@@ -127,6 +138,12 @@ public:
 		return Value;
 	}
 
+	// returns the dense id of the identifier, the same for every use of a name.
+	// Sema and CodeGen index their per-variable tables with it
+	uint32_t getSymbol() {
+		return Symbol;
+	}
+
 	int getNumber() {
 		return NumberVal;
 	}
@@ -187,17 +204,17 @@ class LoopStatement : public Statement {
 
 private:
 	Expression* Condition;
-	llvm::SmallVector<Statement*> Statements;
+	llvm::ArrayRef<Statement*> Statements;
 
 public:
-	LoopStatement(Expression* condition, llvm::SmallVector<Statement*> statements, StateMentType type) : Condition(condition), Statements(statements), Statement(type) { }
+	LoopStatement(Expression* condition, llvm::ArrayRef<Statement*> statements, StateMentType type) : Condition(condition), Statements(statements), Statement(type) { }
 
 	Expression* getCondition()
 	{
 		return Condition;
 	}
 
-	llvm::SmallVector<Statement*> getStatements()
+	llvm::ArrayRef<Statement*> getStatements()
 	{
 		return Statements;
 	}
@@ -214,16 +231,16 @@ class IfStatement : public Statement {
 
 private:
 	Expression* Condition;
-	llvm::SmallVector<Statement*> Statements;
-	llvm::SmallVector<ElifStatement*> ElifsStatements;
+	llvm::ArrayRef<Statement*> Statements;
+	llvm::ArrayRef<ElifStatement*> ElifsStatements;
 	ElseStatement* ElseStatements;
 	bool HasElif;
 	bool HasElse;
 
 public:
 	IfStatement(Expression* condition,
-	 llvm::SmallVector<Statement*> statements,
-	 llvm::SmallVector<ElifStatement*> elifsStatements,
+	 llvm::ArrayRef<Statement*> statements,
+	 llvm::ArrayRef<ElifStatement*> elifsStatements,
 	 ElseStatement* elseStatement,
 	 bool hasElif, bool hasElse,
 	 StateMentType type): Condition(condition),
@@ -247,12 +264,12 @@ public:
 		return HasElse;
 	}
 
-	llvm::SmallVector<ElifStatement*> getElifsStatements()
+	llvm::ArrayRef<ElifStatement*> getElifsStatements()
 	{
 		return ElifsStatements;
 	}
 
-	llvm::SmallVector<Statement*> getStatements()
+	llvm::ArrayRef<Statement*> getStatements()
 	{
 		return Statements;
 	}
@@ -272,17 +289,17 @@ class ElifStatement : public Statement {
 
 private:
 	Expression* Condition;
-	llvm::SmallVector<Statement*> Statements;
+	llvm::ArrayRef<Statement*> Statements;
 
 public:
-	ElifStatement(Expression* condition, llvm::SmallVector<Statement*> statements, StateMentType type): Condition(condition), Statements(statements), Statement(type) { }
+	ElifStatement(Expression* condition, llvm::ArrayRef<Statement*> statements, StateMentType type): Condition(condition), Statements(statements), Statement(type) { }
 
 	Expression* getCondition()
 	{
 		return Condition;
 	}
 
-	llvm::SmallVector<Statement*> getStatements()
+	llvm::ArrayRef<Statement*> getStatements()
 	{
 		return Statements;
 	}
@@ -296,12 +313,12 @@ public:
 class ElseStatement : public Statement {
 
 private:
-	llvm::SmallVector<Statement*> Statements;
+	llvm::ArrayRef<Statement*> Statements;
 
 public:
-	ElseStatement(llvm::SmallVector<Statement*> statements, StateMentType type): Statements(statements), Statement(type) { }
+	ElseStatement(llvm::ArrayRef<Statement*> statements, StateMentType type): Statements(statements), Statement(type) { }
 
-	llvm::SmallVector<Statement*> getStatements()
+	llvm::ArrayRef<Statement*> getStatements()
 	{
 		return Statements;
 	}
@@ -323,8 +340,7 @@ private:
 	Statement::StateMentType type;
 
 public:
-	DecStatement(Expression* lvalue, Expression* rvalue) : lvalue(lvalue), rvalue(rvalue), type(Statement::StateMentType::Declaration), Statement(type) { }
-	DecStatement(Expression* lvalue) : lvalue(lvalue), rvalue(rvalue), type(Statement::StateMentType::Declaration), Statement(type) { rvalue = new Expression(0); }
+	DecStatement(Expression* lvalue, Expression* rvalue) : lvalue(lvalue), rvalue(rvalue), type(Statement::StateMentType::Declaration), Statement(Statement::StateMentType::Declaration) { }
 
 	Expression* getLValue() {
 		return lvalue;
@@ -350,7 +366,7 @@ private:
 	Statement::StateMentType type;
 
 public:
-	AssignStatement(Expression* lvalue, Expression* rvalue) : lvalue(lvalue), rvalue(rvalue), type(Statement::StateMentType::Assignment), Statement(type) { }
+	AssignStatement(Expression* lvalue, Expression* rvalue) : lvalue(lvalue), rvalue(rvalue), type(Statement::StateMentType::Assignment), Statement(Statement::StateMentType::Assignment) { }
 	Expression* getLValue() {
 		return lvalue;
 	}
@@ -442,4 +458,50 @@ public:
 	}
 };
 
+
+/*
+	owns the memory of every AST node of one compilation. nodes and the
+	child lists of blocks are bump allocated next to each other and all of
+	them are released by a single reset() once the tree is no longer needed.
+	nothing in the tree owns other memory, so no destructor has to run.
+*/
+class ASTContext {
+	llvm::BumpPtrAllocator Allocator;
+	size_t Nodes;
+
+public:
+	ASTContext() : Nodes(0) {}
+
+	ASTContext(const ASTContext&) = delete;
+	ASTContext& operator=(const ASTContext&) = delete;
+
+	template <typename T, typename... Args>
+	T* create(Args&&... args)
+	{
+		++Nodes;
+		return new (Allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+	}
+
+	// copies a child list built by the parser into the arena
+	template <typename T>
+	llvm::ArrayRef<T> copy(llvm::ArrayRef<T> Items)
+	{
+		if (Items.empty())
+			return llvm::ArrayRef<T>();
+		T* Storage = Allocator.Allocate<T>(Items.size());
+		std::uninitialized_copy(Items.begin(), Items.end(), Storage);
+		return llvm::ArrayRef<T>(Storage, Items.size());
+	}
+
+	// releases every node created so far
+	void reset()
+	{
+		Allocator.Reset();
+		Nodes = 0;
+	}
+
+	size_t getNodeCount() const { return Nodes; }
+	size_t getBytesAllocated() const { return Allocator.getBytesAllocated(); }
+};
+
 #endif
\ No newline at end of file
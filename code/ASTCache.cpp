@@ -0,0 +1,167 @@
+#include "ASTCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <cstring>
+
+// bump whenever the file layout or FlatAST changes
+static const uint32_t FormatVersion = 2;
+static const uint32_t ByteOrderMark = 0x01020304;
+
+ASTCache::ASTCache(llvm::StringRef Directory, llvm::StringRef Executable, bool Folded) : Directory(Directory)
+{
+	// size and modification time stand in for the compiler version
+	std::string Version;
+	llvm::raw_string_ostream OS(Version);
+	OS << "MAS-Lang cache " << FormatVersion << " " << Folded;
+	llvm::sys::fs::file_status Status;
+	if (!llvm::sys::fs::status(Executable, Status))
+		OS << " " << Status.getSize() << " " << Status.getLastModificationTime().time_since_epoch().count();
+	CompilerKey = llvm::xxHash64(OS.str());
+}
+
+uint64_t ASTCache::getSourceKey(llvm::StringRef Source)
+{
+	return llvm::xxHash64(Source);
+}
+
+std::string ASTCache::getPath(uint64_t SourceKey) const
+{
+	std::string Path;
+	llvm::raw_string_ostream OS(Path);
+	OS << Directory << "/" << llvm::format_hex_no_prefix(SourceKey, 16)
+		<< "-" << llvm::format_hex_no_prefix(CompilerKey, 16) << ".mast";
+	return OS.str();
+}
+
+/*
+	checks the header, the hash of the rest and that the sections fill
+	the file, then the tree itself. nodes and lists are used in
+	place, only the symbol table is read to point the spellings into the
+	mapping
+*/
+std::unique_ptr<FlatAST> ASTCache::lookup(llvm::StringRef Source)
+{
+	uint64_t SourceKey = getSourceKey(Source);
+	llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FileOrErr =
+		llvm::MemoryBuffer::getFile(getPath(SourceKey), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+	if (!FileOrErr)
+		return nullptr;
+
+	llvm::StringRef Data = (*FileOrErr)->getBuffer();
+	if (Data.size() < sizeof(Header))
+		return nullptr;
+
+	const Header& H = *reinterpret_cast<const Header*>(Data.data());
+	if (memcmp(H.Magic, "MAST", 4) != 0 || H.ByteOrder != ByteOrderMark ||
+		H.SourceKey != SourceKey || H.CompilerKey != CompilerKey || H.SourceSize != Source.size() ||
+		H.PayloadKey != llvm::xxHash64(Data.drop_front(sizeof(Header))))
+		return nullptr;
+
+	// the sections follow each other as store writes them and fill the file
+	uint64_t ListsOffset = H.NodesOffset + (uint64_t)H.NodeCount * sizeof(FlatAST::Node);
+	uint64_t SymbolsOffset = ListsOffset + (uint64_t)H.ListCount * sizeof(uint32_t);
+	uint64_t NamesOffset = SymbolsOffset + (uint64_t)H.SymbolCount * sizeof(Symbol);
+	if (H.NodeCount == 0 || H.NodesOffset != sizeof(Header) || H.ListsOffset != ListsOffset ||
+		H.SymbolsOffset != SymbolsOffset || H.NamesOffset != NamesOffset || NamesOffset + H.NamesSize != Data.size())
+		return nullptr;
+
+	const Symbol* Symbols = reinterpret_cast<const Symbol*>(Data.data() + H.SymbolsOffset);
+	const char* Spellings = Data.data() + H.NamesOffset;
+	std::vector<llvm::StringRef> Names(H.SymbolCount);
+	for (uint32_t I = 0; I < H.SymbolCount; ++I)
+	{
+		if ((uint64_t)Symbols[I].Offset + Symbols[I].Size > H.NamesSize)
+			return nullptr;
+		Names[I] = llvm::StringRef(Spellings + Symbols[I].Offset, Symbols[I].Size);
+	}
+
+	llvm::ArrayRef<FlatAST::Node> Nodes(reinterpret_cast<const FlatAST::Node*>(Data.data() + H.NodesOffset), H.NodeCount);
+	llvm::ArrayRef<uint32_t> Lists(reinterpret_cast<const uint32_t*>(Data.data() + H.ListsOffset), H.ListCount);
+	std::unique_ptr<FlatAST> Tree(new FlatAST(Nodes, Lists, std::move(Names)));
+	if (!Tree->verify(Source.size()))
+		return nullptr;
+	Mapped = std::move(*FileOrErr);
+	return Tree;
+}
+
+/*
+	writes to a temporary file and renames it into place, so a concurrent
+	compile never maps a half written file
+*/
+bool ASTCache::store(llvm::StringRef Source, const FlatAST& Tree)
+{
+	llvm::ArrayRef<FlatAST::Node> Nodes = Tree.nodes();
+	llvm::ArrayRef<uint32_t> Lists = Tree.lists();
+	llvm::ArrayRef<llvm::StringRef> Names = Tree.names();
+
+	std::vector<Symbol> Symbols(Names.size());
+	uint64_t NamesSize = 0;
+	for (size_t I = 0; I < Names.size(); ++I)
+	{
+		Symbols[I].Offset = NamesSize;
+		Symbols[I].Size = Names[I].size();
+		NamesSize += Names[I].size();
+	}
+
+	Header H;
+	memcpy(H.Magic, "MAST", 4);
+	H.ByteOrder = ByteOrderMark;
+	H.SourceKey = getSourceKey(Source);
+	H.CompilerKey = CompilerKey;
+	H.SourceSize = Source.size();
+	H.NodeCount = Nodes.size();
+	H.ListCount = Lists.size();
+	H.SymbolCount = Symbols.size();
+	H.NamesSize = NamesSize;
+
+	uint64_t Offset = sizeof(Header);
+	H.NodesOffset = Offset;
+	Offset += Nodes.size() * sizeof(FlatAST::Node);
+	H.ListsOffset = Offset;
+	Offset += Lists.size() * sizeof(uint32_t);
+	H.SymbolsOffset = Offset;
+	Offset += Symbols.size() * sizeof(Symbol);
+	H.NamesOffset = Offset;
+	if (Offset + NamesSize > UINT32_MAX)
+		return false;
+
+	std::string Payload;
+	Payload.reserve(Offset + NamesSize - sizeof(Header));
+	Payload.append(reinterpret_cast<const char*>(Nodes.data()), Nodes.size() * sizeof(FlatAST::Node));
+	Payload.append(reinterpret_cast<const char*>(Lists.data()), Lists.size() * sizeof(uint32_t));
+	Payload.append(reinterpret_cast<const char*>(Symbols.data()), Symbols.size() * sizeof(Symbol));
+	for (llvm::StringRef Name : Names)
+		Payload += Name;
+	H.PayloadKey = llvm::xxHash64(Payload);
+
+	if (llvm::sys::fs::create_directories(Directory))
+		return false;
+
+	int FD;
+	llvm::SmallString<128> TempPath;
+	if (llvm::sys::fs::createUniqueFile(Directory + "/%%%%%%%%.tmp", FD, TempPath))
+		return false;
+
+	{
+		llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		OS.write(reinterpret_cast<const char*>(&H), sizeof(H));
+		OS << Payload;
+		OS.close();
+		if (OS.has_error())
+		{
+			OS.clear_error();
+			llvm::sys::fs::remove(TempPath);
+			return false;
+		}
+	}
+
+	if (llvm::sys::fs::rename(TempPath, getPath(H.SourceKey)))
+	{
+		llvm::sys::fs::remove(TempPath);
+		return false;
+	}
+	return true;
+}
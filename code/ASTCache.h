@@ -0,0 +1,73 @@
+#ifndef ASTCACHE_H
+#define ASTCACHE_H
+
+#include "FlatAST.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+	directory of programs that already parsed and passed Sema. each one is
+	kept as its FlatAST in a file named after a hash of the source text
+	and one of the compiler, so a later compile of the same text maps the
+	file and goes straight to CodeGen.
+
+	file layout, offsets count from the start of the file:
+		Header
+		FlatAST::Node[NodeCount]     at NodesOffset
+		uint32_t[ListCount]          at ListsOffset
+		Symbol[SymbolCount]          at SymbolsOffset
+		char[NamesSize]              at NamesOffset, the spellings of the symbols
+
+	numbers are stored in the byte order of the machine that wrote the
+	file, a file from another byte order is treated as a miss. so is one
+	whose bytes after the header do not hash to PayloadKey or whose tree
+	does not pass FlatAST::verify, the files are not trusted.
+*/
+class ASTCache {
+public:
+	struct Header {
+		char Magic[4];
+		uint32_t ByteOrder;
+		uint64_t SourceKey;
+		uint64_t CompilerKey;
+		uint64_t SourceSize;
+		uint64_t PayloadKey;    // xxHash64 of everything after the header
+		uint32_t NodeCount, NodesOffset;
+		uint32_t ListCount, ListsOffset;
+		uint32_t SymbolCount, SymbolsOffset;
+		uint32_t NamesSize, NamesOffset;
+	};
+
+	// spelling of a symbol id, inside the names
+	struct Symbol {
+		uint32_t Offset;
+		uint32_t Size;
+	};
+
+private:
+	std::string Directory;
+	uint64_t CompilerKey;
+	std::unique_ptr<llvm::MemoryBuffer> Mapped;     // the file of the last hit
+
+	std::string getPath(uint64_t SourceKey) const;
+
+public:
+	// Executable is the compiler binary, rebuilding it invalidates the
+	// cache. Folded tells whether the trees stored also passed the constant
+	// folder, compiles with and without -fold do not share trees
+	ASTCache(llvm::StringRef Directory, llvm::StringRef Executable, bool Folded);
+
+	static uint64_t getSourceKey(llvm::StringRef Source);
+
+	// the cached tree of Source, or null. it refers into the mapped file
+	// and stays valid until the next lookup
+	std::unique_ptr<FlatAST> lookup(llvm::StringRef Source);
+
+	// stores the tree of Source, returns false if the file could not be written
+	bool store(llvm::StringRef Source, const FlatAST& Tree);
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef ASTWALKER_H
+#define ASTWALKER_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+
+/*
+	walks the AST with an explicit worklist instead of recursion, so the
+	nesting depth of a program only costs heap memory.
+
+	Derived is the walker itself (CRTP). every node goes to the hook for
+	its kind, picked by a switch on the kind tag, so there is no virtual
+	call per node and a hook can be inlined. a hook is called for the
+	same node with Step 0, 1, 2, ... for as long as it returns true.
+	children handed to push() during a call are walked completely, in
+	the order they were pushed, before the next step of the node that
+	pushed them.
+
+	the hooks below walk the children and do nothing else. a walker
+	hides the ones it cares about, and declares ASTWalker<Derived> a
+	friend if it keeps them private.
+*/
+template <typename Derived>
+class ASTWalker {
+	struct Item {
+		union {
+			Statement* S;
+			Expression* E;
+		};
+		unsigned Step;
+		bool IsExpression;
+	};
+
+	llvm::SmallVector<Item, 64> Worklist;
+	llvm::SmallVector<Item, 16> Pushed;     // children pushed by the current hook
+
+	Derived& derived() { return *static_cast<Derived*>(this); }
+
+	// moves pushed children to the worklist, reversed so that the first
+	// one pushed is the first one taken off
+	void schedule()
+	{
+		Worklist.append(Pushed.rbegin(), Pushed.rend());
+		Pushed.clear();
+	}
+
+	bool dispatch(Statement* S, unsigned Step)
+	{
+		switch (S->getKind())
+		{
+		case Statement::StateMentType::Declaration:
+			return derived().visitDeclaration((DecStatement*)S, Step);
+		case Statement::StateMentType::Assignment:
+			return derived().visitAssignment((AssignStatement*)S, Step);
+		case Statement::StateMentType::If:
+			return derived().visitIf((IfStatement*)S, Step);
+		case Statement::StateMentType::Elif:
+			return derived().visitElif((ElifStatement*)S, Step);
+		case Statement::StateMentType::Else:
+			return derived().visitElse((ElseStatement*)S, Step);
+		case Statement::StateMentType::Loop:
+			return derived().visitLoop((LoopStatement*)S, Step);
+		}
+		return false;
+	}
+
+	bool dispatch(Expression* E, unsigned Step)
+	{
+		switch (E->getKind())
+		{
+		case Expression::ExpressionType::Identifier:
+			return derived().visitIdentifier(E, Step);
+		case Expression::ExpressionType::Number:
+			return derived().visitNumber(E, Step);
+		case Expression::ExpressionType::Boolean:
+			return derived().visitBoolean(E, Step);
+		case Expression::ExpressionType::BinaryOpType:
+			return derived().visitBinaryOp((BinaryOp*)E, Step);
+		case Expression::ExpressionType::BooleanOpType:
+			// and, or are wrapped in a plain Expression that points at the operation
+			return derived().visitBooleanOp(E->getBooleanOp() ? E->getBooleanOp() : (BooleanOp*)E, Step);
+		}
+		return false;
+	}
+
+	void run()
+	{
+		schedule();
+		while (!Worklist.empty())
+		{
+			Item Current = Worklist.pop_back_val();
+			bool More = Current.IsExpression ? dispatch(Current.E, Current.Step) : dispatch(Current.S, Current.Step);
+			if (More)
+			{
+				++Current.Step;
+				Worklist.push_back(Current);
+			}
+			schedule();
+		}
+	}
+
+protected:
+	void push(Statement* S)
+	{
+		Item I;
+		I.S = S;
+		I.Step = 0;
+		I.IsExpression = false;
+		Pushed.push_back(I);
+	}
+
+	void push(Expression* E)
+	{
+		Item I;
+		I.E = E;
+		I.Step = 0;
+		I.IsExpression = true;
+		Pushed.push_back(I);
+	}
+
+	template <typename T>
+	void push(llvm::ArrayRef<T*> Nodes)
+	{
+		for (T* N : Nodes)
+			push(N);
+	}
+
+	bool visitDeclaration(DecStatement* S, unsigned Step)
+	{
+		push(S->getRValue());
+		return false;
+	}
+
+	bool visitAssignment(AssignStatement* S, unsigned Step)
+	{
+		push(S->getRValue());
+		return false;
+	}
+
+	bool visitIf(IfStatement* S, unsigned Step)
+	{
+		push(S->getCondition());
+		push(S->getStatements());
+		push(S->getElifsStatements());
+		if (S->hasElse())
+			push(S->getElseStatement());
+		return false;
+	}
+
+	bool visitElif(ElifStatement* S, unsigned Step)
+	{
+		push(S->getCondition());
+		push(S->getStatements());
+		return false;
+	}
+
+	bool visitElse(ElseStatement* S, unsigned Step)
+	{
+		push(S->getStatements());
+		return false;
+	}
+
+	bool visitLoop(LoopStatement* S, unsigned Step)
+	{
+		push(S->getCondition());
+		push(S->getStatements());
+		return false;
+	}
+
+	bool visitIdentifier(Expression* E, unsigned Step) { return false; }
+	bool visitNumber(Expression* E, unsigned Step) { return false; }
+	bool visitBoolean(Expression* E, unsigned Step) { return false; }
+
+	bool visitBinaryOp(BinaryOp* E, unsigned Step)
+	{
+		push(E->getLeft());
+		push(E->getRight());
+		return false;
+	}
+
+	bool visitBooleanOp(BooleanOp* E, unsigned Step)
+	{
+		push(E->getLeft());
+		push(E->getRight());
+		return false;
+	}
+
+public:
+	// walks every statement of the program in order
+	void walk(Base* Tree)
+	{
+		push(Tree->getStatements());
+		run();
+	}
+
+	void walk(Statement* S)
+	{
+		push(S);
+		run();
+	}
+
+	void walk(Expression* E)
+	{
+		push(E);
+		run();
+	}
+};
+
+#endif
@@ -1,16 +1,128 @@
 #include "CodeGen.h"
-#include "llvm/ADT/StringMap.h"
+#include "ASTWalker.h"
+#include "Error.h"
+#include "MIR.h"
+#include "Pipeline.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
+#include <tuple>
 
 using namespace llvm;
 
-// Define a visitor class for generating LLVM IR from the AST.
+// Define a walker class for generating LLVM IR from the AST.
 namespace
 {
-    class ToIRVisitor : public ASTVisitor
+    /*
+        checks that L / R can be computed, R is neither 0 nor -1 with L
+        INT_MIN, and otherwise calls mas_div_trap from rtMAS.c, which does
+        not return. the builder is left in the block after the check
+    */
+    void emitDivisionGuard(IRBuilder<>& Builder, Value* L, Value* R, unsigned Line)
     {
+        ConstantInt* Divisor = dyn_cast<ConstantInt>(R);
+        if (Divisor && !Divisor->isZero() && !Divisor->isMinusOne())
+            return;
+
+        BasicBlock* BB = Builder.GetInsertBlock();
+        Function* Fn = BB->getParent();
+        Module* M = Fn->getParent();
+        LLVMContext& Ctx = M->getContext();
+        IntegerType* Int32Ty = Builder.getInt32Ty();
+
+        Value* Zero = Builder.CreateICmpEQ(R, ConstantInt::get(Int32Ty, 0));
+        Value* Overflow = Builder.CreateAnd(Builder.CreateICmpEQ(L, ConstantInt::get(Int32Ty, INT32_MIN, true)),
+            Builder.CreateICmpEQ(R, ConstantInt::get(Int32Ty, -1, true)));
+        BasicBlock* TrapBB = BasicBlock::Create(Ctx, "div.trap", Fn);
+        BasicBlock* OkBB = BasicBlock::Create(Ctx, "div.ok", Fn, BB->getNextNode());
+        Builder.CreateCondBr(Builder.CreateOr(Zero, Overflow), TrapBB, OkBB, MDBuilder(Ctx).createBranchWeights(1, 1 << 20));
+
+        FunctionCallee Trap = M->getOrInsertFunction("mas_div_trap", Builder.getVoidTy(), Int32Ty, Int32Ty);
+        if (Function* TrapFn = dyn_cast<Function>(Trap.getCallee()))
+        {
+            TrapFn->addFnAttr(Attribute::NoReturn);
+            TrapFn->addFnAttr(Attribute::Cold);
+            TrapFn->addFnAttr(Attribute::NoUnwind);
+        }
+        Builder.SetInsertPoint(TrapBB);
+        Builder.CreateCall(Trap, { R, ConstantInt::get(Int32Ty, Line) });
+        Builder.CreateUnreachable();
+        Builder.SetInsertPoint(OkBB);
+    }
+
+    /*
+        the variables each loop assigns, in its body and the statements
+        nested in it, sorted. with DirectSSA a read only goes through the
+        condition blocks of the open loops that assign its variable, any
+        other loop would give it a phi of the value from before the loop
+        and itself, which is removed again once the loop is sealed. with
+        loops nested deep around a read, removing those one after another
+        moved the uses of the variable once per loop
+    */
+    class LoopWritesCollector : public ASTWalker<LoopWritesCollector>
+    {
+        friend class ASTWalker<LoopWritesCollector>;
+
+        llvm::DenseMap<LoopStatement*, std::vector<uint32_t>>& Writes;
+        std::vector<std::vector<uint32_t>> Open;    // variables of the loops being walked
+
+        // declarations are never nested, and no expression assigns
+        bool visitDeclaration(DecStatement* Node, unsigned Step) { return false; }
+
+        bool visitAssignment(AssignStatement* Node, unsigned Step)
+        {
+            if (!Open.empty())
+                Open.back().push_back(Node->getLValue()->getSymbol());
+            return false;
+        }
+
+        bool visitIf(IfStatement* Node, unsigned Step)
+        {
+            push(Node->getStatements());
+            push(Node->getElifsStatements());
+            if (Node->hasElse())
+                push(Node->getElseStatement());
+            return false;
+        }
+
+        bool visitElif(ElifStatement* Node, unsigned Step)
+        {
+            push(Node->getStatements());
+            return false;
+        }
+
+        bool visitLoop(LoopStatement* Node, unsigned Step)
+        {
+            if (Step == 0)
+            {
+                Open.emplace_back();
+                push(Node->getStatements());
+                return true;
+            }
+
+            // a loop assigns what the loops in it do
+            std::vector<uint32_t> Vars = std::move(Open.back());
+            Open.pop_back();
+            llvm::sort(Vars);
+            Vars.erase(std::unique(Vars.begin(), Vars.end()), Vars.end());
+            if (!Open.empty())
+                Open.back().insert(Open.back().end(), Vars.begin(), Vars.end());
+            Writes[Node] = std::move(Vars);
+            return false;
+        }
+
+    public:
+        LoopWritesCollector(llvm::DenseMap<LoopStatement*, std::vector<uint32_t>>& Writes) : Writes(Writes) {}
+    };
+
+    class ToIRVisitor : public ASTWalker<ToIRVisitor>
+    {
+        friend class ASTWalker<ToIRVisitor>;
+
         Module* M;
         IRBuilder<> Builder;
         Type* VoidTy;
@@ -19,136 +131,635 @@ namespace
         Type* Int8PtrPtrTy;
         Constant* Int32Zero;
 
-        Value* V;
-        StringMap<AllocaInst*> nameMap;
+        llvm::SmallVector<Value*, 16> Values;   // values of the expressions walked so far
+        std::vector<Value*> nameMap;            // memory of each variable, indexed by symbol id
+        std::vector<Value*> FragmentMap;        // nameMap of main while a fragment is generated
+
+        // blocks of the if statements and loops that are being generated
+        struct IfState
+        {
+            llvm::BasicBlock* IfBodyBB;
+            llvm::BasicBlock* AfterIfBB;
+            llvm::BasicBlock* BeforeCondBB;
+            llvm::BasicBlock* BeforeBodyBB;
+            llvm::Value* BeforeCondVal;
+            llvm::BasicBlock* ElseBB;
+            size_t Regions;     // regions open before the if
+        };
+        struct LoopState
+        {
+            llvm::BasicBlock* WhileCondBB;
+            llvm::BasicBlock* WhileBodyBB;
+            llvm::BasicBlock* AfterWhileBB;
+        };
+        llvm::SmallVector<IfState, 8> Ifs;
+        llvm::SmallVector<LoopState, 8> Loops;
 
         llvm::FunctionType* MainFty;
-        llvm::Function* MainFn;
+        llvm::Function* MainFn;                 // the function being generated, main or a fragment
+
+        // with ReuseValues, loads and operations already emitted in the
+        // current block are used again. a store drops the load of its
+        // variable, so operations on the new value no longer match
+        bool ReuseValues;
+        llvm::DenseMap<uint32_t, Value*> Loaded;    // by symbol id
+        llvm::DenseMap<std::tuple<unsigned, Value*, Value*>, Value*> Computed;
+
+        // every division checks its divisor first
+        bool GuardDivisions;
+
+        /*
+            with DirectSSA variables live in registers instead of memory,
+            built as in Braun et al., "Simple and Efficient Construction of
+            Static Single Assignment Form". the value of a variable is
+            looked up in the block that reads it and its predecessors, a
+            block with several gets a phi. a block is sealed once all its
+            predecessors are known, a read in a block that is not sealed
+            yet gets a phi whose operands are added when it is. phis that
+            turn out to choose between a single value are removed again.
+            the edges are added as the visitor decides them, which can be
+            before the branch is generated.
+
+            looking a variable up through every block since it was last
+            written would take as many steps as there are blocks in between,
+            so the structure of the program is used to get there directly.
+            a read first checks whether the last block that wrote or read
+            the variable dominates the reading block: a block dominates the
+            blocks entered after it within its region, which is the body of
+            an if, elif, else or loopc, or the rest of an if from an elif
+            condition on. the value of that block is taken, or when loops
+            that are still open start in between, the innermost one's
+            condition block is read instead.
+
+            every if and loopc being generated keeps the last access before
+            it of each variable it accesses. at the end of a branch those
+            variables are read, and the last accesses from before are put
+            back for the next branch. once the statement is done, they get
+            their phis in the block after the if or the loop condition
+            block right away, so later reads find them there
+        */
+        struct SSABlock
+        {
+            llvm::SmallVector<BasicBlock*, 2> Preds;
+            bool Sealed = false;
+            llvm::SmallVector<std::pair<uint32_t, PHINode*>, 4> Incomplete;   // phis waiting for the seal
+            unsigned Entered = ~0u;     // blocks entered before this one
+            unsigned Region = 0;
+        };
+        bool DirectSSA;
+        llvm::DenseMap<BasicBlock*, SSABlock> SSABlocks;
+        llvm::DenseMap<std::pair<BasicBlock*, uint32_t>, Value*> Defs;     // value of a variable at the end of a block so far
+        llvm::DenseMap<Value*, Value*> Replaced;    // removed phi to the value it was replaced with
+        std::vector<PHINode*> Removed;              // freed by finish, so their addresses are not reused before
+        std::vector<uint32_t> Declared;             // in order, their final values are stored to memory
+        std::vector<BasicBlock*> LastAccess;        // by symbol id
+        unsigned EnteredBlocks = 0;
+        std::vector<unsigned> RegionEnds;           // last block entered in each region, ~0u while open
+        std::vector<unsigned> OpenRegions;
+        llvm::DenseMap<LoopStatement*, std::vector<uint32_t>> LoopWrites;  // of the statement being generated
+        // condition blocks of the open loops that assign each variable, with when they were entered
+        llvm::DenseMap<uint32_t, std::vector<std::pair<unsigned, BasicBlock*>>> OpenLoops;
+
+        struct Construct
+        {
+            llvm::DenseMap<uint32_t, unsigned> Branches;                // variable to the last branch it was accessed in
+            std::vector<std::pair<uint32_t, BasicBlock*>> Before;      // variable and its last access before the statement
+            std::vector<uint32_t> Accessed;                             // in the current branch
+            unsigned Branch = 0;
+        };
+        std::vector<Construct> Constructs;
+
+        // a phi whose operands are read from the predecessors of its block
+        struct PhiRead
+        {
+            BasicBlock* BB;
+            PHINode* Phi;
+            unsigned NextPred;
+        };
 
-    public:
-        // Constructor for the visitor class.
-        ToIRVisitor(Module* M) : M(M), Builder(M->getContext())
+        Value* pop()
         {
-            // Initialize LLVM types and constants.
-            VoidTy = Type::getVoidTy(M->getContext());
-            Int32Ty = Type::getInt32Ty(M->getContext());
-            Int8PtrTy = Type::getInt8PtrTy(M->getContext());
-            Int8PtrPtrTy = Int8PtrTy->getPointerTo();
-            Int32Zero = ConstantInt::get(Int32Ty, 0, true);
+            return Values.pop_back_val();
         }
 
-        // Entry point for generating LLVM IR from the AST.
-        void run(AST* Tree)
+        Value*& variable(uint32_t Var)
         {
-            // Create the main function with the appropriate function type.
-            MainFty = FunctionType::get(Int32Ty, { Int32Ty, Int8PtrPtrTy }, false);
-            MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+            if (Var >= nameMap.size())
+                nameMap.resize(std::max<size_t>(Var + 1, nameMap.size() * 2));
+            return nameMap[Var];
+        }
 
-            // Create a basic block for the entry point of the main function.
-            BasicBlock* BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
+        // values of other blocks need not dominate the new one
+        void setInsertPoint(BasicBlock* BB)
+        {
+            enter(BB);
             Builder.SetInsertPoint(BB);
+            if (ReuseValues)
+            {
+                Loaded.clear();
+                Computed.clear();
+            }
+        }
 
-            // Visit the root node of the AST to generate IR.
-            Tree->accept(*this);
+        // the first time BB is generated into, it joins the innermost open region
+        void enter(BasicBlock* BB)
+        {
+            if (!DirectSSA)
+                return;
+            SSABlock& Block = SSABlocks[BB];
+            if (Block.Entered != ~0u)
+                return;
+            Block.Entered = EnteredBlocks++;
+            Block.Region = OpenRegions.back();
+        }
 
-            // Create a return instruction at the end of the main function.
-            Builder.CreateRet(Int32Zero);
+        void openRegion()
+        {
+            if (!DirectSSA)
+                return;
+            OpenRegions.push_back(RegionEnds.size());
+            RegionEnds.push_back(~0u);
+        }
+
+        // closes regions until Depth are open
+        void closeRegions(size_t Depth)
+        {
+            for (; DirectSSA && OpenRegions.size() > Depth; OpenRegions.pop_back())
+                RegionEnds[OpenRegions.back()] = EnteredBlocks - 1;
         }
 
+        // whether A dominates B, ignoring the loops that are open
+        bool dominates(const SSABlock& A, const SSABlock& B)
+        {
+            return A.Entered <= B.Entered && B.Entered <= RegionEnds[A.Region];
+        }
 
-        virtual void visit(Base& Node) override
+        // the innermost open loop that assigns Var, entered after A and not after B
+        BasicBlock* loopBetween(uint32_t Var, const SSABlock& A, const SSABlock& B)
         {
-            for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+            auto Loops = OpenLoops.find(Var);
+            if (Loops == OpenLoops.end())
+                return nullptr;
+            for (auto It = Loops->second.rbegin(); It != Loops->second.rend(); ++It)
             {
-                (*I)->accept(*this);
+                if (It->first <= B.Entered)
+                    return It->first > A.Entered ? It->second : nullptr;
             }
+            return nullptr;
+        }
+
+        void addEdge(BasicBlock* From, BasicBlock* To)
+        {
+            if (DirectSSA)
+                SSABlocks[To].Preds.push_back(From);
+        }
+
+        // branches from the current block
+        void branch(BasicBlock* To)
+        {
+            addEdge(Builder.GetInsertBlock(), To);
+            Builder.CreateBr(To);
         }
 
-        virtual void visit(Statement& Node) override
+        // BB gets no more predecessors
+        void seal(BasicBlock* BB)
         {
-            if (Node.getKind() == Statement::StateMentType::Declaration)
+            if (!DirectSSA)
+                return;
+            SSABlock& Block = SSABlocks[BB];
+            llvm::SmallVector<std::pair<uint32_t, PHINode*>, 4> Incomplete;
+            Incomplete.swap(Block.Incomplete);
+            Block.Sealed = true;
+
+            llvm::SmallVector<PhiRead, 8> Reads;
+            for (auto& [Var, Phi] : Incomplete)
             {
-                DecStatement* declaration = (DecStatement*)&Node;
-                declaration->accept(*this);
+                Reads.push_back({ BB, Phi, 0 });
+                completePhis(Var, Reads, nullptr);
             }
-            else if (Node.getKind() == Statement::StateMentType::Assignment)
+        }
+
+        Value* lookupDef(uint32_t Var, BasicBlock* BB)
+        {
+            auto It = Defs.find({ BB, Var });
+            if (It == Defs.end())
+                return nullptr;
+            while (Value* R = Replaced.lookup(It->second))
+                It->second = R;
+            return It->second;
+        }
+
+        PHINode* createPhi(BasicBlock* BB)
+        {
+            if (BB->empty())
+                return PHINode::Create(Int32Ty, 2, "", BB);
+            return PHINode::Create(Int32Ty, 2, "", &BB->front());
+        }
+
+        /*
+            starts a read of Var in BB. blocks with a single predecessor are
+            followed up, the value found is recorded for each of them. returns
+            the value, or null when a phi with several predecessors was
+            pushed onto Reads and has to be completed first
+        */
+        Value* startRead(uint32_t Var, BasicBlock* BB, llvm::SmallVectorImpl<PhiRead>& Reads)
+        {
+            llvm::SmallVector<BasicBlock*, 8> Chain;
+            Value* V = nullptr;
+            bool Pushed = false;
+            BasicBlock* Last = Var < LastAccess.size() ? LastAccess[Var] : nullptr;
+            const SSABlock* LastBlock = Last ? &SSABlocks.find(Last)->second : nullptr;
+            for (;;)
             {
-                AssignStatement* declaration = (AssignStatement*)&Node;
-                declaration->accept(*this);
+                if ((V = lookupDef(Var, BB)))
+                    break;
+                SSABlock& Block = SSABlocks.find(BB)->second;
+                if (LastBlock && dominates(*LastBlock, Block))
+                {
+                    BasicBlock* Loop = loopBetween(Var, *LastBlock, Block);
+                    if (!Loop)
+                    {
+                        V = lookupDef(Var, Last);
+                        break;
+                    }
+                    if (Loop != BB)
+                    {
+                        Chain.push_back(BB);
+                        BB = Loop;
+                        continue;
+                    }
+                }
+                if (!Block.Sealed)
+                {
+                    PHINode* Phi = createPhi(BB);
+                    Block.Incomplete.push_back({ Var, Phi });
+                    V = Phi;
+                    break;
+                }
+                if (Block.Preds.size() == 1)
+                {
+                    Chain.push_back(BB);
+                    BB = Block.Preds[0];
+                    continue;
+                }
+                // Sema makes sure every variable is written before it is read
+                if (Block.Preds.empty())
+                {
+                    V = UndefValue::get(Int32Ty);
+                    break;
+                }
+                // written before its operands are read, which can lead back here
+                PHINode* Phi = createPhi(BB);
+                Reads.push_back({ BB, Phi, 0 });
+                V = Phi;
+                Pushed = true;
+                break;
             }
-            else if (Node.getKind() == Statement::StateMentType::If)
+
+            Defs[{ BB, Var }] = V;
+            for (BasicBlock* Link : Chain)
+                Defs[{ Link, Var }] = V;
+            return Pushed ? nullptr : V;
+        }
+
+        /*
+            adds the operands of the phis on Reads, innermost first, with an
+            explicit stack since a read can go back through as many blocks
+            as the program has. V is the value of the last read started.
+            returns the value of the outermost phi
+        */
+        Value* completePhis(uint32_t Var, llvm::SmallVectorImpl<PhiRead>& Reads, Value* V)
+        {
+            while (!Reads.empty())
             {
-                IfStatement* declaration = (IfStatement*)&Node;
-                declaration->accept(*this);
+                PhiRead& Read = Reads.back();
+                SSABlock& Block = SSABlocks.find(Read.BB)->second;
+                if (V)
+                {
+                    Read.Phi->addIncoming(V, Block.Preds[Read.NextPred - 1]);
+                    V = nullptr;
+                }
+                if (Read.NextPred < Block.Preds.size())
+                {
+                    BasicBlock* Pred = Block.Preds[Read.NextPred++];
+                    V = startRead(Var, Pred, Reads);
+                    continue;
+                }
+                V = removeTrivialPhi(Read.Phi);
+                Reads.pop_back();
             }
-            else if (Node.getKind() == Statement::StateMentType::Elif)
+            return V;
+        }
+
+        /*
+            a phi whose operands are all the same value or itself is replaced
+            by that value, which can make the phis that use it trivial too.
+            returns what Phi stands for
+        */
+        Value* removeTrivialPhi(PHINode* Phi)
+        {
+            llvm::SmallVector<PHINode*, 8> Work = { Phi };
+            while (!Work.empty())
             {
-                ElifStatement* declaration = (ElifStatement*)&Node;
-                declaration->accept(*this);
+                PHINode* P = Work.pop_back_val();
+                if (!P->getParent())
+                    continue;
+                Value* Same = nullptr;
+                bool Trivial = true;
+                for (Value* Op : P->incoming_values())
+                {
+                    if (Op == Same || Op == P)
+                        continue;
+                    if (Same)
+                    {
+                        Trivial = false;
+                        break;
+                    }
+                    Same = Op;
+                }
+                if (!Trivial)
+                    continue;
+                if (!Same)
+                    Same = UndefValue::get(Int32Ty);
+
+                for (User* U : P->users())
+                {
+                    if (PHINode* UserPhi = dyn_cast<PHINode>(U); UserPhi && UserPhi != P)
+                        Work.push_back(UserPhi);
+                }
+                P->replaceAllUsesWith(Same);
+                P->dropAllReferences();
+                P->removeFromParent();
+                Removed.push_back(P);
+                Replaced[P] = Same;
             }
-            else if (Node.getKind() == Statement::StateMentType::Else)
+
+            Value* V = Phi;
+            while (Value* R = Replaced.lookup(V))
+                V = R;
+            return V;
+        }
+
+        Value* readVariable(uint32_t Var, BasicBlock* BB)
+        {
+            if (Value* V = lookupDef(Var, BB))
+                return V;
+            llvm::SmallVector<PhiRead, 8> Reads;
+            Value* V = startRead(Var, BB, Reads);
+            return completePhis(Var, Reads, V);
+        }
+
+        // the variable was written or read in BB
+        void access(uint32_t Var, BasicBlock* BB)
+        {
+            if (Var >= LastAccess.size())
+                LastAccess.resize(std::max<size_t>(Var + 1, LastAccess.size() * 2));
+            if (!Constructs.empty())
             {
-                ElseStatement* declaration = (ElseStatement*)&Node;
-                declaration->accept(*this);
+                Construct& C = Constructs.back();
+                auto [It, First] = C.Branches.try_emplace(Var, C.Branch);
+                if (First)
+                    C.Before.push_back({ Var, LastAccess[Var] });
+                if (First || It->second != C.Branch)
+                {
+                    It->second = C.Branch;
+                    C.Accessed.push_back(Var);
+                }
             }
-            else if (Node.getKind() == Statement::StateMentType::Loop)
+            LastAccess[Var] = BB;
+        }
+
+        void beginConstruct()
+        {
+            if (DirectSSA)
+                Constructs.emplace_back();
+        }
+
+        // the current block ends a branch of the innermost if or loop
+        void endBranch()
+        {
+            if (!DirectSSA)
+                return;
+            Construct& C = Constructs.back();
+            for (uint32_t Var : C.Accessed)
+                readVariable(Var, Builder.GetInsertBlock());
+            C.Accessed.clear();
+            ++C.Branch;
+            for (auto& [Var, Last] : C.Before)
+                LastAccess[Var] = Last;
+        }
+
+        // the variables accessed by the innermost if or loop get their values in BB, which is sealed
+        void endConstruct(BasicBlock* BB)
+        {
+            if (!DirectSSA)
+                return;
+            std::vector<std::pair<uint32_t, BasicBlock*>> Before = std::move(Constructs.back().Before);
+            Constructs.pop_back();
+            const SSABlock& Block = SSABlocks.find(BB)->second;
+            llvm::SmallVector<Value*, 4> Incoming;
+            for (auto& [Var, Last] : Before)
             {
-                LoopStatement* declaration = (LoopStatement*)&Node;
-                declaration->accept(*this);
+                if (!lookupDef(Var, BB))
+                {
+                    Incoming.clear();
+                    for (BasicBlock* Pred : Block.Preds)
+                        Incoming.push_back(readVariable(Var, Pred));
+                    Value* V = Incoming[0];
+                    if (std::any_of(Incoming.begin(), Incoming.end(), [&](Value* Op) { return Op != V; }))
+                    {
+                        PHINode* Phi = createPhi(BB);
+                        for (size_t I = 0; I < Incoming.size(); ++I)
+                            Phi->addIncoming(Incoming[I], Block.Preds[I]);
+                        V = Phi;
+                    }
+                    Defs[{ BB, Var }] = V;
+                }
+                access(Var, BB);
             }
-            
         }
 
-        virtual void visit(Expression& Node) override
+        // a division by a divisor that is not known to be safe continues in a new block
+        void guardDivision(Value* L, Value* R, BinaryOp* Node)
         {
-            if (Node.getKind() == Expression::ExpressionType::Identifier)
+            BasicBlock* BB = Builder.GetInsertBlock();
+            emitDivisionGuard(Builder, L, R, ::Error::getLine(Node->getLocation()));
+            if (Builder.GetInsertBlock() != BB)
             {
-                V = Builder.CreateLoad(Int32Ty, nameMap[Node.getValue()]);
+                addEdge(BB, Builder.GetInsertBlock());
+                seal(Builder.GetInsertBlock());
+                enter(Builder.GetInsertBlock());
             }
-            else if (Node.getKind() == Expression::ExpressionType::Number)
+        }
+
+        void store(Value* V, uint32_t Var)
+        {
+            if (DirectSSA)
             {
-               
-                int intval = Node.getNumber();
-                V = ConstantInt::get(Int32Ty, intval, true);
+                Defs[{ Builder.GetInsertBlock(), Var }] = V;
+                access(Var, Builder.GetInsertBlock());
+                return;
             }
-            else if (Node.getKind() == Expression::ExpressionType::BooleanOpType) {
-                BooleanOp* temp = Node.getBooleanOp();
-                if (temp->getOperator() == BooleanOp::Operator::And)
-                {
-                    (temp->getLeft())->accept(*this);
-                    Value* Left = V;
+            Builder.CreateStore(V, nameMap[Var]);
+            if (ReuseValues)
+                Loaded.erase(Var);
+        }
 
-                    (temp->getRight())->accept(*this);
-                    Value* Right = V;
+        Value* load(uint32_t Var)
+        {
+            if (DirectSSA)
+            {
+                Value* V = readVariable(Var, Builder.GetInsertBlock());
+                access(Var, Builder.GetInsertBlock());
+                return V;
+            }
+            if (!ReuseValues)
+                return Builder.CreateLoad(Int32Ty, nameMap[Var]);
+            Value*& V = Loaded[Var];
+            if (!V)
+                V = Builder.CreateLoad(Int32Ty, nameMap[Var]);
+            return V;
+        }
 
-                    V = Builder.CreateAnd(Left, Right);
-                }
-                else if (temp->getOperator() == BooleanOp::Operator::Or)
-                {
-                    (temp->getLeft())->accept(*this);
-                    Value* Left = V;
+    public:
+        // Constructor for the visitor class.
+        ToIRVisitor(Module* M, bool ReuseValues, bool GuardDivisions, bool DirectSSA) :
+            M(M), Builder(M->getContext()), ReuseValues(ReuseValues), GuardDivisions(GuardDivisions), DirectSSA(DirectSSA)
+        {
+            // Initialize LLVM types and constants.
+            VoidTy = Type::getVoidTy(M->getContext());
+            Int32Ty = Type::getInt32Ty(M->getContext());
+            Int8PtrTy = Type::getInt8PtrTy(M->getContext());
+            Int8PtrPtrTy = Int8PtrTy->getPointerTo();
+            Int32Zero = ConstantInt::get(Int32Ty, 0, true);
+        }
 
-                    (temp->getRight())->accept(*this);
-                    Value* Right = V;
+        // Starts the main function, statements are generated into it in order.
+        void begin()
+        {
+            // Create the main function with the appropriate function type.
+            MainFty = FunctionType::get(Int32Ty, { Int32Ty, Int8PtrPtrTy }, false);
+            MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
 
-                    V = Builder.CreateOr(Left, Right);
-                }
+            // Create a basic block for the entry point of the main function.
+            BasicBlock* BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
+            seal(BB);
+            openRegion();
+            setInsertPoint(BB);
+        }
+
+        // Create a return instruction at the end of the main function.
+        void finish()
+        {
+            // like the MIR, SSA values only get memory to leave the final values of the variables in
+            if (DirectSSA)
+            {
+                IRBuilder<> Entry(&MainFn->getEntryBlock(), MainFn->getEntryBlock().begin());
+                for (uint32_t Var : Declared)
+                    Builder.CreateStore(load(Var), Entry.CreateAlloca(Int32Ty));
+                for (PHINode* Phi : Removed)
+                    Phi->deleteValue();
+                Removed.clear();
             }
+            Builder.CreateRet(Int32Zero);
         }
 
+        Function* getMain() { return MainFn; }
 
-        virtual void visit(BooleanOp& Node) override
+        // generates a top level statement into main
+        void add(Statement* S)
         {
-            // Visit the left-hand side of the binary operation and get its value.
-            Node.getLeft()->accept(*this);
-            Value* Left = V;
+            if (DirectSSA)
+            {
+                LoopWrites.clear();
+                LoopWritesCollector(LoopWrites).walk(S);
+            }
+            walk(S);
+        }
 
-            // Visit the right-hand side of the binary operation and get its value.
-            Node.getRight()->accept(*this);
-            Value* Right = V;
+        /*
+            generates Statements as the body of Fn, whose arguments point to
+            the variables Vars, then goes back to where main was left
+        */
+        void emitFragment(Function* Fn, ArrayRef<Statement*> Statements, ArrayRef<uint32_t> Vars)
+        {
+            BasicBlock* MainBB = Builder.GetInsertBlock();
+            Function* Main = MainFn;
+            nameMap.swap(FragmentMap);
+            for (size_t I = 0; I < Vars.size(); ++I)
+                variable(Vars[I]) = Fn->getArg(I);
+
+            MainFn = Fn;
+            setInsertPoint(BasicBlock::Create(M->getContext(), "entry", Fn));
+            for (Statement* S : Statements)
+                walk(S);
+            Builder.CreateRetVoid();
+
+            for (uint32_t Var : Vars)
+                nameMap[Var] = nullptr;
+            nameMap.swap(FragmentMap);
+            MainFn = Main;
+            setInsertPoint(MainBB);
+        }
+
+        // calls Fn from main, a variable gets its memory at the first call that uses it
+        void callFragment(Function* Fn, ArrayRef<uint32_t> Vars)
+        {
+            llvm::SmallVector<Value*, 8> Args;
+            for (uint32_t Var : Vars)
+            {
+                Value*& Memory = variable(Var);
+                if (!Memory)
+                    Memory = Builder.CreateAlloca(Int32Ty);
+                Args.push_back(Memory);
+            }
+            Builder.CreateCall(Fn, Args);
+        }
+
+    private:
+        bool visitIdentifier(Expression* Node, unsigned Step)
+        {
+            Values.push_back(load(Node->getSymbol()));
+            return false;
+        }
+
+        bool visitNumber(Expression* Node, unsigned Step)
+        {
+            Values.push_back(ConstantInt::get(Int32Ty, Node->getNumber(), true));
+            return false;
+        }
+
+        bool visitBoolean(Expression* Node, unsigned Step)
+        {
+            Values.push_back(Node->getBoolean() ? Builder.getTrue() : Builder.getFalse());
+            return false;
+        }
+
+        bool visitBooleanOp(BooleanOp* Node, unsigned Step)
+        {
+            // Walk both sides of the boolean operation first.
+            if (Step == 0)
+            {
+                push(Node->getLeft());
+                push(Node->getRight());
+                return true;
+            }
+            Value* Right = pop();
+            Value* Left = pop();
+
+            std::tuple<unsigned, Value*, Value*> Key(0x100 | Node->getOperator(), Left, Right);
+            if (ReuseValues)
+            {
+                if (Value* V = Computed.lookup(Key))
+                {
+                    Values.push_back(V);
+                    return false;
+                }
+            }
 
             // Perform the boolean operation based on the operator type and create the corresponding instruction.
-            switch (Node.getOperator())
+            Value* V = nullptr;
+            switch (Node->getOperator())
             {
             case BooleanOp::Equal:
                 V = Builder.CreateICmpEQ(Left, Right);
@@ -175,21 +786,37 @@ namespace
                 V = Builder.CreateOr(Left, Right);
                 break;
             }
+            if (ReuseValues)
+                Computed[Key] = V;
+            Values.push_back(V);
+            return false;
         }
 
-
-        virtual void visit(BinaryOp& Node) override
+        bool visitBinaryOp(BinaryOp* Node, unsigned Step)
         {
-            // Visit the left-hand side of the binary operation and get its value.
-            Node.getLeft()->accept(*this);
-            Value* Left = V;
+            // Walk both sides of the binary operation first.
+            if (Step == 0)
+            {
+                push(Node->getLeft());
+                push(Node->getRight());
+                return true;
+            }
+            Value* Right = pop();
+            Value* Left = pop();
 
-            // Visit the right-hand side of the binary operation and get its value.
-            Node.getRight()->accept(*this);
-            Value* Right = V;
+            std::tuple<unsigned, Value*, Value*> Key(Node->getOperator(), Left, Right);
+            if (ReuseValues)
+            {
+                if (Value* V = Computed.lookup(Key))
+                {
+                    Values.push_back(V);
+                    return false;
+                }
+            }
 
             // Perform the binary operation based on the operator type and create the corresponding instruction.
-            switch (Node.getOperator())
+            Value* V = Right;
+            switch (Node->getOperator())
             {
             case BinaryOp::Plus:
                 V = Builder.CreateNSWAdd(Left, Right);
@@ -201,13 +828,15 @@ namespace
                 V = Builder.CreateNSWMul(Left, Right);
                 break;
             case BinaryOp::Div:
+                if (GuardDivisions)
+                    guardDivision(Left, Right, Node);
                 V = Builder.CreateSDiv(Left, Right);
                 break;
             case BinaryOp::Pow:
-                if ((Node.getRight())->isNumber())
+                if ((Node->getRight())->isNumber())
                 {
-                    int power = (Node.getRight())->getNumber();
-                    Value* result = Left;
+                    int power = (Node->getRight())->getNumber();
+                    Value* result = power == 0 ? ConstantInt::get(Int32Ty, 1, true) : Left;
                     for (int i=1; i<power; i++)
                     {
                         result = Builder.CreateNSWMul(result, Left);
@@ -216,207 +845,553 @@ namespace
                 }
                 break;
             case BinaryOp::Mod:
+                if (GuardDivisions)
+                    guardDivision(Left, Right, Node);
                 Value* division = Builder.CreateSDiv(Left, Right);
                 Value* multiplication = Builder.CreateNSWMul(division, Right);
                 V = Builder.CreateNSWSub(Left, multiplication);
             }
+            if (ReuseValues)
+                Computed[Key] = V;
+            Values.push_back(V);
+            return false;
         }
 
-        virtual void visit(DecStatement& Node) override
+        bool visitDeclaration(DecStatement* Node, unsigned Step)
         {
-            Value* val = nullptr;
-
-            if (Node.getRValue()->getKind() == Expression::ExpressionType::BinaryOpType || Node.getRValue()->isNumber())
+            // Walk the initial value and get its value, variables without one are given 0 by the parser.
+            if (Step == 0)
             {
-                // If there is an expression provided, visit it and get its value.
-                Node.getRValue()->accept(*this);
-                val = V;
+                push(Node->getRValue());
+                return true;
             }
+            Value* val = pop();
 
-            // Iterate over the variables declared in the declaration statement.
-
-            auto I = Node.getLValue()->getValue();
-            StringRef Var = I;
-
-            // Create an alloca instruction to allocate memory for the variable.
-            nameMap[Var] = Builder.CreateAlloca(Int32Ty);
-
-            // Store the initial value (if any) in the variable's memory location.
-            if (val != nullptr)
-            {
-                Builder.CreateStore(val, nameMap[Var]);
-            }
+            // Create an alloca instruction to allocate memory for the variable,
+            // a fragment is passed the memory of the variables it declares.
+            uint32_t Var = Node->getLValue()->getSymbol();
+            if (DirectSSA)
+                Declared.push_back(Var);
             else
             {
-                Value* Zero = ConstantInt::get(Type::getInt32Ty(M->getContext()), 0);
-                Builder.CreateStore(Zero, nameMap[Var]);
+                Value*& Memory = variable(Var);
+                if (!Memory)
+                    Memory = Builder.CreateAlloca(Int32Ty);
             }
-            
+
+            // Store the initial value in the variable's memory location.
+            store(val, Var);
+            return false;
         }
 
-        virtual void visit(AssignStatement& Node) override
+        bool visitAssignment(AssignStatement* Node, unsigned Step)
         {
-            // Visit the right-hand side of the assignment and get its value.
-            Node.getRValue()->accept(*this);
-            Value* val = V;
+            // Walk the right-hand side of the assignment and get its value.
+            if (Step == 0)
+            {
+                push(Node->getRValue());
+                return true;
+            }
+            Value* val = pop();
 
-            // Get the name of the variable being assigned.
-            auto varName = Node.getLValue()->getValue();
+            // Get the symbol of the variable being assigned.
+            uint32_t Var = Node->getLValue()->getSymbol();
 
             // Create a store instruction to assign the value to the variable.
-            Builder.CreateStore(val, nameMap[varName]);
-
+            store(val, Var);
+            return false;
         }
 
-        virtual void visit(IfStatement& Node) override
+        /*
+            an if statement is generated in three steps: its condition, then
+            its body followed by its elif and else statements, which find the
+            blocks to chain to on the Ifs stack, and at last the branch out
+            of the condition block
+        */
+        bool visitIf(IfStatement* Node, unsigned Step)
         {
-            llvm::BasicBlock* IfCondBB = llvm::BasicBlock::Create(M->getContext(), "if.cond", MainFn);
-
-            llvm::BasicBlock* IfBodyBB = llvm::BasicBlock::Create(M->getContext(), "if.body", MainFn);
+            if (Step == 0)
+            {
+                llvm::BasicBlock* IfCondBB = llvm::BasicBlock::Create(M->getContext(), "if.cond", MainFn);
 
-            llvm::BasicBlock* AfterIfBB = llvm::BasicBlock::Create(M->getContext(), "after.if", MainFn);
+                llvm::BasicBlock* IfBodyBB = llvm::BasicBlock::Create(M->getContext(), "if.body", MainFn);
 
-            Builder.CreateBr(IfCondBB);
-            Builder.SetInsertPoint(IfCondBB);
+                llvm::BasicBlock* AfterIfBB = llvm::BasicBlock::Create(M->getContext(), "after.if", MainFn);
 
-            Node.getCondition()->accept(*this);
-            Value* Cond = V;
+                branch(IfCondBB);
+                seal(IfCondBB);
+                setInsertPoint(IfCondBB);
 
-            Builder.SetInsertPoint(IfBodyBB);
+                Ifs.push_back({ IfBodyBB, AfterIfBB, IfCondBB, IfBodyBB, nullptr, nullptr, OpenRegions.size() });
+                push(Node->getCondition());
+                return true;
+            }
 
-            llvm::SmallVector<Statement*> stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
+            IfState& State = Ifs.back();
+            if (Step == 1)
             {
-                (*I)->accept(*this);
+                State.BeforeCondVal = pop();
+                // a guarded division in the condition ends it in a later block
+                State.BeforeCondBB = Builder.GetInsertBlock();
+
+                // the branch into the body comes with the next condition
+                addEdge(State.BeforeCondBB, State.IfBodyBB);
+                seal(State.IfBodyBB);
+                openRegion();
+                beginConstruct();
+                setInsertPoint(State.IfBodyBB);
+                push(Node->getStatements());
+                for (ElifStatement* Elif : Node->getElifsStatements())
+                    push(Elif);
+                if (Node->hasElse())
+                    push(Node->getElseStatement());
+                return true;
             }
 
-            Builder.CreateBr(AfterIfBB);
-
-            llvm::BasicBlock* BeforeCondBB = IfCondBB;
+            // close the last branch
+            endBranch();
+            branch(State.AfterIfBB);
+            closeRegions(State.Regions);
+
+            // the last condition, of the if itself or of its last elif,
+            // falls through to the else body or past the statement
+            setInsertPoint(State.BeforeCondBB);
+            Builder.CreateCondBr(State.BeforeCondVal, State.BeforeBodyBB, Node->hasElse() ? State.ElseBB : State.AfterIfBB);
+            if (!Node->hasElse())
+                addEdge(State.BeforeCondBB, State.AfterIfBB);
+
+            seal(State.AfterIfBB);
+            endConstruct(State.AfterIfBB);
+            setInsertPoint(State.AfterIfBB);
+            Ifs.pop_back();
+            return false;
+        }
 
-            llvm::BasicBlock* BeforeBodyBB = IfBodyBB;
+        bool visitElif(ElifStatement* Node, unsigned Step)
+        {
+            IfState& State = Ifs.back();
+            if (Step == 0)
+            {
+                // close the branch before this one
+                endBranch();
+                branch(State.AfterIfBB);
+                closeRegions(OpenRegions.size() - 1);
 
-            llvm::Value* BeforeCondVal = Cond;
+                llvm::BasicBlock* ElifCondBB = llvm::BasicBlock::Create(MainFn->getContext(), "elif.cond", MainFn);
 
-            if(Node.hasElif())
-            {
-                for (auto& Elif : Node.getElifsStatements()) {
-                    llvm::BasicBlock* ElifCondBB = llvm::BasicBlock::Create(MainFn->getContext(), "elif.cond", MainFn);
+                llvm::BasicBlock* ElifBodyBB = llvm::BasicBlock::Create(MainFn->getContext(), "elif.body", MainFn);
 
-                    llvm::BasicBlock* ElifBodyBB = llvm::BasicBlock::Create(MainFn->getContext(), "elif.body", MainFn);
+                setInsertPoint(State.BeforeCondBB);
 
-                    Builder.SetInsertPoint(BeforeCondBB);
+                Builder.CreateCondBr(State.BeforeCondVal, State.BeforeBodyBB, ElifCondBB);
+                addEdge(State.BeforeCondBB, ElifCondBB);
+                seal(ElifCondBB);
+                openRegion();
 
-                    Builder.CreateCondBr(BeforeCondVal, BeforeBodyBB, ElifCondBB);
+                setInsertPoint(ElifCondBB);
+                State.BeforeCondBB = ElifCondBB;
+                State.BeforeBodyBB = ElifBodyBB;
+                push(Node->getCondition());
+                return true;
+            }
 
-                    Builder.SetInsertPoint(ElifCondBB);
-                    Elif->getCondition()->accept(*this);
-                    llvm::Value* ElifCondVal = V;
+            State.BeforeCondVal = pop();
+            State.BeforeCondBB = Builder.GetInsertBlock();
+            addEdge(State.BeforeCondBB, State.BeforeBodyBB);
+            seal(State.BeforeBodyBB);
+            openRegion();
+            setInsertPoint(State.BeforeBodyBB);
+            push(Node->getStatements());
+            return false;
+        }
 
-                    Builder.SetInsertPoint(ElifBodyBB);
-                    Elif->accept(*this);
-                    Builder.CreateBr(AfterIfBB);
+        bool visitElse(ElseStatement* Node, unsigned Step)
+        {
+            IfState& State = Ifs.back();
+
+            // close the branch before this one
+            endBranch();
+            branch(State.AfterIfBB);
+            closeRegions(OpenRegions.size() - 1);
+
+            // the last condition branches here once the if is done
+            State.ElseBB = llvm::BasicBlock::Create(MainFn->getContext(), "else.body", MainFn);
+            addEdge(State.BeforeCondBB, State.ElseBB);
+            seal(State.ElseBB);
+            openRegion();
+            setInsertPoint(State.ElseBB);
+            push(Node->getStatements());
+            return false;
+        }
 
-                    BeforeCondBB = ElifCondBB;
-                    BeforeCondVal = ElifCondVal;
-                    BeforeBodyBB = ElifBodyBB;
+        bool visitLoop(LoopStatement* Node, unsigned Step)
+        {
+            if (Step == 0)
+            {
+                LoopState State;
+                State.WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "loop.cond", MainFn);
+                // The basic block for the while body.
+                State.WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "loop.body", MainFn);
+                // The basic block after the while statement.
+                State.AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.loop", MainFn);
+                Loops.push_back(State);
+
+                // Branch to the condition block, it is sealed once the body branches back.
+                branch(State.WhileCondBB);
+                beginConstruct();
+
+                // Set the insertion point to the condition block.
+                setInsertPoint(State.WhileCondBB);
+                if (DirectSSA)
+                {
+                    unsigned Entered = SSABlocks[State.WhileCondBB].Entered;
+                    for (uint32_t Var : LoopWrites.find(Node)->second)
+                        OpenLoops[Var].push_back({ Entered, State.WhileCondBB });
                 }
+
+                // Walk the condition expression.
+                push(Node->getCondition());
+                return true;
             }
 
-            llvm::BasicBlock* ElseBB = nullptr;
-            if (Node.hasElse()) 
+            LoopState& State = Loops.back();
+            if (Step == 1)
             {
-                ElseStatement* elseS = Node.getElseStatement();
-                ElseBB = llvm::BasicBlock::Create(MainFn->getContext(), "else.body", MainFn);
-                Builder.SetInsertPoint(ElseBB);
-                Node.getElseStatement()->accept(*this);
-                Builder.CreateBr(AfterIfBB);
+                // Create the conditional branch.
+                Value* Cond = pop();
+                Builder.CreateCondBr(Cond, State.WhileBodyBB, State.AfterWhileBB);
+                addEdge(Builder.GetInsertBlock(), State.WhileBodyBB);
+                addEdge(Builder.GetInsertBlock(), State.AfterWhileBB);
+                seal(State.WhileBodyBB);
+                seal(State.AfterWhileBB);
+                openRegion();
+
+                // Set the insertion point to the body block.
+                setInsertPoint(State.WhileBodyBB);
+                push(Node->getStatements());
+                return true;
+            }
 
-                Builder.SetInsertPoint(BeforeCondBB);
-                Builder.CreateCondBr(Cond, IfBodyBB, ElseBB);
+            // Branch back to the condition block.
+            endBranch();
+            branch(State.WhileCondBB);
+            closeRegions(OpenRegions.size() - 1);
+            if (DirectSSA)
+            {
+                for (uint32_t Var : LoopWrites.find(Node)->second)
+                    OpenLoops[Var].pop_back();
+            }
+            seal(State.WhileCondBB);
+            endConstruct(State.WhileCondBB);
 
-            } else {
+            // Set the insertion point to the block after the while loop.
+            setInsertPoint(State.AfterWhileBB);
+            Loops.pop_back();
+            return false;
+        }
+    };
 
-                Builder.SetInsertPoint(BeforeCondBB);
-                Builder.CreateCondBr(Cond, IfBodyBB, AfterIfBB);
+    /*
+        generates main from the MIR of a program. values are registers and
+        phis, only the variables the program ends with get memory, and
+        their values are stored to it before main returns
+    */
+    class MIRLowering
+    {
+        Module* M;
+        MIR& F;
+        IRBuilder<> Builder;
+        Type* Int32Ty;
+        std::vector<Value*> Values;         // indexed by value id
+        std::vector<BasicBlock*> Blocks;    // indexed by block id
+        std::vector<BasicBlock*> Tails;     // the block a block ends in, after its division guards
 
+        // by squaring, wrapping like the constant folder does
+        Value* lowerPow(Value* Base, int32_t Power)
+        {
+            Value* Result = nullptr;
+            for (;;)
+            {
+                if (Power & 1)
+                    Result = Result ? Builder.CreateMul(Result, Base) : Base;
+                Power >>= 1;
+                if (!Power)
+                    return Result;
+                Base = Builder.CreateMul(Base, Base);
             }
-
-            Builder.SetInsertPoint(AfterIfBB);
         }
 
-        virtual void visit(ElifStatement& Node) override
+        Value* lower(MIR::Inst& I)
         {
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
+            if (I.Op == MIR::Const)
+                return I.IsBool ? (I.Imm ? Builder.getTrue() : Builder.getFalse()) : ConstantInt::get(Int32Ty, I.Imm, true);
+            Value* L = Values[I.Ops[0]];
+            if (I.Op == MIR::Copy)
+                return L;
+            if (I.Op == MIR::Pow)
+                return lowerPow(L, I.Imm);
+
+            Value* R = Values[I.Ops[1]];
+            switch (I.Op)
             {
-                (*I)->accept(*this);
+            case MIR::Add:
+                return Builder.CreateNSWAdd(L, R);
+            case MIR::Sub:
+                return Builder.CreateNSWSub(L, R);
+            case MIR::Mul:
+                return Builder.CreateNSWMul(L, R);
+            case MIR::Div:
+                if (I.Flags & MIR::Guarded)
+                    emitDivisionGuard(Builder, L, R, I.Imm);
+                return Builder.CreateSDiv(L, R);
+            case MIR::Mod:
+                if (I.Flags & MIR::Guarded)
+                    emitDivisionGuard(Builder, L, R, I.Imm);
+                return Builder.CreateSRem(L, R);
+            case MIR::CmpEQ:
+                return Builder.CreateICmpEQ(L, R);
+            case MIR::CmpNE:
+                return Builder.CreateICmpNE(L, R);
+            case MIR::CmpLT:
+                return Builder.CreateICmpSLT(L, R);
+            case MIR::CmpLE:
+                return Builder.CreateICmpSLE(L, R);
+            case MIR::CmpGT:
+                return Builder.CreateICmpSGT(L, R);
+            case MIR::CmpGE:
+                return Builder.CreateICmpSGE(L, R);
+            case MIR::And:
+                return Builder.CreateAnd(L, R);
+            default:
+                return Builder.CreateOr(L, R);
             }
         }
 
-        virtual void visit(ElseStatement& Node) override
+    public:
+        MIRLowering(Module* M, MIR& F) : M(M), F(F), Builder(M->getContext())
+        {
+            Int32Ty = Type::getInt32Ty(M->getContext());
+        }
+
+        void lower()
         {
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
+            static const char* const BlockNames[] = { "entry", "if.body", "elif.cond", "elif.body", "else.body",
+                "after.if", "loop.cond", "loop.body", "after.loop" };
+
+            Type* Int8PtrPtrTy = Type::getInt8PtrTy(M->getContext())->getPointerTo();
+            FunctionType* MainFty = FunctionType::get(Int32Ty, { Int32Ty, Int8PtrPtrTy }, false);
+            Function* MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+
+            Blocks.resize(F.Blocks.size());
+            for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+                if (F.Blocks[B].Live)
+                    Blocks[B] = BasicBlock::Create(M->getContext(), BlockNames[F.Blocks[B].Kind], MainFn);
+            Tails = Blocks;
+
+            Builder.SetInsertPoint(Blocks[0]);
+            std::vector<AllocaInst*> Variables;
+            for (size_t I = 0; I < F.Exit.size(); ++I)
+                Variables.push_back(Builder.CreateAlloca(Int32Ty));
+
+            // phis may use values from further down, their operands are
+            // added once every value exists
+            Values.resize(F.Insts.size());
+            for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+            {
+                if (!F.Blocks[B].Live)
+                    continue;
+                Builder.SetInsertPoint(Blocks[B]);
+                for (MIR::ValueId P : F.Blocks[B].Phis)
+                    Values[P] = Builder.CreatePHI(Int32Ty, F.Blocks[B].Preds.size());
+            }
+
+            // a block is built in one piece, so its instructions come in
+            // order and after the values they use
+            for (MIR::ValueId V = 0; V < F.Insts.size(); ++V)
+            {
+                MIR::Inst& I = F.Insts[V];
+                if (I.Op == MIR::Dead || I.Op == MIR::Phi)
+                    continue;
+                Builder.SetInsertPoint(Tails[I.Block]);
+                Values[V] = lower(I);
+                Tails[I.Block] = Builder.GetInsertBlock();
+            }
+
+            for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
             {
-                (*I)->accept(*this);
+                MIR::Block& Blk = F.Blocks[B];
+                if (!Blk.Live)
+                    continue;
+                for (MIR::ValueId P : Blk.Phis)
+                {
+                    llvm::MutableArrayRef<MIR::ValueId> Operands = F.getOperands(P);
+                    for (size_t I = 0; I < Operands.size(); ++I)
+                        cast<PHINode>(Values[P])->addIncoming(Values[Operands[I]], Tails[Blk.Preds[I]]);
+                }
+                Builder.SetInsertPoint(Tails[B]);
+                switch (Blk.Term)
+                {
+                case MIR::Br:
+                    Builder.CreateBr(Blocks[Blk.Succ[0]]);
+                    break;
+                case MIR::CondBr:
+                    Builder.CreateCondBr(Values[Blk.Cond], Blocks[Blk.Succ[0]], Blocks[Blk.Succ[1]]);
+                    break;
+                case MIR::Ret:
+                    for (size_t I = 0; I < F.Exit.size(); ++I)
+                        Builder.CreateStore(Values[F.Exit[I].Value], Variables[I]);
+                    Builder.CreateRet(ConstantInt::get(Int32Ty, 0, true));
+                    break;
+                }
             }
         }
+    };
+}; // namespace
 
-        virtual void visit(LoopStatement& Node) override
-        {
+struct CodeGen::ModuleState
+{
+    LLVMContext Ctx;
+    std::unique_ptr<Module> M;
+    ToIRVisitor ToIR;
 
-            llvm::BasicBlock* WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "loop.cond", MainFn);
-            // The basic block for the while body.
-            llvm::BasicBlock* WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "loop.body", MainFn);
-            // The basic block after the while statement.
-            llvm::BasicBlock* AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.loop", MainFn);
+    // with MIR passes the statements are built into F and generated at the end
+    MIR F;
+    std::unique_ptr<MIRBuilder> ToMIR;
 
-            // Branch to the condition block.
-            Builder.CreateBr(WhileCondBB);
+    // fragments are generated and printed here one at a time, printing a
+    // function numbers the globals of its module first
+    std::unique_ptr<Module> Fragments;
 
-            // Set the insertion point to the condition block.
-            Builder.SetInsertPoint(WhileCondBB);
+    ModuleState(bool ReuseValues, bool GuardDivisions, bool DirectSSA) :
+        M(new Module("mas.expr", Ctx)), ToIR(M.get(), ReuseValues, GuardDivisions, DirectSSA) {}
+};
 
-            // Visit the condition expression and create the conditional branch.
-            Node.getCondition()->accept(*this);
-            Value* Cond = V;
-            Builder.CreateCondBr(Cond, WhileBodyBB, AfterWhileBB);
+CodeGen::CodeGen(bool ReuseValues, const MIRPassManager* MIRPasses, bool GuardDivisions, const IRPipeline* Optimizer, bool DirectSSA) :
+    ReuseValues(ReuseValues), MIRPasses(MIRPasses), GuardDivisions(GuardDivisions), Optimizer(Optimizer), DirectSSA(DirectSSA) {}
 
-            // Set the insertion point to the body block.
-            Builder.SetInsertPoint(WhileBodyBB);
+// runs Optimizer on M if there is one, then prints M to the standard output
+static void emit(Module& M, const IRPipeline* Optimizer)
+{
+    if (Optimizer)
+    {
+        PhaseTimer Timer("optimize", "Optimization");
+        Optimizer->run(M);
+    }
+    PhaseTimer Timer("print", "Printing");
+    M.print(outs(), nullptr);
+}
 
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
+CodeGen::~CodeGen() {}
 
-            // Branch back to the condition block.
-            Builder.CreateBr(WhileCondBB);
+void CodeGen::compile(::Base* Tree)
+{
+    begin();
+    {
+        PhaseTimer Timer("irgen", "IR generation");
+        for (Statement* S : Tree->getStatements())
+            add(S);
+    }
+    finish();
+}
 
-            // Set the insertion point to the block after the while loop.
-            Builder.SetInsertPoint(AfterWhileBB);
+void CodeGen::begin()
+{
+    // Create an LLVM context, a module and the visitor that generates IR into it.
+    Open.reset(new ModuleState(ReuseValues, GuardDivisions, DirectSSA && !MIRPasses));
+    if (MIRPasses)
+        Open->ToMIR.reset(new MIRBuilder(Open->F, ReuseValues, GuardDivisions));
+    else
+        Open->ToIR.begin();
+}
 
+void CodeGen::add(Statement* S)
+{
+    if (MIRPasses)
+        Open->ToMIR->add(S);
+    else
+        Open->ToIR.add(S);
+}
 
+void CodeGen::finish()
+{
+    {
+        PhaseTimer Timer("irgen", "IR generation");
+        if (MIRPasses)
+        {
+            Open->ToMIR->finish();
+            MIRPasses->run(Open->F);
+            MIRLowering(Open->M.get(), Open->F).lower();
         }
+        else
+            Open->ToIR.finish();
+    }
 
+    // Print the generated module to the standard output.
+    emit(*Open->M, Optimizer);
+    Open.reset();
+}
 
+// a fragment takes a pointer to each variable it names
+static FunctionType* getFragmentType(LLVMContext& Ctx, size_t Vars)
+{
+    llvm::SmallVector<Type*, 8> Params(Vars, Type::getInt32PtrTy(Ctx));
+    return FunctionType::get(Type::getVoidTy(Ctx), Params, false);
+}
 
-    };
-}; // namespace
-
-void CodeGen::compile(AST* Tree)
+void CodeGen::beginFragments()
 {
-    // Create an LLVM context and a module.
-    LLVMContext Ctx;
-    Module* M = new Module("mas.expr", Ctx);
+    Open.reset(new ModuleState(ReuseValues, false, false));
+    Open->Fragments.reset(new Module("mas.fragments", Open->Ctx));
+    Open->ToIR.begin();
+}
 
-    // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-    ToIRVisitor ToIRn(M);
+// main only gets the declaration of the fragment, when it calls it
+std::string CodeGen::addFragment(llvm::StringRef Name, llvm::ArrayRef<Statement*> Statements, llvm::ArrayRef<uint32_t> Vars)
+{
+    Function* Fn = Function::Create(getFragmentType(Open->Ctx, Vars.size()), GlobalValue::InternalLinkage, Name, Open->Fragments.get());
+    Open->ToIR.emitFragment(Fn, Statements, Vars);
+
+    std::string Text;
+    raw_string_ostream OS(Text);
+    Fn->print(OS);
+    Fn->eraseFromParent();
+    return OS.str();
+}
 
-    ToIRn.run(Tree);
+void CodeGen::callFragment(llvm::StringRef Name, llvm::ArrayRef<uint32_t> Vars)
+{
+    FunctionCallee Fn = Open->M->getOrInsertFunction(Name, getFragmentType(Open->Ctx, Vars.size()));
+    Open->ToIR.callFragment(cast<Function>(Fn.getCallee()), Vars);
+}
 
-    // Print the generated module to the standard output.
-    M->print(outs(), nullptr);
+/*
+    the module is printed by hand, with the fragments as they were printed
+    when generated. to be optimized it has to be parsed back first
+*/
+bool CodeGen::finishFragments(llvm::ArrayRef<llvm::StringRef> Texts)
+{
+    Open->ToIR.finish();
+
+    std::string Assembly;
+    raw_string_ostream Buffer(Assembly);
+    raw_ostream& OS = Optimizer ? static_cast<raw_ostream&>(Buffer) : outs();
+    OS << "; ModuleID = '" << Open->M->getModuleIdentifier() << "'\n"
+        << "source_filename = \"" << Open->M->getSourceFileName() << "\"\n\n";
+    Open->ToIR.getMain()->print(OS);
+    for (llvm::StringRef Text : Texts)
+        OS << "\n" << Text;
+
+    if (Optimizer)
+    {
+        SMDiagnostic Err;
+        std::unique_ptr<Module> Linked = parseAssemblyString(Buffer.str(), Err, Open->Ctx);
+        if (!Linked)
+        {
+            Open.reset();
+            return false;
+        }
+        emit(*Linked, Optimizer);
+    }
+    Open.reset();
+    return true;
 }
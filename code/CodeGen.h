@@ -2,11 +2,61 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <string>
+
+class IRPipeline;
+class MIRPassManager;
 
 class CodeGen
 {
+	bool ReuseValues;
+	const MIRPassManager* MIRPasses;
+	bool GuardDivisions;
+	const IRPipeline* Optimizer;
+	bool DirectSSA;
+
+	// the module being generated between begin and finish
+	struct ModuleState;
+	std::unique_ptr<ModuleState> Open;
+
 public:
-	void compile(AST* Tree);
+	// with ReuseValues, an expression whose operands are unchanged since it
+	// was last computed in the same block takes that value again. with
+	// MIRPasses the program goes through the MIR and these passes first.
+	// with GuardDivisions a division or remainder by 0, or of INT_MIN by
+	// -1, calls mas_div_trap in rtMAS.c instead of being undefined. with
+	// Optimizer the module goes through its LLVM passes before it is
+	// printed. with DirectSSA variables are SSA values rather than memory,
+	// which only holds their final values. MIRPasses do that already
+	explicit CodeGen(bool ReuseValues = false, const MIRPassManager* MIRPasses = nullptr, bool GuardDivisions = false,
+		const IRPipeline* Optimizer = nullptr, bool DirectSSA = false);
+	~CodeGen();
+
+	void compile(Base* Tree);
+
+	// compile one top level statement at a time: begin, then add for each
+	// statement in program order, then finish, which prints the module.
+	// add does not keep S, it can be freed as soon as add returns
+	void begin();
+	void add(Statement* S);
+	void finish();
 
+	// code for the statement cache, see StatementCache.h. a fragment is a
+	// function Name that runs Statements on the variables Vars, passed as
+	// pointers, so its text does not depend on the rest of the program.
+	// beginFragments starts a main that only calls fragments, addFragment
+	// generates one and returns its text, callFragment calls one from
+	// main and finishFragments prints main followed by Texts, the text of
+	// each fragment main calls. ReuseValues and Optimizer apply,
+	// MIRPasses, GuardDivisions and DirectSSA do not. with Optimizer the
+	// module is parsed back first, if the texts do not parse nothing is
+	// printed and finishFragments returns false
+	void beginFragments();
+	std::string addFragment(llvm::StringRef Name, llvm::ArrayRef<Statement*> Statements, llvm::ArrayRef<uint32_t> Vars);
+	void callFragment(llvm::StringRef Name, llvm::ArrayRef<uint32_t> Vars);
+	bool finishFragments(llvm::ArrayRef<llvm::StringRef> Texts);
 };
-#endif
\ No newline at end of file
+#endif
@@ -1,67 +1,116 @@
 #include "Error.h"
+#include "llvm/Support/raw_ostream.h"
 
-void Error::SemiColonNotFound()
+LineTable Error::Lines;
+unsigned Error::NumErrors = 0;
+unsigned Error::ErrorLimit = 0;
+
+void Error::setSource(llvm::StringRef Source, unsigned Line, unsigned Column)
+{
+	Lines.setSource(Source, Line, Column);
+}
+
+void Error::setErrorLimit(unsigned Limit)
+{
+	ErrorLimit = Limit;
+}
+
+void Error::report()
+{
+	if (++NumErrors == ErrorLimit)
+	{
+		llvm::errs() << "Too many errors, stopping...\n";
+		exit(3);
+	}
+}
+
+std::string Error::getLocation(uint32_t Loc)
+{
+	if (!Lines.hasSource())
+		return "";
+	std::pair<unsigned, unsigned> Pos = Lines.getLineAndColumn(Loc);
+	return std::to_string(Pos.first) + ":" + std::to_string(Pos.second) + ": ";
+}
+
+unsigned Error::getLine(uint32_t Loc)
+{
+	return Lines.hasSource() ? Lines.getLineAndColumn(Loc).first : 0;
+}
+
+void Error::SemiColonNotFound(uint32_t Loc)
+{
+	llvm::errs() << getLocation(Loc) << "Semicolon not found...\n";
+	report();
+}
+
+void Error::DefineInsideScope(uint32_t Loc)
+{
+	llvm::errs() << getLocation(Loc) << "Can't define variable inside scope...\n";
+	report();
+}
+
+void Error::AssignmentEqualNotFound(uint32_t Loc)
 {
-	cout << "Semicolon not found...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Assignment does not have a '=' character...\n";
+	report();
 }
 
-void Error::DefineInsideScope()
+void Error::AssignmentSidesNotEqual(uint32_t Loc)
 {
-	cout << "Can't define variable inside scope...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Assignment sides are not equal in size...\n";
+	report();
 }
 
-void Error::AssignmentEqualNotFound()
+void Error::VariableNameNotFound(uint32_t Loc)
 {
-	cout << "Assignment does not have a '=' character...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Variable name not found...\n";
+	report();
 }
 
-void Error::AssignmentSidesNotEqual()
+void Error::BooleanValueExpected(uint32_t Loc)
 {
-	cout << "Assignment sides are not equal in size...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Boolean value expected...\n";
+	report();
 }
 
-void Error::VariableNameNotFound()
+void Error::RightParanthesisExpected(uint32_t Loc)
 {
-	cout << "Variable name not found...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Right paranthesis expected but not found...\n";
+	report();
 }
 
-void Error::BooleanValueExpected()
+void Error::NumberVariableExpected(uint32_t Loc)
 {
-	cout << "Boolean value expected...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Expected a number or a variable, but found none...\n";
+	report();
 }
 
-void Error::RightParanthesisExpected()
+void Error::BeginExpectedAfterColon(uint32_t Loc)
 {
-	cout << "Right paranthesis expected but not found...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Expected 'begin' after condition, but found none...\n";
+	report();
 }
 
-void Error::NumberVariableExpected()
+void Error::EndNotSeenForIf(uint32_t Loc)
 {
-	cout << "Expected a number or a variable, but found none...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Expected 'end' for if statement, but found none...\n";
+	report();
 }
 
-void Error::BeginExpectedAfterColon()
+void Error::ColonExpectedAfterCondition(uint32_t Loc)
 {
-	cout << "Expected 'begin' after condition, but found none...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Colon expected after condition, but found none...\n";
+	report();
 }
 
-void Error::EndNotSeenForIf()
+void Error::DivisionByZero(uint32_t Loc)
 {
-	cout << "Expected 'end' for if statement, but found none...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Division by zero is not allowed.\n";
+	report();
 }
 
-void Error::ColonExpectedAfterCondition()
+void Error::NumberOutOfRange(uint32_t Loc)
 {
-	cout << "Colon expected after condition, but found none...\n";
-	exit(3);
+	llvm::errs() << getLocation(Loc) << "Number is too large for an int...\n";
+	report();
 }
\ No newline at end of file
@@ -3,22 +3,47 @@
 
 #include <iostream>
 #include "Lexer.h"
+#include "LineTable.h"
 using namespace std;
 
 class Error {
+	static LineTable Lines;
+	static unsigned NumErrors;
+	static unsigned ErrorLimit;
 
 public:
-	static void SemiColonNotFound();
-	static void DefineInsideScope();
-	static void AssignmentEqualNotFound();
-	static void AssignmentSidesNotEqual();
-	static void VariableNameNotFound();
-	static void BooleanValueExpected();
-	static void RightParanthesisExpected();
-	static void NumberVariableExpected();
-	static void ColonExpectedAfterCondition();
-	static void EndNotSeenForIf();
-	static void BeginExpectedAfterColon();
+	// the buffer that diagnostic offsets refer to. a buffer that is the
+	// tail of a larger text gives the line and column it starts at there
+	static void setSource(llvm::StringRef Source, unsigned Line = 1, unsigned Column = 1);
+
+	// "line:column: " prefix for the source offset Loc, empty without a source
+	static std::string getLocation(uint32_t Loc);
+
+	// 1-based line of the source offset Loc, 0 without a source
+	static unsigned getLine(uint32_t Loc);
+
+	// the functions below print a diagnostic and return, so the caller can
+	// recover and go on. the compiler stops once Limit errors were reported,
+	// 0 means no limit
+	static void setErrorLimit(unsigned Limit);
+	static unsigned getNumErrors() { return NumErrors; }
+
+	// counts a diagnostic the caller has just printed
+	static void report();
+
+	static void SemiColonNotFound(uint32_t Loc);
+	static void DefineInsideScope(uint32_t Loc);
+	static void AssignmentEqualNotFound(uint32_t Loc);
+	static void AssignmentSidesNotEqual(uint32_t Loc);
+	static void VariableNameNotFound(uint32_t Loc);
+	static void BooleanValueExpected(uint32_t Loc);
+	static void RightParanthesisExpected(uint32_t Loc);
+	static void NumberVariableExpected(uint32_t Loc);
+	static void ColonExpectedAfterCondition(uint32_t Loc);
+	static void EndNotSeenForIf(uint32_t Loc);
+	static void BeginExpectedAfterColon(uint32_t Loc);
+	static void DivisionByZero(uint32_t Loc);
+	static void NumberOutOfRange(uint32_t Loc);
 };
 
 #endif
@@ -0,0 +1,303 @@
+#include "Eval.h"
+#include "ASTWalker.h"
+#include "Fold.h"
+#include <vector>
+
+/*
+	an interpreter on the AST walker. expressions leave their values on
+	Stack, booleans as 0 and 1. an if pushes its conditions one at a time
+	until one holds and then that body, a loop pushes its condition and
+	body for as long as the condition holds. once a budget is used up or
+	an operation can not be computed every hook returns at once, so the
+	rest of the worklist drains without running anything.
+*/
+class PartialEvaluator::Machine : public ASTWalker<Machine> {
+	friend class ASTWalker<Machine>;
+
+	uint64_t MaxSteps;
+	size_t MaxBytes;
+	uint64_t Steps;
+	bool Stopped;                           // the statement being run does not finish
+	bool Failed;                            // a statement did not finish, nothing runs any more
+
+	llvm::SmallVector<int32_t, 16> Stack;
+
+	// indexed by symbol id
+	std::vector<int32_t> Values;
+	std::vector<uint32_t> SavedIn;          // the run the value was last saved to Undo in
+	std::vector<llvm::StringRef> Names;
+	std::vector<uint32_t> Order;            // declared variables in the order they were declared
+
+	// the values the variables had before the statement being run
+	struct Saved {
+		uint32_t Symbol;
+		int32_t Value;
+	};
+	std::vector<Saved> Undo;
+	uint32_t Run;
+
+	template <typename T>
+	static size_t bytes(const std::vector<T>& V) { return V.capacity() * sizeof(T); }
+
+	void checkMemory()
+	{
+		if (bytes(Values) + bytes(SavedIn) + bytes(Names) + bytes(Order) + bytes(Undo) > MaxBytes)
+			Stopped = true;
+	}
+
+	// counts a step, false once the statement being run is not going to finish
+	bool step()
+	{
+		if (!Stopped && ++Steps > MaxSteps)
+			Stopped = true;
+		return !Stopped;
+	}
+
+	int32_t pop() { return Stack.pop_back_val(); }
+
+	void store(uint32_t Var, int32_t Value)
+	{
+		// only the first store of a run has to be undone
+		if (SavedIn[Var] != Run)
+		{
+			SavedIn[Var] = Run;
+			size_t Capacity = Undo.capacity();
+			Undo.push_back({ Var, Values[Var] });
+			if (Undo.capacity() != Capacity)
+				checkMemory();
+		}
+		Values[Var] = Value;
+	}
+
+	bool visitIdentifier(Expression* E, unsigned Step)
+	{
+		if (!step())
+			return false;
+		Stack.push_back(Values[E->getSymbol()]);
+		return false;
+	}
+
+	bool visitNumber(Expression* E, unsigned Step)
+	{
+		if (!step())
+			return false;
+		Stack.push_back(E->getNumber());
+		return false;
+	}
+
+	bool visitBoolean(Expression* E, unsigned Step)
+	{
+		if (!step())
+			return false;
+		Stack.push_back(E->getBoolean());
+		return false;
+	}
+
+	bool visitBinaryOp(BinaryOp* Op, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step == 0)
+		{
+			push(Op->getLeft());
+			push(Op->getRight());
+			return true;
+		}
+		int32_t R = pop();
+		int32_t L = pop();
+
+		// the generated code only raises to a literal power
+		int32_t Result;
+		if ((Op->getOperator() == BinaryOp::Pow && !Op->getRight()->isNumber()) ||
+			!ConstantFolder::evaluate(Op->getOperator(), L, R, Result))
+		{
+			Stopped = true;
+			return false;
+		}
+		Stack.push_back(Result);
+		return false;
+	}
+
+	bool visitBooleanOp(BooleanOp* Op, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step == 0)
+		{
+			push(Op->getLeft());
+			push(Op->getRight());
+			return true;
+		}
+		int32_t R = pop();
+		int32_t L = pop();
+
+		// and, or take both sides like the generated code
+		switch (Op->getOperator())
+		{
+		case BooleanOp::And:
+			Stack.push_back(L & R);
+			break;
+		case BooleanOp::Or:
+			Stack.push_back(L | R);
+			break;
+		default:
+			Stack.push_back(ConstantFolder::compare(Op->getOperator(), L, R));
+			break;
+		}
+		return false;
+	}
+
+	bool visitDeclaration(DecStatement* Dec, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step == 0)
+		{
+			push(Dec->getRValue());
+			return true;
+		}
+
+		// declarations are only allowed at the top level, so each runs once
+		uint32_t Var = Dec->getLValue()->getSymbol();
+		if (Var >= Values.size())
+		{
+			size_t Size = std::max<size_t>(Var + 1, Values.size() * 2);
+			Values.resize(Size);
+			SavedIn.resize(Size);
+			Names.resize(Size);
+			checkMemory();
+		}
+		Names[Var] = Dec->getLValue()->getValue();
+		Order.push_back(Var);
+		store(Var, pop());
+		return false;
+	}
+
+	bool visitAssignment(AssignStatement* Assign, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step == 0)
+		{
+			push(Assign->getRValue());
+			return true;
+		}
+		store(Assign->getLValue()->getSymbol(), pop());
+		return false;
+	}
+
+	/*
+		Step 0 pushes the condition of the if. at Step N the condition of
+		branch N - 1 is on the stack, the if itself is branch 0 and its
+		elifs follow. the first branch whose condition holds has its body
+		pushed, else the next condition is, and after the last one the
+		else body
+	*/
+	bool visitIf(IfStatement* If, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step == 0)
+		{
+			push(If->getCondition());
+			return true;
+		}
+
+		llvm::ArrayRef<ElifStatement*> Elifs = If->getElifsStatements();
+		size_t Branch = Step - 1;
+		if (pop())
+		{
+			push(Branch == 0 ? If->getStatements() : Elifs[Branch - 1]->getStatements());
+			return false;
+		}
+		if (Branch < Elifs.size())
+		{
+			push(Elifs[Branch]->getCondition());
+			return true;
+		}
+		if (If->hasElse())
+			push(If->getElseStatement()->getStatements());
+		return false;
+	}
+
+	// even steps push the condition, odd ones the body while it holds
+	bool visitLoop(LoopStatement* Loop, unsigned Step)
+	{
+		if (!step())
+			return false;
+		if (Step % 2 == 0)
+		{
+			push(Loop->getCondition());
+			return true;
+		}
+		if (!pop())
+			return false;
+		push(Loop->getStatements());
+		return true;
+	}
+
+public:
+	Machine(uint64_t MaxSteps, size_t MaxBytes) :
+		MaxSteps(MaxSteps), MaxBytes(MaxBytes), Steps(0), Stopped(false), Failed(false), Run(1) {}
+
+	bool run(Statement* S)
+	{
+		if (Failed)
+			return false;
+		size_t Declared = Order.size();
+		walk(S);
+
+		if (Stopped)
+		{
+			for (size_t I = Undo.size(); I-- > 0;)
+				Values[Undo[I].Symbol] = Undo[I].Value;
+			Order.resize(Declared);
+			Stack.clear();
+			Failed = true;
+		}
+		Undo.clear();
+		++Run;
+		return !Failed;
+	}
+
+	void getStores(ASTContext& Ctx, llvm::SmallVectorImpl<Statement*>& Out)
+	{
+		for (uint32_t Var : Order)
+			Out.push_back(Ctx.create<DecStatement>(Ctx.create<Expression>(Names[Var], Var), Ctx.create<Expression>((int)Values[Var])));
+	}
+
+	uint64_t getSteps() { return Steps; }
+};
+
+PartialEvaluator::PartialEvaluator(ASTContext& Ctx, uint64_t MaxSteps, size_t MaxBytes) :
+	M(new Machine(MaxSteps, MaxBytes)), Ctx(Ctx) {}
+
+PartialEvaluator::~PartialEvaluator() {}
+
+bool PartialEvaluator::run(Statement* S)
+{
+	return M->run(S);
+}
+
+void PartialEvaluator::getStores(llvm::SmallVectorImpl<Statement*>& Out)
+{
+	M->getStores(Ctx, Out);
+}
+
+Base* PartialEvaluator::evaluate(Base* Tree)
+{
+	llvm::ArrayRef<Statement*> Statements = Tree->getStatements();
+	size_t Done = 0;
+	while (Done < Statements.size() && run(Statements[Done]))
+		++Done;
+
+	llvm::SmallVector<Statement*, 0> Residual;
+	getStores(Residual);
+	Residual.append(Statements.begin() + Done, Statements.end());
+	return Ctx.create<Base>(Ctx.copy(llvm::makeArrayRef(Residual)));
+}
+
+uint64_t PartialEvaluator::getSteps()
+{
+	return M->getSteps();
+}
@@ -0,0 +1,45 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "AST.h"
+#include "llvm/ADT/SmallVector.h"
+#include <memory>
+
+/*
+	runs a checked program while it is compiled. a program has no input,
+	every variable starts from what its declaration computes, so once all
+	statements have run the values left in the variables are all the
+	program does, and a declaration of each with its value replaces it.
+
+	statements run one top level statement at a time within a budget of
+	evaluation steps and of memory for the variables. a statement that
+	does not finish within them, or that divides by zero or overflows a
+	division, has its stores undone and is generated as it is from there
+	on, after the values computed by the statements before it.
+*/
+class PartialEvaluator {
+	class Machine;
+	std::unique_ptr<Machine> M;
+	ASTContext& Ctx;
+
+public:
+	PartialEvaluator(ASTContext& Ctx, uint64_t MaxSteps, size_t MaxBytes);
+	~PartialEvaluator();
+
+	// runs S after the statements run before it, false once a statement
+	// did not finish. nothing is run after that
+	bool run(Statement* S);
+
+	// appends a declaration for every variable declared so far, giving
+	// it the value it has now. the declarations are allocated in Ctx
+	void getStores(llvm::SmallVectorImpl<Statement*>& Out);
+
+	// the declarations of the values Tree computes, followed by the
+	// statements of Tree that could not be run
+	Base* evaluate(Base* Tree);
+
+	// evaluation steps taken so far
+	uint64_t getSteps();
+};
+
+#endif
@@ -0,0 +1,417 @@
+#include "FlatAST.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/ErrorHandling.h"
+
+static_assert(sizeof(FlatAST::Node) == 16, "flat nodes are meant to stay 16 bytes");
+
+const FlatAST::NodeId FlatAST::Invalid;
+
+FlatAST::NodeId FlatAST::add(NodeKind Kind, uint32_t Loc, uint8_t Op)
+{
+	Node N;
+	N.Kind = Kind;
+	N.Op = Op;
+	N.Unused = 0;
+	N.Loc = Loc;
+	N.A = 0;
+	N.B = 0;
+	NodeStorage.push_back(N);
+	return NodeStorage.size() - 1;
+}
+
+/*
+	reserves a list of Count node ids, the caller fills it in once the
+	children have been added
+*/
+uint32_t FlatAST::addList(size_t Count)
+{
+	uint32_t Index = ListStorage.size();
+	ListStorage.push_back(Count);
+	ListStorage.resize(ListStorage.size() + Count, Invalid);
+	return Index;
+}
+
+namespace {
+	// a node still to be added, and where its id goes once it is
+	struct PendingNode {
+		enum SlotKind : uint8_t { ListEntry, OperandA, OperandB };
+
+		TopLevelEntity* Node;
+		bool IsExpression;
+		SlotKind Slot;
+		uint32_t Index;     // the list entry, or the node whose operand it is
+	};
+}
+
+/*
+	flattens the tree with an explicit stack rather than recursion, so
+	the nesting depth costs no native stack. children are pushed last
+	to first, so nodes come off the stack in source order
+*/
+FlatAST::FlatAST(Base* Tree)
+{
+	llvm::SmallVector<PendingNode, 64> Stack;
+
+	auto pushExpression = [&](Expression* E, PendingNode::SlotKind Slot, uint32_t Index) {
+		Stack.push_back({ E, true, Slot, Index });
+	};
+	auto pushBlock = [&](llvm::ArrayRef<Statement*> Statements, uint32_t List) {
+		for (size_t I = Statements.size(); I-- > 0;)
+			Stack.push_back({ Statements[I], false, PendingNode::ListEntry, List + 1 + (uint32_t)I });
+	};
+
+	NodeId Root = add(Program, 0);
+	uint32_t Body = addList(Tree->getStatements().size());
+	NodeStorage[Root].B = Body;
+	pushBlock(Tree->getStatements(), Body);
+
+	while (!Stack.empty())
+	{
+		PendingNode P = Stack.pop_back_val();
+		NodeId N;
+
+		if (P.IsExpression)
+		{
+			Expression* E = static_cast<Expression*>(P.Node);
+			switch (E->getKind())
+			{
+			case Expression::ExpressionType::Number:
+				N = add(Number, E->getLocation());
+				NodeStorage[N].A = (uint32_t)E->getNumber();
+				break;
+			case Expression::ExpressionType::Identifier:
+			{
+				N = add(Identifier, E->getLocation());
+				uint32_t Symbol = E->getSymbol();
+				if (Symbol >= Names.size())
+					Names.resize(Symbol + 1);
+				Names[Symbol] = E->getValue();
+				NodeStorage[N].A = Symbol;
+				break;
+			}
+			case Expression::ExpressionType::Boolean:
+				N = add(Boolean, E->getLocation());
+				NodeStorage[N].A = E->getBoolean();
+				break;
+			case Expression::ExpressionType::BinaryOpType:
+			{
+				::BinaryOp* Op = (::BinaryOp*)E;
+				N = add(BinaryOpType, E->getLocation(), Op->getOperator());
+				pushExpression(Op->getRight(), PendingNode::OperandB, N);
+				pushExpression(Op->getLeft(), PendingNode::OperandA, N);
+				break;
+			}
+			default:
+			{
+				// and/or are wrapped in a plain Expression that points at the operation
+				::BooleanOp* Op = E->getBooleanOp() ? E->getBooleanOp() : (::BooleanOp*)E;
+				N = add(BooleanOpType, Op->getLocation(), Op->getOperator());
+				pushExpression(Op->getRight(), PendingNode::OperandB, N);
+				pushExpression(Op->getLeft(), PendingNode::OperandA, N);
+				break;
+			}
+			}
+		}
+		else
+		{
+			Statement* S = static_cast<Statement*>(P.Node);
+			switch (S->getKind())
+			{
+			case Statement::StateMentType::Declaration:
+			case Statement::StateMentType::Assignment:
+			{
+				bool IsDeclaration = S->getKind() == Statement::StateMentType::Declaration;
+				Expression* LValue = IsDeclaration ? ((DecStatement*)S)->getLValue() : ((AssignStatement*)S)->getLValue();
+				Expression* RValue = IsDeclaration ? ((DecStatement*)S)->getRValue() : ((AssignStatement*)S)->getRValue();
+
+				N = add(IsDeclaration ? Declaration : Assignment, S->getLocation());
+				pushExpression(RValue, PendingNode::OperandB, N);
+				pushExpression(LValue, PendingNode::OperandA, N);
+				break;
+			}
+			case Statement::StateMentType::If:
+			{
+				IfStatement* I = (IfStatement*)S;
+				N = add(If, S->getLocation());
+
+				// body, elifs and else are reserved next to each other before any
+				// nested block adds its own lists, see getElifs
+				llvm::ArrayRef<Statement*> Statements = I->getStatements();
+				llvm::ArrayRef<ElifStatement*> Elifs = I->getElifsStatements();
+				uint32_t Body = addList(Statements.size());
+				uint32_t ElifList = addList(Elifs.size());
+				ListStorage.push_back(Invalid);
+				NodeStorage[N].B = Body;
+
+				if (I->hasElse())
+					Stack.push_back({ I->getElseStatement(), false, PendingNode::ListEntry, ElifList + 1 + (uint32_t)Elifs.size() });
+				for (size_t E = Elifs.size(); E-- > 0;)
+					Stack.push_back({ Elifs[E], false, PendingNode::ListEntry, ElifList + 1 + (uint32_t)E });
+				pushBlock(Statements, Body);
+				pushExpression(I->getCondition(), PendingNode::OperandA, N);
+				break;
+			}
+			case Statement::StateMentType::Elif:
+			case Statement::StateMentType::Loop:
+			{
+				bool IsLoop = S->getKind() == Statement::StateMentType::Loop;
+				llvm::ArrayRef<Statement*> Statements = IsLoop ? ((LoopStatement*)S)->getStatements() : ((ElifStatement*)S)->getStatements();
+				N = add(IsLoop ? Loop : Elif, S->getLocation());
+				uint32_t Body = addList(Statements.size());
+				NodeStorage[N].B = Body;
+				pushBlock(Statements, Body);
+				pushExpression(IsLoop ? ((LoopStatement*)S)->getCondition() : ((ElifStatement*)S)->getCondition(), PendingNode::OperandA, N);
+				break;
+			}
+			default:
+			{
+				llvm::ArrayRef<Statement*> Statements = ((ElseStatement*)S)->getStatements();
+				N = add(Else, S->getLocation());
+				uint32_t Body = addList(Statements.size());
+				NodeStorage[N].B = Body;
+				pushBlock(Statements, Body);
+				break;
+			}
+			}
+		}
+
+		switch (P.Slot)
+		{
+		case PendingNode::ListEntry:
+			ListStorage[P.Index] = N;
+			break;
+		case PendingNode::OperandA:
+			NodeStorage[P.Index].A = N;
+			break;
+		case PendingNode::OperandB:
+			NodeStorage[P.Index].B = N;
+			break;
+		}
+	}
+
+	Nodes = NodeStorage;
+	Lists = ListStorage;
+}
+
+/*
+	every child comes after its parent, so building the nodes from the
+	last one to the first finds the children of each node already built
+*/
+Base* FlatAST::toTree(ASTContext& Ctx) const
+{
+	std::vector<TopLevelEntity*> Built(Nodes.size());
+	llvm::SmallVector<Statement*, 16> Statements;
+	llvm::SmallVector<ElifStatement*, 4> Elifs;
+
+	auto expression = [&](NodeId N) { return static_cast<Expression*>(Built[N]); };
+	auto block = [&](NodeId N) {
+		Statements.clear();
+		for (NodeId S : getStatements(N))
+			Statements.push_back(static_cast<Statement*>(Built[S]));
+		return Ctx.copy(llvm::makeArrayRef(Statements));
+	};
+
+	for (NodeId N = Nodes.size(); N-- > 1;)
+	{
+		const Node& Current = Nodes[N];
+		TopLevelEntity* Res;
+		switch (Current.Kind)
+		{
+		case Number:
+			Res = Ctx.create<Expression>((int)Current.A);
+			break;
+		case Identifier:
+			Res = Ctx.create<Expression>(Names[Current.A], Current.A);
+			break;
+		case Boolean:
+			Res = Ctx.create<Expression>(Current.A != 0);
+			break;
+		case BinaryOpType:
+			Res = Ctx.create<::BinaryOp>((::BinaryOp::Operator)Current.Op, expression(Current.A), expression(Current.B));
+			break;
+		case BooleanOpType:
+		{
+			::BooleanOp* Op = Ctx.create<::BooleanOp>((::BooleanOp::Operator)Current.Op, expression(Current.A), expression(Current.B));
+			Res = Op;
+			if (Current.Op == ::BooleanOp::And || Current.Op == ::BooleanOp::Or)
+			{
+				// the parser wraps and/or in a plain Expression
+				Op->setLocation(Current.Loc);
+				Res = Ctx.create<Expression>(Op);
+			}
+			break;
+		}
+		case Declaration:
+			Res = Ctx.create<DecStatement>(expression(Current.A), expression(Current.B));
+			break;
+		case Assignment:
+		{
+			// the parser gives a compound assignment its target as the left
+			// operand of its value, the encoding has a copy of it there
+			Expression* Var = expression(Current.A);
+			const Node& Value = Nodes[Current.B];
+			if (Value.Kind == BinaryOpType && Nodes[Value.A].Kind == Identifier &&
+				Nodes[Value.A].Loc == Nodes[Current.A].Loc && Nodes[Value.A].A == Nodes[Current.A].A)
+				Var = expression(Value.A);
+			Res = Ctx.create<AssignStatement>(Var, expression(Current.B));
+			break;
+		}
+		case If:
+		{
+			llvm::ArrayRef<Statement*> Body = block(N);
+			Elifs.clear();
+			for (NodeId E : getElifs(N))
+				Elifs.push_back(static_cast<ElifStatement*>(Built[E]));
+			llvm::ArrayRef<ElifStatement*> ElifS = Ctx.copy(llvm::makeArrayRef(Elifs));
+			NodeId Else = getElse(N);
+			Res = Ctx.create<IfStatement>(expression(Current.A), Body, ElifS,
+				Else == Invalid ? nullptr : static_cast<ElseStatement*>(Built[Else]),
+				!ElifS.empty(), Else != Invalid, Statement::StateMentType::If);
+			break;
+		}
+		case Elif:
+			Res = Ctx.create<ElifStatement>(expression(Current.A), block(N), Statement::StateMentType::Elif);
+			break;
+		case Else:
+			Res = Ctx.create<ElseStatement>(block(N), Statement::StateMentType::Else);
+			break;
+		case Loop:
+			Res = Ctx.create<LoopStatement>(expression(Current.A), block(N), Statement::StateMentType::Loop);
+			break;
+		default:
+			llvm_unreachable("toTree on an encoding that does not verify");
+		}
+		Res->setLocation(Current.Loc);
+		Built[N] = Res;
+	}
+
+	return Ctx.create<Base>(block(getRoot()));
+}
+
+/*
+	walks the tree from the root as the passes do, with a stack of the
+	nodes still to visit and the kind each one has to have. the nodes
+	have to come up in the order they are stored, so what passes is a
+	tree, every walk over it ends and a variable is declared before the
+	nodes that use it, as Sema made sure when the tree was stored
+*/
+bool FlatAST::verify(size_t SourceSize) const
+{
+	enum Expected : uint8_t { AnyExpression, AnyStatement, ElifNode, ElseNode, Target, Declared };
+	struct Item {
+		NodeId Node;
+		Expected Kind;
+	};
+
+	llvm::SmallVector<Item, 64> Stack;
+	llvm::BitVector Scope(Names.size());
+	NodeId Next = 0;
+
+	// a count and that many ids, all inside the lists
+	auto list = [&](uint64_t Index) {
+		return Index < Lists.size() && Index + 1 + Lists[Index] <= Lists.size();
+	};
+	auto pushBlock = [&](uint32_t Index) {
+		if (!list(Index))
+			return false;
+		llvm::ArrayRef<NodeId> Statements = getList(Index);
+		for (size_t I = Statements.size(); I-- > 0;)
+			Stack.push_back({ Statements[I], AnyStatement });
+		return true;
+	};
+
+	if (Nodes.empty() || Nodes[0].Kind != Program || !pushBlock(Nodes[0].B))
+		return false;
+	++Next;
+
+	while (!Stack.empty())
+	{
+		Item Current = Stack.pop_back_val();
+		if (Current.Node != Next++)
+			return false;
+		const Node& N = Nodes[Current.Node];
+		if (N.Loc > SourceSize)
+			return false;
+
+		bool IsExpression = N.Kind <= BooleanOpType;
+		bool Fits;
+		switch (Current.Kind)
+		{
+		case AnyExpression:
+			Fits = IsExpression;
+			break;
+		case AnyStatement:
+			Fits = N.Kind == Declaration || N.Kind == Assignment || N.Kind == If || N.Kind == Loop;
+			break;
+		case ElifNode:
+			Fits = N.Kind == Elif;
+			break;
+		case ElseNode:
+			Fits = N.Kind == Else;
+			break;
+		default:
+			// the variable of a declaration or assignment
+			if (N.Kind != Identifier || N.A >= Names.size() || Scope.test(N.A) != (Current.Kind == Declared))
+				return false;
+			Scope.set(N.A);
+			continue;
+		}
+		if (!Fits)
+			return false;
+
+		switch (N.Kind)
+		{
+		case Number:
+			break;
+		case Identifier:
+			if (N.A >= Names.size() || !Scope.test(N.A))
+				return false;
+			break;
+		case Boolean:
+			if (N.A > 1)
+				return false;
+			break;
+		case BinaryOpType:
+		case BooleanOpType:
+			if (N.Op > (N.Kind == BinaryOpType ? (uint8_t)::BinaryOp::Pow : (uint8_t)::BooleanOp::Or))
+				return false;
+			Stack.push_back({ N.B, AnyExpression });
+			Stack.push_back({ N.A, AnyExpression });
+			break;
+		case Declaration:
+		case Assignment:
+			Stack.push_back({ N.B, AnyExpression });
+			Stack.push_back({ N.A, N.Kind == Declaration ? Target : Declared });
+			break;
+		case If:
+		{
+			// the elif list and the else slot follow the body, see getElifs
+			uint64_t ElifList = list(N.B) ? (uint64_t)N.B + 1 + Lists[N.B] : Lists.size();
+			if (!list(ElifList) || ElifList + 1 + Lists[ElifList] >= Lists.size())
+				return false;
+			NodeId ElseId = getElse(Current.Node);
+			if (ElseId != Invalid)
+				Stack.push_back({ ElseId, ElseNode });
+			llvm::ArrayRef<NodeId> Elifs = getElifs(Current.Node);
+			for (size_t I = Elifs.size(); I-- > 0;)
+				Stack.push_back({ Elifs[I], ElifNode });
+			pushBlock(N.B);
+			Stack.push_back({ N.A, AnyExpression });
+			break;
+		}
+		case Elif:
+		case Loop:
+			if (!pushBlock(N.B))
+				return false;
+			Stack.push_back({ N.A, AnyExpression });
+			break;
+		default:
+			if (!pushBlock(N.B))
+				return false;
+			break;
+		}
+	}
+
+	return Next == Nodes.size();
+}
@@ -0,0 +1,153 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <vector>
+
+/*
+	compact encoding of a whole program. every node is a 16 byte record in
+	one array and refers to its children by 32-bit index. nodes are stored
+	in source order (a node comes right before its children), so walking
+	the program reads the array front to back.
+
+	payload of A and B by kind:
+		Number         A = value
+		Identifier     A = symbol id
+		Boolean        A = 0 or 1
+		BinaryOpType   A = left, B = right, Op = BinaryOp::Operator
+		BooleanOpType  A = left, B = right, Op = BooleanOp::Operator
+		Declaration    A = variable, B = initial value
+		Assignment     A = variable, B = value
+		Loop, Elif     A = condition, B = body list
+		Else           B = body list
+		If             A = condition, B = body list, followed by the elif list and the else node
+		Program        B = statement list
+
+	a list is a count followed by that many node ids in the Lists array.
+
+	the encoding holds no pointers, so it can be written to a file as is
+	and used in place from a mapped copy, see ASTCache.
+*/
+class FlatAST {
+public:
+	typedef uint32_t NodeId;
+	static const NodeId Invalid = ~0u;
+
+	enum NodeKind : uint8_t {
+		Number,
+		Identifier,
+		Boolean,
+		BinaryOpType,
+		BooleanOpType,
+		Declaration,
+		Assignment,
+		If,
+		Elif,
+		Else,
+		Loop,
+		Program
+	};
+
+	struct Node {
+		NodeKind Kind;
+		uint8_t Op;
+		uint16_t Unused;    // 0, spelled out so cache files hold no padding
+		uint32_t Loc;   // source offset, as in TopLevelEntity
+		uint32_t A;
+		uint32_t B;
+	};
+
+private:
+	// filled when the encoding is built from a tree, empty for a view
+	std::vector<Node> NodeStorage;
+	std::vector<uint32_t> ListStorage;
+
+	llvm::ArrayRef<Node> Nodes;
+	llvm::ArrayRef<uint32_t> Lists;
+	std::vector<llvm::StringRef> Names;     // spelling of every symbol id
+
+	NodeId add(NodeKind Kind, uint32_t Loc, uint8_t Op = 0);
+	uint32_t addList(size_t Count);
+
+	llvm::ArrayRef<NodeId> getList(uint32_t Index) const
+	{
+		return llvm::ArrayRef<NodeId>(Lists.data() + Index + 1, Lists[Index]);
+	}
+
+public:
+	// flattens a tree built by the parser, the root becomes node 0
+	explicit FlatAST(Base* Tree);
+
+	// uses an encoding that lives elsewhere, like a mapped cache file.
+	// the arrays and spellings have to outlive this object
+	FlatAST(llvm::ArrayRef<Node> Nodes, llvm::ArrayRef<uint32_t> Lists, std::vector<llvm::StringRef> Names)
+		: Nodes(Nodes), Lists(Lists), Names(std::move(Names))
+	{
+	}
+
+	FlatAST(const FlatAST&) = delete;
+	FlatAST& operator=(const FlatAST&) = delete;
+
+	// builds the pointer tree back in Ctx, for passes that only run on it.
+	// an encoding read from elsewhere has to pass verify() first
+	Base* toTree(ASTContext& Ctx) const;
+
+	// whether the encoding is one that the constructor could have built
+	// from a checked program of SourceSize bytes: the nodes stored in the
+	// order of a walk from the root, every kind, operator, symbol, list
+	// and location in range, and every variable declared once and before
+	// it is used
+	bool verify(size_t SourceSize) const;
+
+	NodeId getRoot() const { return 0; }
+
+	// every node in source order, for passes that do not care about nesting
+	llvm::ArrayRef<Node> nodes() const { return Nodes; }
+	llvm::ArrayRef<uint32_t> lists() const { return Lists; }
+	llvm::ArrayRef<llvm::StringRef> names() const { return Names; }
+
+	NodeKind getKind(NodeId N) const { return Nodes[N].Kind; }
+	uint32_t getLocation(NodeId N) const { return Nodes[N].Loc; }
+	uint8_t getOperator(NodeId N) const { return Nodes[N].Op; }
+
+	int getNumber(NodeId N) const { return (int)Nodes[N].A; }
+	bool getBoolean(NodeId N) const { return Nodes[N].A != 0; }
+	uint32_t getSymbol(NodeId N) const { return Nodes[N].A; }
+	llvm::StringRef getName(uint32_t Symbol) const { return Names[Symbol]; }
+
+	// operands of BinaryOp and BooleanOp
+	NodeId getLeft(NodeId N) const { return Nodes[N].A; }
+	NodeId getRight(NodeId N) const { return Nodes[N].B; }
+
+	// Declaration and Assignment
+	NodeId getLValue(NodeId N) const { return Nodes[N].A; }
+	NodeId getRValue(NodeId N) const { return Nodes[N].B; }
+
+	// If, Elif and Loop
+	NodeId getCondition(NodeId N) const { return Nodes[N].A; }
+
+	// statements of Program, If, Elif, Else and Loop
+	llvm::ArrayRef<NodeId> getStatements(NodeId N) const { return getList(Nodes[N].B); }
+
+	llvm::ArrayRef<NodeId> getElifs(NodeId N) const
+	{
+		uint32_t Body = Nodes[N].B;
+		return getList(Body + 1 + Lists[Body]);
+	}
+
+	// the else branch of an If, or Invalid
+	NodeId getElse(NodeId N) const
+	{
+		uint32_t Body = Nodes[N].B;
+		uint32_t ElifList = Body + 1 + Lists[Body];
+		return Lists[ElifList + 1 + Lists[ElifList]];
+	}
+
+	size_t size() const { return Nodes.size(); }
+	size_t getBytes() const { return Nodes.size() * sizeof(Node) + Lists.size() * sizeof(uint32_t); }
+};
+
+#endif
@@ -0,0 +1,486 @@
+#include "Fold.h"
+#include "ASTWalker.h"
+#include "Error.h"
+#include <cstdint>
+
+namespace {
+	bool isNumber(Expression* E, int Value)
+	{
+		return E->isNumber() && E->getNumber() == Value;
+	}
+
+	bool isBoolean(Expression* E, bool Value)
+	{
+		return E->isBoolean() && E->getBoolean() == Value;
+	}
+
+	// the same variable on both sides, so both have the same value
+	bool isSameVariable(Expression* L, Expression* R)
+	{
+		return L->isVariable() && R->isVariable() && L->getSymbol() == R->getSymbol();
+	}
+
+	/*
+		folds bottom up: every expression leaves its folded form on Values
+		and every statement leaves what replaces it on Statements, none if
+		it is dead and the statements of its branch for an if that is
+		always taken
+	*/
+	class Folder : public ASTWalker<Folder> {
+		friend class ASTWalker<Folder>;
+
+		ASTContext& Ctx;
+		bool& HasError;
+		llvm::SmallVector<Expression*, 16> Values;
+		llvm::SmallVector<Statement*, 16> Statements;   // of the blocks being folded, innermost last
+
+		// an if, elif, else or loop whose statements are being folded
+		struct Block {
+			Expression* Condition;      // folded
+			size_t FirstStatement;
+			size_t FirstBranch;         // elifs and else of an if, after its body
+		};
+		llvm::SmallVector<Block, 8> Blocks;
+
+		// one condition and body of an if, elif chain
+		struct Branch {
+			Expression* Condition;
+			llvm::ArrayRef<Statement*> Body;
+			ElifStatement* Elif;        // the elif it came from, null for the if
+		};
+
+		template <typename T>
+		T* at(uint32_t Loc, T* Node)
+		{
+			Node->setLocation(Loc);
+			return Node;
+		}
+
+		Expression* number(uint32_t Loc, int Value) { return at(Loc, Ctx.create<Expression>(Value)); }
+		Expression* boolean(uint32_t Loc, bool Value) { return at(Loc, Ctx.create<Expression>(Value)); }
+
+		// the statements folded since First, Old itself if none of them changed
+		llvm::ArrayRef<Statement*> takeBlock(size_t First, llvm::ArrayRef<Statement*> Old)
+		{
+			llvm::ArrayRef<Statement*> New = llvm::makeArrayRef(Statements).slice(First);
+			llvm::ArrayRef<Statement*> Res = New == Old ? Old : Ctx.copy(New);
+			Statements.resize(First);
+			return Res;
+		}
+
+		Expression* simplify(BinaryOp::Operator Op, Expression* L, Expression* R, uint32_t Loc)
+		{
+			switch (Op)
+			{
+			case BinaryOp::Plus:
+				if (isNumber(R, 0))
+					return L;
+				if (isNumber(L, 0))
+					return R;
+				break;
+			case BinaryOp::Minus:
+				if (isNumber(R, 0))
+					return L;
+				if (isSameVariable(L, R))
+					return number(Loc, 0);
+				break;
+			case BinaryOp::Mul:
+				if (isNumber(R, 0) || isNumber(L, 0))
+					return number(Loc, 0);
+				if (isNumber(R, 1))
+					return L;
+				if (isNumber(L, 1))
+					return R;
+				break;
+			case BinaryOp::Div:
+				if (isNumber(R, 1))
+					return L;
+				break;
+			case BinaryOp::Mod:
+				if (isNumber(R, 1))
+					return number(Loc, 0);
+				break;
+			case BinaryOp::Pow:
+				if (isNumber(R, 1))
+					return L;
+				if (isNumber(R, 0))
+					return number(Loc, 1);
+				break;
+			}
+			return nullptr;
+		}
+
+		bool visitIdentifier(Expression* E, unsigned Step)
+		{
+			Values.push_back(E);
+			return false;
+		}
+
+		bool visitNumber(Expression* E, unsigned Step)
+		{
+			Values.push_back(E);
+			return false;
+		}
+
+		bool visitBoolean(Expression* E, unsigned Step)
+		{
+			Values.push_back(E);
+			return false;
+		}
+
+		bool visitBinaryOp(BinaryOp* Op, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Op->getLeft());
+				push(Op->getRight());
+				return true;
+			}
+			Expression* R = Values.pop_back_val();
+			Expression* L = Values.pop_back_val();
+			uint32_t Loc = Op->getLocation();
+			BinaryOp::Operator O = Op->getOperator();
+
+			int32_t Value;
+			if ((O == BinaryOp::Div || O == BinaryOp::Mod) && isNumber(R, 0))
+			{
+				Error::DivisionByZero(Loc);
+				HasError = true;
+			}
+			else if (L->isNumber() && R->isNumber() && ConstantFolder::evaluate(O, L->getNumber(), R->getNumber(), Value))
+			{
+				Values.push_back(number(Loc, Value));
+				return false;
+			}
+			else if (Expression* Simple = simplify(O, L, R, Loc))
+			{
+				Values.push_back(Simple);
+				return false;
+			}
+
+			if (L == Op->getLeft() && R == Op->getRight())
+				Values.push_back(Op);
+			else
+				Values.push_back(at(Loc, Ctx.create<BinaryOp>(O, L, R)));
+			return false;
+		}
+
+		bool visitBooleanOp(BooleanOp* Op, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Op->getLeft());
+				push(Op->getRight());
+				return true;
+			}
+			Expression* R = Values.pop_back_val();
+			Expression* L = Values.pop_back_val();
+			uint32_t Loc = Op->getLocation();
+			BooleanOp::Operator O = Op->getOperator();
+
+			Expression* Folded = nullptr;
+			switch (O)
+			{
+			case BooleanOp::And:
+				if (isBoolean(L, false) || isBoolean(R, false))
+					Folded = boolean(Loc, false);
+				else if (isBoolean(L, true))
+					Folded = R;
+				else if (isBoolean(R, true))
+					Folded = L;
+				break;
+			case BooleanOp::Or:
+				if (isBoolean(L, true) || isBoolean(R, true))
+					Folded = boolean(Loc, true);
+				else if (isBoolean(L, false))
+					Folded = R;
+				else if (isBoolean(R, false))
+					Folded = L;
+				break;
+			default:
+				if (L->isNumber() && R->isNumber())
+					Folded = boolean(Loc, ConstantFolder::compare(O, L->getNumber(), R->getNumber()));
+				else if (L->isBoolean() && R->isBoolean() && (O == BooleanOp::Equal || O == BooleanOp::NotEqual))
+					Folded = boolean(Loc, ConstantFolder::compare(O, L->getBoolean(), R->getBoolean()));
+				else if (isSameVariable(L, R))
+					Folded = boolean(Loc, ConstantFolder::compare(O, 0, 0));
+				break;
+			}
+
+			if (!Folded && L == Op->getLeft() && R == Op->getRight())
+				Folded = Op;
+			else if (!Folded)
+			{
+				Folded = at(Loc, Ctx.create<BooleanOp>(O, L, R));
+				// and, or are wrapped like the parser does
+				if (O == BooleanOp::And || O == BooleanOp::Or)
+					Folded = at(Loc, Ctx.create<Expression>((BooleanOp*)Folded));
+			}
+			Values.push_back(Folded);
+			return false;
+		}
+
+		bool visitDeclaration(DecStatement* Dec, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Dec->getRValue());
+				return true;
+			}
+			Expression* Value = Values.pop_back_val();
+			if (Value == Dec->getRValue())
+				Statements.push_back(Dec);
+			else
+				Statements.push_back(at(Dec->getLocation(), Ctx.create<DecStatement>(Dec->getLValue(), Value)));
+			return false;
+		}
+
+		bool visitAssignment(AssignStatement* Assign, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Assign->getRValue());
+				return true;
+			}
+			Expression* Value = Values.pop_back_val();
+			if (Value == Assign->getRValue())
+				Statements.push_back(Assign);
+			else
+				Statements.push_back(at(Assign->getLocation(), Ctx.create<AssignStatement>(Assign->getLValue(), Value)));
+			return false;
+		}
+
+		/*
+			an if is folded in four steps: its condition, its body, its elifs
+			and else, and at last the chain is put back together without the
+			branches that can never be taken. a branch that is always taken
+			becomes the else and ends the chain. with no branch left that
+			may or may not be taken, the else body replaces the statement
+		*/
+		bool visitIf(IfStatement* If, unsigned Step)
+		{
+			switch (Step)
+			{
+			case 0:
+				push(If->getCondition());
+				return true;
+			case 1:
+				Blocks.push_back({ Values.pop_back_val(), Statements.size(), 0 });
+				push(If->getStatements());
+				return true;
+			case 2:
+				Blocks.back().FirstBranch = Statements.size();
+				push(If->getElifsStatements());
+				if (If->hasElse())
+					push(If->getElseStatement());
+				return true;
+			}
+
+			Block B = Blocks.pop_back_val();
+			llvm::ArrayRef<ElifStatement*> OldElifs = If->getElifsStatements();
+			llvm::SmallVector<Branch, 4> Branches;
+			for (size_t I = 0; I < OldElifs.size(); ++I)
+			{
+				ElifStatement* Elif = static_cast<ElifStatement*>(Statements[B.FirstBranch + I]);
+				Branches.push_back({ Elif->getCondition(), Elif->getStatements(), Elif });
+			}
+			ElseStatement* Else = If->hasElse() ? static_cast<ElseStatement*>(Statements.back()) : nullptr;
+			Statements.resize(B.FirstBranch);
+			Branches.insert(Branches.begin(), { B.Condition, takeBlock(B.FirstStatement, If->getStatements()), nullptr });
+
+			llvm::SmallVector<Branch, 4> Live;
+			bool Changed = false;
+			for (Branch& Br : Branches)
+			{
+				if (isBoolean(Br.Condition, false))
+				{
+					Changed = true;
+					continue;
+				}
+				if (isBoolean(Br.Condition, true))
+				{
+					Else = at(Br.Elif ? Br.Elif->getLocation() : If->getLocation(),
+						Ctx.create<ElseStatement>(Br.Body, Statement::StateMentType::Else));
+					Changed = true;
+					break;
+				}
+				Live.push_back(Br);
+			}
+
+			if (Live.empty())
+			{
+				if (Else)
+					Statements.append(Else->getStatements().begin(), Else->getStatements().end());
+				return false;
+			}
+
+			Changed |= Live[0].Elif || Else != If->getElseStatement() || Live[0].Condition != If->getCondition() ||
+				Live[0].Body.data() != If->getStatements().data();
+			for (size_t I = 1; I < Live.size() && !Changed; ++I)
+				Changed = Live[I].Elif != OldElifs[I - 1];
+			if (!Changed)
+			{
+				Statements.push_back(If);
+				return false;
+			}
+
+			llvm::SmallVector<ElifStatement*, 4> Elifs;
+			for (size_t I = 1; I < Live.size(); ++I)
+				Elifs.push_back(Live[I].Elif);
+			llvm::ArrayRef<ElifStatement*> ElifS = Ctx.copy(llvm::makeArrayRef(Elifs));
+			Statements.push_back(at(If->getLocation(), Ctx.create<IfStatement>(Live[0].Condition, Live[0].Body, ElifS, Else,
+				!ElifS.empty(), Else != nullptr, Statement::StateMentType::If)));
+			return false;
+		}
+
+		bool visitElif(ElifStatement* Elif, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Elif->getCondition());
+				return true;
+			}
+			if (Step == 1)
+			{
+				Blocks.push_back({ Values.pop_back_val(), Statements.size(), 0 });
+				push(Elif->getStatements());
+				return true;
+			}
+
+			Block B = Blocks.pop_back_val();
+			llvm::ArrayRef<Statement*> Body = takeBlock(B.FirstStatement, Elif->getStatements());
+			if (B.Condition == Elif->getCondition() && Body.data() == Elif->getStatements().data())
+				Statements.push_back(Elif);
+			else
+				Statements.push_back(at(Elif->getLocation(), Ctx.create<ElifStatement>(B.Condition, Body, Statement::StateMentType::Elif)));
+			return false;
+		}
+
+		bool visitElse(ElseStatement* Else, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				Blocks.push_back({ nullptr, Statements.size(), 0 });
+				push(Else->getStatements());
+				return true;
+			}
+
+			Block B = Blocks.pop_back_val();
+			llvm::ArrayRef<Statement*> Body = takeBlock(B.FirstStatement, Else->getStatements());
+			if (Body.data() == Else->getStatements().data())
+				Statements.push_back(Else);
+			else
+				Statements.push_back(at(Else->getLocation(), Ctx.create<ElseStatement>(Body, Statement::StateMentType::Else)));
+			return false;
+		}
+
+		// a loop whose condition is false is dropped, its body is only folded
+		// for the diagnostics
+		bool visitLoop(LoopStatement* Loop, unsigned Step)
+		{
+			if (Step == 0)
+			{
+				push(Loop->getCondition());
+				return true;
+			}
+			if (Step == 1)
+			{
+				Blocks.push_back({ Values.pop_back_val(), Statements.size(), 0 });
+				push(Loop->getStatements());
+				return true;
+			}
+
+			Block B = Blocks.pop_back_val();
+			llvm::ArrayRef<Statement*> Body = takeBlock(B.FirstStatement, Loop->getStatements());
+			if (isBoolean(B.Condition, false))
+				return false;
+			if (B.Condition == Loop->getCondition() && Body.data() == Loop->getStatements().data())
+				Statements.push_back(Loop);
+			else
+				Statements.push_back(at(Loop->getLocation(), Ctx.create<LoopStatement>(B.Condition, Body, Statement::StateMentType::Loop)));
+			return false;
+		}
+
+	public:
+		Folder(ASTContext& Ctx, bool& HasError) : Ctx(Ctx), HasError(HasError) {}
+
+		// the folded top level statements
+		llvm::SmallVectorImpl<Statement*>& getStatements() { return Statements; }
+	};
+}
+
+/*
+	L Op R on 32-bit integers, wrapping like the generated code. it
+	returns false for what can not be folded: a division that traps
+	and a negative power
+*/
+bool ConstantFolder::evaluate(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t& Result)
+{
+	uint32_t A = L, B = R;
+	switch (Op)
+	{
+	case BinaryOp::Plus:
+		Result = (int32_t)(A + B);
+		return true;
+	case BinaryOp::Minus:
+		Result = (int32_t)(A - B);
+		return true;
+	case BinaryOp::Mul:
+		Result = (int32_t)(A * B);
+		return true;
+	case BinaryOp::Div:
+	case BinaryOp::Mod:
+		if (R == 0 || (L == INT32_MIN && R == -1))
+			return false;
+		Result = Op == BinaryOp::Div ? L / R : L % R;
+		return true;
+	case BinaryOp::Pow:
+	{
+		if (R < 0)
+			return false;
+		uint32_t Power = 1;
+		for (uint32_t E = R; E; E >>= 1, A *= A)
+			if (E & 1)
+				Power *= A;
+		Result = (int32_t)Power;
+		return true;
+	}
+	}
+	return false;
+}
+
+bool ConstantFolder::compare(BooleanOp::Operator Op, int L, int R)
+{
+	switch (Op)
+	{
+	case BooleanOp::LessEqual:
+		return L <= R;
+	case BooleanOp::Less:
+		return L < R;
+	case BooleanOp::Greater:
+		return L > R;
+	case BooleanOp::GreaterEqual:
+		return L >= R;
+	case BooleanOp::Equal:
+		return L == R;
+	default:
+		return L != R;
+	}
+}
+
+Base* ConstantFolder::fold(Base* Tree)
+{
+	Folder F(Ctx, HasError);
+	F.walk(Tree);
+	llvm::ArrayRef<Statement*> Statements = F.getStatements();
+	if (Statements == Tree->getStatements())
+		return Tree;
+	return Ctx.create<Base>(Ctx.copy(Statements));
+}
+
+void ConstantFolder::fold(Statement* S, llvm::SmallVectorImpl<Statement*>& Out)
+{
+	Folder F(Ctx, HasError);
+	F.walk(S);
+	Out.append(F.getStatements().begin(), F.getStatements().end());
+}
@@ -0,0 +1,38 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "AST.h"
+#include "llvm/ADT/SmallVector.h"
+
+/*
+	folds a checked program before code generation. operations on
+	constants are evaluated the way the generated code would, identities
+	like a + 0 or b and true are simplified, and if, elif and else
+	branches whose conditions are constant are removed along with loops
+	that never run. a division or modulo by an expression that folds to
+	0 is reported. nodes are never changed in place, anything folded is
+	rebuilt in Ctx, so shared subtrees stay valid
+*/
+class ConstantFolder {
+	ASTContext& Ctx;
+	bool HasError;
+
+public:
+	ConstantFolder(ASTContext& Ctx) : Ctx(Ctx), HasError(false) {}
+
+	// whether a division by zero was reported
+	bool hasError() { return HasError; }
+
+	Base* fold(Base* Tree);
+
+	// folds one top level statement into Out, a dead statement adds nothing
+	// and an if that is always taken adds the statements of its branch
+	void fold(Statement* S, llvm::SmallVectorImpl<Statement*>& Out);
+
+	// L Op R the way the generated code computes it, false for a division
+	// that traps and a negative power
+	static bool evaluate(BinaryOp::Operator Op, int32_t L, int32_t R, int32_t& Result);
+	static bool compare(BooleanOp::Operator Op, int L, int R);
+};
+
+#endif
@@ -0,0 +1,436 @@
+#include "Incremental.h"
+#include "ASTWalker.h"
+#include "Error.h"
+#include "FlatAST.h"
+#include "Parser.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+// characters lexed past the damaged constructs at first, the window
+// doubles from here while the parse has not caught up with the old one
+static const size_t FirstWindowSlack = 256;
+static const size_t MinWindowSize = 4096;
+
+// nodes of replaced constructs the arena holds on to at least, so small
+// buffers are not copied after every few edits
+static const size_t MinGarbageNodes = 4096;
+
+namespace {
+	// moves the locations of a subtree by Delta. offsets wrap around at
+	// 2^32, so the same addition moves nodes back as well as forward
+	class Rebase : public ASTWalker<Rebase> {
+		friend class ASTWalker<Rebase>;
+
+		uint32_t Delta;
+		Expression* Target;     // an assignment target, compound assignments use it as their left operand too
+
+		template <typename T>
+		void move(T* Node)
+		{
+			Node->setLocation(Node->getLocation() + Delta);
+		}
+
+		// an expression is moved by the node it belongs to, and an and/or
+		// together with the operation it wraps
+		void moveAndPush(Expression* E)
+		{
+			if (E == Target)
+				return;
+			move(E);
+			if (E->getKind() == Expression::ExpressionType::BooleanOpType && E->getBooleanOp())
+				move(E->getBooleanOp());
+			push(E);
+		}
+
+		bool visitDeclaration(DecStatement* S, unsigned Step)
+		{
+			move(S);
+			move(S->getLValue());
+			moveAndPush(S->getRValue());
+			return false;
+		}
+
+		bool visitAssignment(AssignStatement* S, unsigned Step)
+		{
+			move(S);
+			move(S->getLValue());
+			Target = S->getLValue();
+			moveAndPush(S->getRValue());
+			return false;
+		}
+
+		bool visitIf(IfStatement* S, unsigned Step)
+		{
+			move(S);
+			moveAndPush(S->getCondition());
+			push(S->getStatements());
+			push(S->getElifsStatements());
+			if (S->hasElse())
+				push(S->getElseStatement());
+			return false;
+		}
+
+		bool visitElif(ElifStatement* S, unsigned Step)
+		{
+			move(S);
+			moveAndPush(S->getCondition());
+			push(S->getStatements());
+			return false;
+		}
+
+		bool visitElse(ElseStatement* S, unsigned Step)
+		{
+			move(S);
+			push(S->getStatements());
+			return false;
+		}
+
+		bool visitLoop(LoopStatement* S, unsigned Step)
+		{
+			move(S);
+			moveAndPush(S->getCondition());
+			push(S->getStatements());
+			return false;
+		}
+
+		bool visitBinaryOp(BinaryOp* E, unsigned Step)
+		{
+			moveAndPush(E->getLeft());
+			moveAndPush(E->getRight());
+			return false;
+		}
+
+		bool visitBooleanOp(BooleanOp* E, unsigned Step)
+		{
+			moveAndPush(E->getLeft());
+			moveAndPush(E->getRight());
+			return false;
+		}
+
+	public:
+		Rebase(uint32_t Delta) : Delta(Delta), Target(nullptr) {}
+	};
+}
+
+IncrementalParser::GapBuffer::GapBuffer(llvm::StringRef Text) : Chars(Text.begin(), Text.end()), GapBegin(0), GapEnd(0)
+{
+	Chars.push_back('\0');
+}
+
+void IncrementalParser::GapBuffer::moveGap(size_t Offset)
+{
+	if (Offset < GapBegin)
+	{
+		size_t Count = GapBegin - Offset;
+		memmove(&Chars[GapEnd - Count], &Chars[Offset], Count);
+		GapBegin -= Count;
+		GapEnd -= Count;
+	}
+	else if (Offset > GapBegin)
+	{
+		size_t Count = Offset - GapBegin;
+		memmove(&Chars[GapBegin], &Chars[GapEnd], Count);
+		GapBegin += Count;
+		GapEnd += Count;
+	}
+}
+
+void IncrementalParser::GapBuffer::replace(size_t Offset, size_t Removed, llvm::StringRef Inserted)
+{
+	moveGap(Offset);
+	GapEnd += Removed;
+	if (GapEnd - GapBegin < Inserted.size())
+	{
+		// a gap of half the text at least, so that growing stays linear
+		size_t Grow = std::max(Inserted.size() - (GapEnd - GapBegin), Chars.size() / 2);
+		Chars.insert(Chars.begin() + GapEnd, Grow, '\0');
+		GapEnd += Grow;
+	}
+	std::copy(Inserted.begin(), Inserted.end(), Chars.begin() + GapBegin);
+	GapBegin += Inserted.size();
+}
+
+IncrementalParser::IncrementalParser(llvm::StringRef Source) : Text(Source), Ctx(new ASTContext()), LiveNodes(0), Names(NameStorage),
+	Leading(0), LeadingLines(0), GapStart(0), GapLines(0), Tree(nullptr), Lexed(0)
+{
+	parseFrom(0, 0);
+}
+
+void IncrementalParser::moveBack()
+{
+	Construct C = Before.back();
+	Before.pop_back();
+	GapStart -= C.Length;
+	GapLines -= C.Lines;
+	After.push_back(C);
+}
+
+void IncrementalParser::moveForward()
+{
+	Construct C = After.back();
+	After.pop_back();
+	GapStart += C.Length;
+	GapLines += C.Lines;
+	Before.push_back(C);
+}
+
+// moves the gap of the constructs to the one Offset is in, the last one
+// for the end of the text. Before is empty if Offset comes before them all
+void IncrementalParser::seek(uint32_t Offset)
+{
+	if (After.empty() && !Before.empty())
+		moveBack();
+	while (!Before.empty() && Offset < GapStart)
+		moveBack();
+	while (After.size() > 1 && Offset >= GapStart + After.back().Length)
+		moveForward();
+}
+
+/*
+	lexes about Size more characters of Rest onto Window. the lexer interns
+	names that point into the text, they are copied out so that the AST
+	stays valid when the text changes, and get the ids they have in the
+	rest of the buffer
+*/
+void IncrementalParser::lexMore(size_t Size)
+{
+	if (Window.size())
+	{
+		Window.Kinds.pop_back();
+		Window.Offsets.pop_back();
+		Window.Values.pop_back();
+	}
+
+	TokenBuffer Fresh;
+	Lexed = Lexer::lexWindow(Rest, Lexed, Size, Fresh);
+	Window.Kinds.insert(Window.Kinds.end(), Fresh.Kinds.begin(), Fresh.Kinds.end());
+	Window.Offsets.insert(Window.Offsets.end(), Fresh.Offsets.begin(), Fresh.Offsets.end());
+	for (unsigned I = 0; I < Fresh.size(); ++I)
+	{
+		uint32_t Value = Fresh.Values[I];
+		if (Fresh.getKind(I) == Token::ident)
+			Value = Window.Identifiers.intern(Fresh.Identifiers.getName(Value), Names);
+		Window.Values.push_back(Value);
+	}
+	Scanner.scan(Window, Lexed == Rest.size());
+}
+
+void IncrementalParser::parseFrom(uint32_t RegionStart, uint32_t Next)
+{
+	Rest = Text.back();
+	Lexed = 0;
+	Scanner = ConstructScanner();
+	Window.Kinds.clear();
+	Window.Offsets.clear();
+	Window.Values.clear();
+	Window.Source = Rest;
+
+	// diagnostics count lines and columns from the start of the region
+	llvm::StringRef Front = Text.front();
+	size_t LineStart = Front.rfind('\n');
+	LineStart = LineStart == llvm::StringRef::npos ? 0 : LineStart + 1;
+	Error::setSource(Rest, GapLines + 1, RegionStart - LineStart + 1);
+
+	// the constructs parsed here, with their origin at where they start in Rest
+	llvm::SmallVector<Construct, 16> Parsed;
+	llvm::SmallVector<Statement*> Statements;
+	size_t Size = After.empty() ? Rest.size() : Next + FirstWindowSlack;
+	lexMore(Size);
+
+	unsigned Position = 0;
+	uint32_t End;
+	while (true)
+	{
+		while (Position >= Scanner.getComplete() && Lexed < Rest.size())
+		{
+			Size = std::max(2 * Size, MinWindowSize);
+			lexMore(Size);
+		}
+
+		// old constructs the new text runs over are dropped, one that
+		// starts where a new one would is back in step with the new text
+		uint32_t Start = Window.getOffset(Position);
+		while (!After.empty() && Next < Start)
+		{
+			Next += After.back().Length;
+			LiveNodes -= After.back().Nodes;
+			After.pop_back();
+		}
+		if (!After.empty() && Next == Start)
+		{
+			End = Next;
+			break;
+		}
+		if (Window.getKind(Position) == Token::eof)
+		{
+			End = Rest.size();
+			break;
+		}
+
+		Statements.clear();
+		size_t Created = Ctx->getNodeCount();
+		Parser P(Window, *Ctx, Position);
+		P.parseNext(Statements);
+
+		// the scan keeps the parser inside the window. should a construct
+		// with a syntax error still get to its end, the construct is parsed
+		// again on the rest of the text
+		if (P.getPosition() + 1 >= Window.size() && Lexed < Rest.size())
+		{
+			lexMore(Rest.size());
+			continue;
+		}
+
+		Construct C = { 0, 0, Start, (uint32_t)(Ctx->getNodeCount() - Created), Ctx->copy(llvm::makeArrayRef(Statements)) };
+		LiveNodes += C.Nodes;
+		Parsed.push_back(C);
+		Position = P.getPosition();
+	}
+
+	// characters before the first new construct belong to the construct
+	// before the region, or lead the text
+	uint32_t First = Parsed.empty() ? End : Parsed.front().Origin;
+	uint32_t Lines = Rest.take_front(First).count('\n');
+	if (Before.empty())
+	{
+		Leading = First;
+		LeadingLines = Lines;
+	}
+	else
+	{
+		Before.back().Length += First;
+		Before.back().Lines += Lines;
+	}
+	GapStart += First;
+	GapLines += Lines;
+
+	for (size_t I = 0; I < Parsed.size(); ++I)
+	{
+		Construct& C = Parsed[I];
+		uint32_t Stop = I + 1 < Parsed.size() ? Parsed[I + 1].Origin : End;
+		C.Length = Stop - C.Origin;
+		C.Lines = Rest.slice(C.Origin, Stop).count('\n');
+		Before.push_back(C);
+		GapStart += C.Length;
+		GapLines += C.Lines;
+	}
+}
+
+void IncrementalParser::edit(uint32_t Offset, uint32_t Removed, llvm::StringRef Inserted)
+{
+	assert(Offset + Removed <= Text.size() && "edit past the end of the text");
+	Tree = nullptr;
+
+	/* the construct the edit starts in is parsed again, and the one before
+	   it while the edit may reach the first token of the construct after
+	   it: where a construct ends can depend on that token, an elif or else
+	   joins the if before it and error recovery stops at keywords */
+	Text.moveGap(Offset);
+	seek(Offset);
+	while (!Before.empty() && Text.front().drop_front(GapStart).find_first_of(" \t\n\v\f\r") == llvm::StringRef::npos)
+		moveBack();
+	uint32_t RegionStart = Before.empty() ? 0 : GapStart;
+
+	/* so is every construct up to the one the edit ends in, a token of it
+	   may grow into the edit. Next is where the first one after them
+	   starts, or the end of the text */
+	uint32_t Next = GapStart;
+	while (!After.empty() && Next <= Offset + Removed)
+	{
+		Next += After.back().Length;
+		LiveNodes -= After.back().Nodes;
+		After.pop_back();
+	}
+	if (Before.empty())
+	{
+		Leading = 0;
+		LeadingLines = 0;
+		GapStart = 0;
+		GapLines = 0;
+	}
+
+	Text.replace(Offset, Removed, Inserted);
+	Text.moveGap(RegionStart);
+	parseFrom(RegionStart, Next - Removed + Inserted.size() - RegionStart);
+
+	size_t Nodes = Ctx->getNodeCount();
+	if (Nodes > 2 * LiveNodes && Nodes - LiveNodes > MinGarbageNodes)
+		compact();
+}
+
+/*
+	copies the statements of every construct to a new arena and frees the
+	old one, with the statements of the constructs edits replaced. the
+	copy goes through the flat encoding, which nests without recursion
+*/
+void IncrementalParser::compact()
+{
+	Program.clear();
+	for (Construct& C : Before)
+		Program.insert(Program.end(), C.Statements.begin(), C.Statements.end());
+	for (Construct& C : After)
+		Program.insert(Program.end(), C.Statements.begin(), C.Statements.end());
+
+	FlatAST Flat(Ctx->create<Base>(llvm::makeArrayRef(Program)));
+	std::unique_ptr<ASTContext> Fresh(new ASTContext());
+	llvm::ArrayRef<Statement*> Copied = Flat.toTree(*Fresh)->getStatements();
+	auto Take = [&](Construct& C) {
+		C.Statements = Copied.take_front(C.Statements.size());
+		Copied = Copied.drop_front(C.Statements.size());
+	};
+	for (Construct& C : Before)
+		Take(C);
+	for (Construct& C : After)
+		Take(C);
+
+	Ctx = std::move(Fresh);
+	Program.clear();
+}
+
+void IncrementalParser::rebase(Construct& C, uint32_t Start)
+{
+	if (C.Origin == Start)
+		return;
+	Rebase Walker(Start - C.Origin);
+	for (Statement* S : C.Statements)
+		Walker.walk(S);
+	C.Origin = Start;
+}
+
+llvm::StringRef IncrementalParser::getText()
+{
+	Text.moveGap(Text.size());
+	return Text.front();
+}
+
+llvm::ArrayRef<Statement*> IncrementalParser::getStatementsAt(uint32_t Offset)
+{
+	seek(Offset);
+	if (After.empty() || Offset < GapStart)
+		return llvm::ArrayRef<Statement*>();
+	rebase(After.back(), GapStart);
+	return After.back().Statements;
+}
+
+Base* IncrementalParser::getTree()
+{
+	if (Tree)
+		return Tree;
+
+	Program.clear();
+	uint32_t Start = Leading;
+	auto Add = [&](Construct& C) {
+		rebase(C, Start);
+		Program.insert(Program.end(), C.Statements.begin(), C.Statements.end());
+		Start += C.Length;
+	};
+	for (Construct& C : Before)
+		Add(C);
+	for (auto It = After.rbegin(); It != After.rend(); ++It)
+		Add(*It);
+
+	Error::setSource(getText());
+	Tree = Ctx->create<Base>(llvm::makeArrayRef(Program));
+	return Tree;
+}
@@ -0,0 +1,121 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "AST.h"
+#include "Lexer.h"
+#include "Streaming.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+	front end for editor integrations. it keeps the text and the AST of one
+	buffer, and after an edit it lexes and parses again only the top level
+	constructs the edit touches, and those after them up to the first one
+	that a parse of the new text still starts at. the statements of every
+	other construct are reused as they are.
+
+	nothing is kept per token or per node of the whole buffer, so an edit
+	costs as much as the text it lexes and parses again, plus the distance
+	from the edit before it:
+	- the text has a gap at the last edit, an edit moves the characters
+	  between the two edits and no others
+	- constructs sit in a gap buffer of their own. they know their length
+	  and not their start, starts are summed up from the gap
+	- node locations count from an origin of their construct. a construct
+	  that moved keeps its nodes as they are until their locations are
+	  asked for, by getStatementsAt or getTree
+	- the nodes of replaced constructs stay in the arena until there are
+	  more of them than live ones, then the live ones are copied to a new
+	  arena. that copy costs what the edits that made the garbage did
+*/
+class IncrementalParser {
+	// characters before the gap and after it, which a null follows so
+	// the lexer stops at the end of the text
+	class GapBuffer {
+		std::vector<char> Chars;
+		size_t GapBegin;
+		size_t GapEnd;
+
+	public:
+		GapBuffer(llvm::StringRef Text);
+
+		size_t size() const { return Chars.size() - 1 - (GapEnd - GapBegin); }
+		llvm::StringRef front() const { return llvm::StringRef(Chars.data(), GapBegin); }
+		llvm::StringRef back() const { return llvm::StringRef(Chars.data() + GapEnd, Chars.size() - 1 - GapEnd); }
+
+		void moveGap(size_t Offset);
+
+		// the gap ends up after the inserted characters
+		void replace(size_t Offset, size_t Removed, llvm::StringRef Inserted);
+	};
+
+	// a top level construct, one "int a, b;" line gives several statements
+	struct Construct {
+		uint32_t Length;        // characters from its first token to the first token of the next one, or to the end
+		uint32_t Lines;         // newlines among them
+		uint32_t Origin;        // the location its first token has in its nodes
+		uint32_t Nodes;         // nodes its parse created
+		llvm::ArrayRef<Statement*> Statements;
+	};
+
+	GapBuffer Text;
+	std::unique_ptr<ASTContext> Ctx;        // statements replaced by edits stay here until compact
+	size_t LiveNodes;                       // the Nodes of every construct
+	llvm::BumpPtrAllocator NameStorage;
+	llvm::StringSaver Names;                // identifier spellings, they must outlive edits of Text
+	TokenBuffer Window;                     // tokens of the text parsed again, with the names of the whole buffer
+	std::vector<Construct> Before;          // constructs before the gap, in source order
+	std::vector<Construct> After;           // constructs after the gap, the last one first
+	uint32_t Leading;                       // characters before the first construct
+	uint32_t LeadingLines;
+	uint32_t GapStart;                      // where After.back() starts, Leading and the lengths in Before
+	uint32_t GapLines;                      // newlines before it
+	std::vector<Statement*> Program;        // the statements of getTree
+	Base* Tree;
+
+	// the text from the region parsed again to the end, and how much of
+	// it is lexed into Window
+	llvm::StringRef Rest;
+	size_t Lexed;
+	ConstructScanner Scanner;
+
+	void moveBack();
+	void moveForward();
+	void seek(uint32_t Offset);
+	void lexMore(size_t Size);
+	void rebase(Construct& C, uint32_t Start);
+	void compact();
+
+	// parses the text from RegionStart, where the gap of Text is and the
+	// one of the constructs, until a construct starts where After.back()
+	// does, which starts at Next in Rest, or to the end of the text
+	void parseFrom(uint32_t RegionStart, uint32_t Next);
+
+public:
+	IncrementalParser(llvm::StringRef Source);
+
+	// replaces Removed characters at Offset with Inserted
+	void edit(uint32_t Offset, uint32_t Removed, llvm::StringRef Inserted);
+
+	// the text as of the last edit, valid until the next edit. it closes
+	// the gap, which moves the characters after the last edit
+	llvm::StringRef getText();
+
+	// the statements of the top level construct at Offset, with their
+	// locations brought up to date. valid until the next edit
+	llvm::ArrayRef<Statement*> getStatementsAt(uint32_t Offset);
+
+	// the whole program as of the last edit, valid until the next edit.
+	// every construct that moved since the last call has its locations
+	// brought up to date here, so this costs what a pass over the whole
+	// program does. diagnostics refer to getText() afterwards
+	Base* getTree();
+
+	// the memory the nodes take, live or not yet compacted away
+	size_t getBytesAllocated() const { return Ctx->getBytesAllocated(); }
+};
+
+#endif
@@ -1,20 +1,62 @@
 #include "Lexer.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <algorithm>
 
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace charinfo {
 
+	// character classes, looked up through a 256-entry table instead of
+	// a chain of comparisons per character
+	enum : unsigned char {
+		Whitespace = 1,
+		Digit = 2,
+		Letter = 4,
+		IdentChar = Digit | Letter
+	};
+
+	struct ClassTable {
+		unsigned char Class[256];
+	};
+
+	constexpr ClassTable buildClassTable() {
+		ClassTable T{};
+		for (int c = 'a'; c <= 'z'; ++c)
+			T.Class[c] = Letter;
+		for (int c = 'A'; c <= 'Z'; ++c)
+			T.Class[c] = Letter;
+		for (int c = '0'; c <= '9'; ++c)
+			T.Class[c] = Digit;
+		T.Class[(unsigned char)' '] = Whitespace;
+		T.Class[(unsigned char)'\t'] = Whitespace;
+		T.Class[(unsigned char)'\f'] = Whitespace;
+		T.Class[(unsigned char)'\v'] = Whitespace;
+		T.Class[(unsigned char)'\r'] = Whitespace;
+		T.Class[(unsigned char)'\n'] = Whitespace;
+		return T;
+	}
+
+	constexpr ClassTable Table = buildClassTable();
+
+	LLVM_READNONE inline bool is(char c, unsigned char Mask) {
+		return Table.Class[(unsigned char)c] & Mask;
+	}
+
 	LLVM_READNONE inline bool isWhitespace(char c) {
-		return c == ' ' || c == '\t' || c == '\f' ||
-			c == '\v' || c == '\r' || c == '\n';
+		return is(c, Whitespace);
 	}
 
 	LLVM_READNONE inline bool isDigit(char c) {
-		return c >= '0' && c <= '9';
+		return is(c, Digit);
 	}
 
 	LLVM_READNONE inline bool isLetter(char c) {
-		return (c >= 'a' && c <= 'z') ||
-			(c >= 'A' && c <= 'Z');
+		return is(c, Letter);
 	}
 
 	LLVM_READNONE inline bool isOperator(char c) {
@@ -24,69 +66,186 @@ namespace charinfo {
 			c == ':' || c == ',';
 	}
 }
-void Lexer::next(Token& token) {
 
-	while (*BufferPtr && charinfo::isWhitespace(*BufferPtr)) {      // Skips whitespace like " "
-		++BufferPtr;
+namespace keywords {
+
+	// perfect hash over the keyword set: (first + last + length) & 31 gives
+	// every keyword its own slot, so a lookup is one hash and one compare
+	constexpr unsigned TableSize = 32;
+
+	constexpr unsigned hash(const char* Text, unsigned Len) {
+		return ((unsigned char)Text[0] + (unsigned char)Text[Len - 1] + Len) & (TableSize - 1);
 	}
 
-	if (!*BufferPtr) {              // since end of context is 0 -> !0 = true -> end of context
-		token.Kind = Token::eof;
-		return;
+	struct Entry {
+		const char* Text;
+		unsigned char Len;
+		Token::TokenKind Kind;
+	};
+
+	struct Table {
+		Entry Slots[TableSize];
+	};
+
+	constexpr Entry List[] = {
+		{"int", 3, Token::KW_int},
+		{"if", 2, Token::KW_if},
+		{"elif", 4, Token::KW_elif},
+		{"else", 4, Token::KW_else},
+		{"loopc", 5, Token::KW_loopc},
+		{"and", 3, Token::KW_and},
+		{"or", 2, Token::KW_or},
+		{"true", 4, Token::KW_true},
+		{"false", 5, Token::KW_false},
+		{"begin", 5, Token::KW_begin},
+		{"end", 3, Token::KW_end}
+	};
+
+	constexpr unsigned MinLen = 2;
+	constexpr unsigned MaxLen = 5;
+
+	constexpr Table buildTable() {
+		Table T{};
+		for (const Entry& E : List)
+			T.Slots[hash(E.Text, E.Len)] = E;
+		return T;
 	}
 
-	if (charinfo::isLetter(*BufferPtr)) {   // looking for keywords or identifiers like "int", a123 , ...
+	constexpr Table Keywords = buildTable();
 
-		const char* end = BufferPtr + 1;
+	constexpr bool isPerfect() {
+		for (const Entry& E : List) {
+			const Entry& Slot = Keywords.Slots[hash(E.Text, E.Len)];
+			if (Slot.Kind != E.Kind)
+				return false;
+		}
+		return true;
+	}
 
-		while (charinfo::isLetter(*end) || charinfo::isDigit(*end))
-			++end;                          // until reaches the end of lexeme
-		// example: ".int " -> "i.nt " -> "in.t " -> "int. "
+	static_assert(isPerfect(), "keyword hash has collisions");
+
+	inline Token::TokenKind lookup(const char* Text, unsigned Len) {
+		if (Len < MinLen || Len > MaxLen)
+			return Token::ident;
+		const Entry& Slot = Keywords.Slots[hash(Text, Len)];
+		if (Slot.Len != Len)
+			return Token::ident;
+		for (unsigned I = 0; I < Len; ++I)
+			if (Slot.Text[I] != Text[I])
+				return Token::ident;
+		return Slot.Kind;
+	}
+}
 
+namespace scan {
 
-		llvm::StringRef Context(BufferPtr, end - BufferPtr);  // start of lexeme, length of lexeme
+	// each function returns the first character at or after Ptr that is not
+	// in its class. the vector loops only run while a whole block is inside
+	// the buffer, the scalar tail stops at the terminating null.
 
-		Token::TokenKind kind;
+#if defined(__AVX2__)
+	inline unsigned whitespaceMask(__m256i C) {
+		__m256i Space = _mm256_cmpeq_epi8(C, _mm256_set1_epi8(' '));
+		__m256i Ctl = _mm256_sub_epi8(C, _mm256_set1_epi8('\t'));    // \t \n \v \f \r
+		Ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(Ctl, _mm256_set1_epi8(4)), Ctl);
+		return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(Space, Ctl));
+	}
 
-		if (Context == "int") {
-			kind = Token::KW_int;
-		}
-		else if (Context == "if") {
-			kind = Token::KW_if;
-		}
-		else if (Context == "elif") {
-			kind = Token::KW_elif;
-		}
-		else if (Context == "else") {
-			kind = Token::KW_else;
-		}
-		else if (Context == "loopc") {
-			kind = Token::KW_loopc;
-		}
-		else if (Context == "and") {
-			kind = Token::KW_and;
-		}
-		else if (Context == "or") {
-			kind = Token::KW_or;
-		}
-		else if (Context == "true") {
-			kind = Token::KW_true;
-		}
-		else if (Context == "false") {
-			kind = Token::KW_false;
-		}
-		else if (Context == "begin")
-		{
-			kind = Token::KW_begin;
-		}
-		else if (Context == "end")
-		{
-			kind = Token::KW_end;
-		}
-		else {
-			kind = Token::ident;
-		}
+	inline unsigned digitMask(__m256i C) {
+		__m256i D = _mm256_sub_epi8(C, _mm256_set1_epi8('0'));
+		return (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(D, _mm256_set1_epi8(9)), D));
+	}
+
+	inline unsigned identMask(__m256i C) {
+		__m256i L = _mm256_sub_epi8(_mm256_or_si256(C, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+		L = _mm256_cmpeq_epi8(_mm256_min_epu8(L, _mm256_set1_epi8(25)), L);
+		return (unsigned)_mm256_movemask_epi8(L) | digitMask(C);
+	}
+
+	constexpr unsigned Width = 32;
+	typedef __m256i Block;
+	inline Block load(const char* Ptr) { return _mm256_loadu_si256((const __m256i*)Ptr); }
+	constexpr unsigned FullMask = 0xFFFFFFFFu;
+#elif defined(__SSE2__)
+	inline unsigned whitespaceMask(__m128i C) {
+		__m128i Space = _mm_cmpeq_epi8(C, _mm_set1_epi8(' '));
+		__m128i Ctl = _mm_sub_epi8(C, _mm_set1_epi8('\t'));          // \t \n \v \f \r
+		Ctl = _mm_cmpeq_epi8(_mm_min_epu8(Ctl, _mm_set1_epi8(4)), Ctl);
+		return (unsigned)_mm_movemask_epi8(_mm_or_si128(Space, Ctl));
+	}
+
+	inline unsigned digitMask(__m128i C) {
+		__m128i D = _mm_sub_epi8(C, _mm_set1_epi8('0'));
+		return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(D, _mm_set1_epi8(9)), D));
+	}
+
+	inline unsigned identMask(__m128i C) {
+		__m128i L = _mm_sub_epi8(_mm_or_si128(C, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+		L = _mm_cmpeq_epi8(_mm_min_epu8(L, _mm_set1_epi8(25)), L);
+		return (unsigned)_mm_movemask_epi8(L) | digitMask(C);
+	}
+
+	constexpr unsigned Width = 16;
+	typedef __m128i Block;
+	inline Block load(const char* Ptr) { return _mm_loadu_si128((const __m128i*)Ptr); }
+	constexpr unsigned FullMask = 0xFFFFu;
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+	// most MAS lexemes are a few characters long, so the first characters
+	// are checked one by one and only longer runs go to the vector loop
+	constexpr unsigned ShortRun = 8;
+
+#define SCAN_RUN(MaskFn, Class)                                              \
+		for (unsigned I = 0; I < ShortRun; ++I, ++Ptr)                       \
+			if (!charinfo::is(*Ptr, Class))                                  \
+				return Ptr;                                                  \
+		while (End - Ptr >= (ptrdiff_t)Width) {                              \
+			unsigned Mask = MaskFn(load(Ptr));                               \
+			if (Mask != FullMask)                                            \
+				return Ptr + llvm::countTrailingOnes(Mask);                  \
+			Ptr += Width;                                                    \
+		}                                                                    \
+		while (charinfo::is(*Ptr, Class))                                    \
+			++Ptr;                                                           \
+		return Ptr
+#else
+#define SCAN_RUN(MaskFn, Class)                                              \
+		while (charinfo::is(*Ptr, Class))                                    \
+			++Ptr;                                                           \
+		return Ptr
+#endif
+
+	inline const char* skipWhitespace(const char* Ptr, const char* End) {
+		SCAN_RUN(whitespaceMask, charinfo::Whitespace);
+	}
+
+	inline const char* skipIdentifier(const char* Ptr, const char* End) {
+		SCAN_RUN(identMask, charinfo::IdentChar);
+	}
+
+	inline const char* skipDigits(const char* Ptr, const char* End) {
+		SCAN_RUN(digitMask, charinfo::Digit);
+	}
+
+#undef SCAN_RUN
+}
+
+void Lexer::next(Token& token) {
+
+	BufferPtr = scan::skipWhitespace(BufferPtr, BufferEnd);      // Skips whitespace like " "
 
+	if (BufferPtr >= BufferEnd || !*BufferPtr) {              // since end of context is 0 -> !0 = true -> end of context
+		token.Kind = Token::eof;
+		return;
+	}
+
+	if (charinfo::isLetter(*BufferPtr)) {   // looking for keywords or identifiers like "int", a123 , ...
+
+		const char* end = scan::skipIdentifier(BufferPtr + 1, BufferEnd);   // until reaches the end of lexeme
+		// example: ".int " -> "i.nt " -> "in.t " -> "int. "
+
+		Token::TokenKind kind = keywords::lookup(BufferPtr, end - BufferPtr);
 
 		formToken(token, end, kind);
 		return;
@@ -94,10 +253,7 @@ void Lexer::next(Token& token) {
 
 	else if (charinfo::isDigit(*BufferPtr)) {
 
-		const char* end = BufferPtr + 1;
-
-		while (charinfo::isDigit(*end))
-			++end;
+		const char* end = scan::skipDigits(BufferPtr + 1, BufferEnd);
 
 		formToken(token, end, Token::number);
 		return;
@@ -179,4 +335,159 @@ void Lexer::formToken(Token& Tok, const char* TokEnd, Token::TokenKind Kind) {
 	Tok.Kind = Kind;
 	Tok.Text = llvm::StringRef(BufferPtr, TokEnd - BufferPtr);
 	BufferPtr = TokEnd;
-}
\ No newline at end of file
+}
+
+void Lexer::lex(TokenBuffer& Tokens) {
+
+	Tokens.Source = llvm::StringRef(BufferStart, BufferEnd - BufferStart);
+
+	// generated sources average two to three bytes per token
+	size_t Expected = Tokens.size() + (BufferEnd - BufferPtr) / 2 + 1;
+	Tokens.Kinds.reserve(Expected);
+	Tokens.Offsets.reserve(Expected);
+	Tokens.Values.reserve(Expected);
+
+	Token Tok;
+	do {
+		next(Tok);
+		if (Tok.is(Token::eof)) {
+			Tokens.push(Token::eof, BufferPtr - BufferStart, 0);
+			break;
+		}
+
+		uint32_t Offset = Tok.Text.data() - BufferStart;
+		uint32_t Value;
+
+		if (Tok.is(Token::ident)) {
+			Value = Tokens.Identifiers.intern(Tok.Text);
+		}
+		else if (Tok.is(Token::number)) {   // decode the number once, here
+			uint64_t Number = 0;
+			for (char c : Tok.Text) {
+				Number = Number * 10 + (c - '0');
+				if (Number > INT32_MAX)
+					break;
+			}
+			Value = Number > INT32_MAX ? (uint32_t)TokenBuffer::OutOfRange : (uint32_t)Number;
+		}
+		else {
+			Value = Tok.Text.size();
+		}
+		Tokens.push(Tok.getKind(), Offset, Value);
+	} while (!Tok.is(Token::eof));
+}
+
+llvm::StringRef TokenBuffer::getText(unsigned I) const {
+	llvm::StringRef Text = Source.substr(Offsets[I]);
+	switch (getKind(I)) {
+	case Token::eof:
+		return llvm::StringRef();
+	case Token::number:                     // the value slot holds the number, rescan the digits
+		return Text.take_while(charinfo::isDigit);
+	case Token::ident:
+		return Identifiers.getName(Values[I]);
+	default:
+		return Text.take_front(Values[I]);
+	}
+}
+
+namespace {
+	// more chunks than threads, so one slow chunk does not hold up the rest
+	constexpr unsigned ChunksPerThread = 4;
+
+	// a chunk ends right after a ';' or whitespace character. no lexeme
+	// contains either one, so every chunk lexes exactly as the same range
+	// does inside the whole buffer
+	size_t findChunkEnd(llvm::StringRef Buffer, size_t Pos) {
+		while (Pos < Buffer.size() && Buffer[Pos] != ';' && !charinfo::isWhitespace(Buffer[Pos]))
+			++Pos;
+		return Pos < Buffer.size() ? Pos + 1 : Buffer.size();
+	}
+}
+
+const size_t Lexer::MinChunkSize;
+
+void Lexer::lexParallel(llvm::StringRef Buffer, TokenBuffer& Tokens, unsigned Threads, size_t MinChunk) {
+
+	// the serial lexer stops at the first null character
+	llvm::StringRef Input = Buffer.take_front(Buffer.find('\0'));
+	size_t Size = Input.size();
+
+	MinChunk = std::max<size_t>(MinChunk, 1);
+	if (Threads <= 1 || Size < 2 * MinChunk) {
+		Lexer Lex(Buffer);
+		Lex.lex(Tokens);
+		return;
+	}
+
+	size_t NumChunks = std::min<size_t>(Threads * ChunksPerThread, Size / MinChunk);
+	llvm::SmallVector<size_t, 64> Bounds;
+	Bounds.push_back(0);
+	for (size_t I = 1; I < NumChunks; ++I) {
+		size_t End = findChunkEnd(Input, std::max(Size * I / NumChunks, Bounds.back()));
+		if (End > Bounds.back() && End < Size)
+			Bounds.push_back(End);
+	}
+	Bounds.push_back(Size);
+	NumChunks = Bounds.size() - 1;
+
+	// every chunk lexes into its own buffer with its own identifier table
+	std::vector<TokenBuffer> Chunks(NumChunks);
+	llvm::ThreadPool Pool(llvm::hardware_concurrency(Threads));
+	for (size_t I = 0; I < NumChunks; ++I) {
+		Pool.async([&, I] {
+			Lexer Lex(Input.slice(Bounds[I], Bounds[I + 1]));
+			Lex.lex(Chunks[I]);
+		});
+	}
+	Pool.wait();
+
+	// merging the identifier tables in chunk order interns every name in
+	// order of first appearance, so ids come out the same as with lex().
+	// only the distinct names of each chunk are hashed here
+	std::vector<std::vector<uint32_t>> Remap(NumChunks);
+	std::vector<size_t> Starts(NumChunks + 1);
+	Starts[0] = 0;
+	for (size_t I = 0; I < NumChunks; ++I) {
+		const IdentifierTable& Local = Chunks[I].Identifiers;
+		Remap[I].resize(Local.size());
+		for (unsigned Id = 0; Id < Local.size(); ++Id)
+			Remap[I][Id] = Tokens.Identifiers.intern(Local.getName(Id));
+		Starts[I + 1] = Starts[I] + Chunks[I].size() - 1;      // drop the chunk's eof
+	}
+
+	size_t Total = Starts[NumChunks] + 1;
+	Tokens.Source = Buffer;
+	Tokens.Kinds.resize(Total);
+	Tokens.Offsets.resize(Total);
+	Tokens.Values.resize(Total);
+
+	// stitch the chunks into place, rebasing offsets and renumbering ids
+	for (size_t I = 0; I < NumChunks; ++I) {
+		Pool.async([&, I] {
+			const TokenBuffer& Chunk = Chunks[I];
+			const std::vector<uint32_t>& Ids = Remap[I];
+			uint32_t Base = Bounds[I];
+			size_t Out = Starts[I];
+			for (unsigned T = 0, E = Chunk.size() - 1; T != E; ++T, ++Out) {
+				Token::TokenKind Kind = Chunk.getKind(T);
+				Tokens.Kinds[Out] = Kind;
+				Tokens.Offsets[Out] = Chunk.Offsets[T] + Base;
+				Tokens.Values[Out] = Kind == Token::ident ? Ids[Chunk.Values[T]] : Chunk.Values[T];
+			}
+		});
+	}
+	Pool.wait();
+
+	Tokens.Kinds[Total - 1] = Token::eof;
+	Tokens.Offsets[Total - 1] = Size;
+	Tokens.Values[Total - 1] = 0;
+}
+
+size_t Lexer::lexWindow(llvm::StringRef Buffer, size_t Begin, size_t Size, TokenBuffer& Tokens) {
+
+	size_t End = Begin + Size < Buffer.size() ? findChunkEnd(Buffer, Begin + Size) : Buffer.size();
+	Lexer Lex(Buffer, Begin, End);
+	Lex.lex(Tokens);
+	return End;
+}
@@ -1,9 +1,13 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/StringRef.h"        // encapsulates a pointer to a C string and its length
+#include "llvm/Support/StringSaver.h"
 #include "llvm/Support/MemoryBuffer.h" // provides read-only access to a block of memory, filled
 // with the content of a file
+#include <cstdint>
+#include <vector>
 
 class Lexer;
 
@@ -75,18 +79,155 @@ public:
 	}
 };
 
+/*
+	interns identifier spellings into dense 32-bit ids, numbered in order
+	of first appearance. the spellings point into the source buffer.
+*/
+class IdentifierTable {
+	llvm::DenseMap<llvm::StringRef, uint32_t> Ids;
+	std::vector<llvm::StringRef> Names;
+
+public:
+	uint32_t intern(llvm::StringRef Name) {
+		auto Result = Ids.try_emplace(Name, (uint32_t)Names.size());
+		if (Result.second)
+			Names.push_back(Name);
+		return Result.first->second;
+	}
+
+	// like intern, but a new name is copied into Saver so it outlives the source
+	uint32_t intern(llvm::StringRef Name, llvm::StringSaver& Saver) {
+		auto It = Ids.find(Name);
+		if (It != Ids.end())
+			return It->second;
+		return intern(Saver.save(Name));
+	}
+
+	llvm::StringRef getName(uint32_t Id) const { return Names[Id]; }
+	unsigned size() const { return Names.size(); }
+};
+
+/*
+	pre-lexed token stream stored as parallel arrays. a token is a one byte
+	kind, the 32-bit offset of its first character in the source and a 32-bit
+	value: the decoded number for number tokens, the interned id for
+	identifiers and the length of the lexeme for everything else. the
+	stream always ends with an eof token.
+
+	a number too large for an int has the value OutOfRange, the parser
+	reports it.
+*/
+class TokenBuffer {
+	friend class Lexer;
+	friend class IncrementalParser;
+	friend class StreamingParser;
+
+	llvm::StringRef Source;
+	std::vector<uint8_t> Kinds;
+	std::vector<uint32_t> Offsets;
+	std::vector<uint32_t> Values;
+	IdentifierTable Identifiers;
+
+	void push(Token::TokenKind Kind, uint32_t Offset, uint32_t Value) {
+		Kinds.push_back(Kind);
+		Offsets.push_back(Offset);
+		Values.push_back(Value);
+	}
+
+public:
+	static const int OutOfRange = -1;
+
+	unsigned size() const { return Kinds.size(); }
+	llvm::StringRef getSource() const { return Source; }
+
+	Token::TokenKind getKind(unsigned I) const { return (Token::TokenKind)Kinds[I]; }
+	uint32_t getOffset(unsigned I) const { return Offsets[I]; }
+	int getNumber(unsigned I) const { return (int)Values[I]; }
+	uint32_t getIdentifier(unsigned I) const { return Values[I]; }
+	llvm::StringRef getText(unsigned I) const;
+
+	const IdentifierTable& getIdentifiers() const { return Identifiers; }
+};
+
+static_assert(Token::KW_end <= UINT8_MAX, "token kinds must fit in the kind array");
+
+/*
+	read position inside a TokenBuffer. it answers the same questions as a
+	Token, so the parser can look at the current token and any token after
+	it without lexing again.
+*/
+class TokenCursor {
+	const TokenBuffer* Buffer;
+	unsigned Index;
+
+public:
+	TokenCursor(const TokenBuffer& Buffer, unsigned Index = 0) : Buffer(&Buffer), Index(Index) {}
+
+	Token::TokenKind getKind() const { return Buffer->getKind(Index); }
+	llvm::StringRef getText() const { return Buffer->getText(Index); }
+	int getNumber() const { return Buffer->getNumber(Index); }
+	uint32_t getIdentifier() const { return Buffer->getIdentifier(Index); }
+	uint32_t getOffset() const { return Buffer->getOffset(Index); }
+	unsigned getIndex() const { return Index; }
+
+	// kind of the token N places ahead, eof once past the end of the stream
+	Token::TokenKind peek(unsigned N) const {
+		unsigned I = Index + N;
+		return I < Buffer->size() ? Buffer->getKind(I) : Token::eof;
+	}
+
+	void advance() {
+		if (Index + 1 < Buffer->size())
+			++Index;
+	}
+
+	bool is(Token::TokenKind K) const { return getKind() == K; }
+
+	bool isOneOf(Token::TokenKind K1, Token::TokenKind K2) const {
+		return is(K1) || is(K2);
+	}
+
+	template <typename... Ts>
+	bool isOneOf(Token::TokenKind K1, Token::TokenKind K2, Ts... Ks) const {
+		return is(K1) || isOneOf(K2, Ks...);
+	}
+};
+
 class Lexer {
 	const char* BufferStart;
 	const char* BufferPtr;
+	const char* BufferEnd;          // one past the last character, used to bound the SIMD scans
 
 public:
 	Lexer(const llvm::StringRef& Buffer) {    // constructor scans the whole context
 		BufferStart = Buffer.begin();
 		BufferPtr = BufferStart;
+		BufferEnd = Buffer.end();
+	}
+
+	// scans Buffer[Begin, End) only, offsets still count from the start of Buffer
+	Lexer(const llvm::StringRef& Buffer, size_t Begin, size_t End) {
+		BufferStart = Buffer.begin();
+		BufferPtr = BufferStart + Begin;
+		BufferEnd = BufferStart + End;
 	}
 
 	void next(Token& token);                       // gets next token
 
+	void lex(TokenBuffer& Tokens);                 // lexes the rest of the input into Tokens
+
+	// chunks of the parallel lexer below this size are not worth a task of their own
+	static const size_t MinChunkSize = 1 << 20;
+
+	// lexes Buffer on Threads threads, the result is the same as lex().
+	// tests pass a smaller MinChunk to get many chunks out of a small input
+	static void lexParallel(llvm::StringRef Buffer, TokenBuffer& Tokens, unsigned Threads, size_t MinChunk = MinChunkSize);
+
+	// lexes about Size characters of Buffer from Begin onto the end of
+	// Tokens, stopping where lex() would also end a token. returns where
+	// it stopped, the next window starts there
+	static size_t lexWindow(llvm::StringRef Buffer, size_t Begin, size_t Size, TokenBuffer& Tokens);
+
 private:
 	void formToken(Token& Result, const char* TokEnd,
 		Token::TokenKind Kind);
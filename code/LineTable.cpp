@@ -0,0 +1,54 @@
+#include "LineTable.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+	// calls F(offset) for every '\n' in Source, 16 bytes at a time where possible
+	template <typename Fn>
+	void forEachNewline(llvm::StringRef Source, Fn F) {
+		const char* Start = Source.begin();
+		const char* Ptr = Start;
+		const char* End = Source.end();
+#if defined(__SSE2__)
+		const __m128i NewLine = _mm_set1_epi8('\n');
+		for (; End - Ptr >= 16; Ptr += 16) {
+			unsigned Mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)Ptr), NewLine));
+			while (Mask) {
+				F(uint32_t(Ptr - Start) + llvm::countTrailingZeros(Mask));
+				Mask &= Mask - 1;
+			}
+		}
+#endif
+		for (; Ptr != End; ++Ptr)
+			if (*Ptr == '\n')
+				F(uint32_t(Ptr - Start));
+	}
+}
+
+void LineTable::build() {
+	// count first so the table is allocated exactly once
+	size_t Lines = 1;
+	forEachNewline(Source, [&](uint32_t) { ++Lines; });
+
+	LineStarts.reserve(Lines);
+	LineStarts.push_back(0);
+	forEachNewline(Source, [&](uint32_t Offset) { LineStarts.push_back(Offset + 1); });
+	Built = true;
+}
+
+std::pair<unsigned, unsigned> LineTable::getLineAndColumn(uint32_t Offset) {
+	if (!Built)
+		build();
+
+	// the last line start that is not after Offset
+	auto It = std::upper_bound(LineStarts.begin(), LineStarts.end(), Offset);
+	unsigned Line = It - LineStarts.begin();
+	unsigned Column = Offset - *(It - 1) + 1;
+	if (Line == 1)
+		Column += FirstColumn - 1;
+	return { Line + FirstLine - 1, Column };
+}
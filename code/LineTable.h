@@ -0,0 +1,42 @@
+#ifndef LINETABLE_H
+#define LINETABLE_H
+
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <vector>
+
+/*
+	maps 32-bit source offsets to 1-based line and column numbers.
+	tokens and AST nodes only carry the offset, the table of line starts
+	is built the first time a diagnostic asks for a position.
+*/
+class LineTable {
+	llvm::StringRef Source;
+	std::vector<uint32_t> LineStarts;   // offset of the first character of every line
+	unsigned FirstLine;                 // where Source starts, when it is the tail of a larger text
+	unsigned FirstColumn;
+	bool Built;
+
+	void build();
+
+public:
+	LineTable() : FirstLine(1), FirstColumn(1), Built(false) {}
+	LineTable(llvm::StringRef Source) : Source(Source), FirstLine(1), FirstColumn(1), Built(false) {}
+
+	// Line and Column are the position of the first character of Buffer,
+	// offsets still count from it
+	void setSource(llvm::StringRef Buffer, unsigned Line = 1, unsigned Column = 1) {
+		Source = Buffer;
+		FirstLine = Line;
+		FirstColumn = Column;
+		LineStarts.clear();
+		Built = false;
+	}
+
+	bool hasSource() const { return Source.data() != nullptr; }
+
+	// returns {line, column} of Offset
+	std::pair<unsigned, unsigned> getLineAndColumn(uint32_t Offset);
+};
+
+#endif
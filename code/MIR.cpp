@@ -0,0 +1,642 @@
+#include "MIR.h"
+#include "ASTWalker.h"
+#include "Error.h"
+#include "llvm/ADT/DenseMap.h"
+#include <algorithm>
+#include <tuple>
+
+const uint32_t MIR::None;
+
+llvm::MutableArrayRef<MIR::ValueId> MIR::getOperands(ValueId V)
+{
+	Inst& I = Insts[V];
+	switch (I.Op)
+	{
+	case Const:
+	case Dead:
+		return llvm::MutableArrayRef<ValueId>();
+	case Pow:
+	case Copy:
+		return llvm::MutableArrayRef<ValueId>(I.Ops, 1);
+	case Phi:
+		return llvm::MutableArrayRef<ValueId>(PhiOperands.data() + I.Ops[0], I.Ops[1]);
+	default:
+		return llvm::MutableArrayRef<ValueId>(I.Ops, 2);
+	}
+}
+
+void MIR::removeEdge(BlockId From, BlockId To)
+{
+	Block& B = Blocks[To];
+	size_t Index = std::find(B.Preds.begin(), B.Preds.end(), From) - B.Preds.begin();
+	B.Preds.erase(B.Preds.begin() + Index);
+	for (ValueId P : B.Phis)
+	{
+		llvm::MutableArrayRef<ValueId> Operands = getOperands(P);
+		std::copy(Operands.begin() + Index + 1, Operands.end(), Operands.begin() + Index);
+		--Insts[P].Ops[1];
+	}
+}
+
+size_t MIR::countInsts() const
+{
+	size_t Count = 0;
+	for (const Inst& I : Insts)
+		Count += I.Op != Dead && I.Op != Const;
+	return Count;
+}
+
+size_t MIR::countPhis() const
+{
+	size_t Count = 0;
+	for (const Block& B : Blocks)
+		Count += B.Live ? B.Phis.size() : 0;
+	return Count;
+}
+
+size_t MIR::countGuards() const
+{
+	size_t Count = 0;
+	for (const Inst& I : Insts)
+		Count += (I.Op == Div || I.Op == Mod) && (I.Flags & Guarded);
+	return Count;
+}
+
+size_t MIR::countBlocks() const
+{
+	size_t Count = 0;
+	for (const Block& B : Blocks)
+		Count += B.Live;
+	return Count;
+}
+
+void MIR::print(llvm::raw_ostream& OS)
+{
+	static const char* const OpNames[] = { "const", "add", "sub", "mul", "div", "mod", "pow",
+		"eq", "ne", "lt", "le", "gt", "ge", "and", "or", "copy", "phi", "dead" };
+	static const char* const KindNames[] = { "entry", "if.body", "elif.cond", "elif.body", "else.body",
+		"after.if", "loop.cond", "loop.body", "after.loop" };
+
+	for (size_t R = 0; R < Regions.size(); ++R)
+	{
+		OS << "region " << R << ": " << (Regions[R].Kind == Region::If ? "if" : "loop")
+			<< " b" << Regions[R].Entry << " .. b" << Regions[R].Exit;
+		if (Regions[R].Parent != None)
+			OS << " in region " << Regions[R].Parent;
+		OS << "\n";
+	}
+
+	auto printInst = [&](ValueId V) {
+		Inst& I = Insts[V];
+		OS << "  %" << V << " = " << OpNames[I.Op];
+		if (I.Op == Const)
+			OS << " " << (I.IsBool ? (I.Imm ? "true" : "false") : llvm::Twine(I.Imm).str());
+		else if (I.Op == Phi)
+		{
+			llvm::MutableArrayRef<ValueId> Operands = getOperands(V);
+			for (size_t P = 0; P < Operands.size(); ++P)
+				OS << (P ? ", [%" : " [%") << Operands[P] << ", b" << Blocks[I.Block].Preds[P] << "]";
+		}
+		else
+		{
+			llvm::MutableArrayRef<ValueId> Operands = getOperands(V);
+			for (size_t P = 0; P < Operands.size(); ++P)
+				OS << (P ? ", %" : " %") << Operands[P];
+			if (I.Op == Pow)
+				OS << ", " << I.Imm;
+			if ((I.Op == Div || I.Op == Mod) && (I.Flags & Guarded))
+				OS << ", guarded at line " << I.Imm;
+		}
+		OS << "\n";
+	};
+
+	for (BlockId B = 0; B < Blocks.size(); ++B)
+	{
+		Block& Blk = Blocks[B];
+		if (!Blk.Live)
+			continue;
+		OS << "b" << B << " (" << KindNames[Blk.Kind] << "):";
+		for (BlockId P : Blk.Preds)
+			OS << " b" << P;
+		OS << "\n";
+		for (ValueId P : Blk.Phis)
+			printInst(P);
+		for (ValueId V = Blk.First; V < Blk.End; ++V)
+			if (isBlockInst(V, B) && Insts[V].Op != Dead)
+				printInst(V);
+		switch (Blk.Term)
+		{
+		case Br:
+			OS << "  br b" << Blk.Succ[0] << "\n";
+			break;
+		case CondBr:
+			OS << "  br %" << Blk.Cond << ", b" << Blk.Succ[0] << ", b" << Blk.Succ[1] << "\n";
+			break;
+		case Ret:
+			OS << "  ret";
+			for (Variable& Var : Exit)
+				OS << " " << Var.Name << " = %" << Var.Value;
+			OS << "\n";
+			break;
+		}
+	}
+}
+
+/*
+	builds SSA form in one walk. Defs holds the value every variable has
+	at the end of the current block, so a use is that value, and an if
+	or a loop logs the changes made inside it, to undo them where the
+	paths through it part and join.
+
+	after an if, a variable changed in one of its branches gets a phi of
+	the values it has at the end of each branch. a loop needs a phi in
+	its header for every variable the body reads or changes, but those
+	are only known once the body is built, so the phi is made at the
+	first use or change inside the loop, by reach(). its operand from the
+	end of the body is filled in when the loop ends. DefDepth says in
+	how many of the open loops the current value of a variable was
+	defined, a value from outside a loop is reached through the phis of
+	the loops in between.
+*/
+class MIRBuilder::Walker : public ASTWalker<Walker> {
+	friend class ASTWalker<Walker>;
+
+	MIR& F;
+	bool ReuseValues;
+	bool GuardDivisions;
+	MIR::BlockId Current;
+	uint32_t CurrentRegion;
+	llvm::SmallVector<MIR::ValueId, 16> Values;     // values of the expressions walked so far
+
+	// indexed by symbol id
+	std::vector<MIR::ValueId> Defs;
+	std::vector<uint32_t> DefDepth;
+	std::vector<uint32_t> Seen;             // marks a variable as handled for the current Stamp
+	std::vector<MIR::ValueId> PhiOf;        // the phi a variable gets after an if
+	uint32_t Stamp;
+
+	struct Change {
+		uint32_t Var;
+		MIR::ValueId Def;
+		uint32_t Depth;
+	};
+	std::vector<Change> Log;        // only kept while an if or a loop is open
+
+	struct HeaderPhi {
+		uint32_t Var;
+		MIR::ValueId Phi;
+	};
+	struct LoopState {
+		MIR::BlockId Header;
+		MIR::BlockId Exit;
+		size_t LogStart;
+		uint32_t Region;
+		llvm::SmallVector<HeaderPhi, 4> Phis;
+	};
+	llvm::SmallVector<LoopState, 8> Loops;
+
+	// the value a variable has at the end of one branch of an if
+	struct BranchDef {
+		uint32_t Var;
+		MIR::ValueId Value;
+		uint32_t Pred;      // the end of the branch among the predecessors of the join
+	};
+	struct IfState {
+		MIR::BlockId Join;
+		MIR::BlockId Next;          // the block the last condition branches to if it fails
+		size_t LogStart;
+		size_t FirstDef;
+		uint32_t Region;
+	};
+	llvm::SmallVector<IfState, 8> Ifs;
+	std::vector<BranchDef> BranchDefs;
+
+	llvm::DenseMap<std::tuple<unsigned, MIR::ValueId, MIR::ValueId>, MIR::ValueId> Computed;
+
+	MIR::ValueId pop()
+	{
+		return Values.pop_back_val();
+	}
+
+	MIR::BlockId newBlock(MIR::BlockKind Kind)
+	{
+		MIR::Block B;
+		B.Kind = Kind;
+		B.Term = MIR::Ret;
+		B.Live = true;
+		B.Cond = MIR::None;
+		B.Succ[0] = B.Succ[1] = MIR::None;
+		B.First = B.End = 0;
+		F.Blocks.push_back(B);
+		return F.Blocks.size() - 1;
+	}
+
+	void setCurrent(MIR::BlockId B)
+	{
+		F.Blocks[Current].End = F.Insts.size();
+		Current = B;
+		F.Blocks[B].First = F.Insts.size();
+		if (ReuseValues)
+			Computed.clear();
+	}
+
+	void branch(MIR::BlockId To)
+	{
+		MIR::Block& B = F.Blocks[Current];
+		B.Term = MIR::Br;
+		B.Succ[0] = To;
+		F.Blocks[To].Preds.push_back(Current);
+	}
+
+	void condBranch(MIR::ValueId Cond, MIR::BlockId Then, MIR::BlockId Else)
+	{
+		MIR::Block& B = F.Blocks[Current];
+		B.Term = MIR::CondBr;
+		B.Cond = Cond;
+		B.Succ[0] = Then;
+		B.Succ[1] = Else;
+		F.Blocks[Then].Preds.push_back(Current);
+		F.Blocks[Else].Preds.push_back(Current);
+	}
+
+	MIR::ValueId emit(MIR::Opcode Op, MIR::ValueId A, MIR::ValueId B = MIR::None, int32_t Imm = 0, bool IsBool = false)
+	{
+		std::tuple<unsigned, MIR::ValueId, MIR::ValueId> Key(Op | IsBool << 8, A, Op == MIR::Const || Op == MIR::Pow ? (uint32_t)Imm : B);
+		if (ReuseValues)
+		{
+			if (MIR::ValueId V = Computed.lookup(Key))
+				return V;
+		}
+		MIR::Inst I;
+		I.Op = Op;
+		I.IsBool = IsBool;
+		I.Flags = 0;
+		I.Imm = Imm;
+		I.Ops[0] = A;
+		I.Ops[1] = B;
+		I.Block = Current;
+		F.Insts.push_back(I);
+		// value 0 is never reused, so a lookup that finds nothing is told apart
+		if (ReuseValues && F.Insts.size() > 1)
+			Computed[Key] = F.Insts.size() - 1;
+		return F.Insts.size() - 1;
+	}
+
+	MIR::ValueId constant(int32_t Value, bool IsBool)
+	{
+		return emit(MIR::Const, MIR::None, MIR::None, Value, IsBool);
+	}
+
+	// a phi in Block with Count operands, all of them Init for now
+	MIR::ValueId phi(MIR::BlockId Block, size_t Count, MIR::ValueId Init)
+	{
+		MIR::Inst I;
+		I.Op = MIR::Phi;
+		I.IsBool = false;
+		I.Flags = 0;
+		I.Imm = 0;
+		I.Ops[0] = F.PhiOperands.size();
+		I.Ops[1] = Count;
+		I.Block = Block;
+		F.PhiOperands.resize(F.PhiOperands.size() + Count, Init);
+		F.Insts.push_back(I);
+		F.Blocks[Block].Phis.push_back(F.Insts.size() - 1);
+		return F.Insts.size() - 1;
+	}
+
+	// gives Var a phi in the header of every open loop its value comes from outside of
+	void reach(uint32_t Var)
+	{
+		while (DefDepth[Var] < Loops.size())
+		{
+			LoopState& Loop = Loops[DefDepth[Var]];
+			MIR::ValueId Phi = phi(Loop.Header, 2, Defs[Var]);
+			Loop.Phis.push_back({ Var, Phi });
+			Defs[Var] = Phi;
+			++DefDepth[Var];
+		}
+	}
+
+	void define(uint32_t Var, MIR::ValueId V)
+	{
+		if (!Ifs.empty() || !Loops.empty())
+			Log.push_back({ Var, Defs[Var], DefDepth[Var] });
+		Defs[Var] = V;
+		DefDepth[Var] = Loops.size();
+	}
+
+	// undoes the changes logged since Start
+	void undo(size_t Start)
+	{
+		for (size_t I = Log.size(); I-- > Start;)
+		{
+			Defs[Log[I].Var] = Log[I].Def;
+			DefDepth[Log[I].Var] = Log[I].Depth;
+		}
+		Log.resize(Start);
+	}
+
+	uint32_t openRegion(MIR::Region::RegionKind Kind, MIR::BlockId Entry, MIR::BlockId Exit)
+	{
+		F.Regions.push_back({ Kind, Entry, Exit, CurrentRegion });
+		CurrentRegion = F.Regions.size() - 1;
+		return CurrentRegion;
+	}
+
+	bool visitIdentifier(Expression* E, unsigned Step)
+	{
+		reach(E->getSymbol());
+		Values.push_back(Defs[E->getSymbol()]);
+		return false;
+	}
+
+	bool visitNumber(Expression* E, unsigned Step)
+	{
+		Values.push_back(constant(E->getNumber(), false));
+		return false;
+	}
+
+	bool visitBoolean(Expression* E, unsigned Step)
+	{
+		Values.push_back(constant(E->getBoolean(), true));
+		return false;
+	}
+
+	bool visitBinaryOp(BinaryOp* Op, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			push(Op->getLeft());
+			push(Op->getRight());
+			return true;
+		}
+		MIR::ValueId R = pop();
+		MIR::ValueId L = pop();
+
+		MIR::ValueId V = R;
+		switch (Op->getOperator())
+		{
+		case BinaryOp::Plus:
+			V = emit(MIR::Add, L, R);
+			break;
+		case BinaryOp::Minus:
+			V = emit(MIR::Sub, L, R);
+			break;
+		case BinaryOp::Mul:
+			V = emit(MIR::Mul, L, R);
+			break;
+		case BinaryOp::Div:
+		case BinaryOp::Mod:
+			V = emit(Op->getOperator() == BinaryOp::Div ? MIR::Div : MIR::Mod, L, R,
+				GuardDivisions ? Error::getLine(Op->getLocation()) : 0);
+			if (GuardDivisions)
+				F.Insts[V].Flags |= MIR::Guarded;
+			break;
+		case BinaryOp::Pow:
+			// like the direct generation, only a literal power is computed
+			// and any other exponent is the result
+			if (Op->getRight()->isNumber())
+			{
+				int Power = Op->getRight()->getNumber();
+				V = Power == 0 ? constant(1, false) : Power < 0 ? L : emit(MIR::Pow, L, MIR::None, Power);
+			}
+			break;
+		}
+		Values.push_back(V);
+		return false;
+	}
+
+	bool visitBooleanOp(BooleanOp* Op, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			push(Op->getLeft());
+			push(Op->getRight());
+			return true;
+		}
+		MIR::ValueId R = pop();
+		MIR::ValueId L = pop();
+
+		static const MIR::Opcode Opcodes[] = { MIR::CmpLE, MIR::CmpLT, MIR::CmpGT, MIR::CmpGE, MIR::CmpEQ, MIR::CmpNE, MIR::And, MIR::Or };
+		Values.push_back(emit(Opcodes[Op->getOperator()], L, R, 0, true));
+		return false;
+	}
+
+	bool visitDeclaration(DecStatement* Dec, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			push(Dec->getRValue());
+			return true;
+		}
+		MIR::ValueId V = pop();
+		if (Dec->getRValue()->isVariable())
+			V = emit(MIR::Copy, V);
+
+		uint32_t Var = Dec->getLValue()->getSymbol();
+		if (Var >= Defs.size())
+		{
+			size_t Size = std::max<size_t>(Var + 1, Defs.size() * 2);
+			Defs.resize(Size);
+			DefDepth.resize(Size);
+			Seen.resize(Size);
+			PhiOf.resize(Size);
+		}
+		F.Exit.push_back({ Var, Dec->getLValue()->getValue(), MIR::None });
+		define(Var, V);
+		return false;
+	}
+
+	bool visitAssignment(AssignStatement* Assign, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			push(Assign->getRValue());
+			return true;
+		}
+		MIR::ValueId V = pop();
+		if (Assign->getRValue()->isVariable())
+			V = emit(MIR::Copy, V);
+
+		uint32_t Var = Assign->getLValue()->getSymbol();
+		reach(Var);
+		define(Var, V);
+		return false;
+	}
+
+	// ends the branch of an if that Current is the last block of
+	void endBranch(IfState& If)
+	{
+		uint32_t Pred = F.Blocks[If.Join].Preds.size();
+		branch(If.Join);
+		++Stamp;
+		for (size_t I = Log.size(); I-- > If.LogStart;)
+		{
+			uint32_t Var = Log[I].Var;
+			if (Seen[Var] == Stamp)
+				continue;
+			Seen[Var] = Stamp;
+			BranchDefs.push_back({ Var, Defs[Var], Pred });
+		}
+		undo(If.LogStart);
+	}
+
+	/*
+		Step 2 * N + 1 has the condition of branch N on Values, the if is
+		branch 0 and its elifs follow, and Step 2 * N + 2 comes after its
+		body. the else body ends the step after the last one of those
+	*/
+	bool visitIf(IfStatement* If, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			push(If->getCondition());
+			return true;
+		}
+		if (Step == 1)
+		{
+			IfState State;
+			State.Join = newBlock(MIR::AfterIf);
+			State.LogStart = Log.size();
+			State.FirstDef = BranchDefs.size();
+			State.Region = openRegion(MIR::Region::If, Current, State.Join);
+			Ifs.push_back(State);
+		}
+
+		IfState& State = Ifs.back();
+		llvm::ArrayRef<ElifStatement*> Elifs = If->getElifsStatements();
+		unsigned Branches = Elifs.size() + 1;
+		unsigned Branch = (Step - 1) / 2;
+		if (Step % 2 == 1 && Branch < Branches)
+		{
+			MIR::ValueId Cond = pop();
+			MIR::BlockId Body = newBlock(Branch == 0 ? MIR::IfBody : MIR::ElifBody);
+			State.Next = Branch + 1 < Branches ? newBlock(MIR::ElifCond) : If->hasElse() ? newBlock(MIR::ElseBody) : State.Join;
+			condBranch(Cond, Body, State.Next);
+			setCurrent(Body);
+			push(Branch == 0 ? If->getStatements() : Elifs[Branch - 1]->getStatements());
+			return true;
+		}
+
+		endBranch(State);
+		if (Step % 2 == 0 && Branch + 1 < Branches)
+		{
+			setCurrent(State.Next);
+			push(Elifs[Branch]->getCondition());
+			return true;
+		}
+		if (Step % 2 == 0 && If->hasElse())
+		{
+			setCurrent(State.Next);
+			push(If->getElseStatement()->getStatements());
+			return true;
+		}
+
+		// every variable changed in a branch gets a phi, with the value it
+		// had before the if on the edges of the other branches
+		IfState Done = Ifs.pop_back_val();
+		setCurrent(Done.Join);
+		size_t Count = F.Blocks[Done.Join].Preds.size();
+		++Stamp;
+		for (size_t I = Done.FirstDef; I < BranchDefs.size(); ++I)
+		{
+			BranchDef& D = BranchDefs[I];
+			if (Seen[D.Var] != Stamp)
+			{
+				Seen[D.Var] = Stamp;
+				PhiOf[D.Var] = phi(Done.Join, Count, Defs[D.Var]);
+			}
+			F.getOperands(PhiOf[D.Var])[D.Pred] = D.Value;
+		}
+		++Stamp;
+		for (size_t I = Done.FirstDef; I < BranchDefs.size(); ++I)
+		{
+			uint32_t Var = BranchDefs[I].Var;
+			if (Seen[Var] == Stamp)
+				continue;
+			Seen[Var] = Stamp;
+			define(Var, PhiOf[Var]);
+		}
+		BranchDefs.resize(Done.FirstDef);
+		CurrentRegion = F.Regions[Done.Region].Parent;
+		return false;
+	}
+
+	bool visitLoop(LoopStatement* Loop, unsigned Step)
+	{
+		if (Step == 0)
+		{
+			LoopState State;
+			State.Header = newBlock(MIR::LoopCond);
+			State.Exit = MIR::None;
+			State.LogStart = Log.size();
+			branch(State.Header);
+			setCurrent(State.Header);
+			State.Region = openRegion(MIR::Region::Loop, State.Header, MIR::None);
+			Loops.push_back(State);
+			push(Loop->getCondition());
+			return true;
+		}
+
+		LoopState& State = Loops.back();
+		if (Step == 1)
+		{
+			MIR::ValueId Cond = pop();
+			MIR::BlockId Body = newBlock(MIR::LoopBody);
+			State.Exit = newBlock(MIR::AfterLoop);
+			F.Regions[State.Region].Exit = State.Exit;
+			condBranch(Cond, Body, State.Exit);
+			setCurrent(Body);
+			push(Loop->getStatements());
+			return true;
+		}
+
+		// the end of the body is the second predecessor of the header
+		branch(State.Header);
+		for (HeaderPhi& P : State.Phis)
+			F.getOperands(P.Phi)[1] = Defs[P.Var];
+		undo(State.LogStart);
+
+		// after the loop the variables have the values of the header phis,
+		// which changes them for the if or loop around this one
+		LoopState Done = Loops.pop_back_val();
+		for (HeaderPhi& P : Done.Phis)
+		{
+			if (!Ifs.empty() || !Loops.empty())
+				Log.push_back({ P.Var, F.getOperands(P.Phi)[0], (uint32_t)Loops.size() });
+			DefDepth[P.Var] = Loops.size();
+		}
+		setCurrent(Done.Exit);
+		CurrentRegion = F.Regions[Done.Region].Parent;
+		return false;
+	}
+
+public:
+	Walker(MIR& F, bool ReuseValues, bool GuardDivisions) :
+		F(F), ReuseValues(ReuseValues), GuardDivisions(GuardDivisions), Current(0), CurrentRegion(MIR::None), Stamp(0)
+	{
+		newBlock(MIR::Entry);
+	}
+
+	void finish()
+	{
+		F.Blocks[Current].End = F.Insts.size();
+		F.Blocks[Current].Term = MIR::Ret;
+		for (MIR::Variable& Var : F.Exit)
+			Var.Value = Defs[Var.Symbol];
+	}
+};
+
+MIRBuilder::MIRBuilder(MIR& F, bool ReuseValues, bool GuardDivisions) : W(new Walker(F, ReuseValues, GuardDivisions)) {}
+
+MIRBuilder::~MIRBuilder() {}
+
+void MIRBuilder::add(Statement* S)
+{
+	W->walk(S);
+}
+
+void MIRBuilder::finish()
+{
+	W->finish();
+}
@@ -0,0 +1,206 @@
+#ifndef MIR_H
+#define MIR_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+	mid-level IR of a whole program, between the AST and LLVM IR. the
+	program is one function made of basic blocks. every instruction
+	defines one integer or boolean value and a variable is only a name
+	for the value it was given last (SSA), so where control flow joins,
+	after an if and at the condition of a loop, a phi picks the value a
+	variable has on the edge that was taken.
+
+	the program has no input and no output, what it computes are the
+	values it leaves in its variables. Exit lists them, passes keep the
+	operations those values and the branches depend on.
+
+	operands of an instruction by opcode:
+		Const          Imm, a boolean if IsBool
+		Add .. Mod     Ops[0], Ops[1], a Guarded Div or Mod has the line
+		               of the division in Imm, to report it
+		Pow            Ops[0] ^ Imm, Imm >= 1
+		Cmp.., And, Or Ops[0], Ops[1], the result is a boolean
+		Copy           Ops[0]
+		Phi            Ops[1] operands from PhiOperands[Ops[0]], one per
+		               predecessor of its block in the order of Block::Preds
+
+	the instructions of a block are the range [First, End) of Insts, a
+	block is filled completely before the next one is started. phis are
+	listed in Block::Phis instead, the phis of a loop header are only
+	known once the body is being built, so a range can hold phis, and
+	what became of them, of other blocks. isBlockInst tells them apart.
+	a removed instruction stays in place as Dead, a removed block is no
+	longer Live.
+
+	every if and loop is a Region. for an if it starts at the block its
+	condition is computed in, for a loop at the header that holds the
+	condition and that the body branches back to, and it ends at the
+	block after the statement.
+*/
+class MIR {
+public:
+	typedef uint32_t ValueId;
+	typedef uint32_t BlockId;
+	static const uint32_t None = ~0u;
+
+	enum Opcode : uint8_t {
+		Const,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Mod,
+		Pow,
+		CmpEQ,
+		CmpNE,
+		CmpLT,
+		CmpLE,
+		CmpGT,
+		CmpGE,
+		And,
+		Or,
+		Copy,
+		Phi,
+		Dead
+	};
+
+	// a division checked for a zero divisor and INT_MIN / -1 when it runs
+	static const uint16_t Guarded = 1;
+
+	struct Inst {
+		Opcode Op;
+		bool IsBool;
+		uint16_t Flags;
+		int32_t Imm;
+		ValueId Ops[2];
+		BlockId Block;
+	};
+
+	// what a block is for, LLVM IR names its blocks after it
+	enum BlockKind : uint8_t {
+		Entry,
+		IfBody,
+		ElifCond,
+		ElifBody,
+		ElseBody,
+		AfterIf,
+		LoopCond,
+		LoopBody,
+		AfterLoop
+	};
+
+	enum Terminator : uint8_t {
+		Br,         // to Succ[0]
+		CondBr,     // to Succ[0] if Cond holds, else to Succ[1]
+		Ret
+	};
+
+	struct Block {
+		BlockKind Kind;
+		Terminator Term;
+		bool Live;
+		ValueId Cond;
+		BlockId Succ[2];
+		uint32_t First;
+		uint32_t End;
+		llvm::SmallVector<ValueId, 2> Phis;
+		llvm::SmallVector<BlockId, 2> Preds;
+	};
+
+	struct Region {
+		enum RegionKind : uint8_t { If, Loop } Kind;
+		BlockId Entry;
+		BlockId Exit;
+		uint32_t Parent;    // enclosing region or None
+	};
+
+	struct Variable {
+		uint32_t Symbol;
+		llvm::StringRef Name;
+		ValueId Value;      // at the end of the program
+	};
+
+	std::vector<Inst> Insts;
+	std::vector<ValueId> PhiOperands;
+	std::vector<Block> Blocks;
+	std::vector<Region> Regions;
+	std::vector<Variable> Exit;     // in the order they are declared
+
+	// V is in the range of B, belongs to B and is not a phi
+	bool isBlockInst(ValueId V, BlockId B) const { return Insts[V].Block == B && Insts[V].Op != Phi; }
+
+	// the operands of any instruction, phis included
+	llvm::MutableArrayRef<ValueId> getOperands(ValueId V);
+
+	// removes the edge From -> To from the predecessors of To and from its phis
+	void removeEdge(BlockId From, BlockId To);
+
+	// live instructions, not counting constants, which need none in LLVM IR
+	size_t countInsts() const;
+	size_t countPhis() const;
+	size_t countBlocks() const;
+	size_t countGuards() const;
+
+	void print(llvm::raw_ostream& OS);
+};
+
+/*
+	builds the MIR of a checked program one top level statement at a
+	time. with ReuseValues an operation already computed in the same
+	block on the same values is not computed again, with GuardDivisions
+	every division and remainder is Guarded
+*/
+class MIRBuilder {
+	class Walker;
+	std::unique_ptr<Walker> W;
+
+public:
+	MIRBuilder(MIR& F, bool ReuseValues, bool GuardDivisions);
+	~MIRBuilder();
+
+	void add(Statement* S);
+
+	// ends the program, after this F is complete
+	void finish();
+};
+
+// runs a list of passes over the MIR of a program
+class MIRPassManager {
+	typedef void (*PassFn)(MIR&);
+	struct Pass {
+		llvm::StringRef Name;
+		PassFn Run;
+	};
+	std::vector<Pass> Passes;
+	bool PrintStats;
+	bool PrintAfter;
+
+public:
+	MIRPassManager() : PrintStats(false), PrintAfter(false) {}
+
+	static const char* getDefaultPipeline();
+
+	// Pipeline names the passes to run, separated by commas. returns
+	// false and the name in Unknown for a pass that does not exist
+	bool parse(llvm::StringRef Pipeline, std::string& Unknown);
+
+	// prints the time every pass takes, the size of the MIR it leaves and
+	// the guarded divisions left in it
+	void setPrintStats(bool Enable) { PrintStats = Enable; }
+
+	// prints the MIR after the last pass
+	void setPrintAfter(bool Enable) { PrintAfter = Enable; }
+
+	void run(MIR& F) const;
+};
+
+#endif
@@ -0,0 +1,871 @@
+#include "Fold.h"
+#include "MIR.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+	// branch conditions are users too, told apart from instructions by this bit
+	const uint32_t BranchUser = 1u << 31;
+
+	// the users of every value in the live blocks, as offsets into one array
+	struct Users {
+		std::vector<uint32_t> Start;
+		std::vector<uint32_t> List;
+
+		explicit Users(MIR& F)
+		{
+			Start.assign(F.Insts.size() + 1, 0);
+			forEachUse(F, [&](MIR::ValueId V, uint32_t User) { ++Start[V + 1]; });
+			for (size_t V = 0; V < F.Insts.size(); ++V)
+				Start[V + 1] += Start[V];
+			List.resize(Start.back());
+			std::vector<uint32_t> Next(Start.begin(), Start.end() - 1);
+			forEachUse(F, [&](MIR::ValueId V, uint32_t User) { List[Next[V]++] = User; });
+		}
+
+		llvm::ArrayRef<uint32_t> of(MIR::ValueId V) const
+		{
+			return llvm::makeArrayRef(List).slice(Start[V], Start[V + 1] - Start[V]);
+		}
+
+		template <typename Fn>
+		static void forEachUse(MIR& F, Fn Use)
+		{
+			for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+			{
+				MIR::Block& Blk = F.Blocks[B];
+				if (!Blk.Live)
+					continue;
+				for (MIR::ValueId P : Blk.Phis)
+					for (MIR::ValueId Op : F.getOperands(P))
+						Use(Op, P);
+				for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+					if (F.isBlockInst(V, B))
+						for (MIR::ValueId Op : F.getOperands(V))
+							Use(Op, V);
+				if (Blk.Term == MIR::CondBr)
+					Use(Blk.Cond, B | BranchUser);
+			}
+		}
+	};
+
+	// a guarded division traps when it runs, so it stays even if nothing reads it
+	bool isGuarded(const MIR::Inst& I)
+	{
+		return (I.Op == MIR::Div || I.Op == MIR::Mod) && (I.Flags & MIR::Guarded);
+	}
+
+	// drops the phis that were made Dead or Const from the lists of their blocks
+	void prunePhis(MIR& F)
+	{
+		for (MIR::Block& B : F.Blocks)
+			B.Phis.erase(std::remove_if(B.Phis.begin(), B.Phis.end(),
+				[&](MIR::ValueId P) { return F.Insts[P].Op != MIR::Phi; }), B.Phis.end());
+	}
+
+	// replaces every operand V that has a Replacement with it
+	void replaceUses(MIR& F, std::vector<MIR::ValueId>& Replacement)
+	{
+		auto find = [&](MIR::ValueId V) {
+			MIR::ValueId Root = V;
+			while (Replacement[Root] != MIR::None)
+				Root = Replacement[Root];
+			while (Replacement[V] != MIR::None)
+			{
+				MIR::ValueId Next = Replacement[V];
+				Replacement[V] = Root;
+				V = Next;
+			}
+			return Root;
+		};
+
+		for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+		{
+			MIR::Block& Blk = F.Blocks[B];
+			if (!Blk.Live)
+				continue;
+			for (MIR::ValueId P : Blk.Phis)
+				for (MIR::ValueId& Op : F.getOperands(P))
+					Op = find(Op);
+			for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+				if (F.isBlockInst(V, B))
+					for (MIR::ValueId& Op : F.getOperands(V))
+						Op = find(Op);
+			if (Blk.Term == MIR::CondBr)
+				Blk.Cond = find(Blk.Cond);
+		}
+		for (MIR::Variable& Var : F.Exit)
+			Var.Value = find(Var.Value);
+	}
+
+	/*
+		copy propagation. uses of a copy take the value copied, and a phi
+		whose operands are all one value, or the phi itself around a loop,
+		is that value. the builder gives every variable a phi at every join
+		and loop it is used in, most of them are of this kind
+	*/
+	void copyPropagation(MIR& F)
+	{
+		std::vector<MIR::ValueId> Replacement(F.Insts.size(), MIR::None);
+		for (MIR::ValueId V = 0; V < F.Insts.size(); ++V)
+		{
+			if (F.Insts[V].Op == MIR::Copy)
+			{
+				Replacement[V] = F.Insts[V].Ops[0];
+				F.Insts[V].Op = MIR::Dead;
+			}
+		}
+		replaceUses(F, Replacement);
+
+		// a phi that becomes trivial can make the phis using it trivial
+		Users U(F);
+		std::vector<MIR::ValueId> Work;
+		for (MIR::Block& B : F.Blocks)
+			if (B.Live)
+				Work.insert(Work.end(), B.Phis.begin(), B.Phis.end());
+		while (!Work.empty())
+		{
+			MIR::ValueId P = Work.back();
+			Work.pop_back();
+			if (F.Insts[P].Op != MIR::Phi)
+				continue;
+
+			MIR::ValueId Same = MIR::None;
+			bool Trivial = true;
+			for (MIR::ValueId Op : F.getOperands(P))
+			{
+				while (Replacement[Op] != MIR::None)
+					Op = Replacement[Op];
+				if (Op == P || Op == Same)
+					continue;
+				if (Same != MIR::None)
+				{
+					Trivial = false;
+					break;
+				}
+				Same = Op;
+			}
+			if (!Trivial || Same == MIR::None)
+				continue;
+
+			Replacement[P] = Same;
+			F.Insts[P].Op = MIR::Dead;
+			for (uint32_t User : U.of(P))
+				if (!(User & BranchUser) && F.Insts[User].Op == MIR::Phi)
+					Work.push_back(User);
+		}
+		replaceUses(F, Replacement);
+		prunePhis(F);
+	}
+
+	/*
+		sparse conditional constant propagation (Wegman and Zadeck). values
+		start unknown and only go down to a constant and then to varying,
+		blocks are only visited once an edge to them is known to be taken,
+		and a phi only meets the operands of those edges. afterwards every
+		constant value becomes a Const, a branch on a constant goes to one
+		block and the blocks never reached are removed
+	*/
+	void constantPropagation(MIR& F)
+	{
+		enum State : uint8_t { Unknown, Constant, Varying };
+		std::vector<uint8_t> States(F.Insts.size(), Unknown);
+		std::vector<int32_t> Constants(F.Insts.size());
+		std::vector<bool> Reached(F.Blocks.size());
+		std::vector<MIR::BlockId> BlockWork;
+		std::vector<MIR::ValueId> ValueWork;
+		Users U(F);
+
+		auto lower = [&](MIR::ValueId V, uint8_t S, int32_t C) {
+			if (States[V] == Varying || (States[V] == S && (S != Constant || Constants[V] == C)))
+				return;
+			States[V] = States[V] == Constant ? (uint8_t)Varying : S;
+			Constants[V] = C;
+			ValueWork.push_back(V);
+		};
+
+		auto taken = [&](MIR::BlockId From, MIR::BlockId To) {
+			if (!Reached[From])
+				return false;
+			MIR::Block& B = F.Blocks[From];
+			if (B.Term != MIR::CondBr || States[B.Cond] == Varying)
+				return true;
+			return States[B.Cond] == Constant && B.Succ[Constants[B.Cond] ? 0 : 1] == To;
+		};
+
+		auto visitPhi = [&](MIR::ValueId P) {
+			MIR::Block& B = F.Blocks[F.Insts[P].Block];
+			llvm::MutableArrayRef<MIR::ValueId> Operands = F.getOperands(P);
+			uint8_t S = Unknown;
+			int32_t C = 0;
+			for (size_t I = 0; I < Operands.size() && S != Varying; ++I)
+			{
+				MIR::ValueId Op = Operands[I];
+				if (!taken(B.Preds[I], F.Insts[P].Block) || States[Op] == Unknown)
+					continue;
+				if (States[Op] == Varying || (S == Constant && Constants[Op] != C))
+					S = Varying;
+				else
+				{
+					S = Constant;
+					C = Constants[Op];
+				}
+			}
+			if (S != Unknown)
+				lower(P, S, C);
+		};
+
+		auto visitInst = [&](MIR::ValueId V) {
+			MIR::Inst& I = F.Insts[V];
+			if (I.Op == MIR::Const)
+			{
+				lower(V, Constant, I.Imm);
+				return;
+			}
+			llvm::MutableArrayRef<MIR::ValueId> Operands = F.getOperands(V);
+			for (MIR::ValueId Op : Operands)
+				if (States[Op] != Constant)
+				{
+					if (States[Op] == Varying)
+						lower(V, Varying, 0);
+					return;
+				}
+
+			int32_t L = Constants[Operands[0]];
+			int32_t R = Operands.size() > 1 ? Constants[Operands[1]] : I.Imm;
+			int32_t Result = 0;
+			bool Known = true;
+			switch (I.Op)
+			{
+			case MIR::Add:
+				Known = ConstantFolder::evaluate(BinaryOp::Plus, L, R, Result);
+				break;
+			case MIR::Sub:
+				Known = ConstantFolder::evaluate(BinaryOp::Minus, L, R, Result);
+				break;
+			case MIR::Mul:
+				Known = ConstantFolder::evaluate(BinaryOp::Mul, L, R, Result);
+				break;
+			case MIR::Div:
+				Known = ConstantFolder::evaluate(BinaryOp::Div, L, R, Result);
+				break;
+			case MIR::Mod:
+				Known = ConstantFolder::evaluate(BinaryOp::Mod, L, R, Result);
+				break;
+			case MIR::Pow:
+				Known = ConstantFolder::evaluate(BinaryOp::Pow, L, R, Result);
+				break;
+			case MIR::CmpEQ:
+				Result = L == R;
+				break;
+			case MIR::CmpNE:
+				Result = L != R;
+				break;
+			case MIR::CmpLT:
+				Result = L < R;
+				break;
+			case MIR::CmpLE:
+				Result = L <= R;
+				break;
+			case MIR::CmpGT:
+				Result = L > R;
+				break;
+			case MIR::CmpGE:
+				Result = L >= R;
+				break;
+			case MIR::And:
+				Result = L & R;
+				break;
+			case MIR::Or:
+				Result = L | R;
+				break;
+			default:
+				Result = L;
+				break;
+			}
+			// a division that traps is left to happen when the program runs
+			lower(V, Known ? Constant : Varying, Result);
+		};
+
+		auto reach = [&](MIR::BlockId From, MIR::BlockId To) {
+			if (!Reached[To])
+			{
+				Reached[To] = true;
+				BlockWork.push_back(To);
+				return;
+			}
+			for (MIR::ValueId P : F.Blocks[To].Phis)
+				visitPhi(P);
+		};
+
+		auto visitTerminator = [&](MIR::BlockId B) {
+			MIR::Block& Blk = F.Blocks[B];
+			if (Blk.Term == MIR::Br)
+				reach(B, Blk.Succ[0]);
+			else if (Blk.Term == MIR::CondBr && States[Blk.Cond] != Unknown)
+			{
+				if (States[Blk.Cond] == Varying || Constants[Blk.Cond])
+					reach(B, Blk.Succ[0]);
+				if (States[Blk.Cond] == Varying || !Constants[Blk.Cond])
+					reach(B, Blk.Succ[1]);
+			}
+		};
+
+		Reached[0] = true;
+		BlockWork.push_back(0);
+		while (!BlockWork.empty() || !ValueWork.empty())
+		{
+			if (!BlockWork.empty())
+			{
+				MIR::BlockId B = BlockWork.back();
+				BlockWork.pop_back();
+				MIR::Block& Blk = F.Blocks[B];
+				for (MIR::ValueId P : Blk.Phis)
+					visitPhi(P);
+				for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+					if (F.isBlockInst(V, B) && F.Insts[V].Op != MIR::Dead)
+						visitInst(V);
+				visitTerminator(B);
+				continue;
+			}
+
+			MIR::ValueId V = ValueWork.back();
+			ValueWork.pop_back();
+			for (uint32_t User : U.of(V))
+			{
+				if (User & BranchUser)
+				{
+					if (Reached[User & ~BranchUser])
+						visitTerminator(User & ~BranchUser);
+				}
+				else if (Reached[F.Insts[User].Block])
+				{
+					if (F.Insts[User].Op == MIR::Phi)
+						visitPhi(User);
+					else
+						visitInst(User);
+				}
+			}
+		}
+
+		// edges that are never taken go first, they take their phi operands along
+		for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+		{
+			MIR::Block& Blk = F.Blocks[B];
+			if (!Blk.Live || Blk.Term == MIR::Ret)
+				continue;
+			for (unsigned S = 0; S < (Blk.Term == MIR::CondBr ? 2u : 1u); ++S)
+				if (!taken(B, Blk.Succ[S]) && F.Blocks[Blk.Succ[S]].Live)
+					F.removeEdge(B, Blk.Succ[S]);
+			if (Blk.Term == MIR::CondBr && Reached[B] && States[Blk.Cond] == Constant)
+			{
+				Blk.Term = MIR::Br;
+				Blk.Succ[0] = Blk.Succ[Constants[Blk.Cond] ? 0 : 1];
+				Blk.Cond = MIR::None;
+			}
+		}
+
+		for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+		{
+			MIR::Block& Blk = F.Blocks[B];
+			if (!Blk.Live)
+				continue;
+			if (!Reached[B])
+			{
+				Blk.Live = false;
+				for (MIR::ValueId P : Blk.Phis)
+					F.Insts[P].Op = MIR::Dead;
+				for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+					if (F.isBlockInst(V, B))
+						F.Insts[V].Op = MIR::Dead;
+				continue;
+			}
+			auto fold = [&](MIR::ValueId V) {
+				MIR::Inst& I = F.Insts[V];
+				if (States[V] != Constant || I.Op == MIR::Const || I.Op == MIR::Dead)
+					return;
+				I.IsBool = I.IsBool || (I.Op >= MIR::CmpEQ && I.Op <= MIR::Or);
+				I.Op = MIR::Const;
+				I.Imm = Constants[V];
+			};
+			for (MIR::ValueId P : Blk.Phis)
+				fold(P);
+			for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+				if (F.isBlockInst(V, B))
+					fold(V);
+		}
+		prunePhis(F);
+	}
+
+	/*
+		dead store elimination. a value nothing reads, no instruction, no
+		branch and not the end of the program, is removed, which can leave
+		its operands unread in turn. an assignment overwritten before it
+		is read is such a value. a guarded division stays, it may trap
+	*/
+	void deadStoreElimination(MIR& F)
+	{
+		std::vector<uint32_t> Reads(F.Insts.size());
+		Users::forEachUse(F, [&](MIR::ValueId V, uint32_t User) { ++Reads[V]; });
+		for (MIR::Variable& Var : F.Exit)
+			++Reads[Var.Value];
+
+		std::vector<MIR::ValueId> Work;
+		for (MIR::BlockId B = 0; B < F.Blocks.size(); ++B)
+		{
+			MIR::Block& Blk = F.Blocks[B];
+			if (!Blk.Live)
+				continue;
+			for (MIR::ValueId P : Blk.Phis)
+				if (!Reads[P])
+					Work.push_back(P);
+			for (MIR::ValueId V = Blk.First; V < Blk.End; ++V)
+				if (F.isBlockInst(V, B) && F.Insts[V].Op != MIR::Dead && !Reads[V] && !isGuarded(F.Insts[V]))
+					Work.push_back(V);
+		}
+		while (!Work.empty())
+		{
+			MIR::ValueId V = Work.back();
+			Work.pop_back();
+			for (MIR::ValueId Op : F.getOperands(V))
+				if (--Reads[Op] == 0 && !isGuarded(F.Insts[Op]))
+					Work.push_back(Op);
+			F.Insts[V].Op = MIR::Dead;
+		}
+		prunePhis(F);
+	}
+
+	/*
+		unused variable elimination. the values of a variable that only
+		feed each other around a loop are each read by the next, so dead
+		store elimination keeps them. this marks what the end of the
+		program, the branches and the guarded divisions need, and removes
+		everything else
+	*/
+	void unusedVariableElimination(MIR& F)
+	{
+		std::vector<bool> Needed(F.Insts.size());
+		std::vector<MIR::ValueId> Work;
+		auto need = [&](MIR::ValueId V) {
+			if (!Needed[V])
+			{
+				Needed[V] = true;
+				Work.push_back(V);
+			}
+		};
+		for (MIR::Variable& Var : F.Exit)
+			need(Var.Value);
+		for (MIR::Block& B : F.Blocks)
+			if (B.Live && B.Term == MIR::CondBr)
+				need(B.Cond);
+		for (MIR::ValueId V = 0; V < F.Insts.size(); ++V)
+			if (isGuarded(F.Insts[V]) && F.Blocks[F.Insts[V].Block].Live)
+				need(V);
+		while (!Work.empty())
+		{
+			MIR::ValueId V = Work.back();
+			Work.pop_back();
+			for (MIR::ValueId Op : F.getOperands(V))
+				need(Op);
+		}
+
+		for (MIR::ValueId V = 0; V < F.Insts.size(); ++V)
+			if (!Needed[V])
+				F.Insts[V].Op = MIR::Dead;
+		prunePhis(F);
+	}
+
+	// the values an integer can take, none if Lo > Hi
+	struct Interval {
+		int64_t Lo;
+		int64_t Hi;
+
+		bool isEmpty() const { return Lo > Hi; }
+		bool contains(int64_t V) const { return Lo <= V && V <= Hi; }
+		bool operator!=(const Interval& O) const { return Lo != O.Lo || Hi != O.Hi; }
+	};
+
+	const Interval Empty = { 1, 0 };
+	const Interval Full = { INT32_MIN, INT32_MAX };
+
+	// a result beyond 32 bits has wrapped, it can be any value
+	Interval fit(int64_t Lo, int64_t Hi)
+	{
+		return Lo < INT32_MIN || Hi > INT32_MAX ? Full : Interval{ Lo, Hi };
+	}
+
+	Interval join(Interval A, Interval B)
+	{
+		if (A.isEmpty())
+			return B;
+		if (B.isEmpty())
+			return A;
+		return { std::min(A.Lo, B.Lo), std::max(A.Hi, B.Hi) };
+	}
+
+	/*
+		value range analysis. every value gets an interval of what it can
+		be, and a value used where a branch condition on it is known, in
+		the body of an if or a loop, is narrowed to the values that pass
+		the condition. the phis of loop headers are widened to the end of
+		the integers after growing twice, so loops are done in a few
+		rounds. a guarded division whose divisor can not be 0, and not -1
+		while the dividend can be INT_MIN, loses its guard
+	*/
+	class RangeAnalysis {
+		MIR& F;
+		std::vector<Interval> Ranges;
+		std::vector<uint8_t> Grown;             // times a loop header phi has grown
+		std::vector<MIR::BlockId> Dominator;    // a block every path to the block goes through, or None
+
+		// narrowing looks at the conditions of this many dominators of a block,
+		// and at this many levels of and and or in a condition
+		static const unsigned MaxDominators = 32;
+		static const unsigned MaxConditionDepth = 2;
+
+		// if a transfer runs this many times per value, the guards all stay
+		static const unsigned MaxVisits = 64;
+
+		// R narrowed to the values V can have if Cond is Taken
+		Interval assume(Interval R, MIR::ValueId V, MIR::ValueId Cond, bool Taken, unsigned Depth)
+		{
+			MIR::Inst& C = F.Insts[Cond];
+			if (((C.Op == MIR::And && Taken) || (C.Op == MIR::Or && !Taken)) && Depth < MaxConditionDepth)
+			{
+				R = assume(R, V, C.Ops[0], Taken, Depth + 1);
+				return assume(R, V, C.Ops[1], Taken, Depth + 1);
+			}
+			if (C.Op < MIR::CmpEQ || C.Op > MIR::CmpGE)
+				return R;
+
+			static const MIR::Opcode Swapped[] = { MIR::CmpEQ, MIR::CmpNE, MIR::CmpGT, MIR::CmpGE, MIR::CmpLT, MIR::CmpLE };
+			static const MIR::Opcode Negated[] = { MIR::CmpNE, MIR::CmpEQ, MIR::CmpGE, MIR::CmpGT, MIR::CmpLE, MIR::CmpLT };
+			MIR::Opcode Op = C.Op;
+			MIR::ValueId Other;
+			if (C.Ops[0] == V)
+				Other = C.Ops[1];
+			else if (C.Ops[1] == V)
+			{
+				Other = C.Ops[0];
+				Op = Swapped[Op - MIR::CmpEQ];
+			}
+			else
+				return R;
+			if (!Taken)
+				Op = Negated[Op - MIR::CmpEQ];
+
+			Interval O = Ranges[Other];
+			if (O.isEmpty())
+				return R;
+			switch (Op)
+			{
+			case MIR::CmpEQ:
+				return { std::max(R.Lo, O.Lo), std::min(R.Hi, O.Hi) };
+			case MIR::CmpNE:
+				if (O.Lo == O.Hi && R.Lo == O.Lo)
+					++R.Lo;
+				if (O.Lo == O.Hi && R.Hi == O.Hi)
+					--R.Hi;
+				return R;
+			case MIR::CmpLT:
+				return { R.Lo, std::min(R.Hi, O.Hi - 1) };
+			case MIR::CmpLE:
+				return { R.Lo, std::min(R.Hi, O.Hi) };
+			case MIR::CmpGT:
+				return { std::max(R.Lo, O.Lo + 1), R.Hi };
+			default:
+				return { std::max(R.Lo, O.Lo), R.Hi };
+			}
+		}
+
+		// the range of V in block B
+		Interval at(MIR::ValueId V, MIR::BlockId B)
+		{
+			Interval R = Ranges[V];
+			unsigned Count = 0;
+			for (MIR::BlockId D = B; D != MIR::None && Count < MaxDominators && !R.isEmpty(); D = Dominator[D], ++Count)
+			{
+				MIR::Block& Blk = F.Blocks[D];
+				if (Blk.Preds.size() != 1)
+					continue;
+				MIR::Block& Pred = F.Blocks[Blk.Preds[0]];
+				if (Pred.Term == MIR::CondBr)
+					R = assume(R, V, Pred.Cond, Pred.Succ[0] == D, 0);
+			}
+			return R;
+		}
+
+		// the range of V on the edge From -> To
+		Interval onEdge(MIR::ValueId V, MIR::BlockId From, MIR::BlockId To)
+		{
+			Interval R = at(V, From);
+			MIR::Block& Pred = F.Blocks[From];
+			if (Pred.Term == MIR::CondBr && !R.isEmpty())
+				R = assume(R, V, Pred.Cond, Pred.Succ[0] == To, 0);
+			return R;
+		}
+
+		static int64_t power(int64_t Base, int32_t Power, bool& Overflow)
+		{
+			if (Base == 0 || Base == 1)
+				return Base;
+			if (Base == -1)
+				return Power & 1 ? -1 : 1;
+			int64_t Result = 1;
+			for (int32_t I = 0; I < Power && !Overflow; ++I)
+			{
+				Result *= Base;
+				Overflow = Result < INT32_MIN || Result > INT32_MAX;
+			}
+			return Result;
+		}
+
+		Interval transfer(MIR::ValueId V)
+		{
+			MIR::Inst& I = F.Insts[V];
+			if (I.Op == MIR::Const)
+				return { I.Imm, I.Imm };
+			if (I.Op >= MIR::CmpEQ && I.Op <= MIR::Or)
+				return { 0, 1 };
+			if (I.Op == MIR::Phi)
+			{
+				MIR::Block& Blk = F.Blocks[I.Block];
+				llvm::MutableArrayRef<MIR::ValueId> Operands = F.getOperands(V);
+				Interval R = Ranges[V];
+				for (size_t Op = 0; Op < Operands.size(); ++Op)
+					R = join(R, onEdge(Operands[Op], Blk.Preds[Op], I.Block));
+
+				Interval Old = Ranges[V];
+				if (Blk.Kind == MIR::LoopCond && !Old.isEmpty() && R != Old && ++Grown[V] > 2)
+				{
+					if (R.Lo < Old.Lo)
+						R.Lo = INT32_MIN;
+					if (R.Hi > Old.Hi)
+						R.Hi = INT32_MAX;
+				}
+				return R;
+			}
+
+			Interval L = at(I.Ops[0], I.Block);
+			if (I.Op == MIR::Copy || L.isEmpty())
+				return L;
+			if (I.Op == MIR::Pow)
+			{
+				bool Overflow = false;
+				int64_t Lo = power(L.Lo, I.Imm, Overflow);
+				int64_t Hi = power(L.Hi, I.Imm, Overflow);
+				if (Overflow)
+					return Full;
+				if (I.Imm & 1)
+					return { Lo, Hi };
+				return { L.contains(0) ? 0 : std::min(Lo, Hi), std::max(Lo, Hi) };
+			}
+
+			Interval R = at(I.Ops[1], I.Block);
+			if (R.isEmpty())
+				return R;
+			switch (I.Op)
+			{
+			case MIR::Add:
+				return fit(L.Lo + R.Lo, L.Hi + R.Hi);
+			case MIR::Sub:
+				return fit(L.Lo - R.Hi, L.Hi - R.Lo);
+			case MIR::Mul:
+			{
+				int64_t Corners[] = { L.Lo * R.Lo, L.Lo * R.Hi, L.Hi * R.Lo, L.Hi * R.Hi };
+				return fit(*std::min_element(std::begin(Corners), std::end(Corners)), *std::max_element(std::begin(Corners), std::end(Corners)));
+			}
+			case MIR::Div:
+			{
+				// a divisor of one sign is monotone, else the quotient is
+				// no larger than the dividend
+				if (!R.contains(0))
+				{
+					int64_t Corners[] = { L.Lo / R.Lo, L.Lo / R.Hi, L.Hi / R.Lo, L.Hi / R.Hi };
+					return fit(*std::min_element(std::begin(Corners), std::end(Corners)), *std::max_element(std::begin(Corners), std::end(Corners)));
+				}
+				int64_t Max = std::max(-L.Lo, L.Hi);
+				return fit(-Max, Max);
+			}
+			default:
+			{
+				// the remainder is smaller than the divisor and has the sign of the dividend
+				int64_t Max = std::max(-R.Lo, R.Hi) - 1;
+				if (Max < 0)
+					return Full;
+				return { L.Lo >= 0 ? 0 : std::max(L.Lo, -Max), L.Hi <= 0 ? 0 : std::min(L.Hi, Max) };
+			}
+			}
+		}
+
+		// the values compared with V in a branch condition narrow V
+		void addPartners(MIR::ValueId Cond, unsigned Depth, llvm::DenseMap<MIR::ValueId, llvm::SmallVector<MIR::ValueId, 2>>& Partners)
+		{
+			MIR::Inst& C = F.Insts[Cond];
+			if ((C.Op == MIR::And || C.Op == MIR::Or) && Depth < MaxConditionDepth)
+			{
+				addPartners(C.Ops[0], Depth + 1, Partners);
+				addPartners(C.Ops[1], Depth + 1, Partners);
+			}
+			else if (C.Op >= MIR::CmpEQ && C.Op <= MIR::CmpGE)
+			{
+				Partners[C.Ops[0]].push_back(C.Ops[1]);
+				Partners[C.Ops[1]].push_back(C.Ops[0]);
+			}
+		}
+
+	public:
+		explicit RangeAnalysis(MIR& F) : F(F) {}
+
+		void run()
+		{
+			if (!F.countGuards())
+				return;
+
+			// one predecessor dominates, a loop header is dominated by the
+			// block before the loop and the join of an if by its condition
+			Dominator.assign(F.Blocks.size(), MIR::None);
+			std::vector<MIR::BlockId> IfEntry(F.Blocks.size(), MIR::None);
+			for (MIR::Region& R : F.Regions)
+				if (R.Kind == MIR::Region::If)
+					IfEntry[R.Exit] = R.Entry;
+			for (MIR::BlockId B = 1; B < F.Blocks.size(); ++B)
+			{
+				MIR::Block& Blk = F.Blocks[B];
+				if (Blk.Preds.size() == 1 || (Blk.Kind == MIR::LoopCond && !Blk.Preds.empty()))
+					Dominator[B] = Blk.Preds[0];
+				else
+					Dominator[B] = IfEntry[B];
+			}
+
+			llvm::DenseMap<MIR::ValueId, llvm::SmallVector<MIR::ValueId, 2>> Partners;
+			for (MIR::Block& B : F.Blocks)
+				if (B.Live && B.Term == MIR::CondBr)
+					addPartners(B.Cond, 0, Partners);
+
+			Ranges.assign(F.Insts.size(), Empty);
+			Grown.assign(F.Insts.size(), 0);
+			Users U(F);
+			std::vector<MIR::ValueId> Work;
+			std::vector<bool> InWork(F.Insts.size());
+			auto pushUsers = [&](MIR::ValueId V) {
+				for (uint32_t User : U.of(V))
+				{
+					if (!(User & BranchUser) && !InWork[User])
+					{
+						InWork[User] = true;
+						Work.push_back(User);
+					}
+				}
+			};
+
+			// the first round goes through the values in the order they were built
+			for (MIR::ValueId V = F.Insts.size(); V-- > 0;)
+			{
+				if (F.Insts[V].Op != MIR::Dead && F.Blocks[F.Insts[V].Block].Live)
+				{
+					InWork[V] = true;
+					Work.push_back(V);
+				}
+			}
+			uint64_t Visits = 0;
+			uint64_t MaxTotal = (uint64_t)MaxVisits * F.Insts.size();
+			while (!Work.empty())
+			{
+				if (++Visits > MaxTotal)
+					return;
+				MIR::ValueId V = Work.back();
+				Work.pop_back();
+				InWork[V] = false;
+				Interval R = transfer(V);
+				if (!(R != Ranges[V]))
+					continue;
+				Ranges[V] = R;
+				pushUsers(V);
+				auto It = Partners.find(V);
+				if (It != Partners.end())
+					for (MIR::ValueId Other : It->second)
+						pushUsers(Other);
+			}
+
+			for (MIR::ValueId V = 0; V < F.Insts.size(); ++V)
+			{
+				MIR::Inst& I = F.Insts[V];
+				if (!isGuarded(I) || !F.Blocks[I.Block].Live)
+					continue;
+				Interval L = at(I.Ops[0], I.Block);
+				Interval R = at(I.Ops[1], I.Block);
+				if (!L.isEmpty() && !R.isEmpty() && !R.contains(0) && !(L.contains(INT32_MIN) && R.contains(-1)))
+					I.Flags &= ~MIR::Guarded;
+			}
+		}
+	};
+
+	void valueRanges(MIR& F)
+	{
+		RangeAnalysis(F).run();
+	}
+
+	struct PassInfo {
+		const char* Name;
+		void (*Run)(MIR&);
+	};
+
+	const PassInfo AllPasses[] = {
+		{ "copy-prop", copyPropagation },
+		{ "sccp", constantPropagation },
+		{ "dse", deadStoreElimination },
+		{ "unused-vars", unusedVariableElimination },
+		{ "ranges", valueRanges },
+	};
+}
+
+const char* MIRPassManager::getDefaultPipeline()
+{
+	return "copy-prop,sccp,copy-prop,dse,unused-vars,ranges";
+}
+
+bool MIRPassManager::parse(llvm::StringRef Pipeline, std::string& Unknown)
+{
+	Passes.clear();
+	llvm::SmallVector<llvm::StringRef, 8> Names;
+	Pipeline.split(Names, ',', -1, false);
+	for (llvm::StringRef Name : Names)
+	{
+		Name = Name.trim();
+		const PassInfo* Found = std::find_if(std::begin(AllPasses), std::end(AllPasses),
+			[&](const PassInfo& P) { return Name == P.Name; });
+		if (Found == std::end(AllPasses))
+		{
+			Unknown = Name.str();
+			return false;
+		}
+		Passes.push_back({ Found->Name, Found->Run });
+	}
+	return true;
+}
+
+void MIRPassManager::run(MIR& F) const
+{
+	auto printSize = [&](llvm::StringRef Name, double Ms) {
+		llvm::errs() << llvm::format("%-12s %10.3f %12zu %10zu %10zu %10zu\n", Name.str().c_str(), Ms,
+			F.countInsts(), F.countPhis(), F.countBlocks(), F.countGuards());
+	};
+
+	if (PrintStats)
+	{
+		llvm::errs() << "MIR pass        time (ms) instructions       phis     blocks     guards\n";
+		printSize("(built)", 0);
+	}
+	for (const Pass& P : Passes)
+	{
+		auto Start = std::chrono::steady_clock::now();
+		P.Run(F);
+		if (PrintStats)
+			printSize(P.Name, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count());
+	}
+	if (PrintAfter)
+		F.print(llvm::errs());
+}
@@ -5,289 +5,493 @@
 #endif
 
 
+namespace operators {
+
+	// how tightly each binary operator binds, higher binds tighter.
+	// and, or share the loosest level as in grammar.txt
+	enum : unsigned char {
+		None,
+		Logical,
+		Relational,
+		Additive,
+		Multiplicative,
+		Exponent
+	};
+
+	struct Info {
+		unsigned char Precedence;
+		unsigned char Op;       // BinaryOp::Operator or BooleanOp::Operator
+	};
+
+	struct OperatorTable {
+		Info Entry[Token::KW_end + 1];
+	};
+
+	constexpr OperatorTable buildOperatorTable() {
+		OperatorTable T{};
+		T.Entry[Token::KW_and] = { Logical, BooleanOp::And };
+		T.Entry[Token::KW_or] = { Logical, BooleanOp::Or };
+		T.Entry[Token::less] = { Relational, BooleanOp::Less };
+		T.Entry[Token::less_equal] = { Relational, BooleanOp::LessEqual };
+		T.Entry[Token::greater] = { Relational, BooleanOp::Greater };
+		T.Entry[Token::greater_equal] = { Relational, BooleanOp::GreaterEqual };
+		T.Entry[Token::equal_equal] = { Relational, BooleanOp::Equal };
+		T.Entry[Token::not_equal] = { Relational, BooleanOp::NotEqual };
+		T.Entry[Token::plus] = { Additive, BinaryOp::Plus };
+		T.Entry[Token::minus] = { Additive, BinaryOp::Minus };
+		T.Entry[Token::star] = { Multiplicative, BinaryOp::Mul };
+		T.Entry[Token::slash] = { Multiplicative, BinaryOp::Div };
+		T.Entry[Token::mod] = { Multiplicative, BinaryOp::Mod };
+		T.Entry[Token::power] = { Exponent, BinaryOp::Pow };
+		return T;
+	}
+
+	constexpr OperatorTable Table = buildOperatorTable();
+}
+
+
 /*
-	parsing a number of statements. it is called two times.
-	one at the start of program to get all the statements, 
-	the other inside control and loop statetments because they 
-	have a number of statements inside the bodies. it returns
-	the base class that consists of all the statements inside the
-	scope body
+	parses the statements of the whole program and returns the base
+	class that holds them
 */
 Base* Parser::parseS()
 {
 	llvm::SmallVector<Statement*> statements;
-	while (!Tok.is(Token::eof))
+	while (parseNext(statements))
+		;
+	return Ctx.create<Base>(Ctx.copy(llvm::makeArrayRef(statements)));
+}
+
+/*
+	parses the next top level construct and appends its statements. a
+	token that can not start a statement is reported and skipped instead,
+	so repeated calls always get to eof. returns false at eof
+*/
+bool Parser::parseNext(llvm::SmallVector<Statement*>& statements)
+{
+	if (parseTopLevel(statements))
+		return true;
+	if (Tok.is(Token::eof))
+		return false;
+	error();
+	if (Tok.isOneOf(Token::KW_elif, Token::KW_else))
+	{
+		/* a branch without its if, parsed for its diagnostics and dropped */
+		parseBlock();
+		return true;
+	}
+	advance();
+	synchronize();
+	return true;
+}
+
+/*
+	panic mode recovery after a syntax error. skips tokens up to the next
+	point where a statement can start: past a semicolon, or before end,
+	elif, else, int, if, loopc or eof. with Begin set it also stops
+	before begin, for a block header that went wrong
+*/
+void Parser::synchronize(bool Begin)
+{
+	while (true)
 	{
 		switch (Tok.getKind())
 		{
-		case Token::ident:
-		{
-			AssignStatement* state = parseAssign();
-
-			statements.push_back(state);
+		case Token::semi_colon:
+			advance();
+			return;
+		case Token::KW_begin:
+			if (Begin)
+				return;
 			break;
-		}
+		case Token::KW_end:
+		case Token::KW_elif:
+		case Token::KW_else:
 		case Token::KW_int:
-		{
-			llvm::SmallVector<DecStatement*> states = parseDefine();
-			if (states.size() == 0)
-			{
-				return nullptr;
-			}
-
-			while (states.size() > 0)
-			{
-				statements.push_back(states.back());
-				states.pop_back();
-			}
-			break;
-		}
 		case Token::KW_if:
-		{
-			IfStatement* statement = parseIf();
-			statements.push_back(statement);
-			break;
-
-		}
 		case Token::KW_loopc:
-		{
-			LoopStatement* statement = parseLoop();
-			statements.push_back(statement);
+		case Token::eof:
+			return;
+		default:
 			break;
 		}
+		advance();
+	}
+}
 
-		default:
-		{
-			return new Base(statements);
-		}
+/*
+	parses one top level construct and appends its statements. it returns
+	false without consuming anything when the current token can not start
+	a statement, which includes eof
+*/
+bool Parser::parseTopLevel(llvm::SmallVector<Statement*>& statements)
+{
+	switch (Tok.getKind())
+	{
+	case Token::ident:
+	{
+		AssignStatement* state = parseAssign();
+		if (state)
+			statements.push_back(state);
+		return true;
+	}
+	case Token::KW_int:
+	{
+		parseDefine(statements);
+		return true;
+	}
+	case Token::KW_if:
+	case Token::KW_loopc:
+	{
+		Statement* statement = parseBlock();
+		statements.push_back(statement);
+		return true;
+	}
+
+	default:
+	{
+		return false;
+	}
 
-		}
 	}
-	return new Base(statements);
 }
 
 /*
-	parses declaration statements like int a, b, c;
+	parses declaration statements like int a, b, c = 1, 2;
+	and appends one declaration per variable in source order. variables
+	without a value of their own start at 0. after a syntax error the
+	variables named so far are still declared, so that later uses of
+	them are not reported as well
 */
-llvm::SmallVector<DecStatement*> Parser::parseDefine()
+void Parser::parseDefine(llvm::SmallVectorImpl<Statement*>& statements)
 {
-	llvm::SmallVector<DecStatement*> assignments;
-
 	llvm::SmallVector<Expression*> variables;
 	llvm::SmallVector<Expression*> values;
+	bool Failed = false;
 
 	advance();
-	bool SeenTokenVariable = true;
-	while (SeenTokenVariable)
+	while (true)
 	{
 		Expression* lhand = parseVar();
+		if (!lhand)
+		{
+			Failed = true;
+			break;
+		}
 		variables.push_back(lhand);
 
 		if (!Tok.is(Token::comma))
-			SeenTokenVariable = false;
-		else
-			advance();
+			break;
+		advance();
 	}
 
-
-
-	if (Tok.is(Token::semi_colon))
-	{
-		bool SeenTokenValue = true;
-		for (int i = 0; i < variables.size(); i++)
-		{
-			Expression* rhand = new Expression(0);
-			values.push_back(rhand);
-		}
-	}
-	else if (!Tok.is(Token::equal))
-	{
-		Error::AssignmentEqualNotFound();
-	}
-	else
+	if (!Failed && Tok.is(Token::equal))
 	{
 		advance(); // pass equal
 
-		bool SeenTokenValue = true;
-		while (SeenTokenValue)
+		while (true)
 		{
 			Expression* rhand = parseExpr();
+			if (!rhand)
+			{
+				Failed = true;
+				break;
+			}
 			values.push_back(rhand);
 
 			if (!Tok.is(Token::comma))
-				SeenTokenValue = false;
-			else
-				advance();
+				break;
+			advance();
 		}
-	}
-
 
+		if (!Failed && variables.size() < values.size())
+		{
+			Error::AssignmentSidesNotEqual(Tok.getOffset());
+			Failed = true;
+		}
+	}
+	else if (!Failed && !Tok.is(Token::semi_colon))
+	{
+		Error::AssignmentEqualNotFound(Tok.getOffset());
+		Failed = true;
+	}
 
+	/* values are matched to the variables front to back */
+	statements.reserve(statements.size() + variables.size());
+	for (size_t i = 0; i < variables.size(); i++)
+	{
+		uint32_t Loc = variables[i]->getLocation();
+		Expression* rhand = i < values.size() ? values[i] : at(Loc, Ctx.create<Expression>(0));
+		statements.push_back(at(Loc, Ctx.create<DecStatement>(variables[i], rhand)));
+	}
 
-	if (variables.size() < values.size())
+	if (Failed)
+	{
+		synchronize();
+	}
+	else if (!Tok.is(Token::semi_colon))
 	{
-		Error::AssignmentSidesNotEqual();
+		Error::SemiColonNotFound(Tok.getOffset());
+		synchronize();
 	}
 	else
 	{
-		while (variables.size() != 0)
-		{
-			assignments.push_back(new DecStatement(variables.front(), values.size() > 0 ? values.front() : new Expression(0)));
-			variables.erase(variables.begin());
-			
-			if (values.size() > 0)
-			{
-				values.erase(values.begin());
-			}
-		}
+		advance();
+	}
+}
 
-		if (Tok.is(Token::semi_colon))
-		{
-			advance();
-			return assignments;
-		}
-		else
-		{
-			Error::SemiColonNotFound();
-		}
+Expression* Parser::makeNumber(uint32_t Loc, int Value)
+{
+	return make<Expression>(ExpressionKey(Expression::ExpressionType::Number, (uint32_t)Value, 0), Loc, Value);
+}
+
+Expression* Parser::makeNumber()
+{
+	int Value = Tok.getNumber();
+	if (Value == TokenBuffer::OutOfRange)
+	{
+		Error::NumberOutOfRange(Tok.getOffset());
+		Value = INT32_MAX;
 	}
+	return makeNumber(Tok.getOffset(), Value);
+}
 
+Expression* Parser::makeIdentifier(uint32_t Loc, llvm::StringRef Name, uint32_t Symbol)
+{
+	return make<Expression>(ExpressionKey(Expression::ExpressionType::Identifier, Symbol, 0), Loc, Name, Symbol);
+}
 
+Expression* Parser::makeBoolean(uint32_t Loc, bool Value)
+{
+	return make<Expression>(ExpressionKey(Expression::ExpressionType::Boolean, Value, 0), Loc, Value);
 }
 
+Expression* Parser::makeBinaryOp(uint32_t Loc, BinaryOp::Operator Op, Expression* Left, Expression* Right)
+{
+	ExpressionKey Key(Expression::ExpressionType::BinaryOpType | Op << 8, (uintptr_t)Left, (uintptr_t)Right);
+	return make<BinaryOp>(Key, Loc, Op, Left, Right);
+}
 
 /*
-	parses the expression
+	and, or are wrapped in a plain Expression that points at the operation,
+	comparisons are not
 */
-Expression* Parser::parseExpr()
+Expression* Parser::makeBooleanOp(uint32_t Loc, BooleanOp::Operator Op, Expression* Left, Expression* Right)
 {
-	Expression* Left = parseTerm();
-	while (Tok.isOneOf(Token::plus, Token::minus))
+	ExpressionKey Key(Expression::ExpressionType::BooleanOpType | Op << 8, (uintptr_t)Left, (uintptr_t)Right);
+	if (Op != BooleanOp::And && Op != BooleanOp::Or)
+		return make<BooleanOp>(Key, Loc, Op, Left, Right);
+
+	if (HashConsing)
 	{
-		BinaryOp::Operator Op =
-			Tok.is(Token::plus) ? BinaryOp::Plus : BinaryOp::Minus;
-		advance();
-		Expression* Right = parseTerm();
-		Left = new BinaryOp(Op, Left, Right);
+		auto It = Uniqued.find(Key);
+		if (It != Uniqued.end())
+			return It->second;
 	}
-	return Left;
+	BooleanOp* Operation = at(Loc, Ctx.create<BooleanOp>(Op, Left, Right));
+	return make<Expression>(Key, Loc, Operation);
 }
 
-
 /*
-	parses the term
+	parses an arithmetic expression like 3*(56+a*2)/2
 */
-Expression* Parser::parseTerm()
+Expression* Parser::parseExpr()
 {
-	Expression* Left = parsePower();
-	while (Tok.isOneOf(Token::star, Token::slash, Token::mod))
-	{
-		BinaryOp::Operator Op =
-			Tok.is(Token::star) ? BinaryOp::Mul : Tok.is(Token::slash) ? BinaryOp::Div : BinaryOp::Mod;
-		advance();
-		Expression* Right = parsePower();
-		Left = new BinaryOp(Op, Left, Right);
-	}
-	return Left;
+	return parseOperators(false);
 }
 
 
 /*
-	parses the power inside expression.
+	parses a sequence of operands and binary operators by precedence
+	climbing. pending operators and open parentheses are kept on explicit
+	stacks, so long chains and deep nesting do not grow the native stack.
+	with Condition set it also accepts relational operators, and, or and
+	true/false, and the result has to be a boolean value. it returns null
+	after reporting a missing operand
 */
-Expression* Parser::parsePower()
+Expression* Parser::parseOperators(bool Condition)
 {
-	Expression* Left = parseFactor();
-	while (Tok.is(Token::power))
+	unsigned char MinPrecedence = Condition ? operators::Logical : operators::Additive;
+
+	/* most values are a single number or variable, they need no stacks */
+	if (!Condition && Tok.isOneOf(Token::number, Token::ident) &&
+		operators::Table.Entry[Tok.peek(1)].Precedence < MinPrecedence && Tok.peek(1) != Token::r_paren)
 	{
-		BinaryOp::Operator Op =
-			BinaryOp::Pow;
+		Expression* Res = Tok.is(Token::number) ?
+			makeNumber() :
+			makeIdentifier(Tok.getOffset(), Tok.getText(), Tok.getIdentifier());
+		advance();
+		return Res;
+	}
+
+	llvm::SmallVector<Expression*, 8> Operands;
+	llvm::SmallVector<PendingOperator, 8> Operators;     // an l_paren entry marks an open parenthesis
+	unsigned OpenParens = 0;
+
+	// the bottom entry binds weaker than any operator, so reducing never
+	// has to check for an empty stack
+	Operators.push_back({ Token::eof, operators::None, 0 });
+
+	while (true)
+	{
+		/* an operand, after any number of opening parentheses */
+		while (Tok.is(Token::l_paren))
+		{
+			Operators.push_back({ Token::l_paren, operators::None, Tok.getOffset() });
+			++OpenParens;
+			advance();
+		}
+
+		switch (Tok.getKind())
+		{
+		case Token::number:
+			Operands.push_back(makeNumber());
+			break;
+		case Token::ident:
+			Operands.push_back(makeIdentifier(Tok.getOffset(), Tok.getText(), Tok.getIdentifier()));
+			break;
+		case Token::KW_true:
+		case Token::KW_false:
+			if (Condition)
+			{
+				Operands.push_back(makeBoolean(Tok.getOffset(), Tok.is(Token::KW_true)));
+				break;
+			}
+		default: // error handling
+			Error::NumberVariableExpected(Tok.getOffset());
+			return nullptr;
+		}
 		advance();
-		Expression* Right = parseFactor();
-		Left = new BinaryOp(Op, Left, Right);
+
+		/* operators and closing parentheses that follow it */
+		while (true)
+		{
+			const operators::Info& Next = operators::Table.Entry[Tok.getKind()];
+			if (Next.Precedence >= MinPrecedence)
+			{
+				// every level is left associative, so equal precedence reduces first
+				while (Operators.back().Precedence >= Next.Precedence)
+					reduce(Operands, Operators);
+				Operators.push_back({ Tok.getKind(), Next.Precedence, Tok.getOffset() });
+				advance();
+				break;
+			}
+
+			if (Tok.is(Token::r_paren) && OpenParens > 0)
+			{
+				while (Operators.back().Precedence != operators::None)
+					reduce(Operands, Operators);
+				Operators.pop_back();
+				--OpenParens;
+				advance();
+				continue;
+			}
+
+			/* end of the expression, missing right parentheses are reported
+			   and then taken as given */
+			if (OpenParens > 0)
+				Error::RightParanthesisExpected(Tok.getOffset());
+			while (Operators.size() > 1)
+			{
+				if (Operators.back().Kind == Token::l_paren)
+					Operators.pop_back();
+				else
+					reduce(Operands, Operators);
+			}
+			if (Condition && !isBooleanValue(Operands.back()))
+				Error::BooleanValueExpected(Tok.getOffset());
+			return Operands.back();
+		}
 	}
-	return Left;
 }
 
+
 /*
-	parses factor
+	pops the top operator and its two operands and pushes the node they
+	form. arithmetic and relational operators take numbers, and, or take
+	boolean values
 */
-Expression* Parser::parseFactor()
+void Parser::reduce(llvm::SmallVectorImpl<Expression*>& Operands, llvm::SmallVectorImpl<PendingOperator>& Operators)
 {
-	Expression* Res = nullptr;
-	switch (Tok.getKind())
-	{
-	case Token::number:
-	{
-		int number;
-		Tok.getText().getAsInteger(10, number);
-		Res = new Expression(number);
-		advance();
-		break;
-	}
-	case Token::ident:
+	PendingOperator Pending = Operators.pop_back_val();
+	Expression* Right = Operands.pop_back_val();
+	Expression* Left = Operands.pop_back_val();
+	const operators::Info& Info = operators::Table.Entry[Pending.Kind];
+
+	Expression* Res;
+	if (Pending.Precedence == operators::Logical)
 	{
-		Res = new Expression(Tok.getText());
-		advance();
-		break;
+		if (!isBooleanValue(Left) || !isBooleanValue(Right))
+			Error::BooleanValueExpected(Pending.Loc);
+		Res = makeBooleanOp(Pending.Loc, (BooleanOp::Operator)Info.Op, Left, Right);
 	}
-	case Token::l_paren:
+	else if (Pending.Precedence == operators::Relational)
 	{
-		advance();
-		Res = parseExpr();
-		if (!consume(Token::r_paren))
-			break;
+		if (isBooleanValue(Left) || isBooleanValue(Right))
+			Error::BooleanValueExpected(Pending.Loc);
+		Res = makeBooleanOp(Pending.Loc, (BooleanOp::Operator)Info.Op, Left, Right);
 	}
-	default: // error handling
+	else
 	{
-		Error::NumberVariableExpected();
+		if (isBooleanValue(Left) || isBooleanValue(Right))
+			Error::NumberVariableExpected(Pending.Loc);
+		Res = makeBinaryOp(Pending.Loc, (BinaryOp::Operator)Info.Op, Left, Right);
 	}
-
-	}
-	return Res;
+	Operands.push_back(Res);
 }
 
 
 /*
 	parse assignment like a = 3;
+	it returns null after a syntax error
 */
 AssignStatement* Parser::parseAssign()
 {
 	Expression* variable;
-	Expression* value;
+	Expression* value = nullptr;
 
 	variable = parseVar();
 
 	if (Tok.is(Token::minus_equal))
 	{
+		uint32_t OpLoc = Tok.getOffset();
 		advance();
 		value = parseExpr();
-		value = new BinaryOp(BinaryOp::Minus, variable, value);
+		if (value)
+			value = makeBinaryOp(OpLoc, BinaryOp::Minus, variable, value);
 
 	}
 	else if (Tok.is(Token::plus_equal))
 	{
+		uint32_t OpLoc = Tok.getOffset();
 		advance();
 		value = parseExpr();
-		value = new BinaryOp(BinaryOp::Plus, variable, value);
+		if (value)
+			value = makeBinaryOp(OpLoc, BinaryOp::Plus, variable, value);
 	}
 	else if (Tok.is(Token::star_equal))
 	{
+		uint32_t OpLoc = Tok.getOffset();
 		advance();
 		value = parseExpr();
-		value = new BinaryOp(BinaryOp::Mul, variable, value);
+		if (value)
+			value = makeBinaryOp(OpLoc, BinaryOp::Mul, variable, value);
 	}
 	else if (Tok.is(Token::slash_equal))
 	{
+		uint32_t OpLoc = Tok.getOffset();
 		advance();
 		value = parseExpr();
-		value = new BinaryOp(BinaryOp::Div, variable, value);
+		if (value)
+			value = makeBinaryOp(OpLoc, BinaryOp::Div, variable, value);
 	}
 	else if (Tok.is(Token::mod_equal))
 	{
+		uint32_t OpLoc = Tok.getOffset();
 		advance();
 		value = parseExpr();
-		value = new BinaryOp(BinaryOp::Mod, variable, value);
+		if (value)
+			value = makeBinaryOp(OpLoc, BinaryOp::Mod, variable, value);
 	}
 	else if (Tok.is(Token::equal))
 	{
@@ -296,16 +500,25 @@ AssignStatement* Parser::parseAssign()
 	}
 	else
 	{
-		Error::AssignmentEqualNotFound();
+		Error::AssignmentEqualNotFound(Tok.getOffset());
 	}
 
+	if (!value)
+	{
+		synchronize();
+		return nullptr;
+	}
+
+	AssignStatement* Res = at(variable->getLocation(), Ctx.create<AssignStatement>(variable, value));
 	if (!Tok.is(Token::semi_colon))
 	{
-		Error::SemiColonNotFound();
+		Error::SemiColonNotFound(Tok.getOffset());
+		synchronize();
+		return Res;
 	}
 
 	advance(); // pass semicolon
-	return new AssignStatement(variable, value);
+	return Res;
 
 }
 
@@ -313,329 +526,206 @@ AssignStatement* Parser::parseAssign()
 /*
 	parses variable name, it returns an expression
 	with type Identifier with variable name inside it.
-	in order to get it you need to call getValue() on Expression object
+	in order to get it you need to call getValue() on Expression object.
+	it returns null if there is no variable name
 */
 Expression* Parser::parseVar()
 {
 	if (!Tok.is(Token::ident))
 	{
-		Error::VariableNameNotFound();
+		Error::VariableNameNotFound(Tok.getOffset());
+		return nullptr;
 	}
 
-	Expression* variable = new Expression(Tok.getText());
+	Expression* variable = at(Tok.getOffset(), Ctx.create<Expression>(Tok.getText(), Tok.getIdentifier()));
 	advance();
 	return variable;
 }
 
 
-LoopStatement* Parser::parseLoop()
-{
-	advance();			// pass loop identifier
-
-	Expression* condition = parseCondition();
-
-
-
-	if (!Tok.is(Token::colon))
-	{
-		Error::ColonExpectedAfterCondition();
-	}
-
-	advance();
-
-	if (Tok.is(Token::KW_begin))
-	{
-		advance();
-
-		Base* AllStates = parseStatement();
-
-		if (!consume(Token::KW_end))
-		{
-
-			return new LoopStatement(condition, AllStates->getStatements(), Statement::StateMentType::Loop);
-		}
-		else
-		{
-			Error::EndNotSeenForIf();
-		}
-	}
-	else
-	{
-		Error::BeginExpectedAfterColon();
-	}
-}
-
 /*
 	parses condition like 3 > 5+1 and true
 */
 Expression* Parser::parseCondition()
 {
-	Expression* lcondition;
-
-	lcondition = parseSubCondition();
-	if (Tok.is(Token::KW_and))
-	{
-		advance();
-		Expression* rcondition = parseCondition();
-		return new Expression(new BooleanOp(BooleanOp::And, lcondition, rcondition));
-	}
-	else if (Tok.is(Token::KW_or))
-	{
-		advance();
-		Expression* rcondition = parseCondition();
-		return new Expression(new BooleanOp(BooleanOp::Or, lcondition, rcondition));
-	}
-	else
-	{
-		return lcondition;
-	}
+	return parseOperators(true);
 }
 
 
 /*
-	parses a single subcondition like 3 > 5+1
-	it does not deal with and, or
+	parses the header of an if, elif, else or loopc block up to and
+	including begin, and opens its body. after a syntax error the header
+	is skipped up to its begin, and without one the statements that
+	follow are taken as the body
 */
-Expression* Parser::parseSubCondition()
+void Parser::openBlock(llvm::SmallVectorImpl<OpenBlock>& Open, size_t FirstStatement)
 {
+	OpenBlock Block;
+	Block.Kind = Tok.is(Token::KW_if) ? Statement::StateMentType::If :
+		Tok.is(Token::KW_elif) ? Statement::StateMentType::Elif :
+		Tok.is(Token::KW_else) ? Statement::StateMentType::Else : Statement::StateMentType::Loop;
+	Block.Loc = Tok.getOffset();
+	Block.Condition = nullptr;
+	Block.FirstStatement = FirstStatement;
+	Block.FirstElif = 0;
+	Block.BodyParsed = false;
+	advance();			// pass the keyword
 
-
-	if (Tok.is(Token::l_paren))
+	bool Failed = false;
+	if (Block.Kind != Statement::StateMentType::Else)
 	{
-
-		advance();
-		Expression* expressionInside = parseCondition();
-		if (!consume(Token::r_paren))
+		Block.Condition = parseCondition();
+		if (!Block.Condition)
 		{
-			return expressionInside;
-		}
-		else
-		{
-			Error::RightParanthesisExpected();
+			// stands in for the condition that failed to parse
+			Block.Condition = at(Block.Loc, Ctx.create<Expression>(false));
+			Failed = true;
 		}
 	}
 
-	else if (Tok.is(Token::KW_true))
+	if (!Failed && !Tok.is(Token::colon))
 	{
-		advance();
-
-		return new Expression(true);
+		Error::ColonExpectedAfterCondition(Tok.getOffset());
+		Failed = true;
 	}
-	else if (Tok.is(Token::KW_false))
+	else if (!Failed)
 	{
 		advance();
-		return new Expression(false);
-	}
-	else
-	{
-		Expression* lhand = parseExpr();
-		BooleanOp::Operator Op;
-
-		if (Tok.is(Token::less))
-		{
-			Op = BooleanOp::Less;
-		}
-		else if (Tok.is(Token::less_equal))
-		{
-			Op = BooleanOp::LessEqual;
-		}
-		else if (Tok.is(Token::greater))
-		{
-			Op = BooleanOp::Greater;
-		}
-		else if (Tok.is(Token::greater_equal))
-		{
-			Op = BooleanOp::GreaterEqual;
-		}
-		else if (Tok.is(Token::equal_equal))
+		if (!Tok.is(Token::KW_begin))
 		{
-			Op = BooleanOp::Equal;
-		}
-		else if (Tok.is(Token::not_equal))
-		{
-			Op = BooleanOp::NotEqual;
-		}
-		else
-		{
-			Error::BooleanValueExpected();
+			Error::BeginExpectedAfterColon(Tok.getOffset());
+			Failed = true;
 		}
+	}
 
+	if (Failed)
+		synchronize(true);
+	if (Tok.is(Token::KW_begin))
 		advance();
-		Expression* rhand = parseExpr();
-		return new BooleanOp(Op, lhand, rhand);
-
-	}
+	Open.push_back(Block);
 }
 
-
 /*
-	parse if statement and return the control statement
-	associated with it.
+	parses an if or loopc statement together with every statement nested
+	inside it, or a stray elif or else branch on its own. the blocks that are still open are kept on an explicit
+	stack instead of recursing once per nesting level, so deeply nested
+	programs cost heap memory rather than native stack
 */
-IfStatement* Parser::parseIf()
+Statement* Parser::parseBlock()
 {
-	advance();			// pass if identifier
-
-	Expression* condition = parseCondition();
+	llvm::SmallVector<OpenBlock, 8> Open;
+	llvm::SmallVector<Statement*, 16> Statements;   // bodies of the open blocks, innermost last
+	llvm::SmallVector<ElifStatement*, 4> Elifs;     // elifs of the open if statements
+	bool ReportedEof = false;                       // eof closes every open block, reported once
 
-	
-
-	if (!Tok.is(Token::colon))
+	openBlock(Open, 0);
+	while (true)
 	{
-		Error::ColonExpectedAfterCondition();
-	}
-
-	advance();
+		OpenBlock& Top = Open.back();
+		Statement* Done;
 
-	if (Tok.is(Token::KW_begin))
-	{
-		advance();
-
-		Base* AllStates = parseStatement();
-
-		if (!consume(Token::KW_end))
+		if (Top.BodyParsed)
 		{
-			llvm::SmallVector<ElifStatement*> ElifS;
-			ElseStatement* ElseS;
-			bool hasElif = false;
-			bool hasElse = false;
-
-			while (Tok.is(Token::KW_elif))
-			{
-				ElifStatement* statement = parseElif();
-				ElifS.push_back(statement);
-				hasElif = true;
-			}
-			if (Tok.is(Token::KW_else))
+			/* an if after its body, it goes on with an elif or else or ends here */
+			if (Tok.isOneOf(Token::KW_elif, Token::KW_else))
 			{
-				ElseS = parseElse();
-				hasElse = true;
+				openBlock(Open, Statements.size());
+				continue;
 			}
-			return new IfStatement(condition, AllStates->getStatements(),
-									ElifS, ElseS, hasElif, hasElse,
-									Statement::StateMentType::If);
+			llvm::ArrayRef<ElifStatement*> ElifS = Ctx.copy(llvm::makeArrayRef(Elifs).slice(Top.FirstElif));
+			Elifs.resize(Top.FirstElif);
+			Done = at(Top.Loc, Ctx.create<IfStatement>(Top.Condition, Top.Body, ElifS, nullptr,
+				!ElifS.empty(), false, Statement::StateMentType::If));
+			Open.pop_back();
 		}
 		else
 		{
-			Error::EndNotSeenForIf();
-		}
-	}
-	else
-	{
-		Error::BeginExpectedAfterColon();
-	}
-}
-
-ElifStatement* Parser::parseElif()
-{
-	advance();			// pass if identifier
-
-	Expression* condition = parseCondition();
-
-	
-
-	if (!Tok.is(Token::colon))
-	{
-		Error::ColonExpectedAfterCondition();
-	}
-
-	advance();
-
-	if (Tok.is(Token::KW_begin))
-	{
-		advance();
-
-		Base* AllStates = parseStatement();
-
-		if (!consume(Token::KW_end))
-		{
-	
-			return new ElifStatement(condition, AllStates->getStatements(), Statement::StateMentType::Elif);
-		}
-		else
-		{
-			Error::EndNotSeenForIf();
-		}
-	}
-	else
-	{
-		Error::BeginExpectedAfterColon();
-	}
-}
-
-ElseStatement* Parser::parseElse()
-{
-	advance();			// pass if identifier
-
-	if (!Tok.is(Token::colon))
-	{
-		Error::ColonExpectedAfterCondition();
-	}
-
-	advance();
-
-	if (Tok.is(Token::KW_begin))
-	{
-		advance();
-
-		Base* AllStates = parseStatement();
-
-		if (!consume(Token::KW_end))
-		{
-	
-			return new ElseStatement(AllStates->getStatements(), Statement::StateMentType::Else);
-		}
-		else
-		{
-			Error::EndNotSeenForIf();
-		}
-	}
-	else
-	{
-		Error::BeginExpectedAfterColon();
-	}
-}
-
-Base* Parser::parseStatement()
-{
-	llvm::SmallVector<Statement*> statements;
-	while (!Tok.is(Token::KW_end))
-	{
-		switch (Tok.getKind())
-		{
-		case Token::ident:
-		{
-			AssignStatement* state = parseAssign();
+			switch (Tok.getKind())
+			{
+			case Token::ident:
+				if (AssignStatement* S = parseAssign())
+					Statements.push_back(S);
+				continue;
+			case Token::KW_int:
+				/* declared anyway, so that uses of the variable are not reported too */
+				Error::DefineInsideScope(Tok.getOffset());
+				parseDefine(Statements);
+				continue;
+			case Token::KW_if:
+			case Token::KW_loopc:
+				openBlock(Open, Statements.size());
+				continue;
+			default:
+				break;
+			}
 
-			statements.push_back(state);
-			break;
-		}
-		case Token::KW_int:
-		{
-			Error::DefineInsideScope();
-		}
-		case Token::KW_if:
-		{
-			IfStatement* statement = parseIf();
-			statements.push_back(statement);
-			break;
+			/* end closes the innermost body. elif, else and eof close it too
+			   once the missing end is reported, anything else is skipped */
+			if (Tok.is(Token::KW_end))
+			{
+				advance();
+			}
+			else if (Tok.isOneOf(Token::KW_elif, Token::KW_else))
+			{
+				Error::EndNotSeenForIf(Tok.getOffset());
+			}
+			else if (Tok.is(Token::eof))
+			{
+				if (!ReportedEof)
+					Error::EndNotSeenForIf(Tok.getOffset());
+				ReportedEof = true;
+			}
+			else
+			{
+				error();
+				advance();
+				synchronize();
+				continue;
+			}
 
-		}
-		case Token::KW_loopc:
-		{
-			LoopStatement* statement = parseLoop();
-			statements.push_back(statement);
-			break;
-		}
+			llvm::ArrayRef<Statement*> Body = Ctx.copy(llvm::makeArrayRef(Statements).slice(Top.FirstStatement));
+			Statements.resize(Top.FirstStatement);
 
-		default:
-		{
-			return new Base(statements);
+			OpenBlock Block = Open.pop_back_val();
+			switch (Block.Kind)
+			{
+			case Statement::StateMentType::If:
+				Block.Body = Body;
+				Block.BodyParsed = true;
+				Block.FirstElif = Elifs.size();
+				Open.push_back(Block);
+				continue;
+			case Statement::StateMentType::Elif:
+			{
+				ElifStatement* ElifS = at(Block.Loc, Ctx.create<ElifStatement>(Block.Condition, Body, Statement::StateMentType::Elif));
+				if (Open.empty())
+					return ElifS;
+				Elifs.push_back(ElifS);
+				continue;
+			}
+			case Statement::StateMentType::Else:
+			{
+				ElseStatement* ElseS = at(Block.Loc, Ctx.create<ElseStatement>(Body, Statement::StateMentType::Else));
+				if (Open.empty())
+					return ElseS;
+				OpenBlock If = Open.pop_back_val();
+				llvm::ArrayRef<ElifStatement*> ElifS = Ctx.copy(llvm::makeArrayRef(Elifs).slice(If.FirstElif));
+				Elifs.resize(If.FirstElif);
+				Done = at(If.Loc, Ctx.create<IfStatement>(If.Condition, If.Body, ElifS, ElseS,
+					!ElifS.empty(), true, Statement::StateMentType::If));
+				break;
+			}
+			default:
+				Done = at(Block.Loc, Ctx.create<LoopStatement>(Block.Condition, Body, Statement::StateMentType::Loop));
+				break;
+			}
 		}
 
-		}
+		/* a statement is complete, it belongs to the enclosing body if there is one */
+		if (Open.empty())
+			return Done;
+		Statements.push_back(Done);
 	}
-	return new Base(statements);
 }
 
 Base* Parser::parse()
@@ -2,24 +2,95 @@
 #define _PARSER_H
 
 #include "AST.h"
+#include "Error.h"
 #include "Lexer.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/raw_ostream.h"
+#include <tuple>
 
 
 
 class Parser {
-	Lexer& Lex;
-	Token Tok;
-	bool HasError;
+	TokenCursor Tok;
+	ASTContext& Ctx;        // every node is allocated here
+	unsigned FirstError;    // errors reported before this parser started
+
+	// with hash consing on, structurally identical expressions are one
+	// node. the key is the kind and operator, then the operands, which
+	// are shared already, or the value of a leaf
+	typedef std::tuple<unsigned, uintptr_t, uintptr_t> ExpressionKey;
+	llvm::DenseMap<ExpressionKey, Expression*> Uniqued;
+	bool HashConsing;
 
 	void error()
 	{
-		llvm::errs() << "Unexpected: " << Tok.getText() << "\n";
-		HasError = true;
+		llvm::errs() << Error::getLocation(Tok.getOffset()) << "Unexpected: " << Tok.getText() << "\n";
+		Error::report();
+	}
+
+	void synchronize(bool Begin = false);
+
+	// records the source offset of Node and returns it
+	template <typename T>
+	T* at(uint32_t Loc, T* Node)
+	{
+		Node->setLocation(Loc);
+		return Node;
+	}
+
+
+	// a binary operator waiting for its right operand
+	struct PendingOperator {
+		Token::TokenKind Kind;
+		unsigned char Precedence;
+		uint32_t Loc;
+	};
+
+	static bool isBooleanValue(Expression* E)
+	{
+		return E->getKind() == Expression::ExpressionType::Boolean ||
+			E->getKind() == Expression::ExpressionType::BooleanOpType;
 	}
 
+	// an if, elif, else or loop body whose statements are still being parsed
+	struct OpenBlock {
+		Statement::StateMentType Kind;
+		uint32_t Loc;
+		Expression* Condition;
+		size_t FirstStatement;              // where its statements start on the statement stack
+		size_t FirstElif;                   // where the elifs of an if start on the elif stack
+		llvm::ArrayRef<Statement*> Body;    // the body of an if, once BodyParsed is set
+		bool BodyParsed;
+	};
 
-	void advance() { Lex.next(Tok); }
+	void openBlock(llvm::SmallVectorImpl<OpenBlock>& Open, size_t FirstStatement);
+
+	// create expression nodes, or return the one already made for the same
+	// key. Loc is only recorded on a new node
+	template <typename T, typename... ArgTs>
+	Expression* make(ExpressionKey Key, uint32_t Loc, ArgTs&&... Args)
+	{
+		if (!HashConsing)
+			return at(Loc, Ctx.create<T>(std::forward<ArgTs>(Args)...));
+		Expression*& Slot = Uniqued[Key];
+		if (!Slot)
+			Slot = at(Loc, Ctx.create<T>(std::forward<ArgTs>(Args)...));
+		return Slot;
+	}
+
+	Expression* makeNumber(uint32_t Loc, int Value);
+	// the number token at the cursor. a literal too large for an int is
+	// reported and read as INT_MAX, so no division by zero is made up
+	Expression* makeNumber();
+	Expression* makeIdentifier(uint32_t Loc, llvm::StringRef Name, uint32_t Symbol);
+	Expression* makeBoolean(uint32_t Loc, bool Value);
+	Expression* makeBinaryOp(uint32_t Loc, BinaryOp::Operator Op, Expression* Left, Expression* Right);
+	Expression* makeBooleanOp(uint32_t Loc, BooleanOp::Operator Op, Expression* Left, Expression* Right);
+
+	Expression* parseOperators(bool Condition);
+	void reduce(llvm::SmallVectorImpl<Expression*>& Operands, llvm::SmallVectorImpl<PendingOperator>& Operators);
+
+	void advance() { Tok.advance(); }
 
 	bool expect(Token::TokenKind Kind)
 	{
@@ -45,30 +116,30 @@ class Parser {
 
 public:
 	Base* parseS();
-	Base* parseStatement();
-	llvm::SmallVector<DecStatement*> parseDefine();
+	bool parseNext(llvm::SmallVector<Statement*>& statements);
+	bool parseTopLevel(llvm::SmallVector<Statement*>& statements);
+	Statement* parseBlock();
+	void parseDefine(llvm::SmallVectorImpl<Statement*>& statements);
 	Expression* parseExpr();
-	Expression* parseTerm();
-	Expression* parsePower();
-	Expression* parseFactor();
 	AssignStatement* parseAssign();
-	LoopStatement* parseLoop();
-	IfStatement* parseIf();
-	ElifStatement* parseElif();
-	ElseStatement* parseElse();
 	Expression* parseCondition();
-	Expression* parseSubCondition();
 	Expression* parseVar();
 
 public:
-	// initializes all members and retrieves the first token
-	Parser(Lexer& Lex) : Lex(Lex), HasError(false)
+	// initializes all members, the cursor starts on token Start
+	Parser(const TokenBuffer& Tokens, ASTContext& Ctx, unsigned Start = 0) : Tok(Tokens, Start), Ctx(Ctx), FirstError(Error::getNumErrors()), HashConsing(false)
 	{
-		advance();
 	}
 
-	// get the value of error flag
-	bool hasError() { return HasError; }
+	// whether a syntax error was reported, the tree is complete either way
+	bool hasError() { return Error::getNumErrors() != FirstError; }
+
+	// share structurally identical expressions from here on. diagnostics
+	// inside a shared expression point at its first occurrence
+	void setHashConsing(bool Enable) { HashConsing = Enable; }
+
+	// index of the current token
+	unsigned getPosition() { return Tok.getIndex(); }
 
 	Base* parse();
 };
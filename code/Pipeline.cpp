@@ -0,0 +1,69 @@
+#include "Pipeline.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Pass.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+
+bool IRPipeline::isLevel(char Level)
+{
+	return (Level >= '0' && Level <= '3') || Level == 's' || Level == 'z';
+}
+
+static llvm::OptimizationLevel getOptimizationLevel(char Level)
+{
+	switch (Level)
+	{
+	case '1':
+		return llvm::OptimizationLevel::O1;
+	case '2':
+		return llvm::OptimizationLevel::O2;
+	case '3':
+		return llvm::OptimizationLevel::O3;
+	case 's':
+		return llvm::OptimizationLevel::Os;
+	case 'z':
+		return llvm::OptimizationLevel::Oz;
+	default:
+		return llvm::OptimizationLevel::O0;
+	}
+}
+
+/*
+	the analysis managers and the instrumentation, which does the timing,
+	printing and verifying between passes, only live for one run. the
+	pass timings are printed when the instrumentation goes away
+*/
+void IRPipeline::run(llvm::Module& M) const
+{
+	llvm::LoopAnalysisManager LAM;
+	llvm::FunctionAnalysisManager FAM;
+	llvm::CGSCCAnalysisManager CGAM;
+	llvm::ModuleAnalysisManager MAM;
+
+	llvm::PassInstrumentationCallbacks PIC;
+	llvm::StandardInstrumentations SI(/*DebugLogging=*/false, VerifyEach);
+	SI.registerCallbacks(PIC, &FAM);
+
+	llvm::PassBuilder PB(nullptr, llvm::PipelineTuningOptions(), llvm::None, &PIC);
+	PB.registerModuleAnalyses(MAM);
+	PB.registerCGSCCAnalyses(CGAM);
+	PB.registerFunctionAnalyses(FAM);
+	PB.registerLoopAnalyses(LAM);
+	PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+	llvm::OptimizationLevel O = getOptimizationLevel(Level);
+	llvm::ModulePassManager MPM;
+	MPM.addPass(llvm::VerifierPass());
+	if (O == llvm::OptimizationLevel::O0)
+		MPM.addPass(PB.buildO0DefaultPipeline(O));
+	else
+		MPM.addPass(PB.buildPerModuleDefaultPipeline(O));
+	MPM.addPass(llvm::VerifierPass());
+	MPM.run(M, MAM);
+}
+
+PhaseTimer::PhaseTimer(llvm::StringRef Name, llvm::StringRef Description) :
+	llvm::NamedRegionTimer(Name, Description, "mas", "MAS-Lang phases", llvm::TimePassesIsEnabled)
+{
+}
@@ -0,0 +1,38 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Timer.h"
+
+namespace llvm {
+	class Module;
+}
+
+/*
+	the LLVM passes run on the generated module before it is printed: the
+	default pipeline of the new pass manager for an -O level. the module
+	is verified before and after the pipeline, with VerifyEach after every
+	pass as well. LLVM's own -time-passes and -print-after-all options
+	apply to the passes run here
+*/
+class IRPipeline {
+	char Level;         // 0, 1, 2, 3, s or z, as after -O
+	bool VerifyEach;
+
+public:
+	IRPipeline(char Level, bool VerifyEach) : Level(Level), VerifyEach(VerifyEach) {}
+
+	// whether Level names a pipeline
+	static bool isLevel(char Level);
+
+	// a module that fails to verify is a compiler bug and aborts
+	void run(llvm::Module& M) const;
+};
+
+// times a phase of the compiler for the -time-passes report
+class PhaseTimer : public llvm::NamedRegionTimer {
+public:
+	PhaseTimer(llvm::StringRef Name, llvm::StringRef Description);
+};
+
+#endif
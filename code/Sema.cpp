@@ -1,15 +1,22 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include "ASTWalker.h"
+#include "Error.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace {
-    class DeclCheck : public ASTVisitor {
-        llvm::StringSet<> Scope;
+    // declared variables and error reporting shared by both tree encodings
+    class ScopeCheck {
+        llvm::BitVector& Scope; // indexed by symbol id, set once the variable is declared
+
+    protected:
         bool HasError;
 
         enum ErrorType { Twice, Not, DivByZero };
 
-        void error(ErrorType ET, llvm::StringRef V) {
+        void error(ErrorType ET, llvm::StringRef V, uint32_t Loc) {
+            llvm::errs() << Error::getLocation(Loc);
             if (ET == ErrorType::DivByZero) {
                 llvm::errs() << "Division by zero is not allowed." << "\n";
             }
@@ -18,186 +25,231 @@ namespace {
                 llvm::errs() << "Variable " << V << " is " << (ET == Twice ? "already" : "not") << " declared!\n";
             }
             HasError = true;
-            exit(3);
+            Error::report();
+        }
+
+        bool isDeclared(uint32_t Symbol) {
+            return Symbol < Scope.size() && Scope.test(Symbol);
+        }
+
+        // marks Symbol as declared, returns false if it already was
+        bool declare(uint32_t Symbol) {
+            if (Symbol >= Scope.size())
+                Scope.resize(std::max<size_t>(Symbol + 1, Scope.size() * 2));
+            if (Scope.test(Symbol))
+                return false;
+            Scope.set(Symbol);
+            return true;
         }
 
     public:
-        DeclCheck() : HasError(false) {}
+        ScopeCheck(llvm::BitVector& Scope) : Scope(Scope), HasError(false) {}
 
         bool hasError() { return HasError; }
+    };
 
-        virtual void visit(Expression& Node) override {
-            if (Node.getKind() == Expression::ExpressionType::Identifier) {
-                if (Scope.find(Node.getValue()) == Scope.end())
-                    error(Not, Node.getValue());
-            }
-            else if (Node.getKind() == Expression::ExpressionType::BinaryOpType)
-            {
-                BinaryOp* declaration = (BinaryOp*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Expression::ExpressionType::BooleanOpType)
-            {
-                BooleanOp* temp = Node.getBooleanOp();
+    class DeclCheck : public ASTWalker<DeclCheck>, public ScopeCheck {
+        friend class ASTWalker<DeclCheck>;
+
+    public:
+        DeclCheck(llvm::BitVector& Scope) : ScopeCheck(Scope), Target(nullptr) {}
 
-                (temp->getLeft())->accept(*this);
+    private:
+        Expression* Target; // an assignment target, compound assignments use it as their left operand too
 
-                (temp->getRight())->accept(*this);
+        bool visitIdentifier(Expression* Node, unsigned Step) {
+            if (Node != Target && !isDeclared(Node->getSymbol()))
+                error(Not, Node->getValue(), Node->getLocation());
+            return false;
+        }
+
+        bool visitBinaryOp(BinaryOp* Op, unsigned Step) {
+            if (Step == 0) {
+                if (Op->getLeft())
+                    push(Op->getLeft());
+                else
+                    HasError = true;
+                if (Op->getRight())
+                    push(Op->getRight());
+                else
+                    HasError = true;
+                return true;
+            }
+
+            // both sides have been checked
+            if (Op->getOperator() == BinaryOp::Operator::Div)
+            {
+                Expression* right = Op->getRight();
+                if (right && right->isNumber() && right->getNumber() == 0) {
+                    error(DivByZero, Op->getLeft()->getValue(), Op->getLocation());
+                }
             }
-        };
+            return false;
+        }
 
-        virtual void visit(BinaryOp& Node) override {
-            if (Node.getLeft())
-                Node.getLeft()->accept(*this);
+        bool visitBooleanOp(BooleanOp* Op, unsigned Step) {
+            if (Op->getLeft())
+                push(Op->getLeft());
             else
                 HasError = true;
-            if (Node.getRight())
-                Node.getRight()->accept(*this);
+            if (Op->getRight())
+                push(Op->getRight());
             else
                 HasError = true;
-            
-            if (Node.getOperator() == BinaryOp::Operator::Div)
-            {
-                Expression* right = (Expression*)Node.getRight();
-                if (right->isNumber() && right->getNumber() == 0) {
-                    error(DivByZero, ((Expression*)Node.getLeft())->getValue());
-                }
-            }
-        };
-
-        virtual void visit(DecStatement& Node) override {
-
-            auto I = (Node.getLValue());
-
-            if (!Scope.insert(Node.getLValue()->getValue()).second)
-                error(Twice, Node.getLValue()->getValue());
-
-            Expression* declaration = (Expression*)Node.getRValue();
-            declaration->accept(*this);
-            
-        };
-
-        virtual void visit(IfStatement& Node) override {
-
-            Expression* declaration = (Expression*)Node.getCondition();
-            declaration->accept(*this);
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
-
-        };
-
-        virtual void visit(ElifStatement& Node) override {
-
-            Expression* declaration = (Expression*)Node.getCondition();
-            declaration->accept(*this);
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
-
-        };
-
-
-        virtual void visit(ElseStatement& Node) override {
-
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
-
-        };
+            return false;
+        }
 
-        virtual void visit(LoopStatement& Node) override {
+        bool visitDeclaration(DecStatement* Dec, unsigned Step) {
+            if (!declare(Dec->getLValue()->getSymbol()))
+                error(Twice, Dec->getLValue()->getValue(), Dec->getLocation());
+            push(Dec->getRValue());
+            return false;
+        }
 
-            Node.getCondition()->accept(*this);
+        bool visitAssignment(AssignStatement* Assign, unsigned Step) {
+            Target = Assign->getLValue();
+            if (!isDeclared(Target->getSymbol()))
+                error(Not, Target->getValue(), Assign->getLocation());
+            push(Assign->getRValue());
+            return false;
+        }
 
-            llvm::SmallVector<Statement* > stmts = Node.getStatements();
-            for (auto I = stmts.begin(), E = stmts.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
+        // if, elif, else and loops only have their children checked
+    };
 
+    /* the same checks on the flat encoding, in the same order. nodes wait
+       on an explicit stack like in DeclCheck, so the nesting depth costs
+       no native stack */
+    class FlatDeclCheck : public ScopeCheck {
+        struct Item {
+            FlatAST::NodeId Node;
+            bool Checked; // a division whose operands have been checked
         };
 
-        virtual void visit(AssignStatement& Node) override {
-            auto I = (Node.getLValue());
-
-           
-            if (!Scope.count(Node.getLValue()->getValue()))
-                error(Not, Node.getLValue()->getValue());
+        const FlatAST& Tree;
+        llvm::SmallVector<Item, 64> Stack;
+        FlatAST::NodeId Target; // the copy of an assignment target that is the left operand of a compound assignment
 
-            Expression* declaration = (Expression*)Node.getRValue();
-            declaration->accept(*this);
+        void push(FlatAST::NodeId N, bool Checked = false) {
+            Stack.push_back({ N, Checked });
+        }
 
-        };
+        // last to first, so the statements come off the stack in order
+        void pushBlock(FlatAST::NodeId N) {
+            llvm::ArrayRef<FlatAST::NodeId> Statements = Tree.getStatements(N);
+            for (size_t I = Statements.size(); I-- > 0;)
+                push(Statements[I]);
+        }
 
-        virtual void visit(Statement& Node) override {
-            if (Node.getKind() == Statement::StateMentType::Declaration)
-            {
-                DecStatement* declaration = (DecStatement*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Statement::StateMentType::Assignment)
-            {
-                AssignStatement* declaration = (AssignStatement*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Statement::StateMentType::If)
-            {
-                IfStatement* declaration = (IfStatement*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Statement::StateMentType::Elif)
-            {
-                ElifStatement* declaration = (ElifStatement*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Statement::StateMentType::Else)
-            {
-                ElseStatement* declaration = (ElseStatement*)&Node;
-                declaration->accept(*this);
-            }
-            else if (Node.getKind() == Statement::StateMentType::Loop)
-            {
-                LoopStatement* declaration = (LoopStatement*)&Node;
-                declaration->accept(*this);
+        void visit(Item Current) {
+            FlatAST::NodeId N = Current.Node;
+            switch (Tree.getKind(N)) {
+            case FlatAST::Identifier:
+                if (N != Target && !isDeclared(Tree.getSymbol(N)))
+                    error(Not, Tree.getName(Tree.getSymbol(N)), Tree.getLocation(N));
+                break;
+            case FlatAST::BinaryOpType: {
+                FlatAST::NodeId Right = Tree.getRight(N);
+                if (!Current.Checked) {
+                    if (Tree.getOperator(N) == BinaryOp::Operator::Div)
+                        push(N, true);
+                    push(Right);
+                    push(Tree.getLeft(N));
+                }
+                else if (Tree.getKind(Right) == FlatAST::Number && Tree.getNumber(Right) == 0)
+                    error(DivByZero, "", Tree.getLocation(N));
+                break;
+            }
+            case FlatAST::BooleanOpType:
+                push(Tree.getRight(N));
+                push(Tree.getLeft(N));
+                break;
+            case FlatAST::Declaration: {
+                FlatAST::NodeId Var = Tree.getLValue(N);
+                if (!declare(Tree.getSymbol(Var)))
+                    error(Twice, Tree.getName(Tree.getSymbol(Var)), Tree.getLocation(N));
+                push(Tree.getRValue(N));
+                break;
+            }
+            case FlatAST::Assignment: {
+                FlatAST::NodeId Var = Tree.getLValue(N);
+                FlatAST::NodeId Value = Tree.getRValue(N);
+                if (!isDeclared(Tree.getSymbol(Var)))
+                    error(Not, Tree.getName(Tree.getSymbol(Var)), Tree.getLocation(N));
+                // the encoding copies the target, the copy is where the target is
+                Target = FlatAST::Invalid;
+                if (Tree.getKind(Value) == FlatAST::BinaryOpType) {
+                    FlatAST::NodeId Left = Tree.getLeft(Value);
+                    if (Tree.getKind(Left) == FlatAST::Identifier && Tree.getLocation(Left) == Tree.getLocation(Var))
+                        Target = Left;
+                }
+                push(Value);
+                break;
+            }
+            case FlatAST::If: {
+                // condition, body, elifs and else, pushed in reverse
+                if (Tree.getElse(N) != FlatAST::Invalid)
+                    push(Tree.getElse(N));
+                llvm::ArrayRef<FlatAST::NodeId> Elifs = Tree.getElifs(N);
+                for (size_t I = Elifs.size(); I-- > 0;)
+                    push(Elifs[I]);
+                pushBlock(N);
+                push(Tree.getCondition(N));
+                break;
+            }
+            case FlatAST::Elif:
+            case FlatAST::Loop:
+                pushBlock(N);
+                push(Tree.getCondition(N));
+                break;
+            case FlatAST::Else:
+            case FlatAST::Program:
+                pushBlock(N);
+                break;
+            default:
+                break;
             }
+        }
 
-        };
-
-        virtual void visit(BooleanOp& Node) override {
-            if (Node.getLeft())
-                Node.getLeft()->accept(*this);
-            else
-                HasError = true;
-            if (Node.getRight())
-                Node.getRight()->accept(*this);
-            else
-                HasError = true;
+    public:
+        FlatDeclCheck(const FlatAST& Tree, llvm::BitVector& Scope) : ScopeCheck(Scope), Tree(Tree), Target(FlatAST::Invalid) {}
 
-        };
+        void check() {
+            push(Tree.getRoot());
+            while (!Stack.empty())
+                visit(Stack.pop_back_val());
+        }
+    };
+}
 
-        virtual void visit(Base& Node) override {
-            for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
-            {
-                (*I)->accept(*this);
-            }
+bool Sema::semantic(Base* Tree) {
+    if (!Tree)
+        return false;
+    llvm::BitVector Scope;
+    DeclCheck Check(Scope);
+    Check.walk(Tree);
+    return Check.hasError();
+}
 
-        };
+bool Sema::semantic(Statement* S) {
+    DeclCheck Check(Declared);
+    Check.walk(S);
+    return Check.hasError();
+}
 
+bool Sema::isDeclared(uint32_t Symbol) const {
+    return Symbol < Declared.size() && Declared.test(Symbol);
+}
 
-    };
+void Sema::declare(uint32_t Symbol) {
+    if (Symbol >= Declared.size())
+        Declared.resize(std::max<size_t>(Symbol + 1, Declared.size() * 2));
+    Declared.set(Symbol);
 }
 
-bool Sema::semantic(AST* Tree) {
-    if (!Tree)
-        return false;
-    DeclCheck Check;
-    Tree->accept(Check);
+bool Sema::semantic(const FlatAST& Tree) {
+    llvm::BitVector Scope;
+    FlatDeclCheck Check(Tree, Scope);
+    Check.check();
     return Check.hasError();
 }
@@ -2,11 +2,25 @@
 #define SEMA_H
 
 #include "AST.h"
+#include "FlatAST.h"
 #include "Lexer.h"
+#include "llvm/ADT/BitVector.h"
 
 class Sema {
+  llvm::BitVector Declared; // variables declared by the statements checked one by one
+
 public:
-  bool semantic(AST *Tree);
+  bool semantic(Base *Tree);
+  bool semantic(const FlatAST &Tree);
+
+  // checks one top level statement. the variables declared by the
+  // statements passed in earlier calls stay declared
+  bool semantic(Statement *S);
+
+  // for statements checked in an earlier compile: whether a variable is
+  // declared so far, and marking one declared without a check
+  bool isDeclared(uint32_t Symbol) const;
+  void declare(uint32_t Symbol);
 };
 
 #endif
\ No newline at end of file
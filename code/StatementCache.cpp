@@ -0,0 +1,262 @@
+#include "StatementCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <cstring>
+
+// bump whenever the file layout, the key or the fragments change
+static const uint32_t FormatVersion = 2;
+static const uint32_t ByteOrderMark = 0x01020304;
+
+StatementCache::StatementCache(llvm::StringRef Directory, llvm::StringRef Executable, uint64_t Options) :
+	Directory(Directory), Loaded(0), Inserted(false), Saver(Allocator)
+{
+	// size and modification time stand in for the compiler version
+	std::string Version;
+	llvm::raw_string_ostream OS(Version);
+	OS << "MAS-Lang statement cache " << FormatVersion << " " << Options;
+	llvm::sys::fs::file_status Status;
+	if (!llvm::sys::fs::status(Executable, Status))
+		OS << " " << Status.getSize() << " " << Status.getLastModificationTime().time_since_epoch().count();
+	CompilerKey = llvm::xxHash64(OS.str());
+}
+
+std::string StatementCache::getPath() const
+{
+	std::string Path;
+	llvm::raw_string_ostream OS(Path);
+	OS << Directory << "/statements-" << llvm::format_hex_no_prefix(CompilerKey, 16) << ".mass";
+	return OS.str();
+}
+
+std::string StatementCache::getName(uint64_t Key)
+{
+	std::string Name;
+	llvm::raw_string_ostream OS(Name);
+	OS << "s." << llvm::format_hex_no_prefix(Key, 16);
+	return OS.str();
+}
+
+uint64_t StatementCache::getCheck(uint64_t Key, llvm::StringRef RolesAndText)
+{
+	return llvm::xxHash64(RolesAndText) ^ Key;
+}
+
+/*
+	checks the header and that every entry lies inside the file, then
+	drops the entries that do not match their check. the others point
+	into the mapping
+*/
+void StatementCache::load()
+{
+	llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FileOrErr =
+		llvm::MemoryBuffer::getFile(getPath(), /*IsText=*/false, /*RequiresNullTerminator=*/false);
+	if (!FileOrErr)
+		return;
+
+	llvm::StringRef Data = (*FileOrErr)->getBuffer();
+	if (Data.size() < sizeof(Header))
+		return;
+
+	const Header& H = *reinterpret_cast<const Header*>(Data.data());
+	if (memcmp(H.Magic, "MASS", 4) != 0 || H.ByteOrder != ByteOrderMark || H.CompilerKey != CompilerKey)
+		return;
+	if (H.EntriesOffset % alignof(Entry) != 0 || H.EntriesOffset + (uint64_t)H.EntryCount * sizeof(Entry) > Data.size() ||
+		(uint64_t)H.DataOffset + H.DataSize > Data.size())
+		return;
+
+	const Entry* Entries = reinterpret_cast<const Entry*>(Data.data() + H.EntriesOffset);
+	const char* Bytes = Data.data() + H.DataOffset;
+	llvm::DenseMap<uint64_t, Fragment> Read;
+	Read.reserve(H.EntryCount);
+	for (uint32_t I = 0; I < H.EntryCount; ++I)
+	{
+		const Entry& E = Entries[I];
+		if ((uint64_t)E.RolesOffset + E.VarCount != E.TextOffset || (uint64_t)E.TextOffset + E.TextSize > H.DataSize)
+			return;
+		if (E.Check != getCheck(E.Key, llvm::StringRef(Bytes + E.RolesOffset, E.VarCount + E.TextSize)))
+			continue;
+		bool Valid = true;
+		for (uint32_t V = 0; V < E.VarCount; ++V)
+			Valid &= (uint8_t)Bytes[E.RolesOffset + V] <= Declare;
+		if (!Valid)
+			continue;
+		Fragment& F = Read[E.Key];
+		F.Roles = llvm::ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(Bytes + E.RolesOffset), E.VarCount);
+		F.Text = llvm::StringRef(Bytes + E.TextOffset, E.TextSize);
+	}
+
+	Fragments = std::move(Read);
+	Loaded = H.EntryCount;     // a dropped entry has the file rewritten
+	Mapped = std::move(*FileOrErr);
+}
+
+/*
+	same rules as ConstructScanner::scan: a statement ends with a semicolon
+	outside of any body, and an if or loopc with the end that closes its
+	last body, unless an elif or else goes on with it
+*/
+unsigned StatementCache::findEnd(const TokenBuffer& Tokens, unsigned Begin)
+{
+	unsigned Depth = 0;
+	bool Closed = false;
+	unsigned I = Begin;
+	for (; Tokens.getKind(I) != Token::eof; ++I)
+	{
+		Token::TokenKind Kind = Tokens.getKind(I);
+		if (Closed && Kind != Token::KW_elif && Kind != Token::KW_else)
+			return I;
+		Closed = false;
+
+		switch (Kind)
+		{
+		case Token::KW_if:
+		case Token::KW_elif:
+		case Token::KW_else:
+		case Token::KW_loopc:
+			++Depth;
+			break;
+		case Token::KW_end:
+			if (Depth && --Depth == 0)
+				Closed = true;
+			break;
+		case Token::semi_colon:
+			if (!Depth)
+				return I + 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return I;
+}
+
+/*
+	hashes the kind and value of every token, with the symbol of an
+	identifier replaced by its number among the variables of the
+	construct. the top bit is cleared, so a key is never one of the
+	reserved keys of DenseMap
+*/
+uint64_t StatementCache::getKey(const TokenBuffer& Tokens, unsigned Begin, unsigned End, llvm::SmallVectorImpl<uint32_t>& Vars)
+{
+	llvm::SmallDenseMap<uint32_t, uint32_t, 16> Numbers;
+	llvm::SmallVector<uint32_t, 64> Words;
+	Vars.clear();
+	for (unsigned I = Begin; I < End; ++I)
+	{
+		Token::TokenKind Kind = Tokens.getKind(I);
+		uint32_t Value = Tokens.getIdentifier(I);
+		if (Kind == Token::ident)
+		{
+			auto Result = Numbers.try_emplace(Value, (uint32_t)Vars.size());
+			if (Result.second)
+				Vars.push_back(Value);
+			Value = Result.first->second;
+		}
+		Words.push_back(Kind);
+		Words.push_back(Value);
+	}
+	llvm::ArrayRef<uint8_t> Bytes(reinterpret_cast<const uint8_t*>(Words.data()), Words.size() * sizeof(uint32_t));
+	return llvm::xxHash64(Bytes) & (UINT64_MAX >> 1);
+}
+
+void StatementCache::use(uint64_t Key)
+{
+	if (IsUsed.insert(Key).second)
+		Used.push_back(Key);
+}
+
+const StatementCache::Fragment* StatementCache::lookup(uint64_t Key)
+{
+	auto It = Fragments.find(Key);
+	if (It == Fragments.end())
+		return nullptr;
+	use(Key);
+	return &It->second;
+}
+
+const StatementCache::Fragment& StatementCache::insert(uint64_t Key, llvm::ArrayRef<uint8_t> Roles, llvm::StringRef Text)
+{
+	Fragment& F = Fragments[Key];
+	uint8_t* Copy = Allocator.Allocate<uint8_t>(Roles.size());
+	std::copy(Roles.begin(), Roles.end(), Copy);
+	F.Roles = llvm::ArrayRef<uint8_t>(Copy, Roles.size());
+	F.Text = Saver.save(Text);
+	Inserted = true;
+	use(Key);
+	return F;
+}
+
+/*
+	writes to a temporary file and renames it into place, so a concurrent
+	compile never maps a half written file
+*/
+bool StatementCache::store()
+{
+	if (!Inserted && Used.size() == Loaded)
+		return true;
+
+	std::vector<Entry> Entries(Used.size());
+	uint64_t DataSize = 0;
+	for (size_t I = 0; I < Used.size(); ++I)
+	{
+		const Fragment& F = Fragments.find(Used[I])->second;
+		Entries[I].Key = Used[I];
+		Entries[I].RolesOffset = DataSize;
+		Entries[I].VarCount = F.Roles.size();
+		DataSize += F.Roles.size();
+		Entries[I].TextOffset = DataSize;
+		Entries[I].TextSize = F.Text.size();
+		DataSize += F.Text.size();
+		std::string RolesAndText(F.Roles.begin(), F.Roles.end());
+		RolesAndText += F.Text;
+		Entries[I].Check = getCheck(Used[I], RolesAndText);
+	}
+
+	Header H;
+	memcpy(H.Magic, "MASS", 4);
+	H.ByteOrder = ByteOrderMark;
+	H.CompilerKey = CompilerKey;
+	H.EntryCount = Entries.size();
+	H.EntriesOffset = sizeof(Header);
+	H.DataOffset = H.EntriesOffset + Entries.size() * sizeof(Entry);
+	H.DataSize = DataSize;
+	if (H.DataOffset + DataSize > UINT32_MAX)
+		return false;
+
+	if (llvm::sys::fs::create_directories(Directory))
+		return false;
+
+	int FD;
+	llvm::SmallString<128> TempPath;
+	if (llvm::sys::fs::createUniqueFile(Directory + "/%%%%%%%%.tmp", FD, TempPath))
+		return false;
+
+	{
+		llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+		OS.write(reinterpret_cast<const char*>(&H), sizeof(H));
+		OS.write(reinterpret_cast<const char*>(Entries.data()), Entries.size() * sizeof(Entry));
+		for (uint64_t Key : Used)
+		{
+			const Fragment& F = Fragments.find(Key)->second;
+			OS.write(reinterpret_cast<const char*>(F.Roles.data()), F.Roles.size());
+			OS << F.Text;
+		}
+		OS.close();
+		if (OS.has_error())
+		{
+			OS.clear_error();
+			llvm::sys::fs::remove(TempPath);
+			return false;
+		}
+	}
+
+	if (llvm::sys::fs::rename(TempPath, getPath()))
+	{
+		llvm::sys::fs::remove(TempPath);
+		return false;
+	}
+	return true;
+}
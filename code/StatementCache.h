@@ -0,0 +1,115 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+
+#include "Lexer.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/StringSaver.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+	cache of the top level constructs of the last compile in a directory,
+	so an edited program only checks and generates the constructs that
+	changed. a construct is keyed by a hash of its tokens with each
+	variable replaced by its number in order of first appearance in the
+	construct, the names do not matter. an entry keeps what Sema needs
+	to know of the declarations around the construct, which of its
+	variables it declares and which it uses, and the construct compiled
+	to a CodeGen fragment that takes a pointer to each of its variables.
+	a construct that failed to check or fold is never cached.
+
+	the whole cache is one file named after the compiler and the options
+	that change the fragments, rewritten with the constructs of the
+	latest compile whenever it added one or left one unused.
+
+	file layout, offsets count from the start of the file:
+		Header
+		Entry[EntryCount]            at EntriesOffset
+		char[DataSize]               at DataOffset, roles and texts
+
+	numbers are stored in the byte order of the machine that wrote the
+	file, a file from another byte order is treated as empty. an entry
+	whose key, roles and text do not hash to its Check is dropped, the
+	texts are printed as they are.
+*/
+class StatementCache {
+public:
+	struct Header {
+		char Magic[4];
+		uint32_t ByteOrder;
+		uint64_t CompilerKey;
+		uint32_t EntryCount, EntriesOffset;
+		uint32_t DataSize, DataOffset;
+	};
+
+	struct Entry {
+		uint64_t Key;
+		uint32_t RolesOffset, VarCount;     // one Role per variable, inside the data
+		uint32_t TextOffset, TextSize;      // right after the roles
+		uint64_t Check;     // see getCheck
+	};
+
+	enum Role : uint8_t { Use, Declare };
+
+	struct Fragment {
+		llvm::ArrayRef<uint8_t> Roles;
+		llvm::StringRef Text;
+	};
+
+private:
+	std::string Directory;
+	uint64_t CompilerKey;
+	std::unique_ptr<llvm::MemoryBuffer> Mapped;
+
+	llvm::DenseMap<uint64_t, Fragment> Fragments;   // loaded and inserted
+	std::vector<uint64_t> Used;                     // keys looked up or inserted, in order
+	llvm::DenseSet<uint64_t> IsUsed;
+	size_t Loaded;
+	bool Inserted;
+
+	llvm::BumpPtrAllocator Allocator;
+	llvm::StringSaver Saver;    // texts and roles inserted
+
+	std::string getPath() const;
+	void use(uint64_t Key);
+
+	// hash of the roles and text that follow each other in RolesAndText,
+	// mixed with Key so an entry with a damaged key does not match either
+	static uint64_t getCheck(uint64_t Key, llvm::StringRef RolesAndText);
+
+public:
+	// Executable is the compiler binary, rebuilding it invalidates the
+	// cache. Options stands for the options the fragments depend on
+	StatementCache(llvm::StringRef Directory, llvm::StringRef Executable, uint64_t Options);
+
+	// maps the file of the directory, a missing or broken one is empty
+	void load();
+
+	// the token after the top level construct that starts at Begin
+	static unsigned findEnd(const TokenBuffer& Tokens, unsigned Begin);
+
+	// the key of Tokens[Begin, End). Vars gets the symbols of its
+	// variables in order of first appearance
+	static uint64_t getKey(const TokenBuffer& Tokens, unsigned Begin, unsigned End, llvm::SmallVectorImpl<uint32_t>& Vars);
+
+	// the name of the fragment of Key
+	static std::string getName(uint64_t Key);
+
+	// the cached construct of Key, or null. it stays valid while the cache lives
+	const Fragment* lookup(uint64_t Key);
+
+	const Fragment& insert(uint64_t Key, llvm::ArrayRef<uint8_t> Roles, llvm::StringRef Text);
+
+	// writes the constructs looked up or inserted since load if they
+	// differ from the file, returns false if the file could not be written
+	bool store();
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "Streaming.h"
+#include "Error.h"
+#include "Parser.h"
+
+// source characters lexed per window
+static const size_t WindowSize = 1 << 20;
+
+StreamingParser::StreamingParser(llvm::StringRef Source, ASTContext& Ctx) :
+	Source(Source.take_front(Source.find('\0'))),   // the lexer stops at the first null character
+	Ctx(Ctx), Lexed(0), Position(0), FirstError(Error::getNumErrors()), HashConsing(false)
+{
+	refill();
+}
+
+bool StreamingParser::hasError()
+{
+	return Error::getNumErrors() != FirstError;
+}
+
+/*
+	drops the tokens that were parsed already and the eof, and lexes the
+	next window onto the rest
+*/
+void StreamingParser::refill()
+{
+	auto dropFront = [&](auto& V) { V.erase(V.begin(), V.begin() + Position); };
+	dropFront(Tokens.Kinds);
+	dropFront(Tokens.Offsets);
+	dropFront(Tokens.Values);
+	Scanner.dropFront(Position);
+	Position = 0;
+
+	if (Tokens.size())
+	{
+		Tokens.Kinds.pop_back();
+		Tokens.Offsets.pop_back();
+		Tokens.Values.pop_back();
+	}
+	Lexed = Lexer::lexWindow(Source, Lexed, WindowSize, Tokens);
+	Scanner.scan(Tokens, Lexed == Source.size());
+}
+
+void ConstructScanner::scan(const TokenBuffer& Tokens, bool Last)
+{
+	unsigned End = Tokens.size() - 1;      // the eof
+	for (; Scanned < End; ++Scanned)
+	{
+		Token::TokenKind Kind = Tokens.getKind(Scanned);
+		if (Closed)
+		{
+			Closed = false;
+			if (Kind != Token::KW_elif && Kind != Token::KW_else)
+				Complete = Scanned;
+		}
+
+		switch (Kind)
+		{
+		case Token::KW_if:
+		case Token::KW_elif:
+		case Token::KW_else:
+		case Token::KW_loopc:
+			++Depth;
+			break;
+		case Token::KW_end:
+			if (Depth && --Depth == 0)
+				Closed = true;
+			break;
+		case Token::semi_colon:
+			if (!Depth)
+				Complete = Scanned + 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// the whole program is in, whatever is left is parsed as it is
+	if (Last)
+		Complete = End;
+}
+
+void ConstructScanner::dropFront(unsigned Count)
+{
+	Scanned -= Count;
+	Complete = Complete > Count ? Complete - Count : 0;
+}
+
+bool StreamingParser::next(llvm::SmallVector<Statement*>& Statements)
+{
+	while (Position >= Scanner.getComplete() && Lexed < Source.size())
+		refill();
+
+	Parser P(Tokens, Ctx, Position);
+	P.setHashConsing(HashConsing);
+	bool More = P.parseNext(Statements);
+	Position = P.getPosition();
+	return More;
+}
@@ -0,0 +1,68 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include "AST.h"
+#include "Lexer.h"
+#include "llvm/ADT/SmallVector.h"
+
+/*
+	finds where top level constructs end in a token stream that grows a
+	window at a time, following the parser: a statement ends with a
+	semicolon outside of any body, and an if or loopc with the end that
+	closes its last body, unless an elif or else goes on with it. if,
+	elif, else and loopc each open a body, end closes one
+*/
+class ConstructScanner {
+	unsigned Scanned;       // tokens scanned so far
+	unsigned Complete;      // tokens before this one form complete constructs
+	unsigned Depth;         // if, elif, else and loopc bodies open at Scanned
+	bool Closed;            // the token before Scanned ended a block at depth 0
+
+public:
+	ConstructScanner() : Scanned(0), Complete(0), Depth(0), Closed(false) {}
+
+	// scans the tokens added to Tokens since the last call. Last is set
+	// once the whole program is in, whatever is left is then complete
+	void scan(const TokenBuffer& Tokens, bool Last);
+
+	// the first Count tokens were dropped from the buffer
+	void dropFront(unsigned Count);
+
+	unsigned getComplete() const { return Complete; }
+};
+
+/*
+	front end for programs too large to keep whole. the source is lexed a
+	window at a time and handed to the parser one top level construct at
+	a time, so a construct is only parsed once all of its tokens are in.
+	tokens are dropped as soon as the construct they belong to is parsed,
+	the token buffer only holds the construct being parsed and the rest
+	of the current window.
+*/
+class StreamingParser {
+	llvm::StringRef Source;
+	ASTContext& Ctx;
+	TokenBuffer Tokens;     // ends with an eof, the real one once Lexed reaches the end
+	size_t Lexed;           // source characters lexed so far
+	unsigned Position;      // token the next construct starts at
+	unsigned FirstError;
+	bool HashConsing;
+	ConstructScanner Scanner;
+
+	void refill();
+
+public:
+	// Source must stay alive while the parser is used
+	StreamingParser(llvm::StringRef Source, ASTContext& Ctx);
+
+	void setHashConsing(bool Enable) { HashConsing = Enable; }
+
+	// whether a syntax error was reported so far
+	bool hasError();
+
+	// parses the next top level construct and appends its statements,
+	// returns false at eof. the statements are allocated in Ctx
+	bool next(llvm::SmallVector<Statement*>& Statements);
+};
+
+#endif
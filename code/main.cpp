@@ -1,15 +1,33 @@
 #include "Lexer.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
+#include <chrono>
 #include <iostream>
 #include "AST.h"
+#include "ASTCache.h"
 #include "CodeGen.h"
+#include "Error.h"
+#include "Eval.h"
+#include "FlatAST.h"
+#include "Fold.h"
+#include "MIR.h"
 #include "Parser.h"
+#include "Pipeline.h"
 #include "Sema.h"
+#include "StatementCache.h"
+#include "Streaming.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
 
 using namespace std;
 
+// stdin is read in chunks of this size
+static const size_t StdinChunkSize = 1 << 20;
+
 
 // Input in llvm format
 static llvm::cl::opt<std::string> Input(llvm::cl::Positional,
@@ -17,24 +35,391 @@ static llvm::cl::opt<std::string> Input(llvm::cl::Positional,
 	llvm::cl::init(""));
 
 static llvm::cl::opt<std::string> FileName("f",
-	llvm::cl::desc("<Specify the file name>"),
+	llvm::cl::desc("<Specify the file name, '-' reads from stdin>"),
 	llvm::cl::value_desc("filename"),
 	llvm::cl::init(""));
 
+static llvm::cl::opt<unsigned> LexThreads("lex-threads",
+	llvm::cl::desc("Number of threads used to lex large inputs (0 uses every core)"),
+	llvm::cl::value_desc("n"),
+	llvm::cl::init(1));
+
+static llvm::cl::opt<bool> UseFlatAST("flat-ast",
+	llvm::cl::desc("Run semantic analysis on the flat, index based AST"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<bool> ASTStats("ast-stats",
+	llvm::cl::desc("Print the size of both AST encodings and the time a semantic pass takes on each"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned> ErrorLimit("error-limit",
+	llvm::cl::desc("Stop after this many errors (0 reports every error)"),
+	llvm::cl::value_desc("n"),
+	llvm::cl::init(20));
+
+static llvm::cl::opt<bool> HashCons("hash-cons",
+	llvm::cl::desc("Share identical subexpressions in the AST and reuse their values in the IR"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<std::string> CacheDir("cache-dir",
+	llvm::cl::desc("Reuse checked programs from this directory and store new ones in it"),
+	llvm::cl::value_desc("directory"),
+	llvm::cl::init(""));
+
+static llvm::cl::opt<bool> Fold("fold",
+	llvm::cl::desc("Fold constant expressions and remove branches that never run (default on)"),
+	llvm::cl::init(true));
+
+static llvm::cl::opt<bool> Evaluate("eval",
+	llvm::cl::desc("Run the program while compiling it and generate only the values it leaves in its variables, "
+		"or those computed before the first statement that does not finish within the budgets and the program from there"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<uint64_t> EvalSteps("eval-steps",
+	llvm::cl::desc("Evaluation steps -eval may take, one per node run"),
+	llvm::cl::value_desc("n"),
+	llvm::cl::init(10000000));
+
+static llvm::cl::opt<unsigned> EvalMemory("eval-memory",
+	llvm::cl::desc("Megabytes -eval may use for the values of variables"),
+	llvm::cl::value_desc("MB"),
+	llvm::cl::init(64));
+
+static llvm::cl::opt<bool> UseMIR("mir",
+	llvm::cl::desc("Generate the program through the mid-level SSA IR and run its passes first"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<std::string> MIRPipeline("mir-passes",
+	llvm::cl::desc("Passes run on the MIR, in order and separated by commas "
+		"(copy-prop, sccp, dse, unused-vars)"),
+	llvm::cl::value_desc("passes"),
+	llvm::cl::init(MIRPassManager::getDefaultPipeline()));
+
+static llvm::cl::opt<bool> MIRStats("mir-stats",
+	llvm::cl::desc("Print the time every MIR pass takes and the size of the MIR it leaves"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<bool> PrintMIR("print-mir",
+	llvm::cl::desc("Print the MIR after its passes"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<bool> DivGuards("div-guards",
+	llvm::cl::desc("Check divisions for a zero divisor and INT_MIN / -1 when they run and call mas_div_trap "
+		"(with -mir, the ranges pass removes the checks it proves unneeded)"),
+	llvm::cl::init(false));
+
+// the passes CodeGen runs with -mir, set up by main
+static MIRPassManager MIRPasses;
+
+static const MIRPassManager* getMIRPasses()
+{
+	return UseMIR ? &MIRPasses : nullptr;
+}
+
+static llvm::cl::opt<char> OptLevel("O",
+	llvm::cl::desc("Optimize the generated module with LLVM's -O0, -O1, -O2, -O3, -Os or -Oz pipeline "
+		"(by default it is printed as generated). -time-passes and -print-after-all show the passes"),
+	llvm::cl::Prefix, llvm::cl::ZeroOrMore, llvm::cl::init(' '));
+
+static llvm::cl::opt<bool> VerifyEach("verify-each",
+	llvm::cl::desc("Verify the module after every pass of the -O pipeline"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<bool> DirectSSA("ssa",
+	llvm::cl::desc("Keep variables in SSA values instead of memory that is loaded and stored, "
+		"only their final values are stored (-mir does this already, not used with -stmt-cache-dir)"),
+	llvm::cl::init(false));
+
+// the LLVM passes CodeGen runs with -O, set up by main
+static llvm::Optional<IRPipeline> Optimizer;
+
+static const IRPipeline* getOptimizer()
+{
+	return Optimizer ? Optimizer.getPointer() : nullptr;
+}
+
+static llvm::cl::opt<bool> Stream("stream",
+	llvm::cl::desc("Check and generate each top level statement as soon as it is parsed, then free it "
+		"(ignores -cache-dir, -flat-ast and -ast-stats)"),
+	llvm::cl::init(false));
+
+static llvm::cl::opt<std::string> StmtCacheDir("stmt-cache-dir",
+	llvm::cl::desc("Check and generate only the top level statements that changed since the last compile "
+		"with this directory and reuse the others (not used with -stream, -mir, -eval or -div-guards)"),
+	llvm::cl::value_desc("directory"),
+	llvm::cl::init(""));
+
+// milliseconds one semantic pass over Tree takes
+template <typename TreeT>
+static double timeSemantic(TreeT Tree)
+{
+	auto Start = std::chrono::steady_clock::now();
+	Sema Semantic;
+	Semantic.semantic(Tree);
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+/*
+	compiles Source one top level statement at a time. the tokens and the
+	AST of a statement are freed once it is checked and generated, only
+	the declared variables and the module carry over. returns the exit
+	code of main
+*/
+static int compileStreaming(llvm::StringRef Source)
+{
+	ASTContext Context;
+	StreamingParser Parser(Source, Context);
+	Parser.setHashConsing(HashCons);
+
+	Sema Semantic;
+	bool SemaFailed = false;
+	ConstantFolder Folder(Context);
+	PartialEvaluator Evaluator(Context, EvalSteps, (size_t)EvalMemory << 20);
+	bool Evaluating = Evaluate;
+	CodeGen CodeGenerator(HashCons, getMIRPasses(), DivGuards, getOptimizer(), DirectSSA);
+	CodeGenerator.begin();
+
+	llvm::SmallVector<Statement*> Statements;
+	llvm::SmallVector<Statement*> Folded;
+	llvm::SmallVector<Statement*> Stores;
+	while (Parser.next(Statements))
+	{
+		for (Statement* S : Statements)
+			SemaFailed |= Semantic.semantic(S);
+
+		// after an error the rest is only checked, nothing is printed
+		if (!SemaFailed && !Error::getNumErrors())
+		{
+			for (Statement* S : Statements)
+			{
+				if (Fold)
+					Folder.fold(S, Folded);
+				else
+					Folded.push_back(S);
+			}
+			SemaFailed |= Folder.hasError();
+		}
+		if (!SemaFailed && !Error::getNumErrors())
+		{
+			for (Statement* S : Folded)
+			{
+				if (Evaluating && Evaluator.run(S))
+					continue;
+				// S did not finish, the values computed so far and the
+				// program from S on are generated
+				if (Evaluating)
+				{
+					Evaluator.getStores(Stores);
+					for (Statement* V : Stores)
+						CodeGenerator.add(V);
+					Stores.clear();
+					Evaluating = false;
+				}
+				CodeGenerator.add(S);
+			}
+		}
+		Statements.clear();
+		Folded.clear();
+		Context.reset();
+	}
+
+	if (Parser.hasError())
+	{
+		return 3;
+	}
+	if (SemaFailed)
+	{
+		llvm::errs() << "Semantic errors occurred...\n";
+		return Error::getNumErrors() ? 3 : 1;
+	}
+	if (Evaluating)
+	{
+		Evaluator.getStores(Stores);
+		for (Statement* V : Stores)
+			CodeGenerator.add(V);
+	}
+	CodeGenerator.finish();
+	return 0;
+}
+
+/*
+	compiles Source with the statement cache in StmtCacheDir. a top level
+	construct found in the cache is only checked against the variables
+	declared before it and its cached fragment is called, the others are
+	parsed, checked, folded and generated into new fragments. returns
+	the exit code of main. Reuse false ignores what the cache holds and
+	replaces it
+*/
+static int compileCached(llvm::StringRef Source, llvm::StringRef Executable, bool Reuse = true)
+{
+	StatementCache Cache(StmtCacheDir, Executable, (uint64_t)HashCons | (uint64_t)Fold << 1);
+	if (Reuse)
+		Cache.load();
+
+	unsigned lexThreads = LexThreads ? (unsigned)LexThreads : llvm::hardware_concurrency().compute_thread_count();
+	TokenBuffer Tokens;
+	Lexer::lexParallel(Source, Tokens, lexThreads);
+
+	ASTContext Context;
+	Sema Semantic;
+	bool ParseFailed = false;
+	bool SemaFailed = false;
+	ConstantFolder Folder(Context);
+	CodeGen CodeGenerator(HashCons, nullptr, false, getOptimizer());
+	CodeGenerator.beginFragments();
+
+	std::vector<llvm::StringRef> Texts;     // of the fragments main calls, each once
+	llvm::DenseSet<uint64_t> Called;
+	llvm::SmallVector<uint32_t, 16> Vars;
+	llvm::SmallVector<uint8_t, 16> Roles;
+	llvm::SmallVector<Statement*> Statements;
+	llvm::SmallVector<Statement*> Folded;
+	unsigned Position = 0;
+	while (Tokens.getKind(Position) != Token::eof)
+	{
+		unsigned End = StatementCache::findEnd(Tokens, Position);
+		uint64_t Key = StatementCache::getKey(Tokens, Position, End, Vars);
+
+		// a cached construct checks the same as before as long as the
+		// variables it uses are declared and those it declares are not
+		const StatementCache::Fragment* Cached = Cache.lookup(Key);
+		if (Cached && Cached->Roles.size() != Vars.size())
+			Cached = nullptr;
+		for (size_t I = 0; Cached && I < Vars.size(); ++I)
+		{
+			if (Semantic.isDeclared(Vars[I]) != (Cached->Roles[I] == StatementCache::Use))
+				Cached = nullptr;
+		}
+
+		if (Cached)
+		{
+			for (size_t I = 0; I < Vars.size(); ++I)
+			{
+				if (Cached->Roles[I] == StatementCache::Declare)
+					Semantic.declare(Vars[I]);
+			}
+			Position = End;
+		}
+		else
+		{
+			Parser P(Tokens, Context, Position);
+			P.setHashConsing(HashCons);
+			if (!P.parseNext(Statements))
+				break;
+			ParseFailed |= P.hasError();
+			for (Statement* S : Statements)
+				SemaFailed |= Semantic.semantic(S);
+			if (!ParseFailed && !SemaFailed && !Error::getNumErrors())
+			{
+				for (Statement* S : Statements)
+				{
+					if (Fold)
+						Folder.fold(S, Folded);
+					else
+						Folded.push_back(S);
+				}
+				SemaFailed |= Folder.hasError();
+			}
+
+			// after an error the rest is only checked
+			if (!ParseFailed && !SemaFailed && !Error::getNumErrors())
+			{
+				if (P.getPosition() != End)
+					Key = StatementCache::getKey(Tokens, Position, P.getPosition(), Vars);
+				Roles.assign(Vars.size(), StatementCache::Use);
+				for (Statement* S : Statements)
+				{
+					if (S->getKind() != Statement::StateMentType::Declaration)
+						continue;
+					uint32_t Symbol = static_cast<DecStatement*>(S)->getLValue()->getSymbol();
+					Roles[std::find(Vars.begin(), Vars.end(), Symbol) - Vars.begin()] = StatementCache::Declare;
+				}
+				Cached = &Cache.insert(Key, Roles, CodeGenerator.addFragment(StatementCache::getName(Key), Folded, Vars));
+			}
+			Position = P.getPosition();
+			Statements.clear();
+			Folded.clear();
+			Context.reset();
+		}
+
+		if (Cached && !ParseFailed && !SemaFailed && !Error::getNumErrors())
+		{
+			CodeGenerator.callFragment(StatementCache::getName(Key), Vars);
+			if (Called.insert(Key).second)
+				Texts.push_back(Cached->Text);
+		}
+	}
+
+	if (ParseFailed)
+	{
+		return 3;
+	}
+	if (SemaFailed)
+	{
+		llvm::errs() << "Semantic errors occurred...\n";
+		return Error::getNumErrors() ? 3 : 1;
+	}
+	// only -O parses the texts back. cached ones that do not parse are
+	// all generated again, fragments just generated always do
+	if (!CodeGenerator.finishFragments(Texts))
+	{
+		if (Reuse)
+			return compileCached(Source, Executable, false);
+		llvm::report_fatal_error("generated fragments do not form a valid module");
+	}
+	Cache.store();
+	return 0;
+}
+
 int main(int argc, const char** argv)
 {
 	// parse command line with builtin llvm function
 	llvm::InitLLVM X(argc, argv);
 	llvm::cl::ParseCommandLineOptions(argc, argv, "MAS-Lang Compiler\n");
 
-	string contentString;
+	std::string UnknownPass;
+	if (!MIRPasses.parse(MIRPipeline, UnknownPass))
+	{
+		llvm::errs() << "Unknown MIR pass '" << UnknownPass << "'...\n";
+		return 1;
+	}
+	MIRPasses.setPrintStats(MIRStats);
+	MIRPasses.setPrintAfter(PrintMIR);
+
+	if (OptLevel != ' ')
+	{
+		if (!IRPipeline::isLevel(OptLevel))
+		{
+			llvm::errs() << "Unknown optimization level '-O" << OptLevel << "'...\n";
+			return 1;
+		}
+		Optimizer.emplace(OptLevel, VerifyEach);
+	}
+
+	// the source buffers stay alive until the compile finishes, since
+	// every Token::Text points straight into them
+	std::unique_ptr<llvm::MemoryBuffer> fileBuffer;
+	llvm::SmallVector<char, 0> stdinBuffer;
 	llvm::StringRef contentRef;
 
-	if (!FileName.empty()) // if filename is specified
+	if (FileName == "-") // read the program from stdin
+	{
+		// read in large chunks straight into one growing buffer, instead of
+		// going through MemoryBuffer::getSTDIN which copies the result again
+		if (llvm::Error error = llvm::sys::fs::readNativeFileToEOF(
+				llvm::sys::fs::getStdinHandle(), stdinBuffer, StdinChunkSize)) {
+			llvm::errs() << "Error reading stdin: " << llvm::toString(std::move(error)) << "\n";
+			return 1;
+		}
+		stdinBuffer.push_back('\0'); // the lexer stops at the terminating null
+		contentRef = llvm::StringRef(stdinBuffer.data(), stdinBuffer.size() - 1);
+	}
+	else if (!FileName.empty()) // if filename is specified
 	{
 		std::string fileName = FileName;
 
-		// Use llvm::MemoryBuffer::getFile with the fileName
+		// Use llvm::MemoryBuffer::getFile with the fileName, large files are
+		// memory mapped rather than read
 		llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> fileOrErr =
 			llvm::MemoryBuffer::getFile(fileName);
 
@@ -42,34 +427,133 @@ int main(int argc, const char** argv)
 			llvm::errs() << "Error opening file: " << error.message() << "\n";
 			return 1;
 		}
-		// Use the file content from the MemoryBuffer
-		contentString = (*fileOrErr)->getBuffer().str();
+		// Use the file content from the MemoryBuffer without copying it
+		fileBuffer = std::move(*fileOrErr);
+		contentRef = fileBuffer->getBuffer();
 	}
 	else // if input is given directly
 	{
-		contentString = Input;
+		contentRef = Input;
+	}
+
+	// token offsets are 32 bits wide
+	if (contentRef.size() > UINT32_MAX)
+	{
+		llvm::errs() << "Input is larger than 4 GB...\n";
+		return 1;
+	}
+
+	if (Stream)
+	{
+		Error::setSource(contentRef);
+		Error::setErrorLimit(ErrorLimit);
+		return compileStreaming(contentRef);
+	}
 
+	if (!StmtCacheDir.empty() && !UseMIR && !Evaluate && !DivGuards)
+	{
+		Error::setSource(contentRef);
+		Error::setErrorLimit(ErrorLimit);
+		return compileCached(contentRef, llvm::sys::fs::getMainExecutable(argv[0], (void*)&timeSemantic<Base*>));
 	}
 
-	contentRef = contentString;
+	Error::setSource(contentRef);   // diagnostics turn token offsets into line:column
+	Error::setErrorLimit(ErrorLimit);
 
-	Token nextToken;
+	// a program seen before goes straight to code generation. it passed
+	// Sema, and the folder as well with -fold, which is part of the key
+	ASTCache Cache(CacheDir, llvm::sys::fs::getMainExecutable(argv[0], (void*)&timeSemantic<Base*>), Fold);
+	if (!CacheDir.empty())
+	{
+		if (std::unique_ptr<FlatAST> Cached = Cache.lookup(contentRef))
+		{
+			ASTContext Context;
+			Base* Tree = Cached->toTree(Context);
+			if (Fold)
+			{
+				ConstantFolder Folder(Context);
+				Tree = Folder.fold(Tree);
+				if (Folder.hasError())
+				{
+					llvm::errs() << "Semantic errors occurred...\n";
+					return 3;
+				}
+			}
+			if (Evaluate)
+				Tree = PartialEvaluator(Context, EvalSteps, (size_t)EvalMemory << 20).evaluate(Tree);
+			CodeGen CodeGenerator(HashCons, getMIRPasses(), DivGuards, getOptimizer(), DirectSSA);
+			CodeGenerator.compile(Tree);
+			return 0;
+		}
+	}
 
-	Lexer lexer(contentRef);
+	unsigned lexThreads = LexThreads ? (unsigned)LexThreads : llvm::hardware_concurrency().compute_thread_count();
 
+	TokenBuffer tokens;
+	{
+		PhaseTimer Timer("lex", "Lexing");
+		Lexer::lexParallel(contentRef, tokens, lexThreads);
+	}
 
-	Parser Parser(lexer);
-	AST* Tree = Parser.parse();
+	ASTContext Context;
+	Parser Parser(tokens, Context);
+	Parser.setHashConsing(HashCons);
+	Base* Tree;
+	{
+		PhaseTimer Timer("parse", "Parsing");
+		Tree = Parser.parse();
+	}
 
+	if (ASTStats)
+	{
+		FlatAST Flat(Tree);
+		llvm::errs() << "pointer AST: " << Context.getNodeCount() << " nodes, " << Context.getBytesAllocated() << " bytes, "
+			<< "semantic pass " << llvm::format("%.3f", timeSemantic<Base*>(Tree)) << " ms\n";
+		llvm::errs() << "flat AST:    " << Flat.size() << " nodes, " << Flat.getBytes() << " bytes, "
+			<< "semantic pass " << llvm::format("%.3f", timeSemantic<const FlatAST&>(Flat)) << " ms\n";
+	}
+
+	// the parser recovers from syntax errors with a complete tree, so the
+	// semantic errors of the same run are reported as well
 	Sema Semantic;
-	if (Semantic.semantic(Tree))
+	bool SemaFailed;
+	{
+		PhaseTimer Timer("sema", "Semantic analysis");
+		SemaFailed = UseFlatAST ? Semantic.semantic(FlatAST(Tree)) : Semantic.semantic(Tree);
+	}
+
+	// constant divisors are only known once the tree is folded, a checked
+	// program is cached as it was written
+	Base* Folded = Tree;
+	if (Fold && !SemaFailed && !Parser.hasError())
+	{
+		PhaseTimer Timer("fold", "Constant folding");
+		ConstantFolder Folder(Context);
+		Folded = Folder.fold(Tree);
+		SemaFailed = Folder.hasError();
+	}
+	if (Parser.hasError())
+	{
+		return 3;
+	}
+	if (SemaFailed)
 	{
 		llvm::errs() << "Semantic errors occurred...\n";
-		return 1;
+		return Error::getNumErrors() ? 3 : 1;
 	}
+
+	if (!CacheDir.empty())
+		Cache.store(contentRef, FlatAST(Tree));
 	
-	CodeGen CodeGenerator;
-	CodeGenerator.compile(Tree);
+	if (Evaluate)
+	{
+		PhaseTimer Timer("eval", "Evaluation");
+		Folded = PartialEvaluator(Context, EvalSteps, (size_t)EvalMemory << 20).evaluate(Folded);
+	}
+
+	CodeGen CodeGenerator(HashCons, getMIRPasses(), DivGuards, getOptimizer(), DirectSSA);
+	CodeGenerator.compile(Folded);
+	Context.reset();
 
 
 	return 0;
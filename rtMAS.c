@@ -19,3 +19,12 @@ int mas_read(char *s)
     }
     return val;
 }
+
+/* called by division guards before a division by zero or INT_MIN / -1 */
+void mas_div_trap(int divisor, int line)
+{
+    if (line)
+        fprintf(stderr, "Line %d: ", line);
+    fprintf(stderr, divisor ? "Division overflow\n" : "Division by zero\n");
+    exit(1);
+}
@@ -0,0 +1,149 @@
+#include "ASTCache.h"
+#include "ASTWalker.h"
+#include "FlatAST.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Sema.h"
+#include "Test.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+/*
+	cache files are not trusted: whatever their bytes, a lookup either
+	misses or gives a tree that CodeGen can be run on
+*/
+namespace {
+	const char* const Program =
+		"int a, b, c = 1, 2, 3;\n"
+		"if a < b and b > 0: begin\n"
+		"    c = a + b * (2 - c);\n"
+		"end\n"
+		"elif c == 3 or a != 1: begin\n"
+		"    loopc c > 0: begin\n"
+		"        c -= 1;\n"
+		"    end\n"
+		"end\n"
+		"else: begin\n"
+		"    a = (a / 3) % 2;\n"
+		"end\n";
+
+	// xorshift, so a failure can be replayed
+	struct Random {
+		uint64_t State = 88172645463325252ull;
+
+		uint64_t next()
+		{
+			State ^= State << 13;
+			State ^= State >> 7;
+			State ^= State << 17;
+			return State;
+		}
+
+		size_t below(size_t N) { return next() % N; }
+	};
+
+	class CountNodes : public ASTWalker<CountNodes> {
+		friend class ASTWalker<CountNodes>;
+
+		bool visitIdentifier(Expression* E, unsigned Step)
+		{
+			++Count;
+			return false;
+		}
+
+	public:
+		size_t Count = 0;
+	};
+
+	// flips bits in copies of the nodes and lists. an encoding that still
+	// verifies has to build a tree that passes Sema, the rest are rejected
+	void testVerify(Base* Tree)
+	{
+		FlatAST Flat(Tree);
+		CHECK(Flat.verify(strlen(Program)));
+		CHECK(!Flat.verify(0));
+
+		Random R;
+		std::vector<llvm::StringRef> Names(Flat.names().begin(), Flat.names().end());
+		unsigned Rejected = 0;
+		for (unsigned Trial = 0; Trial < 20000; ++Trial)
+		{
+			std::vector<FlatAST::Node> Nodes(Flat.nodes().begin(), Flat.nodes().end());
+			std::vector<uint32_t> Lists(Flat.lists().begin(), Flat.lists().end());
+			for (unsigned Flips = R.below(3) + 1; Flips > 0; --Flips)
+			{
+				size_t NodeBytes = Nodes.size() * sizeof(FlatAST::Node);
+				size_t Byte = R.below(NodeBytes + Lists.size() * sizeof(uint32_t));
+				uint8_t* Data = Byte < NodeBytes ? (uint8_t*)Nodes.data() + Byte : (uint8_t*)Lists.data() + Byte - NodeBytes;
+				*Data ^= 1 << R.below(8);
+			}
+
+			FlatAST Mutated(Nodes, Lists, Names);
+			if (!Mutated.verify(strlen(Program)))
+			{
+				++Rejected;
+				continue;
+			}
+			ASTContext Ctx;
+			Base* Rebuilt = Mutated.toTree(Ctx);
+			CHECK(!Sema().semantic(Rebuilt));
+			CountNodes Walker;
+			Walker.walk(Rebuilt);
+		}
+		// most flips break the structure, some only change a number
+		CHECK(Rejected > 0 && Rejected < 20000);
+	}
+
+	// a stored tree is found again, and a file with any bit flipped is not
+	void testCorruptFiles(Base* Tree, const char* Executable)
+	{
+		llvm::SmallString<128> Dir;
+		if (!CHECK(!llvm::sys::fs::createUniqueDirectory("mas-ast-cache", Dir)))
+			return;
+
+		ASTCache Cache(Dir, Executable, /*Folded=*/true);
+		CHECK(Cache.store(Program, FlatAST(Tree)));
+		std::unique_ptr<FlatAST> Found = Cache.lookup(Program);
+		CHECK(Found && Found->size() == FlatAST(Tree).size());
+		Found.reset();
+		CHECK(!ASTCache(Dir, Executable, /*Folded=*/false).lookup(Program));
+
+		std::error_code EC;
+		llvm::sys::fs::directory_iterator File(Dir, EC);
+		if (!CHECK(!EC && File != llvm::sys::fs::directory_iterator()))
+			return;
+		std::string Path = File->path();
+		std::string Original = llvm::MemoryBuffer::getFile(Path).get()->getBuffer().str();
+
+		for (size_t Byte = 0; Byte < Original.size(); ++Byte)
+		{
+			std::string Corrupt = Original;
+			Corrupt[Byte] ^= 1 << (Byte % 8);
+			{
+				llvm::raw_fd_ostream Out(Path, EC);
+				Out << Corrupt;
+			}
+			CHECK(!Cache.lookup(Program));
+		}
+
+		llvm::sys::fs::remove_directories(Dir);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	TokenBuffer Tokens;
+	Lexer(Program).lex(Tokens);
+	ASTContext Ctx;
+	Base* Tree = Parser(Tokens, Ctx).parse();
+	if (!CHECK(!Sema().semantic(Tree)))
+		return test::result();
+
+	testVerify(Tree);
+	testCorruptFiles(Tree, argv[0]);
+	return test::result();
+}
@@ -0,0 +1,13 @@
+# cmake -DCOMPILER=... -DPROGRAM=... -DEXIT=... -DOUTPUT=... -P ExpectExit.cmake
+# compiles PROGRAM and fails unless the compiler exits with EXIT and what
+# it prints matches the regular expression OUTPUT. PASS_REGULAR_EXPRESSION
+# alone would not look at the exit code
+execute_process(COMMAND "${COMPILER}" "${PROGRAM}"
+  RESULT_VARIABLE Result OUTPUT_VARIABLE Output ERROR_VARIABLE Output)
+message("${Output}")
+if (NOT Result STREQUAL EXIT)
+  message(FATAL_ERROR "the compiler exited with ${Result} instead of ${EXIT}")
+endif()
+if (NOT Output MATCHES "${OUTPUT}")
+  message(FATAL_ERROR "the output does not match ${OUTPUT}")
+endif()
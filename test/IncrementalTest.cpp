@@ -0,0 +1,326 @@
+#include "ASTWalker.h"
+#include "Error.h"
+#include "Incremental.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Test.h"
+#include "llvm/ADT/DenseMap.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+	// every node with its kind, location and value, in walk order. names
+	// are spelled out, the incremental parser numbers them its own way
+	class Dump : public ASTWalker<Dump> {
+		friend class ASTWalker<Dump>;
+
+		std::string& Out;
+		llvm::DenseMap<uint32_t, llvm::StringRef> Names;
+		bool SameIds;
+
+		void node(llvm::StringRef Kind, uint32_t Loc, size_t A = 0, size_t B = 0, size_t C = 0)
+		{
+			Out += Kind;
+			Out += "@" + std::to_string(Loc) + ":" + std::to_string(A) + "," + std::to_string(B) + "," + std::to_string(C) + " ";
+		}
+
+		void name(Expression* E)
+		{
+			node(E->getValue(), E->getLocation());
+			auto It = Names.try_emplace(E->getSymbol(), E->getValue()).first;
+			SameIds &= It->second == E->getValue();
+		}
+
+		bool visitDeclaration(DecStatement* S, unsigned Step)
+		{
+			node("int", S->getLocation());
+			name(S->getLValue());
+			push(S->getRValue());
+			return false;
+		}
+
+		bool visitAssignment(AssignStatement* S, unsigned Step)
+		{
+			node("=", S->getLocation());
+			name(S->getLValue());
+			push(S->getRValue());
+			return false;
+		}
+
+		bool visitIf(IfStatement* S, unsigned Step)
+		{
+			node("if", S->getLocation(), S->getStatements().size(), S->getElifsStatements().size(), S->hasElse());
+			return ASTWalker<Dump>::visitIf(S, Step);
+		}
+
+		bool visitElif(ElifStatement* S, unsigned Step)
+		{
+			node("elif", S->getLocation(), S->getStatements().size());
+			return ASTWalker<Dump>::visitElif(S, Step);
+		}
+
+		bool visitElse(ElseStatement* S, unsigned Step)
+		{
+			node("else", S->getLocation(), S->getStatements().size());
+			return ASTWalker<Dump>::visitElse(S, Step);
+		}
+
+		bool visitLoop(LoopStatement* S, unsigned Step)
+		{
+			node("loopc", S->getLocation(), S->getStatements().size());
+			return ASTWalker<Dump>::visitLoop(S, Step);
+		}
+
+		bool visitIdentifier(Expression* E, unsigned Step)
+		{
+			name(E);
+			return false;
+		}
+
+		bool visitNumber(Expression* E, unsigned Step)
+		{
+			node("number", E->getLocation(), E->getNumber());
+			return false;
+		}
+
+		bool visitBoolean(Expression* E, unsigned Step)
+		{
+			node("bool", E->getLocation(), E->getBoolean());
+			return false;
+		}
+
+		bool visitBinaryOp(BinaryOp* E, unsigned Step)
+		{
+			node("binary", E->getLocation(), E->getOperator());
+			return ASTWalker<Dump>::visitBinaryOp(E, Step);
+		}
+
+		bool visitBooleanOp(BooleanOp* E, unsigned Step)
+		{
+			node("boolean", E->getLocation(), E->getOperator());
+			return ASTWalker<Dump>::visitBooleanOp(E, Step);
+		}
+
+	public:
+		Dump(std::string& Out) : Out(Out), SameIds(true) {}
+
+		// whether every name had one id and every id one name
+		bool hasSameIds() const { return SameIds; }
+	};
+
+	std::string dump(Base* Tree, bool& SameIds)
+	{
+		std::string Out;
+		Dump D(Out);
+		D.walk(Tree);
+		SameIds = D.hasSameIds();
+		return Out;
+	}
+
+	std::string parseFresh(llvm::StringRef Text)
+	{
+		TokenBuffer Tokens;
+		Lexer(Text).lex(Tokens);
+		ASTContext Ctx;
+		Error::setSource(Text);
+		bool SameIds;
+		return dump(Parser(Tokens, Ctx).parse(), SameIds);
+	}
+
+	// the incremental parser has the text and the tree a fresh parse of
+	// Expected gives
+	bool matches(IncrementalParser& Incremental, const std::string& Expected)
+	{
+		if (Incremental.getText() != Expected)
+		{
+			llvm::errs() << "the text differs from the edited one\n";
+			return false;
+		}
+		bool SameIds;
+		std::string Tree = dump(Incremental.getTree(), SameIds);
+		if (Tree != parseFresh(Expected))
+		{
+			llvm::errs() << "the tree differs from a fresh parse of:\n" << Expected << "\n";
+			return false;
+		}
+		if (!SameIds)
+		{
+			llvm::errs() << "a name has more than one id\n";
+			return false;
+		}
+		return true;
+	}
+
+	class Random {
+		uint64_t State;
+
+	public:
+		explicit Random(uint64_t Seed) : State(Seed * 0x9E3779B97F4A7C15ull | 1) {}
+
+		unsigned below(unsigned N)
+		{
+			State ^= State << 13;
+			State ^= State >> 7;
+			State ^= State << 17;
+			return (unsigned)(State % N);
+		}
+	};
+
+	const char* const Program =
+		"int x, y1, z = 1, 2;\n"
+		"x = 3;\n"
+		"if x < 3: begin\n"
+		"    y1 = 2;\n"
+		"    loopc z < 10: begin z += 1; end\n"
+		"end elif y1 == 2 and true: begin\n"
+		"    x = x * (y1 + 1);\n"
+		"end else: begin\n"
+		"    z = 0;\n"
+		"end\n"
+		"loopc x > 0: begin x -= 1; end\n"
+		"int w;\n"
+		"w = x + y1 - z;\n";
+
+	// whole statements and blocks, parts of them, and single tokens
+	const char* const Fragments[] = {
+		"x = x + 1;\n", "int q;\n", "if x < 3: begin y1 = 2; end\n", "elif z: begin end\n", "else: begin x = 1; end\n",
+		"loopc w: begin\n", "begin", "end", "end\n", "if ", "elif ", "else", ": ", "loopc ", "int ",
+		"x", "y1", "w2", "42", "7", ";", ";\n", "=", " += ", "-", "*", "(", ")", ",", " and ", " or ", "<", ">=", "true",
+		" ", "\n", "\t", "a", "e", "nd", "lse",
+	};
+
+	/*
+		random inserts, deletions and replacements anywhere in the text,
+		from whole statements down to single characters, so that edits
+		split tokens, join them, open and close blocks, and break the
+		program for a while. after every edit the incremental tree has to
+		be the one a fresh parse gives
+	*/
+	void testRandomEdits()
+	{
+		for (uint64_t Seed = 1; Seed <= 6; ++Seed)
+		{
+			Random R(Seed);
+			std::string Expected;
+			for (unsigned I = 0; I < 4; ++I)
+				Expected += Program;
+			IncrementalParser Incremental(Expected);
+			if (!CHECK(matches(Incremental, Expected)))
+				return;
+
+			for (unsigned Edit = 0; Edit < 300; ++Edit)
+			{
+				uint32_t Offset = R.below(Expected.size() + 1);
+				uint32_t Removed = R.below(3) ? 0 : std::min<uint32_t>(R.below(12), Expected.size() - Offset);
+				std::string Inserted = R.below(4) ? Fragments[R.below(sizeof(Fragments) / sizeof(Fragments[0]))] : "";
+
+				// sometimes only the statements at the edit are asked for
+				Incremental.edit(Offset, Removed, Inserted);
+				Expected.replace(Offset, Removed, Inserted);
+				if (R.below(2))
+				{
+					(void)Incremental.getStatementsAt(R.below(Expected.size() + 1));
+					continue;
+				}
+				if (!CHECK(matches(Incremental, Expected)))
+					return;
+			}
+			CHECK(matches(Incremental, Expected));
+		}
+	}
+
+	// edits at both ends of the text, where there is no construct before
+	// or after the edit, and of an empty text
+	void testEnds()
+	{
+		std::string Expected;
+		IncrementalParser Incremental(Expected);
+		CHECK(matches(Incremental, Expected));
+		CHECK(Incremental.getStatementsAt(0).empty());
+
+		auto Edit = [&](uint32_t Offset, uint32_t Removed, llvm::StringRef Inserted) {
+			Incremental.edit(Offset, Removed, Inserted);
+			Expected.replace(Offset, Removed, Inserted.str());
+			return matches(Incremental, Expected);
+		};
+
+		CHECK(Edit(0, 0, "  \n int a;"));
+		CHECK(Edit(Expected.size(), 0, " a = 1;\n"));
+		CHECK(Edit(0, 0, "int b;"));
+		CHECK(Edit(0, 1, ""));
+		CHECK(Edit(0, 0, "\n\n"));
+		CHECK(Edit(Expected.size() - 1, 1, ""));
+		CHECK(Edit(0, Expected.size(), ""));
+		CHECK(Edit(0, 0, "if a: begin"));
+		CHECK(Edit(Expected.size(), 0, " end else: begin end"));
+
+		// the locations of the construct at an offset are brought up to date
+		// on their own
+		CHECK(Edit(0, 0, "int a;\n"));
+		llvm::ArrayRef<Statement*> If = Incremental.getStatementsAt(Expected.size() - 1);
+		CHECK(If.size() == 1 && If[0]->getLocation() == Expected.find("if"));
+	}
+
+	/*
+		editing one statement over and over replaces its nodes every time.
+		the arena has to stay within a few times the size of the live
+		nodes, and the copied tree has to be the one a fresh parse gives
+	*/
+	void testGarbage()
+	{
+		std::string Expected;
+		for (unsigned I = 0; I < 100; ++I)
+			Expected += Program;
+		IncrementalParser Incremental(Expected);
+		size_t Live = Incremental.getBytesAllocated();
+
+		size_t Offset = Expected.find("x = 3;") + 4;
+		size_t Largest = 0;
+		for (unsigned Edit = 0; Edit < 20000; ++Edit)
+		{
+			Incremental.edit(Offset, 0, "7");
+			Incremental.edit(Offset, 1, "");
+			(void)Incremental.getStatementsAt(Offset);
+			Largest = std::max(Largest, Incremental.getBytesAllocated());
+		}
+		CHECK(Largest < 4 * Live + (1 << 20));
+		CHECK(matches(Incremental, Expected));
+	}
+
+	/*
+		nesting 100000 blocks deep: every pass of the incremental parser over
+		a construct works without recursion. an edit inside the innermost
+		block parses the whole construct again, one in front of it moves it
+	*/
+	void testDeepNesting()
+	{
+		const unsigned Depth = 100000;
+		std::string Expected = "int a;\n";
+		for (unsigned I = 0; I < Depth; ++I)
+			Expected += "if a < 1: begin\n";
+		size_t Inner = Expected.size();
+		Expected += "a = 1;\n";
+		for (unsigned I = 0; I < Depth; ++I)
+			Expected += "end\n";
+
+		IncrementalParser Incremental(Expected);
+		CHECK(matches(Incremental, Expected));
+
+		Incremental.edit(Inner + 4, 1, "2");
+		Expected.replace(Inner + 4, 1, "2");
+		CHECK(matches(Incremental, Expected));
+
+		Incremental.edit(0, 0, "int b;\n");
+		Expected.insert(0, "int b;\n");
+		CHECK(matches(Incremental, Expected));
+	}
+}
+
+int main()
+{
+	testEnds();
+	testRandomEdits();
+	testGarbage();
+	testDeepNesting();
+	return test::result();
+}
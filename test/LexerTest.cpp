@@ -0,0 +1,126 @@
+#include "Lexer.h"
+#include "Parser.h"
+#include "Test.h"
+
+namespace {
+	// value of the only token of Text, which has to be a number
+	int lexNumber(llvm::StringRef Text)
+	{
+		TokenBuffer Tokens;
+		Lexer(Text).lex(Tokens);
+		CHECK(Tokens.size() == 2 && Tokens.getKind(0) == Token::number);
+		return Tokens.getNumber(0);
+	}
+
+	void testNumbers()
+	{
+		CHECK(lexNumber("0") == 0);
+		CHECK(lexNumber("007") == 7);
+		CHECK(lexNumber("2147483647") == INT32_MAX);
+		CHECK(lexNumber("2147483648") == TokenBuffer::OutOfRange);
+		CHECK(lexNumber("4294967295") == TokenBuffer::OutOfRange);
+		CHECK(lexNumber("4294967296") == TokenBuffer::OutOfRange);
+		CHECK(lexNumber("99999999999999999999999") == TokenBuffer::OutOfRange);
+		CHECK(lexNumber("00000000002147483647") == INT32_MAX);
+
+		// the parser reports a literal out of range, and reads it as INT_MAX
+		TokenBuffer Tokens;
+		Lexer("int a = 4294967295;").lex(Tokens);
+		ASTContext Ctx;
+		Parser P(Tokens, Ctx);
+		Base* Tree = P.parse();
+		CHECK(P.hasError());
+		CHECK(Tree->getStatements().size() == 1);
+		DecStatement* Dec = (DecStatement*)Tree->getStatements()[0];
+		CHECK(Dec->getRValue()->isNumber() && Dec->getRValue()->getNumber() == INT32_MAX);
+	}
+
+	// whether two token streams are the same token for token, with the
+	// same identifier ids and the same spelling for every id
+	bool sameTokens(const TokenBuffer& A, const TokenBuffer& B)
+	{
+		if (A.size() != B.size() || A.getIdentifiers().size() != B.getIdentifiers().size())
+			return false;
+		for (unsigned I = 0; I < A.size(); ++I)
+		{
+			if (A.getKind(I) != B.getKind(I) || A.getOffset(I) != B.getOffset(I) || A.getNumber(I) != B.getNumber(I))
+				return false;
+		}
+		for (unsigned Id = 0; Id < A.getIdentifiers().size(); ++Id)
+		{
+			if (A.getIdentifiers().getName(Id) != B.getIdentifiers().getName(Id))
+				return false;
+		}
+		return true;
+	}
+
+	// lexes Source serially and on every thread count in Threads, with
+	// chunks of at least MinChunk bytes, and checks that they all agree
+	bool lexesAlike(llvm::StringRef Source, size_t MinChunk)
+	{
+		TokenBuffer Serial;
+		Lexer(Source).lex(Serial);
+		for (unsigned Threads : { 2, 3, 4, 8 })
+		{
+			TokenBuffer Parallel;
+			Lexer::lexParallel(Source, Parallel, Threads, MinChunk);
+			if (!sameTokens(Serial, Parallel))
+			{
+				llvm::errs() << "-lex-threads=" << Threads << " differs from the serial lexer on a "
+					<< Source.size() << " byte input with chunks of " << MinChunk << " bytes\n";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+		chunks are cut after the first ';' or whitespace character past an
+		even split of the input. shifting a repeated pattern under those
+		cut points one character at a time puts a cut before, inside and
+		after every lexeme in the pattern: begin, end, the "//" lines,
+		which MAS lexes as two slashes and the words after them, and
+		identifiers that begin with a keyword
+	*/
+	void testParallelCuts()
+	{
+		const std::string Pattern =
+			"if a1 < 10: begin\n\tbeginx = endy + 1;end\n"
+			"// a comment;with;semicolons\n"
+			"elif b >= 2 and c: begin c %= 3 ;  end else: begin end\n"
+			"loopc x!=y:begin\r\n\vx-=1;end;int q,r=1,2;";
+
+		std::string Body;
+		while (Body.size() < 4096)
+			Body += Pattern;
+
+		for (size_t Shift = 0; Shift < Pattern.size(); ++Shift)
+		{
+			// the same length for every shift, so the cuts stay where they are
+			std::string Source = std::string(Shift, ' ') + Body + std::string(Pattern.size() - Shift, ' ');
+			CHECK(lexesAlike(Source, 64));
+			CHECK(lexesAlike(Source, 500));
+		}
+
+		// no character a chunk can end at for most of the input, no
+		// whitespace at all, and a stray null the lexers stop at
+		CHECK(lexesAlike(std::string(3000, 'a') + " " + std::string(3000, 'b'), 64));
+		CHECK(lexesAlike(std::string(3000, ';'), 64));
+		CHECK(lexesAlike(std::string(1000, ' '), 64));
+		CHECK(lexesAlike(Body + std::string(1, '\0') + Body, 64));
+		CHECK(lexesAlike(Body.substr(0, Body.size() - 1), 64));
+
+		// the chunk size -lex-threads uses
+		std::string Large;
+		while (Large.size() < 3 * Lexer::MinChunkSize)
+			Large += Pattern;
+		CHECK(lexesAlike(Large, Lexer::MinChunkSize));
+	}
+}
+
+int main()
+{
+	testNumbers();
+	testParallelCuts();
+	return test::result();
+}
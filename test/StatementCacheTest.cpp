@@ -0,0 +1,179 @@
+#include "Lexer.h"
+#include "StatementCache.h"
+#include "Test.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+/*
+	statement-cache-test MAS-Lang compiles a program with -stmt-cache-dir
+	and then damages the cache: an entry whose bytes changed is dropped,
+	and texts that do not parse are generated again with -O instead of
+	ending the compile
+*/
+namespace {
+	const char* const Program =
+		"int a, b = 1, 2;\n"
+		"a = a + b * 3;\n"
+		"if a > b: begin\n"
+		"    b = a - 1;\n"
+		"end\n"
+		"loopc b > 0: begin\n"
+		"    b -= 1;\n"
+		"end\n";
+
+	// the options main keys the cache on by default: -fold, no -hash-cons
+	const uint64_t DefaultOptions = 2;
+
+	std::string Compiler, Dir, Input;
+
+	std::string path(llvm::StringRef Name)
+	{
+		llvm::SmallString<128> Path(Dir);
+		llvm::sys::path::append(Path, Name);
+		return Path.str().str();
+	}
+
+	// the output of a compile with -O1 and the cache, empty if it failed
+	std::string compile()
+	{
+		std::string Output = path("out.ll");
+		std::string CacheFlag = "-stmt-cache-dir=" + Dir;
+		llvm::StringRef Args[] = { Compiler, "-O1", CacheFlag, "-f", Input };
+		llvm::Optional<llvm::StringRef> Redirects[] = { llvm::None, llvm::StringRef(Output), llvm::None };
+		if (!CHECK(llvm::sys::ExecuteAndWait(Compiler, Args, llvm::None, Redirects) == 0))
+			return "";
+		return llvm::MemoryBuffer::getFile(Output).get()->getBuffer().str();
+	}
+
+	// the key of every top level construct of the program
+	std::vector<uint64_t> getKeys()
+	{
+		TokenBuffer Tokens;
+		Lexer(Program).lex(Tokens);
+		std::vector<uint64_t> Keys;
+		llvm::SmallVector<uint32_t, 8> Vars;
+		for (unsigned Position = 0; Tokens.getKind(Position) != Token::eof;)
+		{
+			unsigned End = StatementCache::findEnd(Tokens, Position);
+			Keys.push_back(StatementCache::getKey(Tokens, Position, End, Vars));
+			Position = End;
+		}
+		return Keys;
+	}
+
+	std::string cacheFile()
+	{
+		std::error_code EC;
+		for (llvm::sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC; I.increment(EC))
+			if (llvm::sys::path::extension(I->path()) == ".mass")
+				return I->path();
+		return "";
+	}
+
+	// the texts of Keys, empty for the ones the cache does not have
+	std::vector<std::string> getTexts(const std::vector<uint64_t>& Keys)
+	{
+		StatementCache Cache(Dir, Compiler, DefaultOptions);
+		Cache.load();
+		std::vector<std::string> Texts;
+		for (uint64_t Key : Keys)
+		{
+			const StatementCache::Fragment* F = Cache.lookup(Key);
+			Texts.push_back(F ? F->Text.str() : "");
+		}
+		return Texts;
+	}
+
+	void testDamagedText(const std::vector<uint64_t>& Keys, const std::vector<std::string>& Texts)
+	{
+		std::string File = cacheFile();
+		std::string Original = llvm::MemoryBuffer::getFile(File).get()->getBuffer().str();
+
+		// a character of the last text
+		std::string Damaged = Original;
+		Damaged[Damaged.size() - 3] ^= 0x20;
+		{
+			std::error_code EC;
+			llvm::raw_fd_ostream Out(File, EC);
+			Out << Damaged;
+		}
+		std::vector<std::string> Left = getTexts(Keys);
+		unsigned Dropped = 0;
+		for (size_t I = 0; I < Keys.size(); ++I)
+		{
+			Dropped += Left[I].empty();
+			CHECK(Left[I].empty() || Left[I] == Texts[I]);
+		}
+		CHECK(Dropped == 1);
+	}
+
+	void testUnparsableTexts(const std::vector<uint64_t>& Keys, const std::vector<std::string>& Texts, const std::string& Expected)
+	{
+		// entries that match their checks but hold no IR
+		{
+			StatementCache Cache(Dir, Compiler, DefaultOptions);
+			Cache.load();
+			std::vector<std::vector<uint8_t>> Roles;
+			for (uint64_t Key : Keys)
+			{
+				const StatementCache::Fragment* F = Cache.lookup(Key);
+				Roles.push_back(F ? std::vector<uint8_t>(F->Roles.begin(), F->Roles.end()) : std::vector<uint8_t>());
+			}
+			StatementCache Broken(Dir, Compiler, DefaultOptions);
+			for (size_t I = 0; I < Keys.size(); ++I)
+				Broken.insert(Keys[I], Roles[I], "define void @broken(");
+			CHECK(Broken.store());
+		}
+
+		CHECK(compile() == Expected);
+		CHECK(getTexts(Keys) == Texts);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		llvm::errs() << "usage: statement-cache-test MAS-Lang\n";
+		return 2;
+	}
+	Compiler = argv[1];
+
+	llvm::SmallString<128> Temp;
+	if (llvm::sys::fs::createUniqueDirectory("mas-stmt-cache", Temp))
+	{
+		llvm::errs() << "cannot create a temporary directory\n";
+		return 1;
+	}
+	Dir = Temp.str().str();
+	Input = path("program.mas");
+	{
+		std::error_code EC;
+		llvm::raw_fd_ostream Out(Input, EC);
+		Out << Program;
+	}
+
+	std::string Expected = compile();
+	std::vector<uint64_t> Keys = getKeys();
+	std::vector<std::string> Texts = getTexts(Keys);
+	bool Filled = CHECK(!Expected.empty());
+	for (const std::string& Text : Texts)
+		Filled &= CHECK(!Text.empty());
+
+	if (Filled)
+	{
+		testDamagedText(Keys, Texts);
+		CHECK(compile() == Expected);
+		testUnparsableTexts(Keys, Texts, Expected);
+	}
+
+	llvm::sys::fs::remove_directories(Dir);
+	return test::result();
+}
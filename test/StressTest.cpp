@@ -0,0 +1,134 @@
+#include "Test.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/*
+	stress-test MAS-Lang [flag...] compiles programs with blocks nested
+	10^5 and 10^6 deep with the flags given. every pass walks the program
+	without recursion, so neither compile may fail, and ten times the
+	depth has to cost about ten times the time and memory. "%t" in a flag
+	stands for a directory of the test's own, with one the program is
+	compiled twice, so the second compile reads what the first one left
+*/
+namespace {
+	const unsigned Depths[] = { 100000, 1000000 };
+
+	// how much more than ten times the smaller compile the larger one may
+	// take, a quadratic pass would take a hundred times
+	const double Slack = 3;
+
+	struct Usage {
+		double Seconds;     // user and system time
+		uint64_t PeakKB;
+	};
+
+	// if and loopc in turn. the innermost block assigns a variable every
+	// loop reads, so the loops need phis for it with -ssa and -mir
+	std::string deepProgram(unsigned Depth)
+	{
+		std::string Source = "int a, b;\n";
+		for (unsigned I = 0; I < Depth; ++I)
+			Source += I % 2 ? "loopc b > 0: begin\n" : "if a < 1: begin\n";
+		Source += "a = a + b;\nb = b - 1;\n";
+		for (unsigned I = 0; I < Depth; ++I)
+			Source += "end\n";
+		return Source;
+	}
+
+	bool compile(llvm::StringRef Compiler, const std::vector<std::string>& Flags, llvm::StringRef Input, Usage& Used)
+	{
+		std::vector<llvm::StringRef> Args = { Compiler };
+		Args.insert(Args.end(), Flags.begin(), Flags.end());
+		Args.push_back("-f");
+		Args.push_back(Input);
+
+		// the IR is thrown away, diagnostics show up in the test log
+		llvm::Optional<llvm::StringRef> Redirects[] = { llvm::None, llvm::StringRef(""), llvm::None };
+		std::string Message;
+		llvm::Optional<llvm::sys::ProcessStatistics> Stats;
+		int Result = llvm::sys::ExecuteAndWait(Compiler, Args, llvm::None, Redirects, 0, 0, &Message, nullptr, &Stats);
+		if (Result != 0 || !Stats)
+		{
+			llvm::errs() << "compiling " << Input << " failed with " << Result << (Message.empty() ? "" : ": ") << Message << "\n";
+			return false;
+		}
+		Used.Seconds = Stats->TotalTime.count() / 1e6;
+		Used.PeakKB = Stats->PeakMemory;
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		llvm::errs() << "usage: stress-test MAS-Lang [flag...]\n";
+		return 2;
+	}
+
+	llvm::SmallString<128> Dir;
+	if (llvm::sys::fs::createUniqueDirectory("mas-stress", Dir))
+	{
+		llvm::errs() << "cannot create a temporary directory\n";
+		return 1;
+	}
+
+	std::vector<std::string> Flags;
+	unsigned Compiles = 1;
+	for (int I = 2; I < argc; ++I)
+	{
+		std::string Flag = argv[I];
+		size_t At = Flag.find("%t");
+		if (At != std::string::npos)
+		{
+			Flag.replace(At, 2, Dir.str().str());
+			Compiles = 2;
+		}
+		Flags.push_back(Flag);
+	}
+
+	// by depth, then by compile
+	Usage Used[2][2];
+	for (unsigned D = 0; D < 2; ++D)
+	{
+		llvm::SmallString<128> Input(Dir);
+		llvm::sys::path::append(Input, "deep" + std::to_string(Depths[D]) + ".mas");
+		{
+			std::error_code EC;
+			llvm::raw_fd_ostream Out(Input, EC);
+			if (!CHECK(!EC))
+				break;
+			Out << deepProgram(Depths[D]);
+		}
+
+		for (unsigned C = 0; C < Compiles; ++C)
+		{
+			if (!CHECK(compile(argv[1], Flags, Input, Used[D][C])))
+				break;
+			llvm::outs() << "depth " << Depths[D] << (C ? ", again" : "") << ": "
+				<< llvm::format("%.2f s, %.1f MB\n", Used[D][C].Seconds, Used[D][C].PeakKB / 1024.0);
+		}
+	}
+
+	if (!test::failures())
+	{
+		for (unsigned C = 0; C < Compiles; ++C)
+		{
+			const Usage& Small = Used[0][C];
+			const Usage& Large = Used[1][C];
+			CHECK(Large.Seconds <= Slack * 10 * std::max(Small.Seconds, 0.01));
+			CHECK(Large.PeakKB <= Slack * 10 * Small.PeakKB);
+		}
+	}
+
+	llvm::sys::fs::remove_directories(Dir);
+	return test::result();
+}
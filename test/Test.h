@@ -0,0 +1,38 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "llvm/Support/raw_ostream.h"
+
+/*
+	the tests are plain programs: CHECK prints every condition that does
+	not hold, and main returns test::result(), which fails the test if
+	any did.
+*/
+namespace test {
+	inline unsigned& failures()
+	{
+		static unsigned Count = 0;
+		return Count;
+	}
+
+	inline bool check(bool Condition, const char* Text, const char* File, int Line)
+	{
+		if (!Condition)
+		{
+			llvm::errs() << File << ":" << Line << ": CHECK(" << Text << ") failed\n";
+			++failures();
+		}
+		return Condition;
+	}
+
+	inline int result()
+	{
+		if (failures())
+			llvm::errs() << failures() << " checks failed\n";
+		return failures() ? 1 : 0;
+	}
+}
+
+#define CHECK(Condition) test::check((Condition), #Condition, __FILE__, __LINE__)
+
+#endif